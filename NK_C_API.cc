@@ -20,14 +20,18 @@
  */
 
 #include "NK_C_API.h"
+#include <atomic>
 #include <iostream>
+#include <fstream>
 #include <tuple>
+#include <algorithm>
 #include "libnitrokey/NitrokeyManager.h"
 #include <cstring>
 #include "libnitrokey/LibraryException.h"
 #include "libnitrokey/cxx_semantics.h"
 #include "libnitrokey/stick20_commands.h"
 #include "libnitrokey/device_proto.h"
+#include "libnitrokey/trace.h"
 #include "libnitrokey/version.h"
 
 #ifdef _MSC_VER
@@ -46,7 +50,8 @@ char * strndup(const char* str, size_t maxlen) {
 using namespace nitrokey;
 
 const uint8_t NK_PWS_SLOT_COUNT = PWS_SLOT_COUNT;
-static uint8_t NK_last_command_status = 0;
+// process-wide, atomic so that concurrent calls do not race
+static std::atomic<uint8_t> NK_last_command_status{0};
 static const int max_string_field_length = 100;
 
 template <typename T>
@@ -60,19 +65,21 @@ T* duplicate_vector_and_clear(std::vector<T> &v){
 template <typename R, typename T>
 std::tuple<int, R> get_with_status(T func, R fallback) {
     NK_last_command_status = 0;
+    uint8_t status = 0;
     try {
         return std::make_tuple(0, func());
     }
     catch (CommandFailedException & commandFailedException){
-        NK_last_command_status = commandFailedException.last_command_status;
+        status = commandFailedException.last_command_status;
     }
     catch (LibraryException & libraryException){
-        NK_last_command_status = libraryException.exception_id();
+        status = libraryException.exception_id();
     }
     catch (const DeviceCommunicationException &deviceException){
-      NK_last_command_status = 256-deviceException.getType();
+      status = 256-deviceException.getType();
     }
-    return std::make_tuple(NK_last_command_status, fallback);
+    NK_last_command_status = status;
+    return std::make_tuple(static_cast<int>(status), fallback);
 }
 
 template <typename T>
@@ -97,23 +104,25 @@ auto get_with_result(T func){
 template <typename T>
 uint8_t get_without_result(T func){
     NK_last_command_status = 0;
+    uint8_t status = 0;
     try {
         func();
         return 0;
     }
     catch (CommandFailedException & commandFailedException){
-        NK_last_command_status = commandFailedException.last_command_status;
+        status = commandFailedException.last_command_status;
     }
     catch (LibraryException & libraryException){
-        NK_last_command_status = libraryException.exception_id();
+        status = libraryException.exception_id();
     }
     catch (const InvalidCRCReceived &invalidCRCException){
       ;
     }
     catch (const DeviceCommunicationException &deviceException){
-        NK_last_command_status = 256-deviceException.getType();
+        status = 256-deviceException.getType();
     }
-    return NK_last_command_status;
+    NK_last_command_status = status;
+    return status;
 }
 
 
@@ -122,9 +131,7 @@ extern "C" {
 #endif
 
 	NK_C_API uint8_t NK_get_last_command_status() {
-		auto _copy = NK_last_command_status;
-		NK_last_command_status = 0;
-		return _copy;
+		return NK_last_command_status.exchange(0);
 	}
 
 	NK_C_API int NK_login(const char *device_model) {
@@ -176,6 +183,11 @@ extern "C" {
 		});
 	}
 
+	NK_C_API int NK_shutdown() {
+		auto m = NitrokeyManager::instance();
+		return m->shutdown() ? 0 : 1;
+	}
+
 	NK_C_API int NK_first_authenticate(const char* admin_password, const char* admin_temporary_password) {
 		auto m = NitrokeyManager::instance();
 		return get_without_result([&]() {
@@ -434,6 +446,46 @@ extern "C" {
 		m->set_log_function_raw(log_function);
         }
 
+	NK_C_API void NK_set_async_logging(bool enable, uint32_t capacity, bool block_when_full) {
+		auto &log = nitrokey::log::Log::instance();
+		if (!enable) {
+			log.disable_async();
+			return;
+		}
+		log.enable_async(capacity != 0 ? capacity : nitrokey::log::Log::DEFAULT_ASYNC_CAPACITY,
+				 block_when_full ? LogOverflowPolicy::BLOCK : LogOverflowPolicy::DROP);
+	}
+
+	NK_C_API void NK_flush_log() {
+		nitrokey::log::Log::instance().flush();
+	}
+
+	NK_C_API uint64_t NK_get_dropped_log_messages() {
+		return nitrokey::log::Log::instance().dropped_messages();
+	}
+
+	NK_C_API int NK_open_binary_log(const char* path) {
+		if (path == nullptr) return -1;
+		return nitrokey::log::BinaryLog::instance().open(path) ? 0 : -1;
+	}
+
+	NK_C_API void NK_close_binary_log() {
+		nitrokey::log::BinaryLog::instance().close();
+	}
+
+	NK_C_API void NK_set_trace_function(NK_trace_function fn, void* user_data) {
+		if (fn == nullptr) {
+			trace::set_listener(nullptr);
+			return;
+		}
+		trace::set_listener([fn, user_data](const trace::TraceEvent &e) {
+			const auto timestamp = std::chrono::duration_cast<std::chrono::microseconds>(
+				e.time.time_since_epoch()).count();
+			fn(static_cast<uint8_t>(e.event), e.command_id, e.value, static_cast<uint64_t>(timestamp),
+			   e.device != nullptr ? e.device->get_path().c_str() : "", user_data);
+		});
+	}
+
 	NK_C_API unsigned int NK_get_major_library_version() {
 		return get_major_library_version();
 	}
@@ -552,6 +604,53 @@ extern "C" {
 		});
 	}
 
+	static_assert(sizeof(NK_password_safe_slot::name) == sizeof(PasswordSafeEntry::name), "");
+	static_assert(sizeof(NK_password_safe_slot::login) == sizeof(PasswordSafeEntry::login), "");
+	static_assert(sizeof(NK_password_safe_slot::password) == sizeof(PasswordSafeEntry::password), "");
+	static_assert(sizeof(NK_password_safe::slots) / sizeof(NK_password_safe::slots[0]) == PWS_SLOT_COUNT, "");
+
+	NK_C_API int NK_read_password_safe(uint16_t slot_mask, struct NK_password_safe* out) {
+		if (out == nullptr) {
+			return -1;
+		}
+		auto m = NitrokeyManager::instance();
+		return get_without_result([&]() {
+			auto entries = m->read_password_safe(slot_mask);
+			bzero(out, sizeof(*out));
+			for (const auto &e : entries) {
+				auto &slot = out->slots[out->count++];
+				slot.slot_number = e.slot_number;
+				memcpy(slot.name, e.name, sizeof slot.name);
+				memcpy(slot.login, e.login, sizeof slot.login);
+				memcpy(slot.password, e.password, sizeof slot.password);
+			}
+		});
+	}
+
+	NK_C_API int NK_write_password_safe(const struct NK_password_safe* entries) {
+		if (entries == nullptr) {
+			return -1;
+		}
+		auto m = NitrokeyManager::instance();
+		return get_without_result([&]() {
+			PasswordSafeEntries v;
+			const auto count = std::min<size_t>(entries->count, PWS_SLOT_COUNT);
+			for (size_t i = 0; i < count; ++i) {
+				const auto &slot = entries->slots[i];
+				// fields are not required to be null-terminated in the input
+				char name[sizeof slot.name + 1] = {};
+				char login[sizeof slot.login + 1] = {};
+				char password[sizeof slot.password + 1] = {};
+				memcpy(name, slot.name, sizeof slot.name);
+				memcpy(login, slot.login, sizeof slot.login);
+				memcpy(password, slot.password, sizeof slot.password);
+				v.add(slot.slot_number, name, login, password);
+				misc::secure_zero(password, sizeof password);
+			}
+			m->write_password_safe(v);
+		});
+	}
+
 	NK_C_API int NK_is_AES_supported(const char *user_password) {
 		auto m = NitrokeyManager::instance();
 		return get_with_result([&]() -> uint8_t {
@@ -914,6 +1013,85 @@ NK_C_API char* NK_get_SD_usage_data_as_string() {
 		});
 	 }
 
+	NK_C_API int NK_get_connection_pool_stats(struct NK_connection_pool_stats* out) {
+		if (out == nullptr) {
+			return -1;
+		}
+		auto m = NitrokeyManager::instance();
+		const auto stats = m->get_connection_pool().get_stats();
+		out->hits = stats.hits;
+		out->misses = stats.misses;
+		out->invalidations = stats.invalidations;
+		out->evictions = stats.evictions;
+		out->size = static_cast<uint32_t>(stats.size);
+		out->max_size = static_cast<uint32_t>(stats.max_size);
+		return 0;
+	}
+
+	NK_C_API void NK_set_connection_pool_size(uint32_t max_size) {
+		auto m = NitrokeyManager::instance();
+		m->get_connection_pool().set_max_size(max_size);
+	}
+
+	NK_C_API int NK_get_command_latency(struct NK_command_latency* out, uint32_t max_count) {
+		if (out == nullptr) {
+			return -1;
+		}
+		auto m = NitrokeyManager::instance();
+		const auto latency = m->get_command_latency();
+		const auto count = std::min<size_t>(latency.size(), max_count);
+		for (size_t i = 0; i < count; i++) {
+			const auto &l = latency[i];
+			auto &o = out[i];
+			o.command_id = l.command_id;
+			o.count = l.count;
+			o.polls = l.polls;
+			o.busy = l.busy;
+			o.total_sum_us = l.total.sum_us;
+			o.total_max_us = l.total.max_us;
+			o.total_p50_us = l.total.percentile(50);
+			o.total_p90_us = l.total.percentile(90);
+			o.total_p99_us = l.total.percentile(99);
+			o.first_response_p50_us = l.first_response.percentile(50);
+			o.first_response_p90_us = l.first_response.percentile(90);
+			o.first_response_p99_us = l.first_response.percentile(99);
+		}
+		return static_cast<int>(count);
+	}
+
+	NK_C_API void NK_reset_command_latency() {
+		auto m = NitrokeyManager::instance();
+		m->reset_command_latency();
+	}
+
+	NK_C_API void NK_start_timeline_recording() {
+		auto m = NitrokeyManager::instance();
+		m->get_timeline_recorder().start();
+	}
+
+	NK_C_API void NK_stop_timeline_recording() {
+		auto m = NitrokeyManager::instance();
+		m->get_timeline_recorder().stop();
+	}
+
+	NK_C_API int NK_write_timeline(const char* path) {
+		if (path == nullptr) return -1;
+		auto m = NitrokeyManager::instance();
+		std::ofstream out(path);
+		m->get_timeline_recorder().write_json(out);
+		out.close();
+		return out.fail() ? -1 : 0;
+	}
+
+	NK_C_API char* NK_get_metrics_text() {
+		auto m = NitrokeyManager::instance();
+		const auto text = m->metrics_text();
+		auto res = static_cast<char *>(malloc(text.size() + 1));
+		if (res == nullptr) return nullptr;
+		memcpy(res, text.c_str(), text.size() + 1);
+		return res;
+	}
+
 
 	NK_C_API int NK_wink() {
 		auto m = NitrokeyManager::instance();
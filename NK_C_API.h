@@ -299,6 +299,92 @@ extern "C" {
             bool disable_user_password;
         };
 
+        /**
+         * Contents of a single password safe slot. All fields are
+         * null-terminated strings.
+         */
+        struct NK_password_safe_slot {
+            /**
+             * The password safe slot number, slot_number<16
+             */
+            uint8_t slot_number;
+            char name[12];
+            char login[33];
+            char password[21];
+        };
+
+        /**
+         * Contents of the password safe, as used by NK_read_password_safe and
+         * NK_write_password_safe.
+         */
+        struct NK_password_safe {
+            /**
+             * Number of valid entries in slots
+             */
+            uint8_t count;
+            struct NK_password_safe_slot slots[16];
+        };
+
+        /**
+         * Statistics of the pool of connections opened by NK_connect_with_path.
+         */
+        struct NK_connection_pool_stats {
+            /**
+             * Connections served from the pool
+             */
+            uint64_t hits;
+            /**
+             * Connections which had to be opened
+             */
+            uint64_t misses;
+            /**
+             * Pooled connections dropped, because the device was removed or replugged.
+             * Connections closed by the application are not counted.
+             */
+            uint64_t invalidations;
+            /**
+             * Pooled connections closed to keep the pool under its maximal size
+             */
+            uint64_t evictions;
+            uint32_t size;
+            uint32_t max_size;
+        };
+
+        /**
+         * Transaction latency statistics of a single command, as returned by
+         * NK_get_command_latency. Times are in microseconds. Percentiles are
+         * accurate within 12.5%.
+         */
+        struct NK_command_latency {
+            uint8_t command_id;
+            /**
+             * Number of transactions
+             */
+            uint64_t count;
+            /**
+             * Number of attempts to read the response
+             */
+            uint64_t polls;
+            /**
+             * Number of busy responses
+             */
+            uint64_t busy;
+            /**
+             * Time from sending the command until the transaction finished
+             */
+            uint64_t total_sum_us;
+            uint64_t total_max_us;
+            uint64_t total_p50_us;
+            uint64_t total_p90_us;
+            uint64_t total_p99_us;
+            /**
+             * Time from sending the command until the first not busy response
+             */
+            uint64_t first_response_p50_us;
+            uint64_t first_response_p90_us;
+            uint64_t first_response_p99_us;
+        };
+
    struct NK_storage_ProductionTest{
     uint8_t FirmwareVersion_au8[2];
     uint8_t FirmwareVersionInternal_u8;
@@ -345,6 +431,74 @@ extern "C" {
 	 */
 	NK_C_API void NK_set_log_function(NK_log_function fn);
 
+	/**
+	 * Enable or disable asynchronous logging. When enabled, logging only
+	 * copies the message into a queue, and the messages are formatted and
+	 * printed by a background thread - the log function set with
+	 * NK_set_log_function is then called from that thread.
+	 * Disabling prints the queued messages first.
+	 * NK_shutdown disables it too, as its thread must not outlive the library,
+	 * so enable it again after NK_shutdown, when connecting again.
+	 * While enabled, the function passed to NK_set_log_function may still be
+	 * called with queued messages after it was replaced, until NK_flush_log.
+	 * @param enable true to enable, false to disable
+	 * @param capacity number of queued messages, used when enabled for the first time only, 0 for the default
+	 * @param block_when_full wait for space when the queue is full, instead of dropping the message
+	 */
+	NK_C_API void NK_set_async_logging(bool enable, uint32_t capacity, bool block_when_full);
+
+	/**
+	 * Wait until the messages logged so far are printed.
+	 */
+	NK_C_API void NK_flush_log();
+
+	/**
+	 * Get the number of log messages dropped, because the asynchronous
+	 * logging queue was full.
+	 */
+	NK_C_API uint64_t NK_get_dropped_log_messages();
+
+	/**
+	 * Write the device communication into a binary log file, instead of
+	 * logging the packet dissections as text. Records have a fixed size and
+	 * secret fields are zeroed. Decode with the nitrokey_binlog tool.
+	 * @param path log file path, replaced if it exists
+	 * @return 0 on success, -1 if path is null or the file could not be opened
+	 */
+	NK_C_API int NK_open_binary_log(const char* path);
+
+	/**
+	 * Close the binary log, returning to the text packet dissections.
+	 */
+	NK_C_API void NK_close_binary_log();
+
+	/**
+	 * Callback function for NK_set_trace_function, called at each phase of
+	 * the device communication, synchronously and with the device locked.
+	 * Arguments:
+	 * - event: 0 = transaction start, 1 = command sent, 2 = response read,
+	 *   3 = device busy, 4 = transfer error, 5 = reconnected, 6 = response
+	 *   accepted, 7 = transaction finished, 8 = sending command, 9 = reading
+	 *   response, 10 = transaction lock acquired, 11 = handle lock acquired
+	 * - command_id: ID of the command, 0 for events 4, 5 and 11
+	 * - value: event specific - sending result (1), device status or -1 on
+	 *   read failure (2), delay in ms (3), errno (4), time taken in us (5),
+	 *   command status (6), command status or -1 on communication failure (7),
+	 *   time waited for the lock in us (10, 11), 0 otherwise
+	 * - timestamp_us: monotonic time of the event in microseconds
+	 * - device_path: path of the device, valid during the call only
+	 * - user_data: as passed to NK_set_trace_function
+	 */
+	NK_C_API typedef void (*NK_trace_function)(uint8_t event, uint8_t command_id, int64_t value, uint64_t timestamp_us, const char* device_path, void* user_data);
+
+	/**
+	 * Set a function receiving the device communication trace events.
+	 * Tracing costs nothing when no function is set.
+	 * @param fn trace function, NULL to remove it
+	 * @param user_data passed to each call of fn
+	 */
+	NK_C_API void NK_set_trace_function(NK_trace_function fn, void* user_data);
+
 	/**
 	 * Get the major library version, e. g. the 3 in v3.2.
 	 * @return the major library version
@@ -392,6 +546,19 @@ extern "C" {
 	 */
 	NK_C_API int NK_logout();
 
+	/**
+	 * Disconnect from all devices and release the HID library state.
+	 * The library keeps it initialized between connections otherwise,
+	 * so repeated NK_login_auto/NK_logout calls do not initialize it each time,
+	 * and it is not released when the last device is disconnected - this is
+	 * the only call releasing it.
+	 * Also stops the asynchronous logging thread, printing the queued messages;
+	 * it stays disabled until enabled again with NK_set_async_logging.
+	 * Call before unloading the library.
+	 * @return 0 on success, 1 if devices connected elsewhere keep the library in use
+	 */
+	NK_C_API int NK_shutdown();
+
 	/**
 	 * Query the model of the connected device.
 	 * Returns the model of the connected device or NK_DISCONNECTED.
@@ -764,6 +931,26 @@ extern "C" {
 	 */
 	NK_C_API int NK_erase_password_safe_slot(uint8_t slot_number);
 
+	/**
+	 * Read all programmed password safe slots selected by the mask in a single
+	 * call. Slots which are not programmed are skipped.
+	 * Storage, Pro, Librem Key
+	 * @param slot_mask bit n selects slot n, 0xFFFF for all slots
+	 * @param out the output struct for the slots' contents. It holds secrets and
+	 * should be cleared by the caller once not needed anymore.
+	 * @return command processing error code, -1 if out is NULL
+	 */
+	NK_C_API int NK_read_password_safe(uint16_t slot_mask, struct NK_password_safe* out);
+
+	/**
+	 * Write the first count password safe slots from the given struct in a
+	 * single call.
+	 * Storage, Pro, Librem Key
+	 * @param entries the slots to write
+	 * @return command processing error code, -1 if entries is NULL
+	 */
+	NK_C_API int NK_write_password_safe(const struct NK_password_safe* entries);
+
 	/**
 	 * Check whether AES is supported by the device
 	 * @return 0 for no and 1 for yes
@@ -1023,7 +1210,9 @@ extern "C" {
  * Case 2 (USB path only) is used, when the device cannot be asked about its status data (e.g. during a long operation,
  * like clearing SD card.
  * Internally connects to all available devices and creates a map between ids and connection objects.
- * Side effects: changes active device to last detected Storage device.
+ * Devices are queried in parallel. Connections made by the previous call are reused for devices still present,
+ * and closed for the removed ones.
+ * Active device is not changed, unless it was removed - then no device is active.
  * Storage only
  * @example Example of returned data: '00005d19:dacc2cb4_p_0001:0010:02;000037c7:4cf12445_p_0001:000f:02;0001:000c:02'
  * @return string delimited id's of connected devices
@@ -1062,6 +1251,65 @@ extern "C" {
 	 */
         NK_C_API int NK_connect_with_path(const char* path);
 
+	/**
+	 * Get the statistics of the connection pool used by NK_connect_with_path.
+	 * @param out the output struct for the statistics
+	 * @return 0 on success, -1 if out is null
+	 */
+	NK_C_API int NK_get_connection_pool_stats(struct NK_connection_pool_stats* out);
+
+	/**
+	 * Set the maximal number of connections kept open by NK_connect_with_path.
+	 * Least recently used connections are closed above the limit. 0 disables pooling.
+	 * @param max_size maximal number of pooled connections
+	 */
+	NK_C_API void NK_set_connection_pool_size(uint32_t max_size);
+
+	/**
+	 * Get the transaction latency statistics of the connected device, one entry
+	 * per command run since connecting or the last NK_reset_command_latency call.
+	 * Does not communicate with the device.
+	 * @param out array for the statistics
+	 * @param max_count size of the out array
+	 * @return number of entries written, -1 if out is null
+	 */
+	NK_C_API int NK_get_command_latency(struct NK_command_latency* out, uint32_t max_count);
+
+	/**
+	 * Clear the transaction latency statistics of the connected device.
+	 */
+	NK_C_API void NK_reset_command_latency();
+
+	/**
+	 * Start recording the device activity timeline, dropping the previous
+	 * recording. The function set with NK_set_trace_function keeps being called.
+	 */
+	NK_C_API void NK_start_timeline_recording();
+
+	/**
+	 * Stop recording the device activity timeline.
+	 */
+	NK_C_API void NK_stop_timeline_recording();
+
+	/**
+	 * Write the recorded timeline as a Chrome Trace Event JSON file, to open
+	 * in chrome://tracing or Perfetto. Each device is shown with a track of
+	 * commands, split into send, wait and poll slices, and a track of lock waits.
+	 * @param path output file path
+	 * @return 0 on success, -1 if path is null or the file could not be written
+	 */
+	NK_C_API int NK_write_timeline(const char* path);
+
+	/**
+	 * Get the counters and latency histograms of all open devices in the
+	 * OpenMetrics text format, for Prometheus. Labels: path, model, serial.
+	 * Does not communicate with the devices nor wait for them, so it can be
+	 * called while commands are running.
+	 * The returned string must be freed with free().
+	 * @return metrics text, NULL on allocation failure
+	 */
+	NK_C_API char* NK_get_metrics_text();
+
 	/**
 	 * Blink red and green LED alternatively and infinitely (until device is reconnected).
 	 * @return command processing error code
@@ -23,6 +23,8 @@
 #include <iostream>
 #include "libnitrokey/NitrokeyManager.h"
 #include "libnitrokey/LibraryException.h"
+#include "libnitrokey/metrics.h"
+#include "libnitrokey/command_registry.h"
 #include <algorithm>
 #include <unordered_map>
 #include <stick20_commands.h>
@@ -31,14 +33,12 @@
 #include "libnitrokey/cxx_semantics.h"
 #include "libnitrokey/misc.h"
 #include <functional>
+#include <exception>
+#include <future>
 #include <stick10_commands.h>
 
-std::mutex nitrokey::proto::send_receive_mtx;
-
 namespace nitrokey{
 
-    std::mutex mex_dev_com_manager;
-
 #ifndef strndup
 #ifdef _WIN32
 #pragma message "Using own strndup"
@@ -66,7 +66,7 @@ using nitrokey::misc::strcpyT;
     // package type to auth, auth type [Authorize,UserAuthorize]
     template <typename S, typename A, typename T>
     void NitrokeyManager::authorize_packet(T &package, const char *admin_temporary_password, shared_ptr<Device> device_){
-      if (!is_authorization_command_supported()){
+      if (!is_authorization_command_supported(device_)){
         LOG("Authorization command not supported, skipping", Loglevel::WARNING);
       }
         auto auth = get_payload<A>();
@@ -79,16 +79,10 @@ using nitrokey::misc::strcpyT;
 
     NitrokeyManager::NitrokeyManager() : device(nullptr)
     {
-        set_debug(false);
     }
     NitrokeyManager::~NitrokeyManager() {
         std::lock_guard<std::mutex> lock(mex_dev_com_manager);
-
-        for (auto d : connected_devices){
-            if (d.second == nullptr) continue;
-            d.second->disconnect();
-            connected_devices[d.first] = nullptr;
-        }
+        connection_pool.clear();
     }
 
     bool NitrokeyManager::set_current_device_speed(int retry_delay, int send_receive_delay){
@@ -112,57 +106,138 @@ using nitrokey::misc::strcpyT;
         return Device::enumerate();
     }
 
-    std::vector<std::string> NitrokeyManager::list_devices_by_cpuID(){
-        using misc::toHex;
-        //disconnect default device
-        disconnect();
+    namespace {
+        /**
+         * Builds the ID of a Storage device from its smartcard and SD card IDs.
+         * Falls back to the USB path, when the device is busy with a long operation.
+         * @return empty string, when the device could not be asked for its status
+         */
+        std::string identify_storage_device(shared_ptr<Device> d, const std::string &path) {
+          using misc::toHex;
+          try {
+            const auto status = stick20::GetDeviceStatus::CommandTransaction::run(d).data();
+            const auto sc_id = toHex(status.ActiveSmartCardID_u32);
+            const auto sd_id = toHex(status.ActiveSD_CardID_u32);
+            return sc_id + ":" + sd_id + "_p_" + path;
+          }
+          catch (const LongOperationInProgressException &e) {
+            LOGD1(std::string("Long operation in progress, setting ID to: ") + path);
+            return path;
+          }
+          catch (const DeviceCommunicationException &e) {
+            LOGD1(std::string("Exception encountered: ") + path);
+          }
+          return "";
+        }
+    }
 
+    std::vector<std::string> NitrokeyManager::list_devices_by_cpuID(){
         std::lock_guard<std::mutex> lock(mex_dev_com_manager);
-        LOGD1("Disconnecting registered devices");
+
+        LOGD1("Enumerating devices");
+        std::vector<std::string> paths;
+        for (auto & i: Device::enumerate()){
+            if (i.m_deviceModel == DeviceModel::STORAGE)
+                paths.push_back(i.m_path);
+        }
+
+        // keep registered connections of the devices still present
+        std::unordered_map<std::string, std::string> registered_ids;
+        std::unordered_map<std::string, shared_ptr<Device>> devices;
         for (auto & kv : connected_devices_byID){
-            if (kv.second != nullptr)
+            if (kv.second == nullptr) continue;
+            const auto path = kv.second->get_path();
+            if (std::find(paths.begin(), paths.end(), path) == paths.end()) {
+                LOGD1(std::string("Device removed: ") + kv.first);
                 kv.second->disconnect();
+                continue;
+            }
+            registered_ids[path] = kv.first;
+            devices[path] = kv.second;
+        }
+        // do not open a second connection to the active device
+        if (device != nullptr && device->get_device_model() == DeviceModel::STORAGE
+            && devices.count(device->get_path()) == 0
+            && std::find(paths.begin(), paths.end(), device->get_path()) != paths.end()) {
+            devices[device->get_path()] = device;
         }
-        connected_devices_byID.clear();
 
-        LOGD1("Enumerating devices");
-        std::vector<std::string> res;
-        const auto v = Device::enumerate();
         LOGD1("Discovering IDs");
-        for (auto & i: v){
-            if (i.m_deviceModel != DeviceModel::STORAGE)
-                continue;
-            auto p = i.m_path;
-            auto d = make_shared<Stick20>();
-            LOGD1( std::string("Found: ") + p );
-            d->set_path(p);
-            try{
-                if (d->connect()){
-                    device = d;
-                    std::string id;
-                    try {
-                        const auto status = get_status_storage();
-                        const auto sc_id = toHex(status.ActiveSmartCardID_u32);
-                        const auto sd_id = toHex(status.ActiveSD_CardID_u32);
-                        id += sc_id + ":" + sd_id;
-                        id += "_p_" + p;
-                    }
-                    catch (const LongOperationInProgressException &e) {
-                        LOGD1(std::string("Long operation in progress, setting ID to: ") + p);
-                        id = p;
+        // each identification takes a full command round-trip, run them concurrently
+        std::vector<std::future<std::string>> ids;
+        ids.reserve(paths.size());
+        for (const auto & p: paths){
+            auto &d = devices[p];
+            const bool registered = d != nullptr;
+            if (!registered) {
+                LOGD1(std::string("Found: ") + p);
+                d = make_shared<Stick20>();
+                d->set_path(p);
+            }
+            ids.push_back(std::async(std::launch::async, [p, d, registered]() -> std::string {
+                try {
+                    if (!registered && !d->connect()) {
+                        LOGD1(std::string("Could not connect to: ") + p);
+                        return "";
                     }
+                    return identify_storage_device(d, p);
+                }
+                catch (const DeviceCommunicationException &e){
+                    LOGD1(std::string("Exception encountered: ") + p);
+                }
+                return "";
+            }));
+        }
+
+        // all tasks are waited for before changing any state, so an unexpected
+        // exception leaves the registered devices and the active one as they were
+        std::vector<std::string> found_ids(paths.size());
+        std::exception_ptr failure;
+        for (size_t i = 0; i < paths.size(); i++){
+            try {
+                found_ids[i] = ids[i].get();
+            }
+            catch (...) {
+                if (!failure) failure = std::current_exception();
+            }
+        }
+        if (failure) std::rethrow_exception(failure);
 
-                    connected_devices_byID[id] = d;
-                    res.push_back(id);
-                    LOGD1( std::string("Found: ") + p + " => " + id);
-                } else{
-                    LOGD1( std::string("Could not connect to: ") + p);
+        decltype(connected_devices_byID) identified;
+        std::vector<std::string> res;
+        for (size_t i = 0; i < paths.size(); i++){
+            const auto &p = paths[i];
+            const auto &id = found_ids[i];
+            auto d = devices[p];
+            if (id.empty()) {
+                d->disconnect();
+                if (d == device) {
+                    device = nullptr;
+                    current_device_id = "";
                 }
+                continue;
             }
-            catch (const DeviceCommunicationException &e){
-                LOGD1( std::string("Exception encountered: ") + p);
+            const auto registered = registered_ids.find(p);
+            if (registered != registered_ids.end() && registered->second != id) {
+                LOGD1(std::string("ID changed: ") + registered->second + " => " + id);
+            }
+            identified[id] = d;
+            res.push_back(id);
+            LOGD1( std::string("Found: ") + p + " => " + id);
+        }
+
+        if (device != nullptr && connected_devices_byID.count(current_device_id) != 0) {
+            // follow the active device, which could have been removed or changed its ID
+            const auto active = std::find_if(identified.begin(), identified.end(),
+                [this](const decltype(identified)::value_type &kv) { return kv.second == device; });
+            if (active == identified.end()) {
+                device = nullptr;
+                current_device_id = "";
+            } else {
+                current_device_id = active->first;
             }
         }
+        connected_devices_byID = std::move(identified);
         return res;
     }
 
@@ -200,61 +275,42 @@ using nitrokey::misc::strcpyT;
 
         /**
          * Connects device to path.
-         * Assumes devices are not being disconnected and caches connections (param cache_connections).
+         * Connections are kept in the pool, so switching back to the device reuses the open handle.
          * @param path os-dependent device path
          * @return false, when could not connect, true otherwise
          */
     bool NitrokeyManager::connect_with_path(std::string path) {
-        const bool cache_connections = false;
-
         std::lock_guard<std::mutex> lock(mex_dev_com_manager);
 
-        if (cache_connections){
-            if(connected_devices.find(path) != connected_devices.end()
-                    && connected_devices[path] != nullptr) {
-                device = connected_devices[path];
-                return true;
-            }
-        }
-
-        auto vendor_ids = { NITROKEY_VID, PURISM_VID };
-        for (auto vendor_id : vendor_ids) {
-          auto info_ptr = hid_enumerate(vendor_id, 0);
-          if (!info_ptr) {
-            continue;
-          }
-          auto first_info_ptr = info_ptr;
-
-          misc::Option<DeviceModel> model;
-          while (info_ptr && !model.has_value()) {
-              if (path == std::string(info_ptr->path)) {
-                  model = product_id_to_model(info_ptr->vendor_id, info_ptr->product_id);
-              }
-              info_ptr = info_ptr->next;
-          }
-          hid_free_enumeration(first_info_ptr);
+        auto p = connection_pool.checkout(path);
+        if (p == nullptr) return false;
 
-          if (!model.has_value())
-            continue;
+        device = p;
+        current_device_id = path;
+        nitrokey::log::Log::setPrefix(path);
+        LOGD1("Device successfully changed");
+        return true;
+    }
 
-          auto p = Device::create(model.value());
-          if (!p)
-            continue;
-          p->set_path(path);
+    ConnectionPool &NitrokeyManager::get_connection_pool() {
+        return connection_pool;
+    }
 
-          if(!p->connect()) continue;
+    trace::TimelineRecorder &NitrokeyManager::get_timeline_recorder() {
+        return timeline_recorder;
+    }
 
-          if(cache_connections){
-              connected_devices [path] = p;
-          }
+    std::string NitrokeyManager::metrics_text() {
+        return metrics::openmetrics_text();
+    }
 
-          device = p; //previous device will be disconnected automatically
-          current_device_id = path;
-          nitrokey::log::Log::setPrefix(path);
-          LOGD1("Device successfully changed");
-          return true;
-        }
-        return false;
+    bool NitrokeyManager::connect_with_device(shared_ptr<Device> connected_device) {
+        std::lock_guard<std::mutex> lock(mex_dev_com_manager);
+        if (connected_device == nullptr)
+          return false;
+        device = connected_device;
+        current_device_id = "";
+        return true;
     }
 
     bool NitrokeyManager::connect() {
@@ -335,6 +391,7 @@ using nitrokey::misc::strcpyT;
       std::lock_guard<std::mutex> lock(mutex);
         if (_instance == nullptr){
             _instance = make_shared<NitrokeyManager>();
+            _instance->set_debug(false);
         }
         return _instance;
     }
@@ -346,6 +403,20 @@ using nitrokey::misc::strcpyT;
       return _disconnect_no_lock();
     }
 
+    bool NitrokeyManager::shutdown() {
+      std::lock_guard<std::mutex> lock(mex_dev_com_manager);
+      _disconnect_no_lock();
+      connection_pool.clear();
+      for (auto & kv : connected_devices_byID){
+        if (kv.second != nullptr)
+          kv.second->disconnect();
+      }
+      connected_devices_byID.clear();
+      current_device_id = "";
+      nitrokey::log::Log::instance().disable_async();
+      return Device::release_hid_context();
+    }
+
   bool NitrokeyManager::_disconnect_no_lock() {
     //do not use directly without locked mutex,
     //used by could_be_enumerated, disconnect
@@ -357,6 +428,22 @@ using nitrokey::misc::strcpyT;
     return res;
   }
 
+  std::vector<CommandLatencySnapshot> NitrokeyManager::get_command_latency() {
+      // the statistics are atomic, so not waiting for a transaction holding the manager lock
+      const auto dev = device.load();
+      if (dev == nullptr) {
+        return {};
+      }
+      return dev->m_latency.snapshot();
+  }
+
+  void NitrokeyManager::reset_command_latency() {
+      const auto dev = device.load();
+      if (dev != nullptr) {
+        dev->m_latency.reset();
+      }
+  }
+
   bool NitrokeyManager::is_connected() noexcept {
       std::lock_guard<std::mutex> lock(mex_dev_com_manager);
       if(device != nullptr){
@@ -412,18 +499,18 @@ using nitrokey::misc::strcpyT;
     }
 
     uint32_t NitrokeyManager::get_serial_number_as_u32() {
-        if (device == nullptr) { throw DeviceNotConnected("device not connected"); }
-      switch (device->get_device_model()) {
+        const auto dev = current_device();
+      switch (dev->get_device_model()) {
         case DeviceModel::LIBREM:
         case DeviceModel::PRO: {
-          auto response = GetStatus::CommandTransaction::run(device);
+          auto response = GetStatus::CommandTransaction::run(dev);
           return response.data().card_serial_u32;
         }
           break;
 
         case DeviceModel::STORAGE:
         {
-          auto response = stick20::GetDeviceStatus::CommandTransaction::run(device);
+          auto response = stick20::GetDeviceStatus::CommandTransaction::run(dev);
           return response.data().ActiveSmartCardID_u32;
         }
           break;
@@ -455,14 +542,15 @@ using nitrokey::misc::strcpyT;
 
     string NitrokeyManager::get_HOTP_code(uint8_t slot_number, const char *user_temporary_password) {
       if (!is_valid_hotp_slot_number(slot_number)) throw InvalidSlotException(slot_number);
+      const auto dev = current_device();
 
-      if (is_authorization_command_supported()){
+      if (is_authorization_command_supported(dev)){
         auto gh = get_payload<GetHOTP>();
         gh.slot_number = get_internal_slot_number_for_hotp(slot_number);
         if(user_temporary_password != nullptr && strlen(user_temporary_password)!=0){ //FIXME use string instead of strlen
-            authorize_packet<GetHOTP, UserAuthorize>(gh, user_temporary_password, device);
+            authorize_packet<GetHOTP, UserAuthorize>(gh, user_temporary_password, dev);
         }
-        auto resp = GetHOTP::CommandTransaction::run(device, gh);
+        auto resp = GetHOTP::CommandTransaction::run(dev, gh);
         return getFilledOTPCode(resp.data().code, resp.data().use_8_digits);
       } else {
         auto gh = get_payload<stick10_08::GetHOTP>();
@@ -470,7 +558,7 @@ using nitrokey::misc::strcpyT;
         if(user_temporary_password != nullptr && strlen(user_temporary_password)!=0) {
           strcpyT(gh.temporary_user_password, user_temporary_password);
         }
-        auto resp = stick10_08::GetHOTP::CommandTransaction::run(device, gh);
+        auto resp = stick10_08::GetHOTP::CommandTransaction::run(dev, gh);
         return getFilledOTPCode(resp.data().code, resp.data().use_8_digits);
       }
       return "";
@@ -488,9 +576,10 @@ using nitrokey::misc::strcpyT;
                                           uint8_t last_interval,
                                           const char *user_temporary_password) {
         if(!is_valid_totp_slot_number(slot_number)) throw InvalidSlotException(slot_number);
+        const auto dev = current_device();
         slot_number = get_internal_slot_number_for_totp(slot_number);
 
-        if (is_authorization_command_supported()){
+        if (is_authorization_command_supported(dev)){
           auto gt = get_payload<GetTOTP>();
           gt.slot_number = slot_number;
           gt.challenge = challenge;
@@ -498,31 +587,32 @@ using nitrokey::misc::strcpyT;
           gt.last_totp_time = last_totp_time;
 
           if(user_temporary_password != nullptr && strlen(user_temporary_password)!=0){ //FIXME use string instead of strlen
-              authorize_packet<GetTOTP, UserAuthorize>(gt, user_temporary_password, device);
+              authorize_packet<GetTOTP, UserAuthorize>(gt, user_temporary_password, dev);
           }
-          auto resp = GetTOTP::CommandTransaction::run(device, gt);
+          auto resp = GetTOTP::CommandTransaction::run(dev, gt);
           return getFilledOTPCode(resp.data().code, resp.data().use_8_digits);
         } else {
           auto gt = get_payload<stick10_08::GetTOTP>();
           strcpyT(gt.temporary_user_password, user_temporary_password);
           gt.slot_number = slot_number;
-          auto resp = stick10_08::GetTOTP::CommandTransaction::run(device, gt);
+          auto resp = stick10_08::GetTOTP::CommandTransaction::run(dev, gt);
           return getFilledOTPCode(resp.data().code, resp.data().use_8_digits);
         }
       return "";
     }
 
     bool NitrokeyManager::erase_slot(uint8_t slot_number, const char *temporary_password) {
-      if (is_authorization_command_supported()){
+      const auto dev = current_device();
+      if (is_authorization_command_supported(dev)){
         auto p = get_payload<EraseSlot>();
         p.slot_number = slot_number;
-        authorize_packet<EraseSlot, Authorize>(p, temporary_password, device);
-        auto resp = EraseSlot::CommandTransaction::run(device,p);
+        authorize_packet<EraseSlot, Authorize>(p, temporary_password, dev);
+        auto resp = EraseSlot::CommandTransaction::run(dev,p);
       } else {
         auto p = get_payload<stick10_08::EraseSlot>();
         p.slot_number = slot_number;
         strcpyT(p.temporary_admin_password, temporary_password);
-        auto resp = stick10_08::EraseSlot::CommandTransaction::run(device,p);
+        auto resp = stick10_08::EraseSlot::CommandTransaction::run(dev,p);
       }
         return true;
     }
@@ -539,53 +629,55 @@ using nitrokey::misc::strcpyT;
         return erase_slot(slot_number, temporary_password);
     }
 
-    template <typename T, typename U>
-    void vector_copy_ranged(T& dest, std::vector<U> &vec, size_t begin, size_t elements_to_copy){
-        const size_t d_size = sizeof(dest);
-      if(d_size < elements_to_copy){
-            throw TargetBufferSmallerThanSource(elements_to_copy, d_size);
-        }
-        std::fill(dest, dest+d_size, 0);
-        std::copy(vec.begin() + begin, vec.begin() +begin + elements_to_copy, dest);
-    }
-
-    template <typename T, typename U>
-    void vector_copy(T& dest, std::vector<U> &vec){
+    template <typename T>
+    void buffer_copy(T& dest, const uint8_t *src, size_t size){
         const size_t d_size = sizeof(dest);
-        if(d_size < vec.size()){
-            throw TargetBufferSmallerThanSource(vec.size(), d_size);
+        if(d_size < size){
+            throw TargetBufferSmallerThanSource(size, d_size);
         }
         std::fill(dest, dest+d_size, 0);
-        std::copy(vec.begin(), vec.end(), dest);
+        std::copy(src, src+size, dest);
     }
 
     bool NitrokeyManager::write_HOTP_slot(uint8_t slot_number, const char *slot_name, const char *secret, uint64_t hotp_counter,
                                           bool use_8_digits, bool use_enter, bool use_tokenID, const char *token_ID,
                                           const char *temporary_password) {
         if (!is_valid_hotp_slot_number(slot_number)) throw InvalidSlotException(slot_number);
+        auto secret_bin = misc::hex_string_to_secure_byte(secret);
+        // wiped on release, also when writing fails
+        return write_HOTP_slot(slot_number, slot_name, secret_bin.data(), secret_bin.size(), hotp_counter,
+                               use_8_digits, use_enter, use_tokenID, token_ID, temporary_password);
+    }
+
+    bool NitrokeyManager::write_HOTP_slot(uint8_t slot_number, const char *slot_name, const uint8_t *secret,
+                                          size_t secret_size, uint64_t hotp_counter, bool use_8_digits,
+                                          bool use_enter, bool use_tokenID, const char *token_ID,
+                                          const char *temporary_password) {
+        if (!is_valid_hotp_slot_number(slot_number)) throw InvalidSlotException(slot_number);
+        const auto dev = current_device();
 
       int internal_slot_number = get_internal_slot_number_for_hotp(slot_number);
-      if (is_authorization_command_supported()){
-        write_HOTP_slot_authorize(internal_slot_number, slot_name, secret, hotp_counter, use_8_digits, use_enter, use_tokenID,
-                    token_ID, temporary_password);
+      if (is_authorization_command_supported(dev)){
+        write_HOTP_slot_authorize(dev, internal_slot_number, slot_name, secret, secret_size, hotp_counter, use_8_digits,
+                                  use_enter, use_tokenID, token_ID, temporary_password);
       } else {
-        write_OTP_slot_no_authorize(internal_slot_number, slot_name, secret, hotp_counter, use_8_digits, use_enter, use_tokenID,
-                                    token_ID, temporary_password);
+        write_OTP_slot_no_authorize(dev, internal_slot_number, slot_name, secret, secret_size, hotp_counter,
+                                    use_8_digits, use_enter, use_tokenID, token_ID, temporary_password);
       }
       return true;
     }
 
-    void NitrokeyManager::write_HOTP_slot_authorize(uint8_t slot_number, const char *slot_name, const char *secret,
-                                                    uint64_t hotp_counter, bool use_8_digits, bool use_enter,
-                                                    bool use_tokenID, const char *token_ID, const char *temporary_password) {
-      if (device == nullptr) { throw DeviceNotConnected("device not connected"); }
+    void NitrokeyManager::write_HOTP_slot_authorize(const shared_ptr<Device> &dev,
+                                                    uint8_t slot_number, const char *slot_name, const uint8_t *secret,
+                                                    size_t secret_size, uint64_t hotp_counter, bool use_8_digits,
+                                                    bool use_enter, bool use_tokenID, const char *token_ID,
+                                                    const char *temporary_password) {
       auto payload = get_payload<WriteToHOTPSlot>();
       payload.slot_number = slot_number;
-      auto secret_bin = misc::hex_string_to_byte(secret);
-      vector_copy(payload.slot_secret, secret_bin);
+      buffer_copy(payload.slot_secret, secret, secret_size);
       strcpyT(payload.slot_name, slot_name);
       strcpyT(payload.slot_token_id, token_ID);
-      switch (device->get_device_model() ){
+      switch (dev->get_device_model() ){
         case DeviceModel::LIBREM:
         case DeviceModel::PRO: {
           payload.slot_counter = hotp_counter;
@@ -606,58 +698,72 @@ using nitrokey::misc::strcpyT;
       payload.use_enter = use_enter;
       payload.use_tokenID = use_tokenID;
 
-      authorize_packet<WriteToHOTPSlot, Authorize>(payload, temporary_password, device);
+      authorize_packet<WriteToHOTPSlot, Authorize>(payload, temporary_password, dev);
 
-      auto resp = WriteToHOTPSlot::CommandTransaction::run(device, payload);
+      auto resp = WriteToHOTPSlot::CommandTransaction::run(dev, payload);
+      misc::secure_zero(&payload, sizeof payload);
     }
 
     bool NitrokeyManager::write_TOTP_slot(uint8_t slot_number, const char *slot_name, const char *secret, uint16_t time_window,
                                               bool use_8_digits, bool use_enter, bool use_tokenID, const char *token_ID,
                                               const char *temporary_password) {
         if (!is_valid_totp_slot_number(slot_number)) throw InvalidSlotException(slot_number);
+        auto secret_bin = misc::hex_string_to_secure_byte(secret);
+        return write_TOTP_slot(slot_number, slot_name, secret_bin.data(), secret_bin.size(), time_window,
+                               use_8_digits, use_enter, use_tokenID, token_ID, temporary_password);
+    }
+
+    bool NitrokeyManager::write_TOTP_slot(uint8_t slot_number, const char *slot_name, const uint8_t *secret,
+                                          size_t secret_size, uint16_t time_window, bool use_8_digits,
+                                          bool use_enter, bool use_tokenID, const char *token_ID,
+                                          const char *temporary_password) {
+        if (!is_valid_totp_slot_number(slot_number)) throw InvalidSlotException(slot_number);
+        const auto dev = current_device();
        int internal_slot_number = get_internal_slot_number_for_totp(slot_number);
 
-      if (is_authorization_command_supported()){
-      write_TOTP_slot_authorize(internal_slot_number, slot_name, secret, time_window, use_8_digits, use_enter, use_tokenID,
-                                token_ID, temporary_password);
+      if (is_authorization_command_supported(dev)){
+      write_TOTP_slot_authorize(dev, internal_slot_number, slot_name, secret, secret_size, time_window, use_8_digits,
+                                use_enter, use_tokenID, token_ID, temporary_password);
       } else {
-        write_OTP_slot_no_authorize(internal_slot_number, slot_name, secret, time_window, use_8_digits, use_enter, use_tokenID,
-                                    token_ID, temporary_password);
+        write_OTP_slot_no_authorize(dev, internal_slot_number, slot_name, secret, secret_size, time_window, use_8_digits,
+                                    use_enter, use_tokenID, token_ID, temporary_password);
       }
 
       return true;
     }
 
-    void NitrokeyManager::write_OTP_slot_no_authorize(uint8_t internal_slot_number, const char *slot_name,
-                                                      const char *secret,
+    void NitrokeyManager::write_OTP_slot_no_authorize(const shared_ptr<Device> &dev,
+                                                      uint8_t internal_slot_number, const char *slot_name,
+                                                      const uint8_t *secret, size_t secret_size,
                                                       uint64_t counter_or_interval, bool use_8_digits, bool use_enter,
                                                       bool use_tokenID, const char *token_ID,
                                                       const char *temporary_password) const {
 
+      const auto maximum_OTP_secret_size = 40;
+      if(secret_size > maximum_OTP_secret_size){
+        throw TargetBufferSmallerThanSource(secret_size, maximum_OTP_secret_size);
+      }
+
+      // name, secret chunks and the slot configuration, streamed under one device lock
+      ChunkedTransfer transfer(dev);
       auto payload2 = get_payload<stick10_08::SendOTPData>();
       strcpyT(payload2.temporary_admin_password, temporary_password);
       strcpyT(payload2.data, slot_name);
       payload2.setTypeName();
-      stick10_08::SendOTPData::CommandTransaction::run(device, payload2);
+      stick10_08::SendOTPData::CommandTransaction::run(transfer, payload2);
 
       payload2.setTypeSecret();
       payload2.id = 0;
-      auto secret_bin = misc::hex_string_to_byte(secret);
-      auto remaining_secret_length = secret_bin.size();
-      const auto maximum_OTP_secret_size = 40;
-      if(remaining_secret_length > maximum_OTP_secret_size){
-        throw TargetBufferSmallerThanSource(remaining_secret_length, maximum_OTP_secret_size);
-      }
-
+      auto remaining_secret_length = secret_size;
       while (remaining_secret_length>0){
         const auto bytesToCopy = std::min(sizeof(payload2.data), remaining_secret_length);
-        const auto start = secret_bin.size() - remaining_secret_length;
-        memset(payload2.data, 0, sizeof(payload2.data));
-        vector_copy_ranged(payload2.data, secret_bin, start, bytesToCopy);
-        stick10_08::SendOTPData::CommandTransaction::run(device, payload2);
+        const auto start = secret_size - remaining_secret_length;
+        buffer_copy(payload2.data, secret + start, bytesToCopy);
+        stick10_08::SendOTPData::CommandTransaction::run(transfer, payload2);
         remaining_secret_length -= bytesToCopy;
         payload2.id++;
       }
+      misc::secure_zero(&payload2, sizeof payload2);
 
       auto payload = get_payload<stick10_08::WriteToOTPSlot>();
       strcpyT(payload.temporary_admin_password, temporary_password);
@@ -667,16 +773,17 @@ using nitrokey::misc::strcpyT;
       payload.use_tokenID = use_tokenID;
       payload.slot_counter_or_interval = counter_or_interval;
       payload.slot_number = internal_slot_number;
-      stick10_08::WriteToOTPSlot::CommandTransaction::run(device, payload);
+      stick10_08::WriteToOTPSlot::CommandTransaction::run(transfer, payload);
     }
 
-    void NitrokeyManager::write_TOTP_slot_authorize(uint8_t slot_number, const char *slot_name, const char *secret,
-                                                    uint16_t time_window, bool use_8_digits, bool use_enter,
-                                                    bool use_tokenID, const char *token_ID, const char *temporary_password) {
+    void NitrokeyManager::write_TOTP_slot_authorize(const shared_ptr<Device> &dev,
+                                                    uint8_t slot_number, const char *slot_name, const uint8_t *secret,
+                                                    size_t secret_size, uint16_t time_window, bool use_8_digits,
+                                                    bool use_enter, bool use_tokenID, const char *token_ID,
+                                                    const char *temporary_password) {
       auto payload = get_payload<WriteToTOTPSlot>();
       payload.slot_number = slot_number;
-      auto secret_bin = misc::hex_string_to_byte(secret);
-      vector_copy(payload.slot_secret, secret_bin);
+      buffer_copy(payload.slot_secret, secret, secret_size);
       strcpyT(payload.slot_name, slot_name);
       strcpyT(payload.slot_token_id, token_ID);
       payload.slot_interval = time_window; //FIXME naming
@@ -684,9 +791,10 @@ using nitrokey::misc::strcpyT;
       payload.use_enter = use_enter;
       payload.use_tokenID = use_tokenID;
 
-      authorize_packet<WriteToTOTPSlot, Authorize>(payload, temporary_password, device);
+      authorize_packet<WriteToTOTPSlot, Authorize>(payload, temporary_password, dev);
 
-      auto resp = WriteToTOTPSlot::CommandTransaction::run(device, payload);
+      auto resp = WriteToTOTPSlot::CommandTransaction::run(dev, payload);
+      misc::secure_zero(&payload, sizeof payload);
     }
 
     char * NitrokeyManager::get_totp_slot_name(uint8_t slot_number) {
@@ -747,15 +855,15 @@ using nitrokey::misc::strcpyT;
 
     template <typename ProCommand, PasswordKind StoKind>
     void NitrokeyManager::change_PIN_general(const char *current_PIN, const char *new_PIN) {
-        if (device == nullptr) { throw DeviceNotConnected("device not connected"); }
-        switch (device->get_device_model()){
+        const auto dev = current_device();
+        switch (dev->get_device_model()){
             case DeviceModel::LIBREM:
             case DeviceModel::PRO:
             {
                 auto p = get_payload<ProCommand>();
                 strcpyT(p.old_pin, current_PIN);
                 strcpyT(p.new_pin, new_PIN);
-                ProCommand::CommandTransaction::run(device, p);
+                ProCommand::CommandTransaction::run(dev, p);
             }
                 break;
             //in Storage change admin/user pin is divided to two commands with 20 chars field len
@@ -767,8 +875,8 @@ using nitrokey::misc::strcpyT;
                 auto p2 = get_payload<ChangeAdminUserPin20New>();
                 strcpyT(p2.password, new_PIN);
                 p2.set_kind(StoKind);
-                ChangeAdminUserPin20Current::CommandTransaction::run(device, p);
-                ChangeAdminUserPin20New::CommandTransaction::run(device, p2);
+                ChangeAdminUserPin20Current::CommandTransaction::run(dev, p);
+                ChangeAdminUserPin20New::CommandTransaction::run(dev, p2);
             }
                 break;
         }
@@ -776,14 +884,15 @@ using nitrokey::misc::strcpyT;
     }
 
     void NitrokeyManager::enable_password_safe(const char *user_pin) {
+        const auto dev = current_device();
         //The following command will cancel enabling PWS if it is not supported
         auto a = get_payload<IsAESSupported>();
         strcpyT(a.user_password, user_pin);
-        IsAESSupported::CommandTransaction::run(device, a);
+        IsAESSupported::CommandTransaction::run(dev, a);
 
         auto p = get_payload<EnablePasswordSafe>();
         strcpyT(p.user_password, user_pin);
-        EnablePasswordSafe::CommandTransaction::run(device, p);
+        EnablePasswordSafe::CommandTransaction::run(dev, p);
     }
 
     vector <uint8_t> NitrokeyManager::get_password_safe_slot_status() {
@@ -795,20 +904,20 @@ using nitrokey::misc::strcpyT;
     }
 
     uint8_t NitrokeyManager::get_user_retry_count() {
-        if (device == nullptr) { throw DeviceNotConnected("device not connected"); }
-        if(device->get_device_model() == DeviceModel::STORAGE){
-          stick20::GetDeviceStatus::CommandTransaction::run(device);
+        const auto dev = current_device();
+        if(dev->get_device_model() == DeviceModel::STORAGE){
+          stick20::GetDeviceStatus::CommandTransaction::run(dev);
         }
-        auto response = GetUserPasswordRetryCount::CommandTransaction::run(device);
+        auto response = GetUserPasswordRetryCount::CommandTransaction::run(dev);
         return response.data().password_retry_count;
     }
 
     uint8_t NitrokeyManager::get_admin_retry_count() {
-        if (device == nullptr) { throw DeviceNotConnected("device not connected"); }
-        if(device->get_device_model() == DeviceModel::STORAGE){
-          stick20::GetDeviceStatus::CommandTransaction::run(device);
+        const auto dev = current_device();
+        if(dev->get_device_model() == DeviceModel::STORAGE){
+          stick20::GetDeviceStatus::CommandTransaction::run(dev);
         }
-        auto response = GetPasswordRetryCount::CommandTransaction::run(device);
+        auto response = GetPasswordRetryCount::CommandTransaction::run(dev);
         return response.data().password_retry_count;
     }
 
@@ -845,16 +954,18 @@ using nitrokey::misc::strcpyT;
     void NitrokeyManager::write_password_safe_slot(uint8_t slot_number, const char *slot_name, const char *slot_login,
                                                        const char *slot_password) {
         if (!is_valid_password_safe_slot_number(slot_number)) throw InvalidSlotException(slot_number);
+        const auto dev = current_device();
+        ChunkedTransfer transfer(dev);
         auto p = get_payload<SetPasswordSafeSlotData>();
         p.slot_number = slot_number;
         strcpyT(p.slot_name, slot_name);
         strcpyT(p.slot_password, slot_password);
-        SetPasswordSafeSlotData::CommandTransaction::run(device, p);
+        SetPasswordSafeSlotData::CommandTransaction::run(transfer, p);
 
         auto p2 = get_payload<SetPasswordSafeSlotData2>();
         p2.slot_number = slot_number;
         strcpyT(p2.slot_login_name, slot_login);
-        SetPasswordSafeSlotData2::CommandTransaction::run(device, p2);
+        SetPasswordSafeSlotData2::CommandTransaction::run(transfer, p2);
     }
 
     void NitrokeyManager::erase_password_safe_slot(uint8_t slot_number) {
@@ -864,6 +975,132 @@ using nitrokey::misc::strcpyT;
         ErasePasswordSafeSlot::CommandTransaction::run(device, p);
     }
 
+    PasswordSafeEntries::PasswordSafeEntries()
+        : m_entries(static_cast<PasswordSafeEntry *>(misc::SecureArena::instance().allocate(STORAGE_SIZE))),
+          m_count(0) {}
+
+    PasswordSafeEntries::PasswordSafeEntries(const PasswordSafeEntries &other) : PasswordSafeEntries() {
+        memcpy(m_entries, other.m_entries, STORAGE_SIZE);
+        m_count = other.m_count;
+    }
+
+    PasswordSafeEntries &PasswordSafeEntries::operator=(const PasswordSafeEntries &other) {
+        if (this != &other) {
+            memcpy(m_entries, other.m_entries, STORAGE_SIZE);
+            m_count = other.m_count;
+        }
+        return *this;
+    }
+
+    PasswordSafeEntries::~PasswordSafeEntries() {
+        misc::SecureArena::instance().deallocate(m_entries, STORAGE_SIZE);
+    }
+
+    void PasswordSafeEntries::clear() {
+        misc::secure_zero(m_entries, STORAGE_SIZE);
+        m_count = 0;
+    }
+
+    PasswordSafeEntry &PasswordSafeEntries::append(uint8_t slot_number) {
+        if (slot_number >= PWS_SLOT_COUNT || m_count >= PWS_SLOT_COUNT) throw InvalidSlotException(slot_number);
+        for (const auto &e : *this) {
+          if (e.slot_number == slot_number) throw InvalidSlotException(slot_number);
+        }
+        auto &e = m_entries[m_count++];
+        bzero(&e, sizeof e);
+        e.slot_number = slot_number;
+        return e;
+    }
+
+    namespace {
+        void copy_pws_field(char *dest, size_t field_length, const char *src) {
+          if (src == nullptr) return;
+          const size_t src_strlen = strnlen(src, field_length + 1);
+          if (src_strlen > field_length) {
+            throw TooLongStringException(strlen(src), field_length, src);
+          }
+          memcpy(dest, src, src_strlen);
+          dest[src_strlen] = 0;
+        }
+    }
+
+    void PasswordSafeEntries::add(uint8_t slot_number, const char *name, const char *login, const char *password) {
+        // validate all fields before touching the collection
+        PasswordSafeEntry tmp;
+        bzero(&tmp, sizeof tmp);
+        try {
+          copy_pws_field(tmp.name, PWS_SLOTNAME_LENGTH, name);
+          copy_pws_field(tmp.login, PWS_LOGINNAME_LENGTH, login);
+          copy_pws_field(tmp.password, PWS_PASSWORD_LENGTH, password);
+        } catch (...) {
+          misc::secure_zero(&tmp, sizeof tmp);
+          throw;
+        }
+        auto &e = append(slot_number);
+        memcpy(e.name, tmp.name, sizeof e.name);
+        memcpy(e.login, tmp.login, sizeof e.login);
+        memcpy(e.password, tmp.password, sizeof e.password);
+        misc::secure_zero(&tmp, sizeof tmp);
+    }
+
+    PasswordSafeEntries NitrokeyManager::read_password_safe(uint16_t slot_mask) {
+        std::lock_guard<std::mutex> lock(mex_dev_com_manager);
+        const auto dev = current_device();
+
+        PasswordSafeEntries entries;
+        auto status = GetPasswordSafeSlotStatus::CommandTransaction::run(dev);
+        for (uint8_t slot = 0; slot < PWS_SLOT_COUNT; ++slot) {
+          if ((slot_mask & (1u << slot)) == 0) continue;
+          if (status.data().password_safe_status[slot] == 0) continue;
+
+          auto &e = entries.append(slot);
+          {
+            auto p = get_payload<GetPasswordSafeSlotName>();
+            p.slot_number = slot;
+            auto response = GetPasswordSafeSlotName::CommandTransaction::run(dev, p);
+            strncpy(e.name, reinterpret_cast<const char *>(response.data().slot_name), sizeof e.name - 1);
+          }
+          {
+            auto p = get_payload<GetPasswordSafeSlotLogin>();
+            p.slot_number = slot;
+            auto response = GetPasswordSafeSlotLogin::CommandTransaction::run(dev, p);
+            strncpy(e.login, reinterpret_cast<const char *>(response.data().slot_login), sizeof e.login - 1);
+          }
+          {
+            auto p = get_payload<GetPasswordSafeSlotPassword>();
+            p.slot_number = slot;
+            auto response = GetPasswordSafeSlotPassword::CommandTransaction::run(dev, p);
+            strncpy(e.password, reinterpret_cast<const char *>(response.data().slot_password), sizeof e.password - 1);
+          }
+        }
+        return entries;
+    }
+
+    void NitrokeyManager::write_password_safe(const PasswordSafeEntries &entries) {
+        std::lock_guard<std::mutex> lock(mex_dev_com_manager);
+        const auto dev = current_device();
+
+        // all checked first, so an invalid entry does not leave the slots partially written
+        for (const auto &e : entries) {
+          if (!is_valid_password_safe_slot_number(e.slot_number)) throw InvalidSlotException(e.slot_number);
+        }
+
+        ChunkedTransfer transfer(dev);
+        for (const auto &e : entries) {
+          auto p = get_payload<SetPasswordSafeSlotData>();
+          p.slot_number = e.slot_number;
+          strcpyT(p.slot_name, e.name);
+          strcpyT(p.slot_password, e.password);
+          SetPasswordSafeSlotData::CommandTransaction::run(transfer, p);
+          misc::secure_zero(&p, sizeof p);
+
+          auto p2 = get_payload<SetPasswordSafeSlotData2>();
+          p2.slot_number = e.slot_number;
+          strcpyT(p2.slot_login_name, e.login);
+          SetPasswordSafeSlotData2::CommandTransaction::run(transfer, p2);
+        }
+    }
+
     void NitrokeyManager::user_authenticate(const char *user_password, const char *temporary_password) {
         auto p = get_payload<UserAuthenticate>();
         strcpyT(p.card_password, user_password);
@@ -872,20 +1109,20 @@ using nitrokey::misc::strcpyT;
     }
 
     void NitrokeyManager::build_aes_key(const char *admin_password) {
-        if (device == nullptr) { throw DeviceNotConnected("device not connected"); }
-        switch (device->get_device_model()) {
+        const auto dev = current_device();
+        switch (dev->get_device_model()) {
             case DeviceModel::LIBREM:
             case DeviceModel::PRO: {
                 auto p = get_payload<BuildAESKey>();
                 strcpyT(p.admin_password, admin_password);
-                BuildAESKey::CommandTransaction::run(device, p);
+                BuildAESKey::CommandTransaction::run(dev, p);
                 break;
             }
             case DeviceModel::STORAGE : {
                 auto p = get_payload<stick20::CreateNewKeys>();
                 strcpyT(p.password, admin_password);
                 p.set_defaults();
-                stick20::CreateNewKeys::CommandTransaction::run(device, p);
+                stick20::CreateNewKeys::CommandTransaction::run(dev, p);
                 break;
             }
         }
@@ -898,25 +1135,25 @@ using nitrokey::misc::strcpyT;
     }
 
     void NitrokeyManager::unlock_user_password(const char *admin_password, const char *new_user_password) {
-      if (device == nullptr) { throw DeviceNotConnected("device not connected"); }
-      switch (device->get_device_model()){
+      const auto dev = current_device();
+      switch (dev->get_device_model()){
         case DeviceModel::LIBREM:
         case DeviceModel::PRO: {
           auto p = get_payload<stick10::UnlockUserPassword>();
           strcpyT(p.admin_password, admin_password);
           strcpyT(p.user_new_password, new_user_password);
-          stick10::UnlockUserPassword::CommandTransaction::run(device, p);
+          stick10::UnlockUserPassword::CommandTransaction::run(dev, p);
           break;
         }
         case DeviceModel::STORAGE : {
           auto p2 = get_payload<ChangeAdminUserPin20Current>();
           p2.set_defaults();
           strcpyT(p2.password, admin_password);
-          ChangeAdminUserPin20Current::CommandTransaction::run(device, p2);
+          ChangeAdminUserPin20Current::CommandTransaction::run(dev, p2);
           auto p3 = get_payload<stick20::UnlockUserPin>();
           p3.set_defaults();
           strcpyT(p3.password, new_user_password);
-          stick20::UnlockUserPin::CommandTransaction::run(device, p3);
+          stick20::UnlockUserPin::CommandTransaction::run(dev, p3);
           break;
         }
       }
@@ -925,18 +1162,19 @@ using nitrokey::misc::strcpyT;
 
     void NitrokeyManager::write_config(uint8_t numlock, uint8_t capslock, uint8_t scrolllock, bool enable_user_password,
                                        bool delete_user_password, const char *admin_temporary_password) {
+        const auto dev = current_device();
         auto p = get_payload<stick10_08::WriteGeneralConfig>();
         p.numlock = numlock;
         p.capslock = capslock;
         p.scrolllock = scrolllock;
         p.enable_user_password = static_cast<uint8_t>(enable_user_password ? 1 : 0);
         p.delete_user_password = static_cast<uint8_t>(delete_user_password ? 1 : 0);
-        if (is_authorization_command_supported()){
-          authorize_packet<stick10_08::WriteGeneralConfig, Authorize>(p, admin_temporary_password, device);
+        if (is_authorization_command_supported(dev)){
+          authorize_packet<stick10_08::WriteGeneralConfig, Authorize>(p, admin_temporary_password, dev);
         } else {
           strcpyT(p.temporary_admin_password, admin_temporary_password);
         }
-        stick10_08::WriteGeneralConfig::CommandTransaction::run(device, p);
+        stick10_08::WriteGeneralConfig::CommandTransaction::run(dev, p);
     }
 
     vector<uint8_t> NitrokeyManager::read_config() {
@@ -946,33 +1184,30 @@ using nitrokey::misc::strcpyT;
         return v;
     }
 
+    shared_ptr<Device> NitrokeyManager::current_device() const {
+        auto dev = device.load();
+        if (dev == nullptr) { throw DeviceNotConnected("device not connected"); }
+        return dev;
+    }
+
     bool NitrokeyManager::is_authorization_command_supported(){
-        if (device == nullptr) { throw DeviceNotConnected("device not connected"); }
-      //authorization command is supported for versions equal or below:
-        auto m = std::unordered_map<DeviceModel , int, EnumClassHash>({
-                                               {DeviceModel::PRO, 7},
-                                               {DeviceModel::LIBREM, 7},
-                                               {DeviceModel::STORAGE, 53},
-         });
-        return get_minor_firmware_version() <= m[device->get_device_model()];
+        return is_authorization_command_supported(current_device());
+    }
+
+    bool NitrokeyManager::is_authorization_command_supported(const shared_ptr<Device> &dev){
+        return is_command_supported(CommandID::AUTHORIZE, dev->get_device_model() == DeviceModel::STORAGE,
+                                    get_minor_firmware_version(dev));
     }
 
     bool NitrokeyManager::is_320_OTP_secret_supported(){
-        if (device == nullptr) { throw DeviceNotConnected("device not connected"); }
-        // 320 bit OTP secret is supported by version bigger or equal to:
-        auto m = std::unordered_map<DeviceModel , int, EnumClassHash>({
-                                               {DeviceModel::PRO, 8},
-                                               {DeviceModel::LIBREM, 8},
-                                               {DeviceModel::STORAGE, 54},
-         });
-        return get_minor_firmware_version() >= m[device->get_device_model()];
+        const auto dev = current_device();
+        // 320 bit OTP secrets are sent with the newer slot writing commands
+        return is_command_supported(CommandID::SEND_OTP_DATA, dev->get_device_model() == DeviceModel::STORAGE,
+                                    get_minor_firmware_version(dev));
     }
 
     DeviceModel NitrokeyManager::get_connected_device_model() const{
-        if (device == nullptr){
-            throw DeviceNotConnected("device not connected");
-        }
-      return device->get_device_model();
+      return current_device()->get_device_model();
     }
 
     bool NitrokeyManager::is_smartcard_in_use(){
@@ -986,15 +1221,18 @@ using nitrokey::misc::strcpyT;
     }
 
     uint8_t NitrokeyManager::get_minor_firmware_version(){
-      if (device == nullptr) { throw DeviceNotConnected("device not connected"); }
-      switch(device->get_device_model()){
+      return get_minor_firmware_version(current_device());
+    }
+
+    uint8_t NitrokeyManager::get_minor_firmware_version(const shared_ptr<Device> &dev){
+      switch(dev->get_device_model()){
         case DeviceModel::LIBREM:
         case DeviceModel::PRO:{
-          auto status_p = GetStatus::CommandTransaction::run(device);
+          auto status_p = GetStatus::CommandTransaction::run(dev);
           return status_p.data().firmware_version_st.minor; //7 or 8
         }
         case DeviceModel::STORAGE:{
-          auto status = stick20::GetDeviceStatus::CommandTransaction::run(device);
+          auto status = stick20::GetDeviceStatus::CommandTransaction::run(dev);
           auto test_firmware = status.data().versionInfo.build_iteration != 0;
           if (test_firmware)
             LOG("Development firmware detected. Increasing minor version number.", nitrokey::log::Loglevel::WARNING);
@@ -1004,15 +1242,15 @@ using nitrokey::misc::strcpyT;
       return 0;
     }
     uint8_t NitrokeyManager::get_major_firmware_version(){
-      if (device == nullptr) { throw DeviceNotConnected("device not connected"); }
-      switch(device->get_device_model()){
+      const auto dev = current_device();
+      switch(dev->get_device_model()){
         case DeviceModel::LIBREM:
         case DeviceModel::PRO:{
-          auto status_p = GetStatus::CommandTransaction::run(device);
+          auto status_p = GetStatus::CommandTransaction::run(dev);
           return status_p.data().firmware_version_st.major; //0
         }
         case DeviceModel::STORAGE:{
-          auto status = stick20::GetDeviceStatus::CommandTransaction::run(device);
+          auto status = stick20::GetDeviceStatus::CommandTransaction::run(dev);
           return status.data().versionInfo.major;
         }
       }
@@ -1064,51 +1302,59 @@ using nitrokey::misc::strcpyT;
     }
 
     void NitrokeyManager::set_unencrypted_read_only_admin(const char* admin_pin) {
+      const auto dev = current_device();
       //from v0.49, v0.52+ it needs Admin PIN
-      if (set_unencrypted_volume_rorw_pin_type_user()){
+      if (set_unencrypted_volume_rorw_pin_type_user(dev)){
         LOG("set_unencrypted_read_only_admin is not supported for this version of Storage device. "
                 "Please update firmware to v0.52+. Doing nothing.", nitrokey::log::Loglevel::WARNING);
         return;
       }
-      misc::execute_password_command<stick20::SetUnencryptedVolumeReadOnlyAdmin>(device, admin_pin);
+      misc::execute_password_command<stick20::SetUnencryptedVolumeReadOnlyAdmin>(dev, admin_pin);
     }
 
     void NitrokeyManager::set_unencrypted_read_only(const char *user_pin) {
+      const auto dev = current_device();
         //until v0.48 (incl. v0.50 and v0.51) User PIN was sufficient
         LOG("set_unencrypted_read_only is deprecated. Use set_unencrypted_read_only_admin instead.",
             nitrokey::log::Loglevel::WARNING);
-      if (!set_unencrypted_volume_rorw_pin_type_user()){
+      if (!set_unencrypted_volume_rorw_pin_type_user(dev)){
         LOG("set_unencrypted_read_only is not supported for this version of Storage device. Doing nothing.",
             nitrokey::log::Loglevel::WARNING);
         return;
       }
-      misc::execute_password_command<stick20::SendSetReadonlyToUncryptedVolume>(device, user_pin);
+      misc::execute_password_command<stick20::SendSetReadonlyToUncryptedVolume>(dev, user_pin);
     }
 
     void NitrokeyManager::set_unencrypted_read_write_admin(const char* admin_pin) {
+      const auto dev = current_device();
       //from v0.49, v0.52+ it needs Admin PIN
-      if (set_unencrypted_volume_rorw_pin_type_user()){
+      if (set_unencrypted_volume_rorw_pin_type_user(dev)){
         LOG("set_unencrypted_read_write_admin is not supported for this version of Storage device. "
                 "Please update firmware to v0.52+. Doing nothing.", nitrokey::log::Loglevel::WARNING);
         return;
       }
-      misc::execute_password_command<stick20::SetUnencryptedVolumeReadWriteAdmin>(device, admin_pin);
+      misc::execute_password_command<stick20::SetUnencryptedVolumeReadWriteAdmin>(dev, admin_pin);
     }
 
     void NitrokeyManager::set_unencrypted_read_write(const char *user_pin) {
+      const auto dev = current_device();
         //until v0.48 (incl. v0.50 and v0.51) User PIN was sufficient
       LOG("set_unencrypted_read_write is deprecated. Use set_unencrypted_read_write_admin instead.",
           nitrokey::log::Loglevel::WARNING);
-      if (!set_unencrypted_volume_rorw_pin_type_user()){
+      if (!set_unencrypted_volume_rorw_pin_type_user(dev)){
         LOG("set_unencrypted_read_write is not supported for this version of Storage device. Doing nothing.",
             nitrokey::log::Loglevel::WARNING);
         return;
       }
-      misc::execute_password_command<stick20::SendSetReadwriteToUncryptedVolume>(device, user_pin);
+      misc::execute_password_command<stick20::SendSetReadwriteToUncryptedVolume>(dev, user_pin);
     }
 
     bool NitrokeyManager::set_unencrypted_volume_rorw_pin_type_user(){
-      auto minor_firmware_version = get_minor_firmware_version();
+      return set_unencrypted_volume_rorw_pin_type_user(current_device());
+    }
+
+    bool NitrokeyManager::set_unencrypted_volume_rorw_pin_type_user(const shared_ptr<Device> &dev){
+      auto minor_firmware_version = get_minor_firmware_version(dev);
       return minor_firmware_version <= 48 || minor_firmware_version == 50 || minor_firmware_version == 51;
     }
 
@@ -1180,16 +1426,16 @@ using nitrokey::misc::strcpyT;
    * @return ReadSlot structure
    */
   stick10::ReadSlot::ResponsePayload NitrokeyManager::get_OTP_slot_data(const uint8_t slot_number) {
-    if (device == nullptr) { throw DeviceNotConnected("device not connected"); }
+    const auto dev = current_device();
     auto p = get_payload<stick10::ReadSlot>();
     p.slot_number = slot_number;
     p.data_format = stick10::ReadSlot::CounterFormat::BINARY; // ignored for devices other than Storage v0.54+
-    auto data = stick10::ReadSlot::CommandTransaction::run(device, p);
+    auto data = stick10::ReadSlot::CommandTransaction::run(dev, p);
 
     auto &payload = data.data();
 
     // if fw <=v0.53 and asked binary - do the conversion from ASCII
-    if (device->get_device_model() == DeviceModel::STORAGE && get_minor_firmware_version() <= 53
+    if (dev->get_device_model() == DeviceModel::STORAGE && get_minor_firmware_version(dev) <= 53
          && is_internal_hotp_slot_number(slot_number))
     {
       //convert counter from string to ull
@@ -0,0 +1,312 @@
+/*
+ * Copyright (c) 2015-2018 Nitrokey UG
+ *
+ * This file is part of libnitrokey.
+ *
+ * libnitrokey is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libnitrokey is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libnitrokey. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0
+ */
+
+/*
+ * Microbenchmarks of the protocol, logging and C API layers, and end-to-end
+ * transactions against an in-process fake device.
+ * Usage: nitrokey_bench [--out <file.json>] [--filter <substring>] [--min-time <seconds>]
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "../NK_C_API.h"
+#include "NitrokeyManager.h"
+#include "log.h"
+#include "misc.h"
+#include "stick10_commands.h"
+#include "version.h"
+#include "fake_device.h"
+
+using namespace nitrokey;
+using namespace nitrokey::proto;
+using nitrokey::log::Log;
+using nitrokey::log::Loglevel;
+
+namespace {
+
+  // keeps the benchmarked results alive, so they are not optimized out
+  volatile size_t sink;
+
+  struct Benchmark {
+    std::string name;
+    std::function<void(uint64_t iterations)> run;
+  };
+
+  struct Result {
+    std::string name;
+    uint64_t iterations;
+    double ns_per_op_median;
+    double ns_per_op_min;
+  };
+
+  const int REPETITIONS = 5;
+
+  double measure_ns(const Benchmark &b, uint64_t iterations) {
+    const auto start = std::chrono::steady_clock::now();
+    b.run(iterations);
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+  }
+
+  Result run_benchmark(const Benchmark &b, double min_time_s) {
+    // grow the iteration count until a single run takes min_time_s
+    uint64_t iterations = 1;
+    while (true) {
+      const auto ns = measure_ns(b, iterations);
+      if (ns >= min_time_s * 1e9 || iterations >= (1ull << 40)) break;
+      const auto scale = ns > 0 ? min_time_s * 1e9 / ns : 100;
+      iterations = static_cast<uint64_t>(iterations * std::min(std::max(scale * 1.2, 2.0), 100.0));
+    }
+
+    std::vector<double> per_op;
+    for (int i = 0; i < REPETITIONS; i++) {
+      per_op.push_back(measure_ns(b, iterations) / iterations);
+    }
+    std::sort(per_op.begin(), per_op.end());
+    return {b.name, iterations, per_op[per_op.size() / 2], per_op.front()};
+  }
+
+  std::string json_escape(const std::string &s) {
+    std::string res;
+    for (auto c : s) {
+      if (c == '"' || c == '\\') res += '\\';
+      res += c;
+    }
+    return res;
+  }
+
+  void write_json(std::ostream &out, const std::vector<Result> &results, double min_time_s) {
+    const auto now = std::time(nullptr);
+    char date[32];
+    std::strftime(date, sizeof date, "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+
+    out << "{\n  \"context\": {\n"
+        << "    \"library_version\": \"" << json_escape(get_library_version()) << "\",\n"
+        << "    \"date\": \"" << date << "\",\n"
+        << "    \"min_time_s\": " << min_time_s << ",\n"
+        << "    \"repetitions\": " << REPETITIONS << "\n"
+        << "  },\n  \"benchmarks\": [\n";
+    for (size_t i = 0; i < results.size(); i++) {
+      const auto &r = results[i];
+      out << "    {\"name\": \"" << json_escape(r.name) << "\", \"iterations\": " << r.iterations
+          << ", \"ns_per_op\": " << std::fixed << std::setprecision(1) << r.ns_per_op_median
+          << ", \"ns_per_op_min\": " << r.ns_per_op_min << "}"
+          << (i + 1 < results.size() ? "," : "") << "\n";
+      out.unsetf(std::ios::floatfield);
+    }
+    out << "  ]\n}\n";
+  }
+
+  std::vector<Benchmark> protocol_benchmarks() {
+    using GetStatusTransaction = stick10::GetStatus::CommandTransaction;
+    using AuthenticateTransaction = stick10::FirstAuthenticate::CommandTransaction;
+
+    std::vector<Benchmark> res;
+    res.push_back({"protocol/stm_crc32", [](uint64_t n) {
+      uint8_t data[HID_REPORT_SIZE - 5] = {1, 2, 3};
+      for (uint64_t i = 0; i < n; i++) {
+        data[0] = static_cast<uint8_t>(i);
+        sink = misc::stm_crc32(data, sizeof data);
+      }
+    }});
+    res.push_back({"protocol/HIDReport_build", [](uint64_t n) {
+      AuthenticateTransaction::CommandPayload payload;
+      memset(&payload, 'a', sizeof payload);
+      for (uint64_t i = 0; i < n; i++) {
+        AuthenticateTransaction::OutgoingPacket outp;
+        outp.initialize();
+        outp.payload = payload;
+        outp.update_CRC();
+        sink = outp.crc;
+      }
+    }});
+    res.push_back({"protocol/DeviceResponse_validate", [](uint64_t n) {
+      GetStatusTransaction::ResponsePacket resp;
+      resp.initialize();
+      resp.payload.firmware_version_st.minor = 12;
+      resp.update_CRC();
+      for (uint64_t i = 0; i < n; i++) {
+        sink = resp.isValid() && resp.isCRCcorrect() && resp.payload.isValid();
+      }
+    }});
+    res.push_back({"protocol/QueryDissector", [](uint64_t n) {
+      AuthenticateTransaction::OutgoingPacket outp;
+      outp.initialize();
+      outp.update_CRC();
+      for (uint64_t i = 0; i < n; i++) {
+        sink = static_cast<std::string>(outp).size();
+      }
+    }});
+    res.push_back({"protocol/ResponseDissector", [](uint64_t n) {
+      GetStatusTransaction::ResponsePacket resp;
+      resp.initialize();
+      resp.update_CRC();
+      for (uint64_t i = 0; i < n; i++) {
+        sink = static_cast<std::string>(resp).size();
+      }
+    }});
+    res.push_back({"misc/hex_string_to_byte", [](uint64_t n) {
+      const char *secret = "3132333435363738393031323334353637383930";
+      for (uint64_t i = 0; i < n; i++) {
+        sink = misc::hex_string_to_byte(secret).size();
+      }
+    }});
+    res.push_back({"misc/hexdump", [](uint64_t n) {
+      uint8_t data[HID_REPORT_SIZE] = {0x10, 0x20, 0x30};
+      for (uint64_t i = 0; i < n; i++) {
+        sink = misc::hexdump(data, sizeof data).size();
+      }
+    }});
+    return res;
+  }
+
+  std::vector<Benchmark> log_benchmarks(log::LogHandler &handler) {
+    std::vector<Benchmark> res;
+    res.push_back({"log/filtered", [](uint64_t n) {
+      Log::instance().set_loglevel(Loglevel::ERROR);
+      for (uint64_t i = 0; i < n; i++) {
+        LOG("Status busy, not decreasing receiving_retry_counter counter", Loglevel::DEBUG_L2);
+      }
+    }});
+    res.push_back({"log/enabled", [&handler](uint64_t n) {
+      Log::instance().set_handler(&handler);
+      Log::instance().set_loglevel(Loglevel::DEBUG_L2);
+      for (uint64_t i = 0; i < n; i++) {
+        LOG("Status busy, not decreasing receiving_retry_counter counter", Loglevel::DEBUG_L2);
+      }
+      Log::instance().set_loglevel(Loglevel::ERROR);
+      Log::instance().set_handler(&log::stdlog_handler);
+    }});
+    return res;
+  }
+
+  std::vector<Benchmark> device_benchmarks(std::shared_ptr<FakeDevice> fake) {
+    std::vector<Benchmark> res;
+    res.push_back({"manager/get_status", [](uint64_t n) {
+      auto m = NitrokeyManager::instance();
+      for (uint64_t i = 0; i < n; i++) {
+        sink = m->get_status().firmware_version;
+      }
+    }});
+    res.push_back({"manager/get_HOTP_code", [](uint64_t n) {
+      auto m = NitrokeyManager::instance();
+      for (uint64_t i = 0; i < n; i++) {
+        sink = m->get_HOTP_code(0, "").size();
+      }
+    }});
+    res.push_back({"manager/get_totp_slot_name", [](uint64_t n) {
+      auto m = NitrokeyManager::instance();
+      for (uint64_t i = 0; i < n; i++) {
+        auto name = m->get_totp_slot_name(0);
+        sink = strlen(name);
+        free(name);
+      }
+    }});
+    res.push_back({"manager/get_password_safe_slot_status", [](uint64_t n) {
+      auto m = NitrokeyManager::instance();
+      for (uint64_t i = 0; i < n; i++) {
+        sink = m->get_password_safe_slot_status().size();
+      }
+    }});
+    // compare with manager/get_status for the get_with_status overhead
+    res.push_back({"c_api/NK_get_status", [](uint64_t n) {
+      struct NK_status status;
+      for (uint64_t i = 0; i < n; i++) {
+        sink = static_cast<size_t>(NK_get_status(&status));
+      }
+    }});
+    res.push_back({"c_api/NK_get_status_not_connected", [fake](uint64_t n) {
+      auto m = NitrokeyManager::instance();
+      m->disconnect();
+      struct NK_status status;
+      for (uint64_t i = 0; i < n; i++) {
+        sink = static_cast<size_t>(NK_get_status(&status));
+      }
+      // disconnecting closed the device
+      fake->connect();
+      m->connect_with_device(fake);
+    }});
+    return res;
+  }
+
+  void usage(const char *name) {
+    std::cerr << "Usage: " << name << " [--out <file.json>] [--filter <substring>] [--min-time <seconds>]"
+              << std::endl;
+  }
+}
+
+int main(int argc, char *argv[]) {
+  std::string out_path = "nitrokey_bench.json";
+  std::string filter;
+  double min_time_s = 0.2;
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    if (i + 1 >= argc) {
+      usage(argv[0]);
+      return 2;
+    }
+    if (arg == "--out") out_path = argv[++i];
+    else if (arg == "--filter") filter = argv[++i];
+    else if (arg == "--min-time") min_time_s = std::atof(argv[++i]);
+    else {
+      usage(argv[0]);
+      return 2;
+    }
+  }
+
+  Log::instance().set_loglevel(Loglevel::ERROR);
+  log::RawFunctionalLogHandler null_handler([](const std::string &, Loglevel) {});
+  auto fake = std::make_shared<FakeDevice>();
+  NitrokeyManager::instance()->connect_with_device(fake);
+
+  std::vector<Benchmark> benchmarks;
+  for (auto group : {protocol_benchmarks(), log_benchmarks(null_handler), device_benchmarks(fake)}) {
+    benchmarks.insert(benchmarks.end(), group.begin(), group.end());
+  }
+
+  std::vector<Result> results;
+  for (const auto &b : benchmarks) {
+    if (b.name.find(filter) == std::string::npos) continue;
+    const auto r = run_benchmark(b, min_time_s);
+    std::cout << std::left << std::setw(44) << r.name << std::right << std::fixed << std::setprecision(1)
+              << std::setw(12) << r.ns_per_op_median << " ns/op" << std::setw(14) << r.iterations
+              << " iterations" << std::endl;
+    results.push_back(r);
+  }
+  NitrokeyManager::instance()->disconnect();
+
+  std::ofstream out(out_path);
+  if (!out) {
+    std::cerr << "Could not write " << out_path << std::endl;
+    return 1;
+  }
+  write_json(out, results, min_time_s);
+  std::cout << "Results written to " << out_path << std::endl;
+  return 0;
+}
@@ -0,0 +1,128 @@
+/*
+ * Copyright (c) 2015-2018 Nitrokey UG
+ *
+ * This file is part of libnitrokey.
+ *
+ * libnitrokey is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libnitrokey is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libnitrokey. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0
+ */
+
+#include <algorithm>
+#include <chrono>
+#include "libnitrokey/binary_log.h"
+#include "libnitrokey/device_proto.h"
+#include "libnitrokey/command.h"
+#include "libnitrokey/device.h"
+
+namespace nitrokey {
+
+namespace proto {
+    namespace {
+        thread_local log::VolatileFieldCollector *volatile_field_collector = nullptr;
+    }
+
+    void mark_volatile_field(const void *field, size_t size) {
+      if (volatile_field_collector != nullptr) volatile_field_collector->add(field, size);
+    }
+}
+
+namespace log {
+
+    const uint8_t BinaryLogRecord::FLAG_REPORT;
+    const uint8_t BinaryLogRecord::FLAG_MASKED;
+
+    VolatileFieldCollector::VolatileFieldCollector(const void *object, size_t size)
+        : m_object(static_cast<const uint8_t *>(object)), m_size(size) {
+      proto::volatile_field_collector = this;
+    }
+
+    VolatileFieldCollector::~VolatileFieldCollector() {
+      proto::volatile_field_collector = nullptr;
+    }
+
+    void VolatileFieldCollector::add(const void *field, size_t size) {
+      const auto f = static_cast<const uint8_t *>(field);
+      if (f < m_object || f + size > m_object + m_size) return;
+      m_fields.emplace_back(static_cast<size_t>(f - m_object), size);
+    }
+
+    BinaryLog &BinaryLog::instance() {
+      // never destroyed, so logging works until exit
+      static auto instance = new BinaryLog;
+      return *instance;
+    }
+
+    bool BinaryLog::open(const std::string &path) {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      if (m_file != nullptr) fclose(m_file);
+      m_open = false;
+      m_devices.clear();
+      m_next_device_id = 0;
+
+      m_file = fopen(path.c_str(), "wb");
+      if (m_file == nullptr) return false;
+      BinaryLogHeader header;
+      memcpy(header.magic, BINARY_LOG_MAGIC, sizeof header.magic);
+      header.version = BINARY_LOG_VERSION;
+      header.record_size = sizeof(BinaryLogRecord);
+      if (fwrite(&header, sizeof header, 1, m_file) != 1) {
+        fclose(m_file);
+        m_file = nullptr;
+        return false;
+      }
+      m_open = true;
+      return true;
+    }
+
+    void BinaryLog::close() {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_open = false;
+      if (m_file == nullptr) return;
+      fclose(m_file);
+      m_file = nullptr;
+    }
+
+    uint32_t BinaryLog::device_id(const device::Device *device) {
+      const uint64_t instance_id = device != nullptr ? device->get_instance_id() : 0;
+      auto it = m_devices.find(instance_id);
+      if (it != m_devices.end()) return it->second;
+
+      const auto id = m_next_device_id++;
+      m_devices[instance_id] = id;
+      const std::string path = device != nullptr ? device->get_path() : std::string();
+
+      BinaryLogRecord r;
+      memset(&r, 0, sizeof r);
+      r.timestamp_us = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::system_clock::now().time_since_epoch()).count());
+      r.device_id = id;
+      r.event = static_cast<uint8_t>(BinaryLogEvent::DEVICE);
+      r.device_status = device != nullptr ? static_cast<uint8_t>(device->get_device_model()) : 0;
+      memcpy(r.report, path.c_str(), std::min(path.size(), sizeof r.report - 1));
+      fwrite(&r, sizeof r, 1, m_file);
+      return id;
+    }
+
+    void BinaryLog::write(const device::Device *device, BinaryLogRecord &record) {
+      record.timestamp_us = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::system_clock::now().time_since_epoch()).count());
+      std::lock_guard<std::mutex> lock(m_mutex);
+      if (m_file == nullptr) return;
+      record.device_id = device_id(device);
+      fwrite(&record, sizeof record, 1, m_file);
+    }
+
+}
+}
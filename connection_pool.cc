@@ -0,0 +1,136 @@
+/*
+ * Copyright (c) 2015-2018 Nitrokey UG
+ *
+ * This file is part of libnitrokey.
+ *
+ * libnitrokey is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libnitrokey is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libnitrokey. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0
+ */
+
+#include <algorithm>
+#include "libnitrokey/connection_pool.h"
+#include "libnitrokey/enumeration_cache.h"
+#include "libnitrokey/log.h"
+
+namespace nitrokey {
+namespace device {
+
+    using namespace nitrokey::log;
+    using std::chrono::steady_clock;
+
+    const size_t ConnectionPool::DEFAULT_MAX_SIZE;
+
+    ConnectionPool::ConnectionPool(size_t max_size) : m_max_size(max_size), m_pruned_generation(0) {}
+
+    std::shared_ptr<Device> ConnectionPool::checkout(const std::string &path) {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      auto &cache = Device::enumeration_cache();
+      const auto generation = cache.generation();
+      if (generation != m_pruned_generation) {
+        prune_removed(cache);
+        m_pruned_generation = generation;
+      }
+      const auto appeared_in = cache.appeared_in(path);
+
+      auto it = m_entries.find(path);
+      if (it != m_entries.end()) {
+        auto &entry = it->second;
+        // the handle could have been closed by its user, or the device replugged
+        if (appeared_in != 0 && appeared_in <= entry.generation && entry.device->is_open()) {
+          m_stats.hits++;
+          entry.last_checkout = steady_clock::now();
+          return entry.device;
+        }
+        LOGD1("Pooled connection outdated: " + path);
+        // a handle closed by its user is just reopened
+        if (appeared_in == 0 || appeared_in > entry.generation) m_stats.invalidations++;
+        m_entries.erase(it);
+      }
+
+      m_stats.misses++;
+      // lookup rescans on miss, so freshly connected devices are found
+      const auto info = cache.find(path);
+      if (!info.has_value()) return nullptr;
+      auto d = Device::create(info.value().m_deviceModel);
+      if (!d) return nullptr;
+      d->set_path(path);
+      d->set_serial_number(info.value().m_serialNumber);
+      if (!d->connect()) return nullptr;
+
+      if (m_max_size == 0) return d;
+      while (m_entries.size() >= m_max_size) {
+        evict_least_recently_used();
+      }
+      m_entries[path] = {d, cache.generation(), steady_clock::now()};
+      return d;
+    }
+
+    void ConnectionPool::remove(const std::string &path) {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_entries.erase(path);
+    }
+
+    void ConnectionPool::clear() {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_entries.clear();
+    }
+
+    void ConnectionPool::set_max_size(size_t max_size) {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_max_size = max_size;
+      while (m_entries.size() > m_max_size) {
+        evict_least_recently_used();
+      }
+    }
+
+    ConnectionPoolStats ConnectionPool::get_stats() {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      auto stats = m_stats;
+      stats.size = m_entries.size();
+      stats.max_size = m_max_size;
+      return stats;
+    }
+
+    void ConnectionPool::reset_stats() {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_stats = ConnectionPoolStats();
+    }
+
+    void ConnectionPool::prune_removed(EnumerationCache &cache) {
+      for (auto it = m_entries.begin(); it != m_entries.end();) {
+        const auto appeared_in = cache.appeared_in(it->first);
+        if (appeared_in != 0 && appeared_in <= it->second.generation) {
+          ++it;
+          continue;
+        }
+        LOGD1("Dropping pooled connection of removed device: " + it->first);
+        m_stats.invalidations++;
+        it = m_entries.erase(it);
+      }
+    }
+
+    void ConnectionPool::evict_least_recently_used() {
+      const auto oldest = std::min_element(m_entries.begin(), m_entries.end(),
+          [](const std::pair<const std::string, Entry> &a, const std::pair<const std::string, Entry> &b) {
+            return a.second.last_checkout < b.second.last_checkout;
+          });
+      if (oldest == m_entries.end()) return;
+      LOGD1("Evicting pooled connection: " + oldest->first);
+      m_stats.evictions++;
+      m_entries.erase(oldest);
+    }
+
+}
+}
@@ -19,6 +19,8 @@
  * SPDX-License-Identifier: LGPL-3.0
  */
 
+#include <algorithm>
+#include <cerrno>
 #include <chrono>
 #include <codecvt>
 #include <iostream>
@@ -29,13 +31,57 @@
 #include "hidapi/hidapi.h"
 #include "libnitrokey/misc.h"
 #include "libnitrokey/device.h"
+#include "libnitrokey/enumeration_cache.h"
 #include "libnitrokey/log.h"
+#include "trace_probes.h"
 #include <mutex>
 #include "DeviceCommunicationExceptions.h"
 #include "device.h"
 
+// serializes hidapi calls not bound to a single device handle
 std::mutex mex_dev_com;
 
+namespace {
+  /**
+   * hidapi library state is initialized on first use and kept until released
+   * explicitly with Device::release_hid_context(), instead of after each
+   * disconnection, so reconnecting does not pay for library initialization.
+   * Both guarded by mex_dev_com.
+   */
+  bool hid_initialized = false;
+  /**
+   * Number of open device handles. Not a reference count: closing the last
+   * handle keeps the library state, it only allows release_hid_context().
+   */
+  int hid_open_handles = 0;
+
+  /** call with mex_dev_com locked */
+  bool hid_acquire_context() {
+    if (!hid_initialized) {
+      if (hid_init() != 0) {
+        return false;
+      }
+      hid_initialized = true;
+    }
+    return true;
+  }
+
+  /**
+   * Existing device objects, for reading their statistics. The mutex is
+   * never held while waiting for other locks.
+   */
+  struct Instances {
+    std::mutex mutex;
+    std::vector<const nitrokey::device::Device *> devices;
+  };
+
+  // never destroyed, as devices can outlive the static objects of this file
+  Instances &instances() {
+    static auto i = new Instances();
+    return *i;
+  }
+}
+
 using namespace nitrokey::device;
 using namespace nitrokey::log;
 using namespace nitrokey::misc;
@@ -76,6 +122,7 @@ Option<DeviceModel> nitrokey::device::product_id_to_model(uint16_t vendor_id, ui
 }
 
 std::atomic_int Device::instances_count{0};
+std::atomic<uint64_t> Device::next_instance_id{1};
 std::chrono::milliseconds Device::default_delay {0} ;
 
 std::ostream& nitrokey::device::operator<<(std::ostream& stream, DeviceModel model) {
@@ -101,9 +148,12 @@ Device::Device(const uint16_t vid, const uint16_t pid, const DeviceModel model,
                const milliseconds retry_timeout)
     :
       last_command_status(0),
+      m_health(ConnectionHealth::DISCONNECTED),
+      m_consecutive_errors(0),
       m_vid(vid),
       m_pid(pid),
       m_model(model),
+      m_instance_id(next_instance_id++),
       m_retry_sending_count(1),
       m_retry_receiving_count(retry_receiving_count),
       m_retry_timeout(retry_timeout),
@@ -111,12 +161,16 @@ Device::Device(const uint16_t vid, const uint16_t pid, const DeviceModel model,
       mp_devhandle(nullptr)
 {
   instances_count++;
+  auto &i = instances();
+  std::lock_guard<std::mutex> lock(i.mutex);
+  i.devices.push_back(this);
 }
 
 bool Device::disconnect() {
   //called in object's destructor
   LOG(__FUNCTION__, Loglevel::DEBUG_L2);
-  std::lock_guard<std::mutex> lock(mex_dev_com);
+  std::lock_guard<std::mutex> lock(m_dev_com_mtx);
+  m_health = ConnectionHealth::DISCONNECTED;
   return _disconnect();
 }
 
@@ -127,69 +181,127 @@ bool Device::_disconnect() {
   LOG(std::string(__FUNCTION__) +  std::string(" *IN* "), Loglevel::DEBUG_L2);
 
   if(mp_devhandle == nullptr) {
-    LOG(std::string("Disconnection: handle already freed: ") + std::to_string(mp_devhandle == nullptr) + " ("+m_path+")", Loglevel::DEBUG_L1);
+    LOG(std::string("Disconnection: handle already freed: ") + std::to_string(mp_devhandle == nullptr) + " ("+get_path()+")", Loglevel::DEBUG_L1);
     return false;
   }
 
-  hid_close(mp_devhandle);
+  _close_handle(mp_devhandle);
   mp_devhandle = nullptr;
-#ifndef __APPLE__
-  if (instances_count == 1){
-    LOG(std::string("Calling hid_exit"), Loglevel::DEBUG_L2);
-    hid_exit();
-  }
-#endif
   return true;
 }
 
+void Device::_close_handle(hid_device *handle) {
+  std::lock_guard<std::mutex> lock(mex_dev_com);
+  hid_close(handle);
+  hid_open_handles--;
+}
+
 bool Device::connect() {
   LOG(__FUNCTION__, Loglevel::DEBUG_L2);
-  std::lock_guard<std::mutex> lock(mex_dev_com);
-  return _connect();
+  std::lock_guard<std::mutex> lock(m_dev_com_mtx);
+  const bool success = _connect();
+  m_health = success ? ConnectionHealth::HEALTHY : ConnectionHealth::DISCONNECTED;
+  m_consecutive_errors = 0;
+  return success;
 }
 
 bool Device::_connect() {
   LOG(std::string(__FUNCTION__) + std::string(" *IN* "), Loglevel::DEBUG_L2);
 
-//   hid_init(); // done automatically on hid_open
-  if (m_path.empty()){
-    mp_devhandle = hid_open(m_vid, m_pid, nullptr);
-  } else {
-    mp_devhandle = hid_open_path(m_path.c_str());
-  }
+  mp_devhandle = _open_handle();
   const bool success = mp_devhandle != nullptr;
-  LOG(std::string("Connection success: ") + std::to_string(success) + " ("+m_path+")", Loglevel::DEBUG_L1);
+  LOG(std::string("Connection success: ") + std::to_string(success) + " ("+get_path()+")", Loglevel::DEBUG_L1);
   return success;
 }
 
+hid_device *Device::_open_handle() {
+  std::lock_guard<std::mutex> lock(mex_dev_com);
+  if (!hid_acquire_context()) {
+    LOG("Could not initialize hidapi", Loglevel::ERROR);
+    return nullptr;
+  }
+  hid_device *handle;
+  const auto path = get_path();
+  if (path.empty()){
+    handle = hid_open(m_vid, m_pid, nullptr);
+  } else {
+    handle = hid_open_path(path.c_str());
+  }
+  if (handle != nullptr) hid_open_handles++;
+  return handle;
+}
+
+void Device::set_serial_number(const std::string &serial_number) {
+  std::lock_guard<std::mutex> lock(m_info_mtx);
+  m_serial_number = serial_number;
+}
+
+std::string Device::get_serial_number() const {
+  std::lock_guard<std::mutex> lock(m_info_mtx);
+  return m_serial_number;
+}
+
+void Device::for_each_instance(const std::function<void(const Device &)> &f) {
+  auto &i = instances();
+  std::lock_guard<std::mutex> lock(i.mutex);
+  for (const auto d : i.devices) f(*d);
+}
+
 void Device::set_path(const std::string path){
+  std::lock_guard<std::mutex> lock(m_info_mtx);
   m_path = path;
 }
 
+std::string Device::get_path() const {
+  std::lock_guard<std::mutex> lock(m_info_mtx);
+  return m_path;
+}
+
 int Device::send(const void *packet) {
   LOG(__FUNCTION__, Loglevel::DEBUG_L2);
-  std::lock_guard<std::mutex> lock(mex_dev_com);
+  nitrokey::trace::LockWaitTimer lock_wait;
+  std::unique_lock<std::mutex> lock(m_dev_com_mtx);
+  if (lock_wait.active()) NK_TRACE(handle_lock_wait, this, 0, lock_wait.elapsed_us());
   LOG(std::string(__FUNCTION__) +  std::string(" *IN* "), Loglevel::DEBUG_L2);
 
   int send_feature_report = -1;
+  int attempts = 3;
+  bool extended = false;
 
-  for (int i = 0; i < 3 && send_feature_report < 0; ++i) {
+  for (int i = 0; i < attempts; ++i) {
     if (mp_devhandle == nullptr) {
       LOG(std::string("Connection fail") , Loglevel::DEBUG_L2);
       throw DeviceNotConnected("Attempted HID send on an invalid descriptor.");
     }
-    send_feature_report = hid_send_feature_report(
-        mp_devhandle, static_cast<const unsigned char *>(packet), HID_REPORT_SIZE);
-    if (send_feature_report < 0) _reconnect();
-    //add thread sleep?
-    LOG(std::string("Sending attempt: ")+std::to_string(i+1) + " / 3" , Loglevel::DEBUG_L2);
+    errno = 0;
+    send_feature_report = _write_report(packet);
+    const int error = errno;
+    LOG(std::string("Sending attempt: ")+std::to_string(i+1) + " / " + std::to_string(attempts), Loglevel::DEBUG_L2);
+    if (send_feature_report >= 0) {
+      _on_transfer_success();
+      break;
+    }
+    NK_TRACE(transfer_error, this, 0, error);
+    const auto delay = _on_transfer_error(_is_handle_dead(error, lock));
+    // the reopened handle is always tried
+    if (m_health == ConnectionHealth::RECONNECTING && i == attempts - 1 && !extended) {
+      attempts++;
+      extended = true;
+    }
+    if (delay.count() > 0) std::this_thread::sleep_for(delay);
   }
   return send_feature_report;
 }
 
+int Device::_write_report(const void *packet) {
+  return hid_send_feature_report(mp_devhandle, static_cast<const unsigned char *>(packet), HID_REPORT_SIZE);
+}
+
 int Device::recv(void *packet) {
   LOG(__FUNCTION__, Loglevel::DEBUG_L2);
-  std::lock_guard<std::mutex> lock(mex_dev_com);
+  nitrokey::trace::LockWaitTimer lock_wait;
+  std::unique_lock<std::mutex> lock(m_dev_com_mtx);
+  if (lock_wait.active()) NK_TRACE(handle_lock_wait, this, 0, lock_wait.elapsed_us());
   LOG(std::string(__FUNCTION__) +  std::string(" *IN* "), Loglevel::DEBUG_L2);
   int status;
   int retry_count = 0;
@@ -200,16 +312,14 @@ int Device::recv(void *packet) {
       throw DeviceNotConnected("Attempted HID receive on an invalid descriptor.");
     }
 
-    status = (hid_get_feature_report(mp_devhandle, static_cast<unsigned char *>(packet),
-                                     HID_REPORT_SIZE));
-
-    auto pwherr = hid_error(mp_devhandle);
-    std::wstring wherr = (pwherr != nullptr) ? pwherr : L"No error message";
-    std::string herr(wherr.begin(), wherr.end());
-    LOG(std::string("libhid error message: ") + herr,
-                    Loglevel::DEBUG_L2);
+    errno = 0;
+    status = _read_report(packet);
+    const int error = errno;
 
-    if (status > 0) break;  // success
+    if (status > 0) {
+      _on_transfer_success();
+      break;
+    }
     if (retry_count++ >= m_retry_receiving_count) {
       LOG(
           "Maximum retry count reached: " + std::to_string(retry_count),
@@ -219,15 +329,29 @@ int Device::recv(void *packet) {
           Loglevel::DEBUG);
       break;
     }
-    _reconnect();
+    NK_TRACE(transfer_error, this, 0, error);
+    const auto delay = _on_transfer_error(_is_handle_dead(error, lock));
     LOG("Retrying... " + std::to_string(retry_count),
                     Loglevel::DEBUG);
-    std::this_thread::sleep_for(m_retry_timeout);
+    std::this_thread::sleep_for(delay);
   }
 
   return status;
 }
 
+int Device::_read_report(void *packet) {
+  const auto status = hid_get_feature_report(mp_devhandle, static_cast<unsigned char *>(packet), HID_REPORT_SIZE);
+  const int error = errno;
+
+  auto pwherr = hid_error(mp_devhandle);
+  std::wstring wherr = (pwherr != nullptr) ? pwherr : L"No error message";
+  std::string herr(wherr.begin(), wherr.end());
+  LOG(std::string("libhid error message: ") + herr,
+                  Loglevel::DEBUG_L2);
+  errno = error;
+  return status;
+}
+
 namespace {
   void add_vendor_devices(std::vector<DeviceInfo>& res, uint16_t vendor_id){
     auto pInfo = hid_enumerate(vendor_id, 0);
@@ -255,11 +379,34 @@ namespace {
   }
 }
 
+namespace {
+  std::vector<DeviceInfo> scan_devices(){
+    std::lock_guard<std::mutex> lock(mex_dev_com);
+    std::vector<DeviceInfo> res;
+    if (!hid_acquire_context()) {
+      LOG("Could not initialize hidapi", Loglevel::ERROR);
+      return res;
+    }
+    ::add_vendor_devices(res, NITROKEY_VID);
+    ::add_vendor_devices(res, PURISM_VID);
+    return res;
+  }
+}
+
+EnumerationCache &Device::enumeration_cache(){
+  static EnumerationCache cache(scan_devices);
+  return cache;
+}
+
 std::vector<DeviceInfo> Device::enumerate(){
-  std::vector<DeviceInfo> res;
-  ::add_vendor_devices(res, NITROKEY_VID);
-  ::add_vendor_devices(res, PURISM_VID);
-  return res;
+  return enumeration_cache().devices();
+}
+
+Option<DeviceModel> Device::model_for_path(const std::string &path) {
+  const auto info = enumeration_cache().find(path);
+  if (!info.has_value())
+    return {};
+  return info.value().m_deviceModel;
 }
 
 std::shared_ptr<Device> Device::create(DeviceModel model) {
@@ -275,19 +422,41 @@ std::shared_ptr<Device> Device::create(DeviceModel model) {
   }
 }
 
+bool Device::is_open() {
+  std::lock_guard<std::mutex> lock(m_dev_com_mtx);
+  return mp_devhandle != nullptr;
+}
+
+bool Device::release_hid_context() {
+  std::lock_guard<std::mutex> lock(mex_dev_com);
+  if (hid_open_handles > 0) {
+    LOG("Cannot release hidapi, devices still connected: " + std::to_string(hid_open_handles), Loglevel::WARNING);
+    return false;
+  }
+  if (!hid_initialized) {
+    return true;
+  }
+#ifndef __APPLE__
+  LOG(std::string("Calling hid_exit"), Loglevel::DEBUG_L2);
+  hid_exit();
+  hid_initialized = false;
+#endif
+  return true;
+}
+
 bool Device::could_be_enumerated() {
   LOG(__FUNCTION__, Loglevel::DEBUG_L2);
-  std::lock_guard<std::mutex> lock(mex_dev_com);
+  std::unique_lock<std::mutex> lock(m_dev_com_mtx);
   if (mp_devhandle==nullptr){
     return false;
   }
 #ifndef __APPLE__
-  auto pInfo = hid_enumerate(m_vid, m_pid);
-  if (pInfo != nullptr){
-    hid_free_enumeration(pInfo);
-    return true;
+  lock.unlock();
+  const auto path = get_path();
+  if (path.empty()) {
+    return enumeration_cache().contains(m_model);
   }
-  return false;
+  return enumeration_cache().find(path).has_value();
 #else
 //  alternative for OSX
   unsigned char buf[1];
@@ -300,6 +469,99 @@ void Device::show_stats() {
   LOG(s, Loglevel::DEBUG_L2);
 }
 
+namespace {
+  /**
+   * Consecutive transient errors retried with the same handle, before reopening it.
+   */
+  const int TRANSIENT_RETRIES = 2;
+  /**
+   * Minimal time between reopening the handle, so a device failing
+   * repeatedly is not reopened on each attempt.
+   */
+  const milliseconds MIN_RECONNECT_INTERVAL = 250ms;
+
+  /**
+   * errno values after which the handle is unusable. Others (EPIPE, EAGAIN,
+   * ETIMEDOUT, EIO, EPROTO) may come from a single glitch on the bus.
+   * Note: not all hidapi backends set errno.
+   */
+  bool is_dead_handle_error(int error) {
+    switch (error) {
+      case ENODEV:
+      case ENXIO:
+      case ENOENT:
+      case EBADF:
+#ifdef ESHUTDOWN
+      case ESHUTDOWN:
+#endif
+        return true;
+      default:
+        return false;
+    }
+  }
+}
+
+void Device::_on_transfer_success() {
+  m_consecutive_errors = 0;
+  m_health = ConnectionHealth::HEALTHY;
+}
+
+bool Device::_is_handle_dead(int error, std::unique_lock<std::mutex> &lock) {
+  if (is_dead_handle_error(error)) return true;
+  const auto path = get_path();
+  if (path.empty()) return false;
+  // backends not reporting errno are covered by checking the device presence,
+  // which may rescan the bus, so not under the handle lock
+  lock.unlock();
+  const bool present = enumeration_cache().find(path).has_value();
+  lock.lock();
+  return !present;
+}
+
+milliseconds Device::_on_transfer_error(bool dead) {
+  m_consecutive_errors++;
+  const auto backoff = std::min(m_retry_timeout,
+                                milliseconds(1 << std::min(m_consecutive_errors, 7)));
+
+  if (dead) {
+    ++m_counters.dead_handle_errors;
+  } else {
+    ++m_counters.transient_errors;
+    if (m_consecutive_errors <= TRANSIENT_RETRIES) {
+      m_health = ConnectionHealth::DEGRADED;
+      return backoff;
+    }
+  }
+
+  const auto now = steady_clock::now();
+  if (now - m_last_reconnect < MIN_RECONNECT_INTERVAL) {
+    ++m_counters.reconnects_rate_limited;
+    m_health = ConnectionHealth::DEGRADED;
+    if (dead) {
+      // retrying the same handle is pointless
+      LOG("Dead device handle, reconnecting not allowed yet", Loglevel::DEBUG_L1);
+      throw DeviceNotConnected("Device handle is dead, reconnecting too often");
+    }
+    return backoff;
+  }
+
+  m_health = ConnectionHealth::RECONNECTING;
+  _reconnect();
+  m_last_reconnect = steady_clock::now();
+  const int64_t latency = duration_cast<microseconds>(m_last_reconnect - now).count();
+  m_counters.reconnect_time_total_us += latency;
+  if (latency > m_counters.reconnect_time_max_us) m_counters.reconnect_time_max_us = latency;
+  LOG("Reconnected in " + std::to_string(latency) + " us", Loglevel::DEBUG_L1);
+  NK_TRACE(reconnect, this, 0, latency);
+
+  m_consecutive_errors = 0;
+  if (mp_devhandle == nullptr) {
+    ++m_counters.reconnect_failures;
+    m_health = ConnectionHealth::DISCONNECTED;
+  }
+  return 0ms;
+}
+
 void Device::_reconnect() {
   LOG(__FUNCTION__, Loglevel::DEBUG_L2);
   ++m_counters.low_level_reconnect;
@@ -308,6 +570,11 @@ void Device::_reconnect() {
 }
 
 Device::~Device() {
+  {
+    auto &i = instances();
+    std::lock_guard<std::mutex> lock(i.mutex);
+    i.devices.erase(std::remove(i.devices.begin(), i.devices.end(), this), i.devices.end());
+  }
   show_stats();
   disconnect();
   instances_count--;
@@ -319,12 +586,12 @@ void Device::set_default_device_speed(int delay) {
 
 
 void Device::set_receiving_delay(const std::chrono::milliseconds delay){
-  std::lock_guard<std::mutex> lock(mex_dev_com);
+  std::lock_guard<std::mutex> lock(m_dev_com_mtx);
   m_send_receive_delay = delay;
 }
 
 void Device::set_retry_delay(const std::chrono::milliseconds delay){
-  std::lock_guard<std::mutex> lock(mex_dev_com);
+  std::lock_guard<std::mutex> lock(m_dev_com_mtx);
   m_retry_timeout = delay;
 }
 
@@ -379,6 +646,14 @@ std::string Device::ErrorCounters::get_as_string() {
   p(low_level_reconnect);
   p(sending_error);
   p(receiving_error);
+  ss << "(";
+  p(transient_errors);
+  p(dead_handle_errors);
+  p(reconnects_rate_limited);
+  p(reconnect_failures);
+  p(reconnect_time_total_us);
+  p(reconnect_time_max_us);
+  ss << ")";
   return ss.str();
 }
 
@@ -0,0 +1,402 @@
+/*
+ * Copyright (c) 2015-2018 Nitrokey UG
+ *
+ * This file is part of libnitrokey.
+ *
+ * libnitrokey is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libnitrokey is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libnitrokey. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0
+ */
+
+#include "libnitrokey/device_proto.h"
+#include "libnitrokey/command_registry.h"
+#include "trace_probes.h"
+
+namespace nitrokey {
+namespace proto {
+
+    using namespace ::nitrokey::device;
+    using namespace ::nitrokey::log;
+    using namespace std::chrono_literals;
+
+    namespace {
+        /**
+         * Clears the packet when leaving the scope, also on exceptions.
+         */
+        class PacketCleaner {
+        public:
+            PacketCleaner(void *packet, size_t size) : m_packet(packet), m_size(size) {}
+            ~PacketCleaner() { clear(); }
+            PacketCleaner(const PacketCleaner &) = delete;
+            PacketCleaner &operator=(const PacketCleaner &) = delete;
+
+            void clear() { if (m_packet != nullptr) misc::secure_zero(m_packet, m_size); }
+            void release() { m_packet = nullptr; m_size = 0; }
+
+        private:
+            void *m_packet;
+            size_t m_size;
+        };
+
+        /**
+         * Report buffer taken from the device's pool for the scope.
+         */
+        class PooledReport {
+        public:
+            explicit PooledReport(ReportPool &pool) : m_pool(pool), m_report(pool.acquire()) {}
+            ~PooledReport() { m_pool.release(m_report); }
+            PooledReport(const PooledReport &) = delete;
+            PooledReport &operator=(const PooledReport &) = delete;
+
+            uint8_t *get() const { return m_report; }
+
+        private:
+            ReportPool &m_pool;
+            uint8_t *m_report;
+        };
+
+        /**
+         * Time to the first poll of the commands streamed in a ChunkedTransfer.
+         * These mostly store the data on the device, so the response is usually
+         * ready well before the device's send_receive_delay.
+         */
+        constexpr std::chrono::milliseconds STREAMED_FIRST_POLL_DELAY = 5ms;
+
+        void execute(Device *dev, uint8_t command_id, const void *payload, size_t payload_size,
+                     uint8_t *response, const PacketHandlers &handlers, std::chrono::milliseconds first_poll_delay);
+    }
+
+    void run_transaction(Device *dev, uint8_t command_id, const void *payload, size_t payload_size,
+                         uint8_t *response, const PacketHandlers &handlers) {
+      LOG(__FUNCTION__, Loglevel::DEBUG_L2);
+
+      if (dev == nullptr || response == nullptr){
+        LOG(std::string("Connection not established yet"), Loglevel::DEBUG_L2);
+        throw DeviceNotConnected("Device not initialized");
+      }
+      trace::LockWaitTimer lock_wait;
+      std::lock_guard<std::mutex> guard(dev->m_send_receive_mtx);
+      if (lock_wait.active())
+        NK_TRACE(transaction_lock_wait, dev, command_id, lock_wait.elapsed_us());
+
+      execute(dev, command_id, payload, payload_size, response, handlers, dev->get_send_receive_delay());
+    }
+
+    ChunkedTransfer::ChunkedTransfer(std::shared_ptr<Device> dev) : m_device(std::move(dev)), m_chunks(0) {
+      if (m_device == nullptr){
+        LOG(std::string("Connection not established yet"), Loglevel::DEBUG_L2);
+        throw DeviceNotConnected("Device not initialized");
+      }
+      trace::LockWaitTimer lock_wait;
+      m_lock = std::unique_lock<std::mutex>(m_device->m_send_receive_mtx);
+      if (lock_wait.active())
+        NK_TRACE(transaction_lock_wait, m_device.get(), 0, lock_wait.elapsed_us());
+    }
+
+    void ChunkedTransfer::run(uint8_t command_id, const void *payload, size_t payload_size, uint8_t *response,
+                              const PacketHandlers &handlers) {
+      LOG(__FUNCTION__, Loglevel::DEBUG_L2);
+      const auto dev = m_device.get();
+      execute(dev, command_id, payload, payload_size, response, handlers,
+              std::min(STREAMED_FIRST_POLL_DELAY, dev->get_send_receive_delay()));
+      m_chunks++;
+    }
+
+    namespace {
+    /**
+     * Runs the command, with the device's transaction lock held.
+     * The outgoing report is packed from the payload into a buffer of the
+     * device's report pool and wiped when done.
+     * The first poll follows the command after first_poll_delay. When that is
+     * shorter than the device's send_receive_delay, the first response is only
+     * accepted if it answers this command, as the device may still be holding
+     * the previous one; otherwise polling continues as usual once the full
+     * delay has passed.
+     */
+    void execute(Device *dev, uint8_t command_id, const void *payload, size_t payload_size,
+                 uint8_t *response, const PacketHandlers &handlers, std::chrono::milliseconds first_poll_delay) {
+      // the report is zeroed by the pool, and wiped when returned to it
+      PooledReport outgoing(dev->m_report_pool);
+      auto &outp = *reinterpret_cast<RawReport *>(outgoing.get());
+      outp.command_id = command_id;
+      memcpy(outp.payload, payload, payload_size);
+      auto &resp = *reinterpret_cast<RawResponse *>(response);
+      PacketCleaner clean_resp(&resp, sizeof resp);
+      dev->m_counters.total_comm_runs++;
+
+      int status = 0;
+      bzero(&resp, sizeof resp);
+      outp.update_CRC();
+
+      TransactionTimer latency(dev->m_latency, outp.command_id);
+      trace::TransactionTrace tracing(dev, outp.command_id);
+
+      LOG("-------------------", Loglevel::DEBUG);
+      auto &binary_log = BinaryLog::instance();
+      if (binary_log.is_open()) {
+        handlers.log_query(dev, outp);
+      } else if (Log::instance().is_enabled(Loglevel::DEBUG)) {
+        LOG("Outgoing HID packet:", Loglevel::DEBUG);
+        LOG(handlers.dissect_query(outp), Loglevel::DEBUG);
+      }
+      LOG(std::string("=> ") + std::string(commandid_to_string(static_cast<CommandID>(outp.command_id))), Loglevel::DEBUG_L1);
+
+
+      if (!outp.isValid()) {
+        LOG(std::string("Throw: Invalid outgoing packet"), Loglevel::DEBUG_L1);
+        throw DeviceSendingFailure("Invalid outgoing packet");
+      }
+
+      bool successful_communication = false;
+      int receiving_retry_counter = 0;
+      int sending_retry_counter = dev->get_retry_sending_count();
+      while (sending_retry_counter-- > 0) {
+        dev->m_counters.sends_executed++;
+        NK_TRACE(send_start, dev, outp.command_id, 0);
+        status = dev->send(&outp);
+        NK_TRACE(send_done, dev, outp.command_id, status);
+        if (status <= 0){
+            //FIXME early disconnection not yet working properly
+//                  LOG("Encountered communication error, disconnecting device", Loglevel::DEBUG_L2);
+//                  dev->disconnect();
+          dev->m_counters.sending_error++;
+          LOG(std::string("Throw: Device error while sending command "), Loglevel::DEBUG_L1);
+          throw DeviceSendingFailure(
+              std::string("Device error while sending command ") +
+              std::to_string(status));
+        }
+
+        std::this_thread::sleep_for(first_poll_delay);
+        bool awaiting_first_response = first_poll_delay < dev->get_send_receive_delay();
+
+        // FIXME make checks done in device:recv here
+        receiving_retry_counter = dev->get_retry_receiving_count();
+        int busy_counter = 0;
+        auto retry_timeout = dev->get_retry_timeout();
+        while (receiving_retry_counter-- > 0) {
+          dev->m_counters.recv_executed++;
+          NK_TRACE(recv_start, dev, outp.command_id, 0);
+          status = dev->recv(&resp);
+
+          if (dev->get_device_model() == DeviceModel::STORAGE &&
+              command_info(resp.command_id).storage_status) {
+            LOG(std::string("Detected storage device cmd, status: ") +
+                            std::to_string(resp.storage_status.device_status), Loglevel::DEBUG_L2);
+
+            resp.last_command_status = static_cast<uint8_t>(stick10::command_status::ok);
+            switch (static_cast<stick20::device_status>(resp.storage_status.device_status)) {
+              case stick20::device_status::idle :
+              case stick20::device_status::ok:
+                resp.device_status = static_cast<uint8_t>(stick10::device_status::ok);
+                break;
+              case stick20::device_status::busy:
+              case stick20::device_status::busy_progressbar: //TODO this will be modified later for getting progressbar status
+                resp.device_status = static_cast<uint8_t>(stick10::device_status::busy);
+                break;
+              case stick20::device_status::wrong_password:
+                resp.last_command_status = static_cast<uint8_t>(stick10::command_status::wrong_password);
+                resp.device_status = static_cast<uint8_t>(stick10::device_status::ok);
+                break;
+              case stick20::device_status::no_user_password_unlock:
+                resp.last_command_status = static_cast<uint8_t>(stick10::command_status::AES_dec_failed);
+                resp.device_status = static_cast<uint8_t>(stick10::device_status::ok);
+                break;
+              default:
+                LOG(std::string("Unknown storage device status, cannot translate: ") +
+                                std::to_string(resp.storage_status.device_status), Loglevel::DEBUG);
+                resp.device_status = resp.storage_status.device_status;
+                break;
+            };
+          }
+
+          if (awaiting_first_response) {
+            awaiting_first_response = false;
+            if (status > 0 && resp.last_command_crc != outp.crc) {
+              LOG("Early poll returned the previous response, waiting", Loglevel::DEBUG_L2);
+              receiving_retry_counter++;
+              std::this_thread::sleep_for(dev->get_send_receive_delay() - first_poll_delay);
+              continue;
+            }
+          }
+
+          if (status <= 0) latency.poll(TransactionTimer::PollResult::FAILED);
+          else if (resp.device_status == static_cast<uint8_t>(stick10::device_status::busy))
+            latency.poll(TransactionTimer::PollResult::BUSY);
+          else latency.poll(TransactionTimer::PollResult::READY);
+          NK_TRACE(poll, dev, outp.command_id,
+                   status <= 0 ? -1 : resp.device_status);
+
+          //Some of the commands return wrong CRC, for now skip checking it (TODO list and report)
+          //if (resp.device_status == 0 && resp.last_command_crc == outp.crc && resp.isCRCcorrect()) break;
+          auto CRC_equal_awaited = true; // resp.last_command_crc == outp.crc;
+          if (resp.device_status == static_cast<uint8_t>(stick10::device_status::ok) &&
+              CRC_equal_awaited && resp.isValid()){
+            successful_communication = true;
+            break;
+          }
+          if (resp.device_status == static_cast<uint8_t>(stick10::device_status::busy)) {
+            dev->m_counters.busy++;
+
+            if (busy_counter++<10) {
+              receiving_retry_counter++;
+              LOG("Status busy, not decreasing receiving_retry_counter counter: " +
+                              std::to_string(receiving_retry_counter), Loglevel::DEBUG_L2);
+            } else {
+              retry_timeout *= 2;
+              retry_timeout = std::min(retry_timeout, 300ms);
+              busy_counter = 0;
+              LOG("Status busy, decreasing receiving_retry_counter counter: " +
+                              std::to_string(receiving_retry_counter) + ", current delay:"
+                  + std::to_string(retry_timeout.count()), Loglevel::DEBUG);
+              LOG(std::string("Busy retry: status ")
+                  + std::to_string(resp.storage_status.device_status)
+                  + ", "
+                  + std::to_string(retry_timeout.count())
+                  + "ms, counter "
+                  + std::to_string(receiving_retry_counter)
+                    + ", progress: "
+                  + std::to_string(resp.storage_status.progress_bar_value)
+              , Loglevel::DEBUG_L1);
+            }
+          }
+          if (resp.device_status == static_cast<uint8_t>(stick10::device_status::busy) &&
+              static_cast<stick20::device_status>(resp.storage_status.device_status)
+              == stick20::device_status::busy_progressbar){
+            successful_communication = true;
+            break;
+          }
+          LOG(std::string("Retry status - dev status, awaited cmd crc, correct packet CRC: ")
+                          + std::to_string(resp.device_status) +
+                          " " + std::to_string(CRC_equal_awaited) +
+                          " " + std::to_string(resp.isCRCcorrect()), Loglevel::DEBUG_L2);
+
+          if (!resp.isCRCcorrect()) dev->m_counters.wrong_CRC++;
+          if (!CRC_equal_awaited) dev->m_counters.CRC_other_than_awaited++;
+
+
+          LOG(
+              "Device is not ready or received packet's last CRC is not equal to sent CRC packet, retrying...",
+              Loglevel::DEBUG_L2);
+          if (binary_log.is_open()) {
+            handlers.log_response(dev, BinaryLogEvent::RETRIED_RESPONSE, resp,
+                                sending_retry_counter, receiving_retry_counter);
+          } else if (Log::instance().is_enabled(Loglevel::DEBUG_L2)) {
+            LOG("Invalid incoming HID packet:", Loglevel::DEBUG_L2);
+            LOG(handlers.dissect_response(resp), Loglevel::DEBUG_L2);
+          }
+          dev->m_counters.total_retries++;
+          LOG(".", Loglevel::DEBUG_L1);
+          NK_TRACE(busy_backoff, dev, outp.command_id, retry_timeout.count());
+          std::this_thread::sleep_for(retry_timeout);
+          continue;
+        }
+        if (successful_communication) break;
+        LOG(std::string("Resending (outer loop) "), Loglevel::DEBUG_L2);
+        LOG(std::string("sending_retry_counter count: ") + std::to_string(sending_retry_counter),
+                        Loglevel::DEBUG);
+      }
+
+      if(resp.last_command_crc != outp.crc){
+        LOG(std::string("Accepting response with CRC other than expected ")
+            + "Command ID: " + std::to_string(resp.command_id) + " " +
+            commandid_to_string(static_cast<CommandID>(resp.command_id)) + "  "
+            + "Reported by response and expected: " + std::to_string(resp.last_command_crc) + "!=" + std::to_string(outp.crc),
+            Loglevel::WARNING
+        );
+      }
+
+      dev->set_last_command_status(resp.last_command_status); // FIXME should be handled on device.recv
+
+
+      if (status <= 0) {
+        dev->m_counters.receiving_error++;
+        LOG(std::string("Throw: Device error while executing command "), Loglevel::DEBUG_L1);
+        throw DeviceReceivingFailure( //FIXME replace with CriticalErrorException
+            std::string("Device error while executing command ") +
+            std::to_string(status));
+      }
+
+      LOG(std::string("<= ") +
+          std::string(
+              commandid_to_string(static_cast<CommandID>(resp.command_id))
+              + std::string(" ")
+              + std::to_string(resp.device_status)
+              + std::string(" ")
+              + std::to_string(resp.storage_status.device_status)
+//                          + std::to_string( status_translate_command(resp.storage_status.device_status))
+          ), Loglevel::DEBUG_L1);
+
+      if (binary_log.is_open()) {
+        handlers.log_response(dev, BinaryLogEvent::RESPONSE, resp,
+                            sending_retry_counter, receiving_retry_counter);
+      } else if (Log::instance().is_enabled(Loglevel::DEBUG)) {
+        LOG("Incoming HID packet:", Loglevel::DEBUG);
+        LOG(handlers.dissect_response(resp), Loglevel::DEBUG);
+      }
+      if (dev->get_retry_receiving_count() - receiving_retry_counter > 2) {
+        LOG(std::string("Packet received with receiving_retry_counter count: ") +
+            std::to_string(receiving_retry_counter),
+            Loglevel::DEBUG_L1);
+      }
+
+      if (resp.device_status == static_cast<uint8_t>(stick10::device_status::busy) &&
+          static_cast<stick20::device_status>(resp.storage_status.device_status)
+          == stick20::device_status::busy_progressbar){
+        dev->m_counters.busy_progressbar++;
+        LOG(std::string("Throw: Long operation in progress exception"), Loglevel::DEBUG_L1);
+        throw LongOperationInProgressException(
+            resp.command_id, resp.device_status, resp.storage_status.progress_bar_value);
+      }
+
+      if (!resp.isValid()) {
+        LOG(std::string("Throw: Invalid incoming packet"), Loglevel::DEBUG_L1);
+        throw InvalidCRCReceived("Invalid incoming packet");
+      }
+      if (receiving_retry_counter <= 0){
+        LOG(std::string("Throw: \"Maximum receiving_retry_counter count reached for receiving response from the device!\""
+        + std::to_string(receiving_retry_counter)), Loglevel::DEBUG_L1);
+        throw DeviceReceivingFailure(
+            "Maximum receiving_retry_counter count reached for receiving response from the device!");
+      }
+      dev->m_counters.communication_successful++;
+      NK_TRACE(decode, dev, resp.command_id, resp.last_command_status);
+      tracing.set_result(resp.last_command_status);
+
+      if (resp.last_command_status != static_cast<uint8_t>(stick10::command_status::ok)){
+        dev->m_counters.command_result_not_equal_0_recv++;
+        LOG(std::string("Throw: CommandFailedException ") + std::to_string(resp.last_command_status), Loglevel::DEBUG_L1);
+        throw CommandFailedException(resp.command_id, resp.last_command_status);
+      }
+
+      dev->m_counters.command_successful_recv++;
+
+      if (dev->get_device_model() == DeviceModel::STORAGE &&
+          command_info(resp.command_id).storage_status) {
+        dev->m_counters.successful_storage_commands++;
+      }
+
+      if (!resp.isCRCcorrect())
+        LOG(std::string("Accepting response from device with invalid CRC. ")
+             + "Command ID: " + std::to_string(resp.command_id) + " " +
+                 commandid_to_string(static_cast<CommandID>(resp.command_id)) + "  "
+             + "Reported and calculated: " + std::to_string(resp.crc) + "!=" + std::to_string(resp.calculate_CRC()),
+            Loglevel::WARNING
+        );
+
+      clean_resp.release();
+    }
+    }
+
+}
+}
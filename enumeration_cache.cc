@@ -0,0 +1,215 @@
+/*
+ * Copyright (c) 2015-2018 Nitrokey UG
+ *
+ * This file is part of libnitrokey.
+ *
+ * libnitrokey is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libnitrokey is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libnitrokey. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include "libnitrokey/enumeration_cache.h"
+#include "libnitrokey/log.h"
+
+#ifdef __linux__
+#include <linux/netlink.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+namespace nitrokey {
+namespace device {
+
+    using namespace nitrokey::log;
+    using std::chrono::steady_clock;
+
+    constexpr std::chrono::milliseconds EnumerationCache::DEFAULT_TTL;
+    constexpr std::chrono::milliseconds EnumerationCache::DEFAULT_HOTPLUG_TTL;
+
+    namespace {
+        bool same_devices(const std::vector<DeviceInfo> &a, const std::vector<DeviceInfo> &b) {
+          return a.size() == b.size()
+                 && std::equal(a.begin(), a.end(), b.begin(), [](const DeviceInfo &x, const DeviceInfo &y) {
+                   return x.m_deviceModel == y.m_deviceModel && x.m_path == y.m_path
+                          && x.m_serialNumber == y.m_serialNumber;
+                 });
+        }
+    }
+
+    EnumerationCache::EnumerationCache(Scanner scanner, std::chrono::milliseconds ttl, bool monitor_hotplug,
+                                       std::chrono::milliseconds hotplug_ttl)
+        : m_scanner(std::move(scanner)), m_scanned(false), m_generation(0), m_ttl(ttl), m_hotplug_ttl(hotplug_ttl),
+          m_outdated(true), m_stop(false), m_monitor_fd(-1) {
+      if (monitor_hotplug) {
+        start_monitor();
+      }
+    }
+
+    EnumerationCache::~EnumerationCache() {
+      m_stop = true;
+      if (m_monitor.joinable()) {
+        m_monitor.join();
+      }
+#ifdef __linux__
+      if (m_monitor_fd >= 0) {
+        close(m_monitor_fd);
+      }
+#endif
+    }
+
+    std::vector<DeviceInfo> EnumerationCache::devices() {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      refresh_if_outdated();
+      return m_devices;
+    }
+
+    misc::Option<DeviceInfo> EnumerationCache::find(const std::string &path) {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      const auto lookup = [this, &path]() -> misc::Option<DeviceInfo> {
+        for (const auto &d : m_devices) {
+          if (d.m_path == path) return d;
+        }
+        return {};
+      };
+
+      const bool refreshed = m_outdated || !m_scanned;
+      refresh_if_outdated();
+      auto res = lookup();
+      if (!res.has_value() && !refreshed) {
+        refresh();
+        res = lookup();
+      }
+      return res;
+    }
+
+    bool EnumerationCache::contains(DeviceModel model) {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      refresh_if_outdated();
+      return std::any_of(m_devices.begin(), m_devices.end(),
+                         [model](const DeviceInfo &d) { return d.m_deviceModel == model; });
+    }
+
+    void EnumerationCache::invalidate() {
+      m_outdated = true;
+    }
+
+    uint64_t EnumerationCache::generation() {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      refresh_if_outdated();
+      return m_generation;
+    }
+
+    uint64_t EnumerationCache::appeared_in(const std::string &path) {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      refresh_if_outdated();
+      const auto it = m_appeared_in.find(path);
+      return it != m_appeared_in.end() ? it->second : 0;
+    }
+
+    void EnumerationCache::set_ttl(std::chrono::milliseconds ttl) {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_ttl = ttl;
+    }
+
+    void EnumerationCache::set_hotplug_ttl(std::chrono::milliseconds ttl) {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_hotplug_ttl = ttl;
+    }
+
+    void EnumerationCache::refresh_if_outdated() {
+      // with hotplug events the list stays valid until an event arrives, the
+      // longer time-to-live covers a socket to which no events are delivered
+      const auto ttl = is_hotplug_monitored() ? m_hotplug_ttl : m_ttl;
+      const bool expired = steady_clock::now() - m_scan_time >= ttl;
+      if (!m_scanned || m_outdated || expired) {
+        refresh();
+      }
+    }
+
+    void EnumerationCache::refresh() {
+      // clear the flag first, so an event arriving during the scan is not lost
+      m_outdated = false;
+      auto devices = m_scanner();
+      if (!m_scanned || !same_devices(devices, m_devices)) {
+        m_generation++;
+        LOG("Device list changed, generation " + std::to_string(m_generation), Loglevel::DEBUG_L2);
+      }
+      std::unordered_map<std::string, uint64_t> appeared_in;
+      for (const auto &d : devices) {
+        const auto it = m_appeared_in.find(d.m_path);
+        appeared_in[d.m_path] = it != m_appeared_in.end() ? it->second : m_generation;
+      }
+      m_appeared_in = std::move(appeared_in);
+      m_devices = std::move(devices);
+      m_scanned = true;
+      m_scan_time = steady_clock::now();
+    }
+
+    void EnumerationCache::start_monitor() {
+#ifdef __linux__
+      int fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, NETLINK_KOBJECT_UEVENT);
+      if (fd < 0) {
+        LOG("Hotplug monitoring not available, falling back to periodic scans", Loglevel::DEBUG_L1);
+        return;
+      }
+      sockaddr_nl addr;
+      memset(&addr, 0, sizeof(addr));
+      addr.nl_family = AF_NETLINK;
+      addr.nl_groups = 1; // kernel events
+      if (bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0) {
+        LOG("Hotplug monitoring not available, falling back to periodic scans", Loglevel::DEBUG_L1);
+        close(fd);
+        return;
+      }
+      m_monitor_fd = fd;
+      m_monitor = std::thread(&EnumerationCache::monitor_loop, this);
+#endif
+    }
+
+    void EnumerationCache::monitor_loop() {
+#ifdef __linux__
+      char buf[4096];
+      pollfd pfd = {m_monitor_fd, POLLIN, 0};
+      while (!m_stop) {
+        // wake up periodically to notice the stop request
+        const auto ready = poll(&pfd, 1, 200);
+        if (ready <= 0) continue;
+
+        while (true) {
+          const auto len = recv(m_monitor_fd, buf, sizeof(buf) - 1, 0);
+          if (len < 0) {
+            // on ENOBUFS events were lost, assume the worst
+            if (errno != EAGAIN && errno != EWOULDBLOCK) m_outdated = true;
+            break;
+          }
+          buf[len] = 0;
+          if (strncmp(buf, "add@", 4) != 0 && strncmp(buf, "remove@", 7) != 0) continue;
+          // message is "action@devpath" followed by NUL separated KEY=value pairs
+          for (size_t i = 0; i < static_cast<size_t>(len); i += strlen(buf + i) + 1) {
+            if (strcmp(buf + i, "SUBSYSTEM=hidraw") == 0 || strcmp(buf + i, "SUBSYSTEM=usb") == 0) {
+              m_outdated = true;
+              break;
+            }
+          }
+        }
+      }
+#endif
+    }
+
+}
+}
@@ -0,0 +1,199 @@
+/*
+ * Copyright (c) 2015-2018 Nitrokey UG
+ *
+ * This file is part of libnitrokey.
+ *
+ * libnitrokey is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libnitrokey is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libnitrokey. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <thread>
+#include "libnitrokey/fleet.h"
+#include "libnitrokey/NitrokeyManager.h"
+#include "libnitrokey/CommandFailedException.h"
+#include "libnitrokey/LibraryException.h"
+#include "libnitrokey/LongOperationInProgressException.h"
+
+namespace nitrokey {
+namespace fleet {
+
+    using namespace nitrokey::device;
+    using std::chrono::steady_clock;
+
+    bool DeviceFilter::matches(const DeviceInfo &info) const {
+      if (!models.empty() && std::find(models.begin(), models.end(), info.m_deviceModel) == models.end())
+        return false;
+      if (!serial_numbers.empty()
+          && std::find(serial_numbers.begin(), serial_numbers.end(), info.m_serialNumber) == serial_numbers.end())
+        return false;
+      return true;
+    }
+
+    namespace {
+        /** cancellation flag of the run the current worker thread belongs to */
+        thread_local const std::atomic_bool *current_cancellation = nullptr;
+    }
+
+    bool cancellation_requested() {
+      return current_cancellation != nullptr && current_cancellation->load();
+    }
+
+    std::vector<DeviceInfo> select_devices(const DeviceFilter &filter) {
+      auto devices = Device::enumerate();
+      devices.erase(std::remove_if(devices.begin(), devices.end(),
+                                   [&filter](const DeviceInfo &i) { return !filter.matches(i); }),
+                    devices.end());
+      return devices;
+    }
+
+namespace detail {
+
+    namespace {
+        /**
+         * State shared between the caller and the workers. Owned by both, as
+         * the workers still running after the deadline are detached.
+         */
+        struct SharedState {
+            std::mutex mutex;
+            std::condition_variable finished_cv;
+            std::vector<DeviceInfo> devices;
+            std::vector<TaskOutcome> outcomes;
+            std::vector<bool> finished;
+            Task task;
+            Connector connect;
+            size_t next = 0;
+            size_t finished_count = 0;
+            /** results were collected by the caller, further updates are ignored */
+            bool collected = false;
+            /** set when the deadline passes, see cancellation_requested() */
+            std::atomic_bool cancelled{false};
+        };
+
+        std::string run_on_device(SharedState &state, size_t index) {
+          const auto &info = state.devices[index];
+          std::shared_ptr<Device> d;
+          if (state.connect) {
+            d = state.connect(info);
+            if (!d) return "could not connect";
+          } else {
+            d = Device::create(info.m_deviceModel);
+            if (!d) return "unsupported device model";
+            d->set_path(info.m_path);
+            if (!d->connect()) return "could not connect";
+          }
+
+          NitrokeyManager manager;
+          manager.connect_with_device(d);
+          try {
+            state.task(index, manager);
+          } catch (LongOperationInProgressException &e) {
+            return "long operation in progress";
+          } catch (CommandFailedException &e) {
+            return "command failed with status " + std::to_string(e.last_command_status);
+          } catch (DeviceCommunicationException &e) {
+            return e.what();
+          } catch (LibraryException &e) {
+            return "library error " + std::to_string(e.exception_id());
+          } catch (std::exception &e) {
+            return e.what();
+          }
+          return "";
+        }
+
+        void worker(std::shared_ptr<SharedState> state) {
+          current_cancellation = &state->cancelled;
+          while (true) {
+            size_t index;
+            {
+              std::lock_guard<std::mutex> lock(state->mutex);
+              if (state->collected || state->next >= state->devices.size()) break;
+              index = state->next++;
+            }
+
+            const auto start = steady_clock::now();
+            const auto error = run_on_device(*state, index);
+            const auto duration = std::chrono::duration_cast<std::chrono::microseconds>(steady_clock::now() - start);
+
+            std::lock_guard<std::mutex> lock(state->mutex);
+            if (state->collected) break;
+            auto &outcome = state->outcomes[index];
+            outcome.success = error.empty();
+            outcome.error = error;
+            outcome.duration = duration;
+            state->finished[index] = true;
+            state->finished_count++;
+            state->finished_cv.notify_all();
+          }
+          current_cancellation = nullptr;
+        }
+    }
+
+    std::vector<TaskOutcome> run_tasks(const std::vector<DeviceInfo> &devices, Task task,
+                                       const FleetOptions &options, Connector connect) {
+      if (devices.empty()) return {};
+
+      const auto state = std::make_shared<SharedState>();
+      state->devices = devices;
+      state->outcomes.resize(devices.size());
+      state->finished.resize(devices.size(), false);
+      state->task = std::move(task);
+      state->connect = std::move(connect);
+
+      const auto start = steady_clock::now();
+      const auto worker_count = std::max<size_t>(1, std::min(options.max_workers, devices.size()));
+      std::vector<std::thread> workers;
+      workers.reserve(worker_count);
+      for (size_t i = 0; i < worker_count; i++) {
+        workers.emplace_back(worker, state);
+      }
+
+      std::unique_lock<std::mutex> lock(state->mutex);
+      const auto all_finished = [&state] { return state->finished_count == state->devices.size(); };
+      bool completed = true;
+      if (options.deadline.count() > 0) {
+        completed = state->finished_cv.wait_until(lock, start + options.deadline, all_finished);
+      } else {
+        state->finished_cv.wait(lock, all_finished);
+      }
+
+      state->collected = true;
+      if (!completed) state->cancelled = true;
+      auto outcomes = state->outcomes;
+      if (!completed) {
+        const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(steady_clock::now() - start);
+        for (size_t i = 0; i < outcomes.size(); i++) {
+          if (state->finished[i]) continue;
+          outcomes[i].timed_out = true;
+          outcomes[i].error = "deadline exceeded";
+          outcomes[i].duration = elapsed;
+        }
+      }
+      lock.unlock();
+
+      // the idle workers exit right away, the ones still running an
+      // operation after the deadline finish it in the background
+      for (auto &w : workers) {
+        if (completed) w.join();
+        else w.detach();
+      }
+      return outcomes;
+    }
+
+}
+}
+}
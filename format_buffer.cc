@@ -0,0 +1,175 @@
+/*
+ * Copyright (c) 2015-2018 Nitrokey UG
+ *
+ * This file is part of libnitrokey.
+ *
+ * libnitrokey is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libnitrokey is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libnitrokey. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0
+ */
+
+#include <cctype>
+#include <cstring>
+#include "libnitrokey/format_buffer.h"
+
+namespace nitrokey {
+namespace misc {
+
+    const size_t FormatBuffer::CAPACITY;
+
+    namespace {
+        const char HEX_DIGITS[] = "0123456789abcdef";
+        const char TRUNCATION_MARK[] = "...";
+
+        // two characters per byte
+        struct HexTable {
+            char pairs[512];
+            HexTable() {
+              for (int i = 0; i < 256; i++) {
+                pairs[2 * i] = HEX_DIGITS[i >> 4];
+                pairs[2 * i + 1] = HEX_DIGITS[i & 0xF];
+              }
+            }
+        };
+        const HexTable hex_table;
+
+        /** @return number of characters written to the end of out, at most 16 */
+        size_t format_hex(char (&out)[16], uint64_t value, int width) {
+          size_t n = 0;
+          do {
+            out[sizeof out - ++n] = HEX_DIGITS[value & 0xF];
+            value >>= 4;
+          } while (value != 0 && n < sizeof out);
+          while (n < static_cast<size_t>(width) && n < sizeof out) out[sizeof out - ++n] = '0';
+          return n;
+        }
+
+        void format_bits(char (&out)[8], uint8_t value) {
+          for (int i = 0; i < 8; i++) out[i] = (value & (0x80 >> i)) ? '1' : '0';
+        }
+    }
+
+    size_t format_hexdump_line(char *out, const HexdumpView &view, size_t offset) {
+      char *p = out;
+      if (view.print_header) {
+        char digits[16];
+        const auto n = format_hex(digits, offset, 4);
+        memcpy(p, digits + sizeof digits - n, n);
+        p += n;
+        *p++ = '\t';
+      }
+      const auto end = offset + 16 < view.size ? offset + 16 : view.size;
+      for (size_t i = offset; i < offset + 16; i++) {
+        if (i < end) {
+          memcpy(p, hex_table.pairs + 2 * view.data[i], 2);
+          p[2] = ' ';
+          p += 3;
+        } else if (view.print_empty) {
+          memcpy(p, "-- ", 3);
+          p += 3;
+        }
+      }
+      if (view.print_ascii) {
+        *p++ = ' ';
+        *p++ = ' ';
+        for (size_t i = offset; i < end; i++) {
+          *p++ = std::isgraph(view.data[i]) ? static_cast<char>(view.data[i]) : '.';
+        }
+      }
+      *p++ = '\n';
+      return static_cast<size_t>(p - out);
+    }
+
+    FormatBuffer &FormatBuffer::append(const char *s, size_t size) {
+      // keep space for the truncation mark
+      const auto available = CAPACITY - sizeof TRUNCATION_MARK - m_size;
+      if (size > available) {
+        size = available;
+        m_truncated = true;
+      }
+      memcpy(m_data + m_size, s, size);
+      m_size += size;
+      return *this;
+    }
+
+    FormatBuffer &FormatBuffer::operator<<(const char *s) {
+      return append(s, strlen(s));
+    }
+
+    FormatBuffer &FormatBuffer::append_decimal(uint64_t value) {
+      char digits[20];
+      size_t n = 0;
+      do {
+        digits[sizeof digits - ++n] = static_cast<char>('0' + value % 10);
+        value /= 10;
+      } while (value != 0);
+      return append(digits + sizeof digits - n, n);
+    }
+
+    FormatBuffer &FormatBuffer::append_decimal(int64_t value) {
+      if (value >= 0) return append_decimal(static_cast<uint64_t>(value));
+      *this << '-';
+      return append_decimal(static_cast<uint64_t>(0) - static_cast<uint64_t>(value));
+    }
+
+    FormatBuffer &FormatBuffer::operator<<(HexValue v) {
+      char digits[16];
+      const auto n = format_hex(digits, v.value, v.width);
+      return append(digits + sizeof digits - n, n);
+    }
+
+    FormatBuffer &FormatBuffer::operator<<(BitsValue v) {
+      char digits[8];
+      format_bits(digits, v.value);
+      return append(digits, sizeof digits);
+    }
+
+    FormatBuffer &FormatBuffer::operator<<(const HexdumpView &v) {
+      char line[HEXDUMP_LINE_MAX];
+      for (size_t offset = 0; offset < v.size && !m_truncated; offset += 16) {
+        append(line, format_hexdump_line(line, v, offset));
+      }
+      return *this;
+    }
+
+    std::string FormatBuffer::str() const {
+      std::string res;
+      res.reserve(m_size + (m_truncated ? sizeof TRUNCATION_MARK : 0));
+      res.append(m_data, m_size);
+      if (m_truncated) res.append(TRUNCATION_MARK);
+      return res;
+    }
+
+    std::ostream &operator<<(std::ostream &out, HexValue v) {
+      char digits[16];
+      const auto n = format_hex(digits, v.value, v.width);
+      return out.write(digits + sizeof digits - n, static_cast<std::streamsize>(n));
+    }
+
+    std::ostream &operator<<(std::ostream &out, BitsValue v) {
+      char digits[8];
+      format_bits(digits, v.value);
+      return out.write(digits, sizeof digits);
+    }
+
+    std::ostream &operator<<(std::ostream &out, const HexdumpView &v) {
+      char line[HEXDUMP_LINE_MAX];
+      for (size_t offset = 0; offset < v.size; offset += 16) {
+        out.write(line, static_cast<std::streamsize>(format_hexdump_line(line, v, offset)));
+      }
+      return out;
+    }
+
+}
+}
@@ -0,0 +1,182 @@
+/*
+ * Copyright (c) 2015-2018 Nitrokey UG
+ *
+ * This file is part of libnitrokey.
+ *
+ * libnitrokey is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libnitrokey is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libnitrokey. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0
+ */
+
+#include <algorithm>
+#include <limits>
+#include "libnitrokey/latency_stats.h"
+
+namespace nitrokey {
+namespace device {
+
+    using std::chrono::steady_clock;
+
+    const int LatencyHistogram::SUB_BUCKET_BITS;
+    const int LatencyHistogram::SUB_BUCKETS;
+    const int LatencyHistogram::MAX_EXPONENT;
+    const int LatencyHistogram::BUCKET_COUNT;
+
+    namespace {
+        const auto relaxed = std::memory_order_relaxed;
+
+        int highest_bit(uint64_t value) {
+          int bit = 0;
+          while (value >>= 1) bit++;
+          return bit;
+        }
+    }
+
+    uint64_t HistogramSnapshot::percentile(double percentile) const {
+      if (count == 0) return 0;
+      auto rank = static_cast<uint64_t>(percentile / 100.0 * count + 0.5);
+      if (rank == 0) rank = 1;
+      uint64_t seen = 0;
+      for (const auto &b : buckets) {
+        seen += b.count;
+        if (seen >= rank) return std::min(b.upper_bound_us, max_us);
+      }
+      return max_us;
+    }
+
+    LatencyHistogram::LatencyHistogram() {
+      reset();
+    }
+
+    int LatencyHistogram::bucket_index(uint64_t value_us) {
+      if (value_us < SUB_BUCKETS) return static_cast<int>(value_us);
+      auto exponent = highest_bit(value_us);
+      if (exponent > MAX_EXPONENT) return BUCKET_COUNT - 1;
+      const auto sub_bucket = (value_us >> (exponent - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1);
+      return (exponent - SUB_BUCKET_BITS + 1) * SUB_BUCKETS + static_cast<int>(sub_bucket);
+    }
+
+    uint64_t LatencyHistogram::bucket_upper_bound(int index) {
+      if (index < SUB_BUCKETS) return static_cast<uint64_t>(index);
+      const int exponent = index / SUB_BUCKETS + SUB_BUCKET_BITS - 1;
+      const uint64_t sub_bucket = index % SUB_BUCKETS;
+      const int shift = exponent - SUB_BUCKET_BITS;
+      return ((SUB_BUCKETS + sub_bucket + 1) << shift) - 1;
+    }
+
+    void LatencyHistogram::record(uint64_t value_us) {
+      m_buckets[bucket_index(value_us)].fetch_add(1, relaxed);
+      m_sum.fetch_add(value_us, relaxed);
+
+      auto current = m_min.load(relaxed);
+      while (value_us < current && !m_min.compare_exchange_weak(current, value_us, relaxed)) {}
+      current = m_max.load(relaxed);
+      while (value_us > current && !m_max.compare_exchange_weak(current, value_us, relaxed)) {}
+    }
+
+    HistogramSnapshot LatencyHistogram::snapshot() const {
+      HistogramSnapshot s;
+      for (int i = 0; i < BUCKET_COUNT; i++) {
+        const auto count = m_buckets[i].load(relaxed);
+        if (count == 0) continue;
+        s.buckets.push_back({bucket_upper_bound(i), count});
+        s.count += count;
+      }
+      // count is summed from the buckets, so it is consistent with them
+      // even when recording runs in parallel
+      s.sum_us = m_sum.load(relaxed);
+      s.min_us = s.count != 0 ? m_min.load(relaxed) : 0;
+      s.max_us = m_max.load(relaxed);
+      return s;
+    }
+
+    void LatencyHistogram::reset() {
+      for (auto &b : m_buckets) b.store(0, relaxed);
+      m_sum.store(0, relaxed);
+      m_min.store(std::numeric_limits<uint64_t>::max(), relaxed);
+      m_max.store(0, relaxed);
+    }
+
+    LatencyStats::CommandStats::CommandStats() : count(0), polls(0), busy(0) {}
+
+    LatencyStats::LatencyStats() {
+      for (auto &c : m_commands) c.store(nullptr);
+    }
+
+    LatencyStats::~LatencyStats() {
+      for (auto &c : m_commands) delete c.load();
+    }
+
+    LatencyStats::CommandStats &LatencyStats::for_command(uint8_t command_id) {
+      auto &slot = m_commands[command_id];
+      auto stats = slot.load(std::memory_order_acquire);
+      if (stats != nullptr) return *stats;
+
+      auto created = new CommandStats();
+      if (slot.compare_exchange_strong(stats, created, std::memory_order_acq_rel)) return *created;
+      // created concurrently by another thread
+      delete created;
+      return *stats;
+    }
+
+    std::vector<CommandLatencySnapshot> LatencyStats::snapshot() const {
+      std::vector<CommandLatencySnapshot> res;
+      for (int i = 0; i < 256; i++) {
+        const auto stats = m_commands[i].load(std::memory_order_acquire);
+        if (stats == nullptr || stats->count.load(relaxed) == 0) continue;
+        CommandLatencySnapshot s;
+        s.command_id = static_cast<uint8_t>(i);
+        s.count = stats->count.load(relaxed);
+        s.polls = stats->polls.load(relaxed);
+        s.busy = stats->busy.load(relaxed);
+        s.total = stats->total.snapshot();
+        s.first_response = stats->first_response.snapshot();
+        res.push_back(std::move(s));
+      }
+      return res;
+    }
+
+    void LatencyStats::reset() {
+      // entries are kept allocated, as recording may hold references to them
+      for (auto &c : m_commands) {
+        const auto stats = c.load(std::memory_order_acquire);
+        if (stats == nullptr) continue;
+        stats->count.store(0, relaxed);
+        stats->polls.store(0, relaxed);
+        stats->busy.store(0, relaxed);
+        stats->total.reset();
+        stats->first_response.reset();
+      }
+    }
+
+    TransactionTimer::TransactionTimer(LatencyStats &stats, uint8_t command_id)
+        : m_stats(stats.for_command(command_id)), m_start(steady_clock::now()), m_responded(false) {}
+
+    TransactionTimer::~TransactionTimer() {
+      const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(steady_clock::now() - m_start);
+      m_stats.count.fetch_add(1, relaxed);
+      m_stats.total.record(static_cast<uint64_t>(elapsed.count()));
+    }
+
+    void TransactionTimer::poll(PollResult result) {
+      m_stats.polls.fetch_add(1, relaxed);
+      if (result == PollResult::BUSY) m_stats.busy.fetch_add(1, relaxed);
+      if (result != PollResult::READY || m_responded) return;
+      m_responded = true;
+      const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(steady_clock::now() - m_start);
+      m_stats.first_response.record(static_cast<uint64_t>(elapsed.count()));
+    }
+
+}
+}
@@ -24,6 +24,9 @@ HEADERS = \
    $$PWD/libnitrokey/cxx_semantics.h \
    $$PWD/libnitrokey/device.h \
    $$PWD/libnitrokey/device_proto.h \
+   $$PWD/libnitrokey/command_registry.h \
+   $$PWD/libnitrokey/report_pool.h \
+   $$PWD/libnitrokey/secure_arena.h \
    $$PWD/libnitrokey/DeviceCommunicationExceptions.h \
    $$PWD/libnitrokey/dissect.h \
    $$PWD/libnitrokey/LibraryException.h \
@@ -32,9 +35,21 @@ HEADERS = \
    $$PWD/libnitrokey/LongOperationInProgressException.h \
    $$PWD/libnitrokey/misc.h \
    $$PWD/libnitrokey/NitrokeyManager.h \
+   $$PWD/libnitrokey/slot_sync.h \
+   $$PWD/libnitrokey/provisioning.h \
+   $$PWD/libnitrokey/fleet.h \
+   $$PWD/libnitrokey/enumeration_cache.h \
+   $$PWD/libnitrokey/connection_pool.h \
+   $$PWD/libnitrokey/latency_stats.h \
+   $$PWD/libnitrokey/trace.h \
+   $$PWD/libnitrokey/timeline.h \
+   $$PWD/libnitrokey/metrics.h \
+   $$PWD/libnitrokey/binary_log.h \
+   $$PWD/libnitrokey/format_buffer.h \
    $$PWD/libnitrokey/stick10_commands.h \
    $$PWD/libnitrokey/stick10_commands_0.8.h \
    $$PWD/libnitrokey/stick20_commands.h \
+   $$PWD/trace_probes.h \
    $$PWD/NK_C_API.h
 
 
@@ -46,6 +61,20 @@ SOURCES = \
    $$PWD/version.cc \
    $$PWD/misc.cc \
    $$PWD/NitrokeyManager.cc \
+   $$PWD/slot_sync.cc \
+   $$PWD/provisioning.cc \
+   $$PWD/fleet.cc \
+   $$PWD/enumeration_cache.cc \
+   $$PWD/connection_pool.cc \
+   $$PWD/latency_stats.cc \
+   $$PWD/trace.cc \
+   $$PWD/timeline.cc \
+   $$PWD/metrics.cc \
+   $$PWD/binary_log.cc \
+   $$PWD/format_buffer.cc \
+   $$PWD/device_proto.cc \
+   $$PWD/report_pool.cc \
+   $$PWD/secure_arena.cc \
    $$PWD/NK_C_API.cc
 
 
@@ -80,6 +109,7 @@ INCLUDEPATH = \
     $$PWD/libnitrokey \
     $$PWD/libnitrokey/hidapi \
     $$PWD/unittest \
+    $$PWD/testing \
     $$PWD/unittest/Catch/single_include
 
 unix:!macx{
@@ -22,9 +22,9 @@
 #ifndef LIBNITROKEY_LIBRARYEXCEPTION_H
 #define LIBNITROKEY_LIBRARYEXCEPTION_H
 
-#include <mutex>
 #include <exception>
 #include <cstdint>
+#include <cstdio>
 #include <string>
 #include "log.h"
 
@@ -33,12 +33,7 @@ public:
     virtual uint8_t exception_id()= 0;
 };
 
-// Use static string object for keeping the c_str message for the caller.
-// Strings collection used as an alternative to memory leaks done via strdup().
 // TargetBufferSmallerThanSource Exception should never happen in a correctly written library client.
-static std::vector<std::string> g_exception_messages;
-static std::mutex g_exception_message_mutex;
-
 class TargetBufferSmallerThanSource: public LibraryException {
 public:
     virtual uint8_t exception_id() override {
@@ -51,17 +46,19 @@ public:
 
     TargetBufferSmallerThanSource(
             size_t source_size_, size_t target_size_
-            ) : source_size(source_size_),  target_size(target_size_) {}
+            ) : source_size(source_size_),  target_size(target_size_) {
+      // formatted once into the exception itself, so what() neither allocates nor locks
+      snprintf(message, sizeof message,
+               "Target buffer size is smaller than source: [source size, buffer size] %zu %zu",
+               source_size, target_size);
+    }
 
     virtual const char *what() const noexcept override {
-        std::lock_guard<std::mutex> lock(g_exception_message_mutex);
-        std::string s = " ";
-        auto ts = [](size_t x){ return std::to_string(x); };
-        g_exception_messages.emplace_back(std::string("Target buffer size is smaller than source: [source size, buffer size]")
-                              + s + ts(source_size) + s + ts(target_size));
-        return g_exception_messages.back().c_str();
+        return message;
     }
 
+private:
+    char message[128];
 };
 
 class InvalidHexString : public LibraryException {
@@ -81,6 +78,23 @@ public:
 
 };
 
+class InvalidBase32String : public LibraryException {
+public:
+    virtual uint8_t exception_id() override {
+        return 204;
+    }
+
+public:
+    uint8_t invalid_char;
+
+    InvalidBase32String (uint8_t invalid_char_) : invalid_char(invalid_char_) {}
+
+    virtual const char *what() const noexcept override {
+        return "Invalid character in base32 string";
+    }
+
+};
+
 class InvalidSlotException : public LibraryException {
 public:
     virtual uint8_t exception_id() override {
@@ -123,4 +137,24 @@ public:
 
 };
 
+class InvalidOTPSourceEntry : public LibraryException {
+public:
+    virtual uint8_t exception_id() override {
+        return 205;
+    }
+
+public:
+    std::size_t line;
+    const char *reason;
+
+    InvalidOTPSourceEntry(size_t line_, const char *reason_) : line(line_), reason(reason_) {
+      LOG(std::string("InvalidOTPSourceEntry, line ") + std::to_string(line) + ": " + reason, nitrokey::log::Loglevel::DEBUG);
+    }
+
+    virtual const char *what() const noexcept override {
+        return reason;
+    }
+
+};
+
 #endif //LIBNITROKEY_LIBRARYEXCEPTION_H
@@ -23,6 +23,8 @@
 #define LIBNITROKEY_NITROKEYMANAGER_H
 
 #include "device.h"
+#include "connection_pool.h"
+#include "timeline.h"
 #include "log.h"
 #include "device_proto.h"
 #include "stick10_commands.h"
@@ -45,6 +47,92 @@ namespace nitrokey {
 char * strndup(const char* str, size_t maxlen);
 #endif
 
+    /**
+     * Contents of a single Password Safe slot, as used by the bulk
+     * NitrokeyManager::read_password_safe and write_password_safe operations.
+     * Fields are null-terminated C strings.
+     */
+    struct PasswordSafeEntry {
+        uint8_t slot_number;
+        char name[PWS_SLOTNAME_LENGTH + 1];
+        char login[PWS_LOGINNAME_LENGTH + 1];
+        char password[PWS_PASSWORD_LENGTH + 1];
+    };
+
+    /**
+     * Fixed capacity collection of Password Safe slots. The storage comes from
+     * misc::SecureArena, is never reallocated and is wiped on destruction, so
+     * no stray copies of the passwords are left behind on the heap.
+     */
+    class PasswordSafeEntries {
+    public:
+        PasswordSafeEntries();
+        PasswordSafeEntries(const PasswordSafeEntries &other);
+        PasswordSafeEntries &operator=(const PasswordSafeEntries &other);
+        ~PasswordSafeEntries();
+
+        /**
+         * Adds slot data to the collection.
+         * Throws InvalidSlotException on invalid or repeated slot number and
+         * TooLongStringException when any of the fields does not fit the slot.
+         */
+        void add(uint8_t slot_number, const char *name, const char *login, const char *password);
+        void clear();
+
+        size_t size() const { return m_count; }
+        bool empty() const { return m_count == 0; }
+        const PasswordSafeEntry &operator[](size_t i) const { return m_entries[i]; }
+        const PasswordSafeEntry *begin() const { return m_entries; }
+        const PasswordSafeEntry *end() const { return m_entries + m_count; }
+
+    private:
+        friend class NitrokeyManager;
+        PasswordSafeEntry &append(uint8_t slot_number);
+
+        static const size_t STORAGE_SIZE = sizeof(PasswordSafeEntry) * PWS_SLOT_COUNT;
+        PasswordSafeEntry *m_entries;
+        size_t m_count;
+    };
+
+    /**
+     * Pointer to the current device, read and replaced atomically. Commands
+     * read it without the manager lock, so one running during a concurrent
+     * disconnect or device change works with either device, and fails with
+     * DeviceNotConnected instead of dereferencing a released pointer.
+     */
+    class AtomicDevicePtr {
+    public:
+        AtomicDevicePtr(std::shared_ptr<Device> device = nullptr) : m_device(std::move(device)) {}
+        AtomicDevicePtr(const AtomicDevicePtr &) = delete;
+        AtomicDevicePtr &operator=(const AtomicDevicePtr &) = delete;
+
+        AtomicDevicePtr &operator=(std::shared_ptr<Device> device) {
+          std::atomic_store(&m_device, std::move(device));
+          return *this;
+        }
+        std::shared_ptr<Device> load() const { return std::atomic_load(&m_device); }
+        operator std::shared_ptr<Device>() const { return load(); }
+        explicit operator bool() const { return load() != nullptr; }
+
+        /**
+         * Keeps the device alive until the end of the full expression.
+         */
+        std::shared_ptr<Device> operator->() const {
+          auto device = load();
+          if (device == nullptr) throw DeviceNotConnected("Device not initialized");
+          return device;
+        }
+
+        friend bool operator==(const AtomicDevicePtr &a, std::nullptr_t) { return a.load() == nullptr; }
+        friend bool operator!=(const AtomicDevicePtr &a, std::nullptr_t) { return a.load() != nullptr; }
+        friend bool operator==(const AtomicDevicePtr &a, const std::shared_ptr<Device> &b) { return a.load() == b; }
+        friend bool operator==(const std::shared_ptr<Device> &a, const AtomicDevicePtr &b) { return a == b.load(); }
+        friend bool operator!=(const AtomicDevicePtr &a, const std::shared_ptr<Device> &b) { return a.load() != b; }
+
+    private:
+        std::shared_ptr<Device> m_device;
+    };
+
     class NitrokeyManager {
     public:
         static shared_ptr <NitrokeyManager> instance();
@@ -56,6 +144,16 @@ char * strndup(const char* str, size_t maxlen);
         bool write_TOTP_slot(uint8_t slot_number, const char *slot_name, const char *secret, uint16_t time_window,
                                      bool use_8_digits, bool use_enter, bool use_tokenID, const char *token_ID,
                                      const char *temporary_password);
+        /**
+         * Variants of write_HOTP_slot and write_TOTP_slot taking already decoded, binary secret.
+         * Secret longer than supported by the device (20 or 40 bytes) causes TargetBufferSmallerThanSource.
+         */
+        bool write_HOTP_slot(uint8_t slot_number, const char *slot_name, const uint8_t *secret, size_t secret_size,
+                             uint64_t hotp_counter, bool use_8_digits, bool use_enter, bool use_tokenID,
+                             const char *token_ID, const char *temporary_password);
+        bool write_TOTP_slot(uint8_t slot_number, const char *slot_name, const uint8_t *secret, size_t secret_size,
+                             uint16_t time_window, bool use_8_digits, bool use_enter, bool use_tokenID,
+                             const char *token_ID, const char *temporary_password);
         string get_HOTP_code(uint8_t slot_number, const char *user_temporary_password);
         string get_TOTP_code(uint8_t slot_number, uint64_t challenge, uint64_t last_totp_time,
                              uint8_t last_interval,
@@ -91,11 +189,49 @@ char * strndup(const char* str, size_t maxlen);
          */
         bool connect_with_ID(const std::string id);
         bool connect_with_path (std::string path);
+        /**
+         * Pool of the connections opened by connect_with_path, with its statistics.
+         */
+        ConnectionPool &get_connection_pool();
+        /**
+         * Uses the given, already connected device object for all further commands.
+         * Skips the enumeration done in connect_with_path, for when the caller
+         * has enumerated the devices itself.
+         * @param connected_device device object, connected by the caller
+         * @return false, when the device is null, true otherwise
+         */
+        bool connect_with_device(shared_ptr<Device> connected_device);
         bool connect(const char *device_model);
         bool connect(device::DeviceModel device_model);
         bool connect();
         bool disconnect();
+        /**
+         * Disconnects the active device and the devices registered with
+         * list_devices_by_cpuID(), then releases the HID library state.
+         * Disconnecting does not release it, so call this before unloading the library.
+         * The library is initialized again on the next connection attempt.
+         * Also disables asynchronous logging, which is not enabled again on reconnection.
+         * @return false, when devices connected outside of this manager keep the library in use
+         */
+        bool shutdown();
         bool is_connected() noexcept ;
+        /**
+         * Returns the transaction latency statistics of the connected device, per command.
+         * Does not communicate with the device, nor wait for the running transactions.
+         * @return empty list, when no device is connected
+         */
+        std::vector<CommandLatencySnapshot> get_command_latency();
+        void reset_command_latency();
+        /**
+         * Recorder of the device activity timeline, for all devices.
+         */
+        trace::TimelineRecorder &get_timeline_recorder();
+        /**
+         * Renders the counters and latency histograms of the open devices in the
+         * OpenMetrics text format. Does not communicate with the devices nor
+         * wait for their locks.
+         */
+        std::string metrics_text();
         bool could_current_device_be_enumerated();
       bool set_default_commands_delay(int delay);
 
@@ -131,6 +267,23 @@ char * strndup(const char* str, size_t maxlen);
 
         void erase_password_safe_slot(uint8_t slot_number);
 
+        /**
+         * Reads all programmed Password Safe slots selected by the mask in one
+         * go. Empty slots are skipped using the slot status bitmap, so only
+         * programmed slots are queried. The device is held for the whole operation.
+         * Password Safe has to be unlocked first (see enable_password_safe).
+         * @param slot_mask bit n selects slot n, all slots by default
+         * @return contents of the selected, programmed slots in slot order
+         */
+        PasswordSafeEntries read_password_safe(uint16_t slot_mask = 0xFFFF);
+
+        /**
+         * Writes all given Password Safe entries, holding the device for the
+         * whole operation. Password Safe has to be unlocked first.
+         * @param entries slots to write
+         */
+        void write_password_safe(const PasswordSafeEntries &entries);
+
         void user_authenticate(const char *user_password, const char *temporary_password);
 
         void factory_reset(const char *admin_password);
@@ -226,13 +379,16 @@ char * strndup(const char* str, size_t maxlen);
     private:
 
         static shared_ptr <NitrokeyManager> _instance;
-        std::shared_ptr<Device> device;
+        // serializes device changes and guards the connection caches
+        std::mutex mex_dev_com_manager;
+        AtomicDevicePtr device;
         std::string current_device_id;
     public:
         const string get_current_device_id() const;
 
     private:
-        std::unordered_map<std::string, shared_ptr<Device> > connected_devices;
+        ConnectionPool connection_pool;
+        trace::TimelineRecorder timeline_recorder;
         std::unordered_map<std::string, shared_ptr<Device> > connected_devices_byID;
 
 
@@ -248,16 +404,31 @@ char * strndup(const char* str, size_t maxlen);
         template <typename ProCommand, PasswordKind StoKind>
         void change_PIN_general(const char *current_PIN, const char *new_PIN);
 
-        void write_HOTP_slot_authorize(uint8_t slot_number, const char *slot_name, const char *secret, uint64_t hotp_counter,
+        /**
+         * Loads the device once, so that a manager call running several commands
+         * is not split between two devices by a concurrent connect.
+         * @throws DeviceNotConnected
+         */
+        shared_ptr<Device> current_device() const;
+        bool is_authorization_command_supported(const shared_ptr<Device> &dev);
+        uint8_t get_minor_firmware_version(const shared_ptr<Device> &dev);
+        bool set_unencrypted_volume_rorw_pin_type_user(const shared_ptr<Device> &dev);
+
+        void write_HOTP_slot_authorize(const shared_ptr<Device> &dev,
+                                   uint8_t slot_number, const char *slot_name, const uint8_t *secret,
+                                   size_t secret_size, uint64_t hotp_counter,
                                    bool use_8_digits, bool use_enter, bool use_tokenID, const char *token_ID,
                                    const char *temporary_password);
 
-        void write_TOTP_slot_authorize(uint8_t slot_number, const char *slot_name, const char *secret, uint16_t time_window,
+        void write_TOTP_slot_authorize(const shared_ptr<Device> &dev,
+                                   uint8_t slot_number, const char *slot_name, const uint8_t *secret,
+                                   size_t secret_size, uint16_t time_window,
                                    bool use_8_digits, bool use_enter, bool use_tokenID, const char *token_ID,
                                    const char *temporary_password);
 
-        void write_OTP_slot_no_authorize(uint8_t internal_slot_number, const char *slot_name, const char *secret,
-                                         uint64_t counter_or_interval,
+        void write_OTP_slot_no_authorize(const shared_ptr<Device> &dev,
+                                         uint8_t internal_slot_number, const char *slot_name, const uint8_t *secret,
+                                         size_t secret_size, uint64_t counter_or_interval,
                                          bool use_8_digits, bool use_enter, bool use_tokenID, const char *token_ID,
                                          const char *temporary_password) const;
       bool _disconnect_no_lock();
@@ -0,0 +1,197 @@
+/*
+ * Copyright (c) 2015-2018 Nitrokey UG
+ *
+ * This file is part of libnitrokey.
+ *
+ * libnitrokey is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libnitrokey is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libnitrokey. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0
+ */
+
+#ifndef LIBNITROKEY_BINARY_LOG_H
+#define LIBNITROKEY_BINARY_LOG_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace nitrokey {
+namespace device {
+    class Device;
+}
+
+namespace log {
+
+    enum class BinaryLogEvent : uint8_t {
+        /** device first seen, report: its path, device_status: its model */
+        DEVICE = 0,
+        /** command sent */
+        QUERY = 1,
+        /** response accepted */
+        RESPONSE = 2,
+        /** response read, but not ready or invalid, so read again */
+        RETRIED_RESPONSE = 3,
+    };
+
+#pragma pack (push,1)
+    struct BinaryLogHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t record_size;
+    };
+
+    /**
+     * Fixed size record of the binary log, in the host byte order.
+     */
+    struct BinaryLogRecord {
+        static const uint8_t FLAG_REPORT = 1;
+        /** secret fields of the report are zeroed */
+        static const uint8_t FLAG_MASKED = 2;
+
+        /** microseconds since the Unix epoch */
+        uint64_t timestamp_us;
+        /** numbered in the order of appearance, see BinaryLogEvent::DEVICE */
+        uint32_t device_id;
+        uint8_t command_id;
+        uint8_t event;
+        uint8_t device_status;
+        uint8_t command_status;
+        /** retry counters of the transaction, counting down as in the text log */
+        uint16_t sending_retries;
+        uint16_t receiving_retries;
+        uint8_t flags;
+        uint8_t reserved[10];
+        /** raw HID report */
+        uint8_t report[65];
+    };
+#pragma pack (pop)
+
+    static_assert(sizeof(BinaryLogRecord) == 96, "BinaryLogRecord size changed");
+
+    const char BINARY_LOG_MAGIC[8] = {'N', 'K', 'B', 'I', 'N', 'L', 'O', 'G'};
+    const uint32_t BINARY_LOG_VERSION = 1;
+
+    /**
+     * Collects the fields printed as volatile by the payload dissection,
+     * see print_to_ss_volatile.
+     */
+    class VolatileFieldCollector {
+    public:
+        VolatileFieldCollector(const void *object, size_t size);
+        ~VolatileFieldCollector();
+        VolatileFieldCollector(const VolatileFieldCollector &) = delete;
+        VolatileFieldCollector &operator=(const VolatileFieldCollector &) = delete;
+
+        void add(const void *field, size_t size);
+        /** offsets and sizes of the fields, relative to the object */
+        const std::vector<std::pair<size_t, size_t>> &fields() const { return m_fields; }
+
+    private:
+        const uint8_t *m_object;
+        size_t m_size;
+        std::vector<std::pair<size_t, size_t>> m_fields;
+    };
+
+    /**
+     * Offsets of the secret fields of the packet type, found once by running
+     * its payload dissection. A payload without any field in its dissection
+     * is masked whole, as its contents are unknown.
+     */
+    template <typename Packet>
+    const std::vector<std::pair<size_t, size_t>> &volatile_fields() {
+      static const auto fields = []() {
+        Packet packet;
+        memset(&packet, 0, sizeof packet);
+        VolatileFieldCollector collector(&packet, sizeof packet);
+        // each field is printed on its own line
+        const bool has_fields = packet.payload.dissect().find('\n') != std::string::npos;
+        auto result = collector.fields();
+        if (result.empty() && !has_fields && !std::is_empty<decltype(packet.payload)>::value) {
+          const auto offset = reinterpret_cast<const uint8_t *>(&packet.payload)
+                              - reinterpret_cast<const uint8_t *>(&packet);
+          result.emplace_back(static_cast<size_t>(offset), sizeof packet.payload);
+        }
+        return result;
+      }();
+      return fields;
+    }
+
+    /**
+     * Structured alternative to logging the packet dissections as text: writes
+     * each packet into a file as a fixed size record, with the secret fields
+     * masked. Decode with the nitrokey_binlog tool.
+     * While the log is open, packet dissections are not written to the text log.
+     */
+    class BinaryLog {
+    public:
+        static BinaryLog &instance();
+
+        /**
+         * Opens the log file, replacing its contents.
+         * @return false if the file could not be opened
+         */
+        bool open(const std::string &path);
+        void close();
+        bool is_open() const { return m_open.load(std::memory_order_relaxed); }
+
+        template <typename Packet>
+        void write_packet(const device::Device *device, BinaryLogEvent event, const Packet &packet,
+                          uint8_t device_status, uint8_t command_status,
+                          int sending_retries, int receiving_retries) {
+          static_assert(sizeof(Packet) <= sizeof(BinaryLogRecord::report), "packet does not fit the record");
+          BinaryLogRecord r;
+          memset(&r, 0, sizeof r);
+          r.command_id = static_cast<uint8_t>(packet.command_id);
+          r.event = static_cast<uint8_t>(event);
+          r.device_status = device_status;
+          r.command_status = command_status;
+          r.sending_retries = static_cast<uint16_t>(sending_retries < 0 ? 0 : sending_retries);
+          r.receiving_retries = static_cast<uint16_t>(receiving_retries < 0 ? 0 : receiving_retries);
+          r.flags = BinaryLogRecord::FLAG_REPORT;
+          memcpy(r.report, &packet, sizeof packet);
+          const auto &fields = volatile_fields<Packet>();
+          for (const auto &f : fields) memset(r.report + f.first, 0, f.second);
+          if (!fields.empty()) r.flags |= BinaryLogRecord::FLAG_MASKED;
+          write(device, r);
+        }
+
+        /**
+         * Writes the record, filling its device ID and timestamp.
+         */
+        void write(const device::Device *device, BinaryLogRecord &record);
+
+    private:
+        BinaryLog() = default;
+        /** call with m_mutex locked */
+        uint32_t device_id(const device::Device *device);
+
+        std::mutex m_mutex;
+        std::atomic_bool m_open{false};
+        FILE *m_file = nullptr;
+        /** log device IDs by Device::get_instance_id() */
+        std::unordered_map<uint64_t, uint32_t> m_devices;
+        uint32_t m_next_device_id = 0;
+    };
+
+}
+}
+
+#endif //LIBNITROKEY_BINARY_LOG_H
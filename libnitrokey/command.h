@@ -25,19 +25,33 @@
 #include "command_id.h"
 #include "cxx_semantics.h"
 
-#define print_to_ss(x) ( ss << " " << (#x) <<":\t" << (x) << std::endl );
-#define print_to_ss_int(x) ( ss << " " << (#x) <<":\t" << static_cast<int>(x) << std::endl );
+#define print_to_ss(x) ( ss << " " << (#x) <<":\t" << (x) << '\n' );
+#define print_to_ss_int(x) ( ss << " " << (#x) <<":\t" << static_cast<int>(x) << '\n' );
+// volatile fields are also masked in the binary log, see binary_log.h
 #ifdef LOG_VOLATILE_DATA
-#define print_to_ss_volatile(x) print_to_ss(x);
+#define print_to_ss_volatile(x) ( ::nitrokey::proto::mark_volatile_field(&(x), sizeof (x)) ); print_to_ss(x);
 #else
-#define print_to_ss_volatile(x) ( ss << " " << (#x) <<":\t" << "***********" << std::endl );
+#define print_to_ss_volatile(x) ( ::nitrokey::proto::mark_volatile_field(&(x), sizeof (x)), \
+                                  ss << " " << (#x) <<":\t" << "***********" << '\n' );
 #endif
 #define hexdump_to_ss(x) (ss << #x":\n"\
-                          << ::nitrokey::misc::hexdump(reinterpret_cast<const uint8_t *>(&x), sizeof x, false));
+                          << ::nitrokey::misc::hexdump_view(reinterpret_cast<const uint8_t *>(&x), sizeof x, false));
+// marks a secret field not printed through print_to_ss_volatile, see binary_log.h
+#define mark_volatile(x) ( ::nitrokey::proto::mark_volatile_field(&(x), sizeof (x)) );
+#ifdef LOG_VOLATILE_DATA
+#define hexdump_to_ss_volatile(x) mark_volatile(x) hexdump_to_ss(x)
+#else
+#define hexdump_to_ss_volatile(x) mark_volatile(x) (ss << #x":\t" << "***********" << '\n');
+#endif
 
 namespace nitrokey {
     namespace proto {
 
+        /**
+         * Reports a field printed as volatile by a payload dissection.
+         */
+        void mark_volatile_field(const void *field, size_t size);
+
         template<CommandID cmd_id>
         class Command : semantics::non_constructible {
         public:
@@ -65,7 +79,7 @@ namespace stick20{
                 uint8_t password[password_length];
 
                 std::string dissect() const {
-                  std::stringstream ss;
+                  ::nitrokey::misc::FormatBuffer ss;
                   print_to_ss( kind );
                   print_to_ss_volatile(password);
                   return ss.str();
@@ -0,0 +1,236 @@
+/*
+ * Copyright (c) 2015-2018 Nitrokey UG
+ *
+ * This file is part of libnitrokey.
+ *
+ * libnitrokey is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libnitrokey is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libnitrokey. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0
+ */
+
+#ifndef LIBNITROKEY_COMMAND_REGISTRY_H
+#define LIBNITROKEY_COMMAND_REGISTRY_H
+
+#include <stdint.h>
+#include "command_id.h"
+
+namespace nitrokey {
+namespace proto {
+
+    enum class CommandFamily : uint8_t {
+        /** OTP, password safe and PIN commands, handled by Pro, Librem Key and Storage */
+        COMMON,
+        /** handled by Storage only */
+        STORAGE
+    };
+
+    /** Credentials the command needs: a PIN in its payload or an earlier authentication. */
+    enum class CommandAuth : uint8_t {
+        NONE,
+        USER,
+        ADMIN
+    };
+
+    enum class LatencyClass : uint8_t {
+        /** answered right away */
+        FAST,
+        /** checks a PIN, writes the flash or uses the smart card, up to a few seconds */
+        SLOW,
+        /** runs in the background reporting progress, poll with GET_DEVICE_STATUS */
+        LONG
+    };
+
+    /** Range of firmware minor versions, inclusive. */
+    struct FirmwareRange {
+        uint8_t min = 0;
+        uint8_t max = 255;
+    };
+
+    struct CommandInfo {
+        CommandID id = CommandID::GET_STATUS;
+        const char *name = "UNKNOWN";
+        CommandFamily family = CommandFamily::COMMON;
+        /**
+         * Does not change the device state and its response depends on the state only,
+         * so the responses can be cached or parallel requests coalesced.
+         */
+        bool read_only = false;
+        CommandAuth auth = CommandAuth::NONE;
+        LatencyClass latency = LatencyClass::FAST;
+        /** firmware versions of Pro and Librem Key supporting the command */
+        FirmwareRange pro;
+        /** firmware versions of Storage supporting the command */
+        FirmwareRange storage;
+        /** false for the IDs not assigned to a command */
+        bool known = false;
+        /** the response reports the status in the Storage status block, see DeviceResponse */
+        bool storage_status = false;
+    };
+
+    namespace registry {
+        constexpr auto COMMON = CommandFamily::COMMON;
+        constexpr auto STORAGE = CommandFamily::STORAGE;
+        constexpr auto NONE = CommandAuth::NONE;
+        constexpr auto USER = CommandAuth::USER;
+        constexpr auto ADMIN = CommandAuth::ADMIN;
+        constexpr auto FAST = LatencyClass::FAST;
+        constexpr auto SLOW = LatencyClass::SLOW;
+        constexpr auto LONG = LatencyClass::LONG;
+        constexpr bool RO = true;
+        constexpr bool RW = false;
+        constexpr FirmwareRange ANY = {};
+
+        constexpr FirmwareRange since(uint8_t min) { return {min, 255}; }
+        constexpr FirmwareRange until(uint8_t max) { return {0, max}; }
+
+        /*
+         * All the commands, in the order of CommandID.
+         * Firmware ranges are minor versions: Pro v0.8 is 8, Storage v0.54 is 54.
+         */
+        constexpr CommandInfo commands[] = {
+            // id, name, family, read only, auth, latency, Pro firmware, Storage firmware
+            {CommandID::GET_STATUS, "GET_STATUS", COMMON, RO, NONE, FAST, ANY, ANY},
+            {CommandID::WRITE_TO_SLOT, "WRITE_TO_SLOT", COMMON, RW, ADMIN, SLOW, until(7), until(53)},
+            {CommandID::READ_SLOT_NAME, "READ_SLOT_NAME", COMMON, RO, NONE, FAST, ANY, ANY},
+            {CommandID::READ_SLOT, "READ_SLOT", COMMON, RO, NONE, FAST, ANY, ANY},
+            // HOTP increments the counter
+            {CommandID::GET_CODE, "GET_CODE", COMMON, RW, USER, SLOW, ANY, ANY},
+            {CommandID::WRITE_CONFIG, "WRITE_CONFIG", COMMON, RW, ADMIN, SLOW, ANY, ANY},
+            {CommandID::ERASE_SLOT, "ERASE_SLOT", COMMON, RW, ADMIN, SLOW, ANY, ANY},
+            {CommandID::FIRST_AUTHENTICATE, "FIRST_AUTHENTICATE", COMMON, RW, ADMIN, SLOW, ANY, ANY},
+            {CommandID::AUTHORIZE, "AUTHORIZE", COMMON, RW, ADMIN, FAST, until(7), until(53)},
+            {CommandID::GET_PASSWORD_RETRY_COUNT, "GET_PASSWORD_RETRY_COUNT", COMMON, RO, NONE, FAST, ANY, ANY},
+            {CommandID::CLEAR_WARNING, "CLEAR_WARNING", COMMON, RW, NONE, FAST, ANY, ANY},
+            {CommandID::SET_TIME, "SET_TIME", COMMON, RW, NONE, FAST, ANY, ANY},
+            {CommandID::TEST_COUNTER, "TEST_COUNTER", COMMON, RW, NONE, SLOW, ANY, ANY},
+            {CommandID::TEST_TIME, "TEST_TIME", COMMON, RW, NONE, SLOW, ANY, ANY},
+            {CommandID::USER_AUTHENTICATE, "USER_AUTHENTICATE", COMMON, RW, USER, SLOW, ANY, ANY},
+            {CommandID::GET_USER_PASSWORD_RETRY_COUNT, "GET_USER_PASSWORD_RETRY_COUNT", COMMON, RO, NONE, FAST, ANY, ANY},
+            {CommandID::USER_AUTHORIZE, "USER_AUTHORIZE", COMMON, RW, USER, FAST, until(7), until(53)},
+            {CommandID::UNLOCK_USER_PASSWORD, "UNLOCK_USER_PASSWORD", COMMON, RW, ADMIN, SLOW, ANY, ANY},
+            {CommandID::LOCK_DEVICE, "LOCK_DEVICE", COMMON, RW, NONE, FAST, ANY, ANY},
+            {CommandID::FACTORY_RESET, "FACTORY_RESET", COMMON, RW, ADMIN, LONG, ANY, ANY},
+            {CommandID::CHANGE_USER_PIN, "CHANGE_USER_PIN", COMMON, RW, USER, SLOW, ANY, ANY},
+            {CommandID::CHANGE_ADMIN_PIN, "CHANGE_ADMIN_PIN", COMMON, RW, ADMIN, SLOW, ANY, ANY},
+            {CommandID::WRITE_TO_SLOT_2, "WRITE_TO_SLOT_2", COMMON, RW, ADMIN, SLOW, since(8), since(54)},
+            {CommandID::SEND_OTP_DATA, "SEND_OTP_DATA", COMMON, RW, ADMIN, FAST, since(8), since(54)},
+            {CommandID::FIRMWARE_UPDATE, "FIRMWARE_UPDATE", COMMON, RW, ADMIN, LONG, ANY, ANY},
+            {CommandID::FIRMWARE_PASSWORD_CHANGE, "FIRMWARE_PASSWORD_CHANGE", COMMON, RW, ADMIN, SLOW, ANY, ANY},
+            // a new value each time
+            {CommandID::GET_RANDOM, "GET_RANDOM", COMMON, RW, NONE, FAST, ANY, ANY},
+
+            {CommandID::ENABLE_CRYPTED_PARI, "ENABLE_CRYPTED_PARI", STORAGE, RW, USER, SLOW, ANY, ANY},
+            {CommandID::DISABLE_CRYPTED_PARI, "DISABLE_CRYPTED_PARI", STORAGE, RW, NONE, SLOW, ANY, ANY},
+            {CommandID::ENABLE_HIDDEN_CRYPTED_PARI, "ENABLE_HIDDEN_CRYPTED_PARI", STORAGE, RW, USER, SLOW, ANY, ANY},
+            {CommandID::DISABLE_HIDDEN_CRYPTED_PARI, "DISABLE_HIDDEN_CRYPTED_PARI", STORAGE, RW, NONE, SLOW, ANY, ANY},
+            {CommandID::ENABLE_FIRMWARE_UPDATE, "ENABLE_FIRMWARE_UPDATE", STORAGE, RW, ADMIN, FAST, ANY, ANY},
+            {CommandID::EXPORT_FIRMWARE_TO_FILE, "EXPORT_FIRMWARE_TO_FILE", STORAGE, RW, ADMIN, LONG, ANY, ANY},
+            {CommandID::GENERATE_NEW_KEYS, "GENERATE_NEW_KEYS", STORAGE, RW, ADMIN, LONG, ANY, ANY},
+            {CommandID::FILL_SD_CARD_WITH_RANDOM_CHARS, "FILL_SD_CARD_WITH_RANDOM_CHARS", STORAGE, RW, ADMIN, LONG, ANY, ANY},
+            {CommandID::WRITE_STATUS_DATA, "WRITE_STATUS_DATA", STORAGE, RW, NONE, FAST, ANY, ANY},
+            {CommandID::ENABLE_READONLY_UNCRYPTED_LUN, "ENABLE_READONLY_UNCRYPTED_LUN", STORAGE, RW, USER, SLOW, ANY, ANY},
+            {CommandID::ENABLE_READWRITE_UNCRYPTED_LUN, "ENABLE_READWRITE_UNCRYPTED_LUN", STORAGE, RW, USER, SLOW, ANY, ANY},
+            {CommandID::SEND_PASSWORD_MATRIX, "SEND_PASSWORD_MATRIX", STORAGE, RW, NONE, FAST, ANY, ANY},
+            {CommandID::SEND_PASSWORD_MATRIX_PINDATA, "SEND_PASSWORD_MATRIX_PINDATA", STORAGE, RW, NONE, FAST, ANY, ANY},
+            {CommandID::SEND_PASSWORD_MATRIX_SETUP, "SEND_PASSWORD_MATRIX_SETUP", STORAGE, RW, NONE, FAST, ANY, ANY},
+            {CommandID::GET_DEVICE_STATUS, "GET_DEVICE_STATUS", STORAGE, RO, NONE, FAST, ANY, ANY},
+            {CommandID::SEND_DEVICE_STATUS, "SEND_DEVICE_STATUS", STORAGE, RW, NONE, FAST, ANY, ANY},
+            {CommandID::SEND_HIDDEN_VOLUME_PASSWORD, "SEND_HIDDEN_VOLUME_PASSWORD", STORAGE, RW, USER, SLOW, ANY, ANY},
+            {CommandID::SEND_HIDDEN_VOLUME_SETUP, "SEND_HIDDEN_VOLUME_SETUP", STORAGE, RW, NONE, SLOW, ANY, ANY},
+            {CommandID::SEND_PASSWORD, "SEND_PASSWORD", STORAGE, RW, ADMIN, SLOW, ANY, ANY},
+            {CommandID::SEND_NEW_PASSWORD, "SEND_NEW_PASSWORD", STORAGE, RW, ADMIN, SLOW, ANY, ANY},
+            {CommandID::CLEAR_NEW_SD_CARD_FOUND, "CLEAR_NEW_SD_CARD_FOUND", STORAGE, RW, ADMIN, FAST, ANY, ANY},
+            {CommandID::SEND_STARTUP, "SEND_STARTUP", STORAGE, RW, NONE, FAST, ANY, ANY},
+            {CommandID::SEND_CLEAR_STICK_KEYS_NOT_INITIATED, "SEND_CLEAR_STICK_KEYS_NOT_INITIATED", STORAGE, RW, ADMIN, FAST, ANY, ANY},
+            {CommandID::SEND_LOCK_STICK_HARDWARE, "SEND_LOCK_STICK_HARDWARE", STORAGE, RW, ADMIN, FAST, ANY, ANY},
+            {CommandID::PRODUCTION_TEST, "PRODUCTION_TEST", STORAGE, RO, NONE, FAST, ANY, ANY},
+            {CommandID::SEND_DEBUG_DATA, "SEND_DEBUG_DATA", STORAGE, RW, NONE, FAST, ANY, ANY},
+            {CommandID::CHANGE_UPDATE_PIN, "CHANGE_UPDATE_PIN", STORAGE, RW, ADMIN, SLOW, ANY, ANY},
+            {CommandID::ENABLE_ADMIN_READONLY_UNCRYPTED_LUN, "ENABLE_ADMIN_READONLY_UNCRYPTED_LUN", STORAGE, RW, ADMIN, SLOW, ANY, since(49)},
+            {CommandID::ENABLE_ADMIN_READWRITE_UNCRYPTED_LUN, "ENABLE_ADMIN_READWRITE_UNCRYPTED_LUN", STORAGE, RW, ADMIN, SLOW, ANY, since(49)},
+            {CommandID::ENABLE_ADMIN_READONLY_ENCRYPTED_LUN, "ENABLE_ADMIN_READONLY_ENCRYPTED_LUN", STORAGE, RW, ADMIN, SLOW, ANY, since(49)},
+            {CommandID::ENABLE_ADMIN_READWRITE_ENCRYPTED_LUN, "ENABLE_ADMIN_READWRITE_ENCRYPTED_LUN", STORAGE, RW, ADMIN, SLOW, ANY, since(49)},
+            {CommandID::CHECK_SMARTCARD_USAGE, "CHECK_SMARTCARD_USAGE", STORAGE, RO, NONE, FAST, ANY, ANY},
+            {CommandID::WINK, "WINK", STORAGE, RW, NONE, FAST, ANY, since(52)},
+
+            // password safe needs to be unlocked with the user PIN first
+            {CommandID::GET_PW_SAFE_SLOT_STATUS, "GET_PW_SAFE_SLOT_STATUS", COMMON, RO, USER, FAST, ANY, ANY},
+            {CommandID::GET_PW_SAFE_SLOT_NAME, "GET_PW_SAFE_SLOT_NAME", COMMON, RO, USER, FAST, ANY, ANY},
+            {CommandID::GET_PW_SAFE_SLOT_PASSWORD, "GET_PW_SAFE_SLOT_PASSWORD", COMMON, RO, USER, FAST, ANY, ANY},
+            {CommandID::GET_PW_SAFE_SLOT_LOGINNAME, "GET_PW_SAFE_SLOT_LOGINNAME", COMMON, RO, USER, FAST, ANY, ANY},
+            {CommandID::SET_PW_SAFE_SLOT_DATA_1, "SET_PW_SAFE_SLOT_DATA_1", COMMON, RW, USER, FAST, ANY, ANY},
+            {CommandID::SET_PW_SAFE_SLOT_DATA_2, "SET_PW_SAFE_SLOT_DATA_2", COMMON, RW, USER, SLOW, ANY, ANY},
+            {CommandID::PW_SAFE_ERASE_SLOT, "PW_SAFE_ERASE_SLOT", COMMON, RW, USER, SLOW, ANY, ANY},
+            {CommandID::PW_SAFE_ENABLE, "PW_SAFE_ENABLE", COMMON, RW, USER, SLOW, ANY, ANY},
+            {CommandID::PW_SAFE_INIT_KEY, "PW_SAFE_INIT_KEY", COMMON, RW, USER, SLOW, ANY, ANY},
+            {CommandID::PW_SAFE_SEND_DATA, "PW_SAFE_SEND_DATA", COMMON, RW, USER, FAST, ANY, ANY},
+            {CommandID::DETECT_SC_AES, "DETECT_SC_AES", COMMON, RW, USER, SLOW, ANY, ANY},
+            {CommandID::NEW_AES_KEY, "NEW_AES_KEY", COMMON, RW, ADMIN, LONG, ANY, ANY},
+            {CommandID::SD_CARD_HIGH_WATERMARK, "SD_CARD_HIGH_WATERMARK", STORAGE, RO, NONE, FAST, ANY, ANY},
+        };
+
+        struct CommandTable {
+            CommandInfo entries[256];
+        };
+
+        constexpr CommandTable make_table() {
+          CommandTable table = {};
+          for (int i = 0; i < 256; i++) {
+            table.entries[i].id = static_cast<CommandID>(i);
+          }
+          for (const auto &c : commands) {
+            auto &e = table.entries[static_cast<uint8_t>(c.id)];
+            e = c;
+            e.known = true;
+          }
+          // the block of Storage commands, also unassigned ones
+          for (int i = stick20::CMD_START_VALUE; i < stick20::CMD_END_VALUE; i++) {
+            table.entries[i].storage_status = true;
+          }
+          return table;
+        }
+
+        struct Registry {
+            static constexpr CommandTable table = make_table();
+        };
+    }
+
+    /**
+     * Returns the metadata of the command. IDs not assigned to a command give
+     * an entry named "UNKNOWN", with known set to false.
+     */
+    constexpr const CommandInfo &command_info(CommandID id) {
+      return registry::Registry::table.entries[static_cast<uint8_t>(id)];
+    }
+
+    constexpr const CommandInfo &command_info(uint8_t id) {
+      return registry::Registry::table.entries[id];
+    }
+
+    /**
+     * Returns true if the command is handled by the device model family and firmware version.
+     * @param storage true for Storage, false for Pro and Librem Key
+     * @param firmware_minor firmware minor version
+     */
+    constexpr bool is_command_supported(CommandID id, bool storage, uint8_t firmware_minor) {
+      const auto &c = command_info(id);
+      const auto &range = storage ? c.storage : c.pro;
+      return c.known && (storage || c.family == CommandFamily::COMMON) &&
+             range.min <= firmware_minor && firmware_minor <= range.max;
+    }
+
+}
+}
+
+#endif //LIBNITROKEY_COMMAND_REGISTRY_H
@@ -0,0 +1,109 @@
+/*
+ * Copyright (c) 2015-2018 Nitrokey UG
+ *
+ * This file is part of libnitrokey.
+ *
+ * libnitrokey is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libnitrokey is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libnitrokey. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0
+ */
+
+#ifndef LIBNITROKEY_CONNECTION_POOL_H
+#define LIBNITROKEY_CONNECTION_POOL_H
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include "device.h"
+
+namespace nitrokey {
+namespace device {
+
+    struct ConnectionPoolStats {
+        /** checkouts served with a pooled connection */
+        uint64_t hits = 0;
+        /** checkouts which had to open a new connection */
+        uint64_t misses = 0;
+        /**
+         * pooled connections dropped, because the device was removed or replaced;
+         * connections closed with disconnect() are not counted
+         */
+        uint64_t invalidations = 0;
+        /** pooled connections dropped to keep the pool size under the limit */
+        uint64_t evictions = 0;
+        size_t size = 0;
+        size_t max_size = 0;
+    };
+
+    /**
+     * Keeps connections to devices open, keyed by their path, so switching between
+     * devices does not reopen them each time. On checkout a pooled connection is
+     * validated against the enumeration cache: it is reused only if its handle is
+     * still open and the device under the path has not been reconnected since the
+     * connection was opened. When the device list changes, the connections of the
+     * removed devices are dropped on the next checkout. Least recently used
+     * connections are closed when the pool is full.
+     */
+    class ConnectionPool {
+    public:
+        static const size_t DEFAULT_MAX_SIZE = 16;
+
+        explicit ConnectionPool(size_t max_size = DEFAULT_MAX_SIZE);
+
+        /**
+         * Returns an open connection to the device under the path, pooled or new.
+         * @return nullptr if the path does not belong to a supported device or the connection failed
+         */
+        std::shared_ptr<Device> checkout(const std::string &path);
+        /**
+         * Drops the pooled connection. It is closed once no longer used.
+         */
+        void remove(const std::string &path);
+        void clear();
+
+        /**
+         * Sets the maximal number of pooled connections. Zero disables pooling.
+         */
+        void set_max_size(size_t max_size);
+        ConnectionPoolStats get_stats();
+        void reset_stats();
+
+    private:
+        struct Entry {
+            std::shared_ptr<Device> device;
+            /** enumeration generation at which the connection was opened */
+            uint64_t generation;
+            std::chrono::steady_clock::time_point last_checkout;
+        };
+
+        /** call with m_mutex locked */
+        void prune_removed(EnumerationCache &cache);
+        /** call with m_mutex locked */
+        void evict_least_recently_used();
+
+        std::mutex m_mutex;
+        std::unordered_map<std::string, Entry> m_entries;
+        size_t m_max_size;
+        /** enumeration generation of the last pruning */
+        uint64_t m_pruned_generation;
+        ConnectionPoolStats m_stats;
+    };
+
+}
+}
+
+#endif //LIBNITROKEY_CONNECTION_POOL_H
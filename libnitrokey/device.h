@@ -24,13 +24,18 @@
 #include <chrono>
 #include "hidapi/hidapi.h"
 #include <cstdint>
+#include <functional>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <ostream>
 #include <vector>
 #include "misc.h"
+#include "latency_stats.h"
+#include "report_pool.h"
 
 #define HID_REPORT_SIZE 65
+static_assert(HID_REPORT_SIZE == nitrokey::device::ReportPool::REPORT_SIZE, "report pool buffer size");
 
 #include <atomic>
 
@@ -56,6 +61,8 @@ enum class DeviceModel{
 
 std::ostream& operator<<(std::ostream& stream, DeviceModel model);
 
+class EnumerationCache;
+
 /**
  * The USB vendor ID for Nitrokey devices.
  */
@@ -107,6 +114,20 @@ struct DeviceInfo {
 
 #include <atomic>
 
+/**
+ * State of the connection, as seen by the last transfers.
+ */
+enum class ConnectionHealth {
+    /** last transfer succeeded */
+    HEALTHY,
+    /** transient errors, retrying with the same handle */
+    DEGRADED,
+    /** handle reopened, waiting for a successful transfer */
+    RECONNECTING,
+    /** handle closed, or could not be reopened */
+    DISCONNECTED
+};
+
 class Device {
 
 public:
@@ -128,10 +149,26 @@ public:
     cnt command_result_not_equal_0_recv;
     cnt communication_successful;
     cnt low_level_reconnect;
+    cnt transient_errors;
+    cnt dead_handle_errors;
+    cnt reconnects_rate_limited;
+    cnt reconnect_failures;
+    std::atomic<int64_t> reconnect_time_total_us;
+    std::atomic<int64_t> reconnect_time_max_us;
     std::string get_as_string();
 
   } m_counters = {};
 
+  /**
+   * Transaction latencies, per command ID.
+   */
+  LatencyStats m_latency;
+
+  /**
+   * Buffers the responses are received into, see proto::ClearingProxy.
+   */
+  ReportPool m_report_pool;
+
 
     Device(const uint16_t vid, const uint16_t pid, const DeviceModel model,
                    const milliseconds send_receive_delay, const int retry_receiving_count,
@@ -156,17 +193,39 @@ public:
   virtual int recv(void *packet);
 
   /***
-   * Returns true if some device is visible by OS with given VID and PID
-   * whether the device is connected through HID API or not.
+   * Returns true if the device is still visible by OS under its path (or, when
+   * connected without a path, if any device of the same model is visible).
+   * Served from the enumeration cache, without scanning the bus.
    * @return true if visible by OS
    */
   bool could_be_enumerated();
+  /**
+   * Returns true if the device handle is open. Does not check the device presence.
+   */
+  bool is_open();
   /**
    * Returns a vector with all connected Nitrokey devices.
    *
    * @return information about all connected devices
    */
   static std::vector<DeviceInfo> enumerate();
+  /**
+   * Looks up the model of the device visible under the given path.
+   * @return absent value if no Nitrokey device is found under the path
+   */
+  static misc::Option<DeviceModel> model_for_path(const std::string &path);
+  /**
+   * Returns the library-wide list of connected devices, which serves
+   * enumerate(), model_for_path() and could_be_enumerated().
+   */
+  static EnumerationCache &enumeration_cache();
+  /**
+   * Releases the hidapi library state. It is initialized on first use and
+   * kept while the process runs otherwise, also when all devices are disconnected:
+   * this is the only place calling hid_exit(), see NitrokeyManager::shutdown().
+   * @return false if some device is still connected, true otherwise
+   */
+  static bool release_hid_context();
 
   /**
    * Create a Device of the given model.
@@ -185,23 +244,95 @@ public:
   void set_last_command_status(uint8_t _err) { last_command_status = _err;}
   bool last_command_sucessfull() const {return last_command_status == 0;}
   DeviceModel get_device_model() const {return m_model;}
+  /**
+   * Unique for the process lifetime, unlike the object address, which can be
+   * reused by a device created later. Starts at 1.
+   */
+  uint64_t get_instance_id() const {return m_instance_id;}
+  ConnectionHealth get_connection_health() const {return m_health;}
   void set_receiving_delay(std::chrono::milliseconds delay);
   void set_retry_delay(std::chrono::milliseconds delay);
   static void set_default_device_speed(int delay);
   void setDefaultDelay();
+  /**
+   * The path and serial number are copied under a lock, so they can be read
+   * from other threads, e.g. by the metrics, while being set.
+   */
   void set_path(const std::string path);
+  std::string get_path() const;
+  /**
+   * Serial number reported by the USB enumeration, set by the code opening
+   * the device by its path. Not read from the device.
+   */
+  void set_serial_number(const std::string &serial_number);
+  std::string get_serial_number() const;
+  /**
+   * Like is_open(), without waiting for the device handle lock.
+   */
+  bool has_handle() const { return mp_devhandle != nullptr; }
 
+  /**
+   * Calls the function for each existing device object. The objects are
+   * not destroyed during the call, and the function must not create or
+   * destroy any. Does not wait for the device locks.
+   */
+  static void for_each_instance(const std::function<void(const Device &)> &f);
+
+  /**
+   * Serializes command transactions (send, wait, receive) to this device.
+   * Transactions to different devices can run in parallel.
+   */
+  std::mutex m_send_receive_mtx;
 
         private:
   std::atomic<uint8_t> last_command_status;
   void _reconnect();
   bool _connect();
   bool _disconnect();
+  /**
+   * Updates the connection health after a failed transfer. Transient errors
+   * are retried with the same handle after a short backoff, the handle is
+   * reopened when dead or still failing, at most once per reconnect interval.
+   * Call with m_dev_com_mtx locked.
+   * @param dead the handle is unusable, see _is_handle_dead
+   * @return time to wait before the next attempt
+   * @throws DeviceNotConnected when the handle is dead and can't be reopened yet
+   */
+  std::chrono::milliseconds _on_transfer_error(bool dead);
+  /**
+   * Tells if the handle is unusable after a transfer failed with the errno
+   * value. When the error does not tell, checks if the device is still
+   * present, with the lock of m_dev_com_mtx released for the lookup.
+   */
+  bool _is_handle_dead(int error, std::unique_lock<std::mutex> &lock);
+  /** Call with m_dev_com_mtx locked. */
+  void _on_transfer_success();
+
+  std::atomic<ConnectionHealth> m_health;
+  int m_consecutive_errors;
+  std::chrono::steady_clock::time_point m_last_reconnect;
 
 protected:
+  /**
+   * HID transport, replaced by the devices emulated in the tests.
+   * Called with m_dev_com_mtx locked. ~Device closes an open handle with
+   * Device::_close_handle, so a subclass replacing the transport has to
+   * call disconnect() in its own destructor.
+   * @return the opened handle, nullptr on failure
+   */
+  virtual hid_device *_open_handle();
+  virtual void _close_handle(hid_device *handle);
+  /**
+   * Transfers a report of HID_REPORT_SIZE over the open handle.
+   * @return as hid_send_feature_report and hid_get_feature_report, with errno set on failure
+   */
+  virtual int _write_report(const void *packet);
+  virtual int _read_report(void *packet);
+
   const uint16_t m_vid;
   const uint16_t m_pid;
   const DeviceModel m_model;
+  const uint64_t m_instance_id;
 
   /*
    *	While the project uses Signal11 portable HIDAPI
@@ -213,9 +344,19 @@ protected:
   std::chrono::milliseconds m_retry_timeout;
   std::chrono::milliseconds m_send_receive_delay;
   std::atomic<hid_device *>mp_devhandle;
+  /** guards m_path and m_serial_number */
+  mutable std::mutex m_info_mtx;
   std::string m_path;
+  std::string m_serial_number;
+  /**
+   * Guards the device handle. hidapi calls not bound to a handle
+   * (enumeration, open, close) are serialized with a library wide lock,
+   * always taken after this one.
+   */
+  std::mutex m_dev_com_mtx;
 
   static std::atomic_int instances_count;
+  static std::atomic<uint64_t> next_instance_id;
   static std::chrono::milliseconds default_delay ;
 };
 
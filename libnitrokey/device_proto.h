@@ -35,6 +35,8 @@
 #include "log.h"
 #include "command_id.h"
 #include "dissect.h"
+#include "trace.h"
+#include "binary_log.h"
 #include "CommandFailedException.h"
 #include "LongOperationInProgressException.h"
 
@@ -58,8 +60,6 @@
 
 namespace nitrokey {
     namespace proto {
-      extern std::mutex send_receive_mtx;
-
 
 /*
  *	POD types for HID proto commands
@@ -173,29 +173,162 @@ namespace nitrokey {
             }
         } __packed;
 
+/*
+ *	Untyped views of the packets, layout compatible with HIDReport and
+ *	DeviceResponse of any payload. Used by the transaction engine, which is
+ *	common to all commands.
+ */
+        struct RawReport {
+            uint8_t _zero;
+            uint8_t command_id;
+            uint8_t payload[HID_REPORT_SIZE - 6];
+            uint32_t crc;
+
+            void update_CRC() {
+              crc = misc::stm_crc32(reinterpret_cast<const uint8_t *>(this) + 1,
+                                    static_cast<size_t>(HID_REPORT_SIZE - 5));
+            }
+
+            bool isValid() const { return true; }
+        } __packed;
+
+        struct RawResponse {
+            uint8_t _zero;
+            uint8_t device_status;
+            uint8_t command_id;
+            uint32_t last_command_crc;
+            uint8_t last_command_status;
+
+            union {
+                uint8_t payload[HID_REPORT_SIZE - DeviceResponseConstants::wrapping_size];
+                struct {
+                    uint8_t _storage_status_padding[DeviceResponseConstants::storage_status_absolute_address
+                                                    - DeviceResponseConstants::header_size];
+                    uint8_t command_counter;
+                    uint8_t command_id;
+                    uint8_t device_status; //@see stick20::device_status
+                    uint8_t progress_bar_value;
+                } __packed storage_status;
+            } __packed;
+
+            uint32_t crc;
+
+            uint32_t calculate_CRC() const {
+              return misc::stm_crc32(reinterpret_cast<const uint8_t *>(this) + 1,
+                                     static_cast<size_t>(HID_REPORT_SIZE - 5));
+            }
+
+            bool isCRCcorrect() const { return crc == calculate_CRC(); }
+            bool isValid() const { return crc != 0; }
+        } __packed;
+
+        /**
+         * Parts of a transaction which depend on the packet types, provided
+         * by each Transaction instantiation to the engine: the text
+         * dissection and the binary log records.
+         */
+        struct PacketHandlers {
+            std::string (*dissect_query)(const RawReport &report);
+            std::string (*dissect_response)(const RawResponse &response);
+            void (*log_query)(const device::Device *dev, const RawReport &report);
+            void (*log_response)(const device::Device *dev, log::BinaryLogEvent event, const RawResponse &response,
+                                 int sending_retries, int receiving_retries);
+        };
+
+        /**
+         * Runs a single command on the device: sends the report, polls for the
+         * response with retries and busy backoff, translates the Storage
+         * status and checks the result. Shared by all the Transaction types.
+         * The outgoing report is packed from the payload into a buffer of the
+         * device's report pool and wiped when done. The response is received
+         * into the given HID_REPORT_SIZE buffer, holding a RawResponse, which
+         * is wiped when an exception is thrown.
+         * @throws DeviceNotConnected, DeviceSendingFailure, DeviceReceivingFailure,
+         * InvalidCRCReceived, LongOperationInProgressException, CommandFailedException
+         */
+        void run_transaction(device::Device *dev, uint8_t command_id, const void *payload, size_t payload_size,
+                             uint8_t *response, const PacketHandlers &handlers);
+
+        /**
+         * Streams a logical payload split over consecutive commands, like the
+         * OTP secret sent in SendOTPData chunks, or the password safe slot
+         * sent in SetPasswordSafeSlotData and SetPasswordSafeSlotData2.
+         * Holds the device's transaction lock for its lifetime, so other
+         * transactions can't interleave, and polls for each response right
+         * after sending instead of waiting the full send_receive_delay.
+         * Each command is still checked, and stops the transfer with an
+         * exception on failure. Run the commands with
+         * Transaction::run(ChunkedTransfer &, payload).
+         * @throws DeviceNotConnected when the device is not set
+         */
+        class ChunkedTransfer {
+        public:
+            explicit ChunkedTransfer(std::shared_ptr<device::Device> dev);
+            ChunkedTransfer(const ChunkedTransfer &) = delete;
+            ChunkedTransfer &operator=(const ChunkedTransfer &) = delete;
+
+            /**
+             * Like run_transaction, under the transfer's lock.
+             */
+            void run(uint8_t command_id, const void *payload, size_t payload_size,
+                     uint8_t *response, const PacketHandlers &handlers);
+
+            const std::shared_ptr<device::Device> &device() const { return m_device; }
+            /** number of commands completed */
+            size_t chunks() const { return m_chunks; }
+
+        private:
+            std::shared_ptr<device::Device> m_device;
+            std::unique_lock<std::mutex> m_lock;
+            size_t m_chunks;
+        };
+
         struct EmptyPayload {
             bool isValid() const { return true; }
 
             std::string dissect() const { return std::string("Empty Payload."); }
         } __packed;
 
+        /**
+         * Response of a transaction, decoded in place: refers to the report
+         * buffer taken from the device's pool, which is wiped and returned
+         * when the proxy is destroyed. Keeps the device alive until then.
+         * Move only.
+         */
         template<typename command_packet, typename response_payload>
         class ClearingProxy {
         public:
-            ClearingProxy(command_packet &p) {
-              packet = p;
-              bzero(&p, sizeof(p));
+            explicit ClearingProxy(std::shared_ptr<device::Device> dev)
+                : m_device(std::move(dev)),
+                  m_report(m_device != nullptr ? m_device->m_report_pool.acquire() : nullptr) {}
+
+            ClearingProxy(ClearingProxy &&other) noexcept
+                : m_device(std::move(other.m_device)), m_report(other.m_report) {
+              other.m_report = nullptr;
             }
 
-            virtual ~ClearingProxy() {
-              bzero(&packet, sizeof(packet));
+            ClearingProxy(const ClearingProxy &) = delete;
+            ClearingProxy &operator=(const ClearingProxy &) = delete;
+            ClearingProxy &operator=(ClearingProxy &&) = delete;
+
+            ~ClearingProxy() {
+              if (m_report != nullptr) m_device->m_report_pool.release(m_report);
             }
 
             response_payload &data() {
-              return packet.payload;
+              return packet().payload;
             }
 
-            command_packet packet;
+            command_packet &packet() {
+              return *reinterpret_cast<command_packet *>(m_report);
+            }
+
+            /** the raw report buffer, nullptr when not connected */
+            uint8_t *report() { return m_report; }
+
+        private:
+            std::shared_ptr<device::Device> m_device;
+            uint8_t *m_report;
         };
 
         template<CommandID cmd_id, typename command_payload, typename response_payload>
@@ -218,6 +351,8 @@ namespace nitrokey {
                           "OutgoingPacket type is not the right size");
             static_assert(sizeof(ResponsePacket) == HID_REPORT_SIZE,
                           "ResponsePacket type is not the right size");
+            static_assert(sizeof(RawReport) == HID_REPORT_SIZE && sizeof(RawResponse) == HID_REPORT_SIZE,
+                          "raw packet types are not the right size");
 
             static uint32_t getCRC(
                 const command_payload &payload) {
@@ -230,262 +365,83 @@ namespace nitrokey {
 
             template<typename T>
             static void clear_packet(T &st) {
-              bzero(&st, sizeof(st));
+              misc::secure_zero(&st, sizeof(st));
             }
 
-            static ClearingProxy<ResponsePacket, response_payload> run(std::shared_ptr<device::Device> dev,
-                                                                       const command_payload &payload) {
-              using namespace ::nitrokey::device;
-              using namespace ::nitrokey::log;
-              using namespace std::chrono_literals;
-
-              std::lock_guard<std::mutex> guard(send_receive_mtx);
-
-              LOG(__FUNCTION__, Loglevel::DEBUG_L2);
+        private:
+            static std::string dissect_query(const RawReport &report) {
+              OutgoingPacket packet;
+              memcpy(&packet, &report, sizeof packet);
+              const auto res = static_cast<std::string>(packet);
+              clear_packet(packet);
+              return res;
+            }
 
-              if (dev == nullptr){
-                LOG(std::string("Connection not established yet"), Loglevel::DEBUG_L2);
-                throw DeviceNotConnected("Device not initialized");
-              }
-              dev->m_counters.total_comm_runs++;
+            static std::string dissect_response(const RawResponse &response) {
+              ResponsePacket packet;
+              memcpy(&packet, &response, sizeof packet);
+              const auto res = static_cast<std::string>(packet);
+              clear_packet(packet);
+              return res;
+            }
 
-              int status = 0;
-              OutgoingPacket outp;
-              ResponsePacket resp;
+            static void log_query(const device::Device *dev, const RawReport &report) {
+              OutgoingPacket packet;
+              memcpy(&packet, &report, sizeof packet);
+              log::BinaryLog::instance().write_packet(dev, log::BinaryLogEvent::QUERY, packet, 0, 0, 0, 0);
+              clear_packet(packet);
+            }
 
-              // POD types can't have non-default constructors
-              outp.initialize();
-              resp.initialize();
+            static void log_response(const device::Device *dev, log::BinaryLogEvent event, const RawResponse &response,
+                                     int sending_retries, int receiving_retries) {
+              ResponsePacket packet;
+              memcpy(&packet, &response, sizeof packet);
+              log::BinaryLog::instance().write_packet(dev, event, packet, packet.device_status, packet.last_command_status,
+                                                 sending_retries, receiving_retries);
+              clear_packet(packet);
+            }
 
-              outp.payload = payload;
-              outp.update_CRC();
+            static constexpr PacketHandlers handlers = {
+                &dissect_query, &dissect_response, &log_query, &log_response
+            };
 
-              LOG("-------------------", Loglevel::DEBUG);
-              LOG("Outgoing HID packet:", Loglevel::DEBUG);
-              LOG(static_cast<std::string>(outp), Loglevel::DEBUG);
-              LOG(std::string("=> ") + std::string(commandid_to_string(static_cast<CommandID>(outp.command_id))), Loglevel::DEBUG_L1);
-
-
-              if (!outp.isValid()) {
-                LOG(std::string("Throw: Invalid outgoing packet"), Loglevel::DEBUG_L1);
-                throw DeviceSendingFailure("Invalid outgoing packet");
-              }
-
-              bool successful_communication = false;
-              int receiving_retry_counter = 0;
-              int sending_retry_counter = dev->get_retry_sending_count();
-              while (sending_retry_counter-- > 0) {
-                dev->m_counters.sends_executed++;
-                status = dev->send(&outp);
-                if (status <= 0){
-                    //FIXME early disconnection not yet working properly
-//                  LOG("Encountered communication error, disconnecting device", Loglevel::DEBUG_L2);
-//                  dev->disconnect();
-                  dev->m_counters.sending_error++;
-                  LOG(std::string("Throw: Device error while sending command "), Loglevel::DEBUG_L1);
-                  throw DeviceSendingFailure(
-                      std::string("Device error while sending command ") +
-                      std::to_string(status));
-                }
-
-                std::this_thread::sleep_for(dev->get_send_receive_delay());
-
-                // FIXME make checks done in device:recv here
-                receiving_retry_counter = dev->get_retry_receiving_count();
-                int busy_counter = 0;
-                auto retry_timeout = dev->get_retry_timeout();
-                while (receiving_retry_counter-- > 0) {
-                  dev->m_counters.recv_executed++;
-                  status = dev->recv(&resp);
-
-                  if (dev->get_device_model() == DeviceModel::STORAGE &&
-                      resp.command_id >= stick20::CMD_START_VALUE &&
-                      resp.command_id < stick20::CMD_END_VALUE ) {
-                    LOG(std::string("Detected storage device cmd, status: ") +
-                                    std::to_string(resp.storage_status.device_status), Loglevel::DEBUG_L2);
-
-                    resp.last_command_status = static_cast<uint8_t>(stick10::command_status::ok);
-                    switch (static_cast<stick20::device_status>(resp.storage_status.device_status)) {
-                      case stick20::device_status::idle :
-                      case stick20::device_status::ok:
-                        resp.device_status = static_cast<uint8_t>(stick10::device_status::ok);
-                        break;
-                      case stick20::device_status::busy:
-                      case stick20::device_status::busy_progressbar: //TODO this will be modified later for getting progressbar status
-                        resp.device_status = static_cast<uint8_t>(stick10::device_status::busy);
-                        break;
-                      case stick20::device_status::wrong_password:
-                        resp.last_command_status = static_cast<uint8_t>(stick10::command_status::wrong_password);
-                        resp.device_status = static_cast<uint8_t>(stick10::device_status::ok);
-                        break;
-                      case stick20::device_status::no_user_password_unlock:
-                        resp.last_command_status = static_cast<uint8_t>(stick10::command_status::AES_dec_failed);
-                        resp.device_status = static_cast<uint8_t>(stick10::device_status::ok);
-                        break;
-                      default:
-                        LOG(std::string("Unknown storage device status, cannot translate: ") +
-                                        std::to_string(resp.storage_status.device_status), Loglevel::DEBUG);
-                        resp.device_status = resp.storage_status.device_status;
-                        break;
-                    };
-                  }
-
-                  //Some of the commands return wrong CRC, for now skip checking it (TODO list and report)
-                  //if (resp.device_status == 0 && resp.last_command_crc == outp.crc && resp.isCRCcorrect()) break;
-                  auto CRC_equal_awaited = true; // resp.last_command_crc == outp.crc;
-                  if (resp.device_status == static_cast<uint8_t>(stick10::device_status::ok) &&
-                      CRC_equal_awaited && resp.isValid()){
-                    successful_communication = true;
-                    break;
-                  }
-                  if (resp.device_status == static_cast<uint8_t>(stick10::device_status::busy)) {
-                    dev->m_counters.busy++;
-
-                    if (busy_counter++<10) {
-                      receiving_retry_counter++;
-                      LOG("Status busy, not decreasing receiving_retry_counter counter: " +
-                                      std::to_string(receiving_retry_counter), Loglevel::DEBUG_L2);
-                    } else {
-                      retry_timeout *= 2;
-                      retry_timeout = std::min(retry_timeout, 300ms);
-                      busy_counter = 0;
-                      LOG("Status busy, decreasing receiving_retry_counter counter: " +
-                                      std::to_string(receiving_retry_counter) + ", current delay:"
-                          + std::to_string(retry_timeout.count()), Loglevel::DEBUG);
-                      LOG(std::string("Busy retry: status ")
-                          + std::to_string(resp.storage_status.device_status)
-                          + ", "
-                          + std::to_string(retry_timeout.count())
-                          + "ms, counter "
-                          + std::to_string(receiving_retry_counter)
-                            + ", progress: "
-                          + std::to_string(resp.storage_status.progress_bar_value)
-                      , Loglevel::DEBUG_L1);
-                    }
-                  }
-                  if (resp.device_status == static_cast<uint8_t>(stick10::device_status::busy) &&
-                      static_cast<stick20::device_status>(resp.storage_status.device_status)
-                      == stick20::device_status::busy_progressbar){
-                    successful_communication = true;
-                    break;
-                  }
-                  LOG(std::string("Retry status - dev status, awaited cmd crc, correct packet CRC: ")
-                                  + std::to_string(resp.device_status) +
-                                  " " + std::to_string(CRC_equal_awaited) +
-                                  " " + std::to_string(resp.isCRCcorrect()), Loglevel::DEBUG_L2);
-
-                  if (!resp.isCRCcorrect()) dev->m_counters.wrong_CRC++;
-                  if (!CRC_equal_awaited) dev->m_counters.CRC_other_than_awaited++;
-
-
-                  LOG(
-                      "Device is not ready or received packet's last CRC is not equal to sent CRC packet, retrying...",
-                      Loglevel::DEBUG_L2);
-                  LOG("Invalid incoming HID packet:", Loglevel::DEBUG_L2);
-                  LOG(static_cast<std::string>(resp), Loglevel::DEBUG_L2);
-                  dev->m_counters.total_retries++;
-                  LOG(".", Loglevel::DEBUG_L1);
-                  std::this_thread::sleep_for(retry_timeout);
-                  continue;
-                }
-                if (successful_communication) break;
-                LOG(std::string("Resending (outer loop) "), Loglevel::DEBUG_L2);
-                LOG(std::string("sending_retry_counter count: ") + std::to_string(sending_retry_counter),
-                                Loglevel::DEBUG);
-              }
-
-              if(resp.last_command_crc != outp.crc){
-                LOG(std::string("Accepting response with CRC other than expected ")
-                    + "Command ID: " + std::to_string(resp.command_id) + " " +
-                    commandid_to_string(static_cast<CommandID>(resp.command_id)) + "  "
-                    + "Reported by response and expected: " + std::to_string(resp.last_command_crc) + "!=" + std::to_string(outp.crc),
-                    Loglevel::WARNING
-                );
-              }
-
-              dev->set_last_command_status(resp.last_command_status); // FIXME should be handled on device.recv
-
-              clear_packet(outp);
-
-
-              if (status <= 0) {
-                dev->m_counters.receiving_error++;
-                LOG(std::string("Throw: Device error while executing command "), Loglevel::DEBUG_L1);
-                throw DeviceReceivingFailure( //FIXME replace with CriticalErrorException
-                    std::string("Device error while executing command ") +
-                    std::to_string(status));
-              }
-
-              LOG(std::string("<= ") +
-                  std::string(
-                      commandid_to_string(static_cast<CommandID>(resp.command_id))
-                      + std::string(" ")
-                      + std::to_string(resp.device_status)
-                      + std::string(" ")
-                      + std::to_string(resp.storage_status.device_status)
-//                          + std::to_string( status_translate_command(resp.storage_status.device_status))
-                  ), Loglevel::DEBUG_L1);
-
-              LOG("Incoming HID packet:", Loglevel::DEBUG);
-              LOG(static_cast<std::string>(resp), Loglevel::DEBUG);
-              if (dev->get_retry_receiving_count() - receiving_retry_counter > 2) {
-                LOG(std::string("Packet received with receiving_retry_counter count: ") +
-                    std::to_string(receiving_retry_counter),
-                    Loglevel::DEBUG_L1);
-              }
-
-              if (resp.device_status == static_cast<uint8_t>(stick10::device_status::busy) &&
-                  static_cast<stick20::device_status>(resp.storage_status.device_status)
-                  == stick20::device_status::busy_progressbar){
-                dev->m_counters.busy_progressbar++;
-                LOG(std::string("Throw: Long operation in progress exception"), Loglevel::DEBUG_L1);
-                throw LongOperationInProgressException(
-                    resp.command_id, resp.device_status, resp.storage_status.progress_bar_value);
-              }
-
-              if (!resp.isValid()) {
-                LOG(std::string("Throw: Invalid incoming packet"), Loglevel::DEBUG_L1);
-                throw InvalidCRCReceived("Invalid incoming packet");
-              }
-              if (receiving_retry_counter <= 0){
-                LOG(std::string("Throw: \"Maximum receiving_retry_counter count reached for receiving response from the device!\""
-                + std::to_string(receiving_retry_counter)), Loglevel::DEBUG_L1);
-                throw DeviceReceivingFailure(
-                    "Maximum receiving_retry_counter count reached for receiving response from the device!");
-              }
-              dev->m_counters.communication_successful++;
-
-              if (resp.last_command_status != static_cast<uint8_t>(stick10::command_status::ok)){
-                dev->m_counters.command_result_not_equal_0_recv++;
-                LOG(std::string("Throw: CommandFailedException ") + std::to_string(resp.last_command_status), Loglevel::DEBUG_L1);
-                throw CommandFailedException(resp.command_id, resp.last_command_status);
-              }
-
-              dev->m_counters.command_successful_recv++;
-
-              if (dev->get_device_model() == DeviceModel::STORAGE &&
-                  resp.command_id >= stick20::CMD_START_VALUE &&
-                  resp.command_id < stick20::CMD_END_VALUE ) {
-                dev->m_counters.successful_storage_commands++;
-              }
-
-              if (!resp.isCRCcorrect())
-                LOG(std::string("Accepting response from device with invalid CRC. ")
-                     + "Command ID: " + std::to_string(resp.command_id) + " " +
-                         commandid_to_string(static_cast<CommandID>(resp.command_id)) + "  "
-			+ "Reported and calculated: " + std::to_string(resp.crc) + "!=" + std::to_string(resp.calculate_CRC()),
-			Loglevel::WARNING
-                );
+        public:
 
+            static ClearingProxy<ResponsePacket, response_payload> run(std::shared_ptr<device::Device> dev,
+                                                                       const command_payload &payload) {
+              static_assert(sizeof(command_payload) <= sizeof(RawReport::payload),
+                            "command payload does not fit the report");
+              const auto device = dev.get();
+              ClearingProxy<ResponsePacket, response_payload> resp(std::move(dev));
+              run_transaction(device, static_cast<uint8_t>(cmd_id), &payload,
+                              std::is_empty<command_payload>::value ? 0 : sizeof payload,
+                              resp.report(), handlers);
               // See: DeviceResponse
               return resp;
             }
 
+            /**
+             * Runs the command as a part of the transfer, see ChunkedTransfer.
+             */
+            static ClearingProxy<ResponsePacket, response_payload> run(ChunkedTransfer &transfer,
+                                                                       const command_payload &payload) {
+              static_assert(sizeof(command_payload) <= sizeof(RawReport::payload),
+                            "command payload does not fit the report");
+              ClearingProxy<ResponsePacket, response_payload> resp(transfer.device());
+              transfer.run(static_cast<uint8_t>(cmd_id), &payload,
+                           std::is_empty<command_payload>::value ? 0 : sizeof payload,
+                           resp.report(), handlers);
+              return resp;
+            }
+
             static ClearingProxy<ResponsePacket, response_payload> run(std::shared_ptr<device::Device> dev) {
               command_payload empty_payload;
               return run(dev, empty_payload);
             }
         };
+
+        template<CommandID cmd_id, typename command_payload, typename response_payload>
+        constexpr PacketHandlers Transaction<cmd_id, command_payload, response_payload>::handlers;
     }
 }
 #endif
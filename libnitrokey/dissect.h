@@ -25,8 +25,6 @@
 #ifndef DISSECT_H
 #define DISSECT_H
 #include <string>
-#include <sstream>
-#include <iomanip>
 #include "misc.h"
 #include "cxx_semantics.h"
 #include "command_id.h"
@@ -39,21 +37,19 @@ template <CommandID id, class HIDPacket>
 class QueryDissector : semantics::non_constructible {
  public:
   static std::string dissect(const HIDPacket &pod) {
-    std::stringstream out;
+    ::nitrokey::misc::FormatBuffer out;
 
 #ifdef LOG_VOLATILE_DATA
-    out << "Raw HID packet:" << std::endl;
-    out << ::nitrokey::misc::hexdump(reinterpret_cast<const uint8_t *>(&pod), sizeof pod);
+    out << "Raw HID packet:" << '\n';
+    out << ::nitrokey::misc::hexdump_view(reinterpret_cast<const uint8_t *>(&pod), sizeof pod);
 #endif
 
-    out << "Contents:" << std::endl;
+    out << "Contents:" << '\n';
     out << "Command ID:\t" << commandid_to_string(static_cast<CommandID>(pod.command_id))
-        << std::endl;
-      out << "CRC:\t"
-        << std::hex << std::setw(2) << std::setfill('0')
-        << pod.crc << std::endl;
+        << '\n';
+      out << "CRC:\t" << ::nitrokey::misc::hex(pod.crc, 2) << '\n';
 
-      out << "Payload:" << std::endl;
+      out << "Payload:" << '\n';
     out << pod.payload.dissect();
     return out.str();
   }
@@ -101,32 +97,27 @@ class ResponseDissector : semantics::non_constructible {
     }
 
   static std::string dissect(const HIDPacket &pod) {
-    std::stringstream out;
+    ::nitrokey::misc::FormatBuffer out;
 
     // FIXME use values from firmware (possibly generate separate
     // header automatically)
 
 #ifdef LOG_VOLATILE_DATA
-    out << "Raw HID packet:" << std::endl;
-    out << ::nitrokey::misc::hexdump(reinterpret_cast<const uint8_t *>(&pod), sizeof pod);
+    out << "Raw HID packet:" << '\n';
+    out << ::nitrokey::misc::hexdump_view(reinterpret_cast<const uint8_t *>(&pod), sizeof pod);
 #endif
 
     out << "Device status:\t" << pod.device_status + 0 << " "
-        << status_translate_device(pod.device_status) << std::endl;
-    out << "Command ID:\t" << commandid_to_string(static_cast<CommandID>(pod.command_id)) << " hex: " << std::hex << static_cast<int>(pod.command_id)
-        << std::endl;
-    out << "Last command CRC:\t"
-            << std::hex << std::setw(2) << std::setfill('0')
-            << pod.last_command_crc << std::endl;
+        << status_translate_device(pod.device_status) << '\n';
+    out << "Command ID:\t" << commandid_to_string(static_cast<CommandID>(pod.command_id)) << " hex: " << ::nitrokey::misc::hex(pod.command_id)
+        << '\n';
+    out << "Last command CRC:\t" << ::nitrokey::misc::hex(pod.last_command_crc, 2) << '\n';
     out << "Last command status:\t" << pod.last_command_status + 0 << " "
-        << status_translate_command(pod.last_command_status) << std::endl;
-    out << "CRC:\t"
-            << std::hex << std::setw(2) << std::setfill('0')
-            << pod.crc << std::endl;
+        << status_translate_command(pod.last_command_status) << '\n';
+    out << "CRC:\t" << ::nitrokey::misc::hex(pod.crc, 2) << '\n';
     if(static_cast<int>(pod.command_id) == pod.storage_status.command_id){
-      out << "Storage stick status (where applicable):" << std::endl;
-#define d(x) out << " "#x": \t"<< std::hex << std::setw(2) \
-    << std::setfill('0')<< static_cast<int>(x) << std::endl;
+      out << "Storage stick status (where applicable):" << '\n';
+#define d(x) out << " "#x": \t" << ::nitrokey::misc::hex(x, 2) << '\n';
     d(pod.storage_status.command_counter);
     d(pod.storage_status.command_id);
     d(pod.storage_status.device_status);
@@ -134,7 +125,7 @@ class ResponseDissector : semantics::non_constructible {
 #undef d
     }
 
-    out << "Payload:" << std::endl;
+    out << "Payload:" << '\n';
     out << pod.payload.dissect();
     return out.str();
   }
@@ -0,0 +1,127 @@
+/*
+ * Copyright (c) 2015-2018 Nitrokey UG
+ *
+ * This file is part of libnitrokey.
+ *
+ * libnitrokey is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libnitrokey is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libnitrokey. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0
+ */
+
+#ifndef LIBNITROKEY_ENUMERATION_CACHE_H
+#define LIBNITROKEY_ENUMERATION_CACHE_H
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "device.h"
+#include "misc.h"
+
+namespace nitrokey {
+namespace device {
+
+    /**
+     * Keeps the list of connected devices between USB bus scans.
+     * On Linux the kernel hotplug events (netlink uevents) of the hidraw and usb
+     * subsystems mark the list as outdated, and it is rescanned on the next access.
+     * Where the events are not available, the list is rescanned when older than
+     * the configured time-to-live. As the socket may be bound while no events
+     * are delivered (e.g. in containers), the list is rescanned with a longer
+     * time-to-live also when they are monitored.
+     */
+    class EnumerationCache {
+    public:
+        using Scanner = std::function<std::vector<DeviceInfo>()>;
+
+        static constexpr std::chrono::milliseconds DEFAULT_TTL = std::chrono::milliseconds(500);
+        static constexpr std::chrono::milliseconds DEFAULT_HOTPLUG_TTL = std::chrono::milliseconds(10000);
+
+        /**
+         * @param scanner function listing the connected devices, called with the cache locked
+         * @param ttl maximal age of the list, used when hotplug events are not monitored
+         * @param monitor_hotplug listen to the hotplug events, if supported by the platform
+         * @param hotplug_ttl maximal age of the list, used when hotplug events are monitored
+         */
+        explicit EnumerationCache(Scanner scanner, std::chrono::milliseconds ttl = DEFAULT_TTL,
+                                  bool monitor_hotplug = true,
+                                  std::chrono::milliseconds hotplug_ttl = DEFAULT_HOTPLUG_TTL);
+        ~EnumerationCache();
+        EnumerationCache(const EnumerationCache &) = delete;
+        EnumerationCache &operator=(const EnumerationCache &) = delete;
+
+        /**
+         * Returns the connected devices, rescanning if the list is outdated.
+         */
+        std::vector<DeviceInfo> devices();
+        /**
+         * Looks up the device by its path. Rescans once on miss, in case
+         * the device has just been connected and no event arrived yet.
+         */
+        misc::Option<DeviceInfo> find(const std::string &path);
+        /**
+         * Returns true if any device of the model is connected.
+         */
+        bool contains(DeviceModel model);
+        /**
+         * Marks the list as outdated.
+         */
+        void invalidate();
+        /**
+         * Number of changes of the device list seen so far. Increased only
+         * when a rescan gives a different list.
+         */
+        uint64_t generation();
+        /**
+         * Returns the generation in which the device under the path appeared,
+         * or 0 if it is not connected. Changes when a rescan found the device
+         * disconnected and connected again, even under the same path.
+         */
+        uint64_t appeared_in(const std::string &path);
+        bool is_hotplug_monitored() const { return m_monitor_fd >= 0; }
+        void set_ttl(std::chrono::milliseconds ttl);
+        void set_hotplug_ttl(std::chrono::milliseconds ttl);
+
+    private:
+        /** call with m_mutex locked */
+        void refresh_if_outdated();
+        /** call with m_mutex locked */
+        void refresh();
+        void start_monitor();
+        void monitor_loop();
+
+        Scanner m_scanner;
+        std::mutex m_mutex;
+        std::vector<DeviceInfo> m_devices;
+        std::unordered_map<std::string, uint64_t> m_appeared_in;
+        bool m_scanned;
+        uint64_t m_generation;
+        std::chrono::milliseconds m_ttl;
+        std::chrono::milliseconds m_hotplug_ttl;
+        std::chrono::steady_clock::time_point m_scan_time;
+
+        std::atomic_bool m_outdated;
+        std::atomic_bool m_stop;
+        int m_monitor_fd;
+        std::thread m_monitor;
+    };
+
+}
+}
+
+#endif //LIBNITROKEY_ENUMERATION_CACHE_H
@@ -0,0 +1,158 @@
+/*
+ * Copyright (c) 2015-2018 Nitrokey UG
+ *
+ * This file is part of libnitrokey.
+ *
+ * libnitrokey is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libnitrokey is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libnitrokey. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0
+ */
+
+#ifndef LIBNITROKEY_FLEET_H
+#define LIBNITROKEY_FLEET_H
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "device.h"
+
+namespace nitrokey {
+    class NitrokeyManager;
+
+namespace fleet {
+
+    /**
+     * Selects devices to run the operation on. Empty lists match all devices.
+     */
+    struct DeviceFilter {
+        std::vector<device::DeviceModel> models;
+        /** USB serial numbers, as reported by Device::enumerate */
+        std::vector<std::string> serial_numbers;
+
+        bool matches(const device::DeviceInfo &info) const;
+    };
+
+    struct FleetOptions {
+        DeviceFilter filter;
+        /** maximal number of devices processed at the same time */
+        size_t max_workers = 16;
+        /**
+         * Time after which run() returns, with the unfinished devices marked as
+         * timed out. Devices not started yet are skipped. The operations still
+         * running finish in the background, and can stop early by checking
+         * cancellation_requested(). Zero disables the deadline.
+         */
+        std::chrono::milliseconds deadline = std::chrono::milliseconds(0);
+    };
+
+    /**
+     * Outcome of the operation on a single device.
+     */
+    template <typename T>
+    struct DeviceResult {
+        device::DeviceInfo device;
+        bool success = false;
+        bool timed_out = false;
+        T value = T();
+        /** error description, empty on success */
+        std::string error;
+        /** time spent on the device, including connecting to it */
+        std::chrono::microseconds duration = std::chrono::microseconds(0);
+    };
+
+    namespace detail {
+        struct TaskOutcome {
+            bool success = false;
+            bool timed_out = false;
+            std::string error;
+            std::chrono::microseconds duration = std::chrono::microseconds(0);
+        };
+
+        using Task = std::function<void(size_t index, NitrokeyManager &manager)>;
+        /** opens the device, nullptr on failure; replaced by the tests */
+        using Connector = std::function<std::shared_ptr<device::Device>(const device::DeviceInfo &info)>;
+
+        /**
+         * Runs task for each of the devices on a worker pool, each worker
+         * using its own NitrokeyManager instance connected to the device.
+         * Returns once all the workers have finished, or at the deadline;
+         * the task is then still referenced by the workers running it.
+         * @param connect opens the devices, by their path when empty
+         */
+        std::vector<TaskOutcome> run_tasks(const std::vector<device::DeviceInfo> &devices, Task task,
+                                           const FleetOptions &options, Connector connect = Connector());
+    }
+
+    /**
+     * Tells an operation run by run() that the deadline has passed, and its
+     * result will be discarded. Always false outside of the operations.
+     */
+    bool cancellation_requested();
+
+    /**
+     * Lists connected devices matching the filter.
+     */
+    std::vector<device::DeviceInfo> select_devices(const DeviceFilter &filter);
+
+    /**
+     * Runs the operation on all connected devices selected by the options,
+     * in parallel. Each invocation gets its own NitrokeyManager connected to
+     * one device. Exceptions thrown by the operation are reported in the
+     * results, together with the timing of each device.
+     * Returns when all operations are done, or at the deadline. The operations
+     * still running then finish in the background, so with a deadline the
+     * operation must not refer to objects of the caller which could be gone by then.
+     * @param operation operation to run, called concurrently from worker threads
+     * @return results in enumeration order
+     */
+    template <typename T>
+    std::vector<DeviceResult<T>> run(std::function<T(NitrokeyManager &)> operation,
+                                     const FleetOptions &options = FleetOptions()) {
+      const auto devices = select_devices(options.filter);
+
+      // shared with the operations still running after the deadline
+      struct Values {
+          // locked, as elements of std::vector<bool> are not independent
+          std::mutex mutex;
+          std::vector<T> values;
+      };
+      const auto values = std::make_shared<Values>();
+      values->values.resize(devices.size());
+      auto outcomes = detail::run_tasks(devices, [values, operation](size_t index, NitrokeyManager &manager) {
+        auto value = operation(manager);
+        std::lock_guard<std::mutex> lock(values->mutex);
+        values->values[index] = std::move(value);
+      }, options);
+
+      std::lock_guard<std::mutex> lock(values->mutex);
+      std::vector<DeviceResult<T>> results(devices.size());
+      for (size_t i = 0; i < devices.size(); i++) {
+        auto &r = results[i];
+        r.device = devices[i];
+        r.success = outcomes[i].success;
+        r.timed_out = outcomes[i].timed_out;
+        r.error = outcomes[i].error;
+        r.duration = outcomes[i].duration;
+        if (r.success) r.value = std::move(values->values[i]);
+      }
+      return results;
+    }
+
+}
+}
+
+#endif //LIBNITROKEY_FLEET_H
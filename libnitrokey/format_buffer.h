@@ -0,0 +1,144 @@
+/*
+ * Copyright (c) 2015-2018 Nitrokey UG
+ *
+ * This file is part of libnitrokey.
+ *
+ * libnitrokey is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libnitrokey is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libnitrokey. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0
+ */
+
+#ifndef LIBNITROKEY_FORMAT_BUFFER_H
+#define LIBNITROKEY_FORMAT_BUFFER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <type_traits>
+
+namespace nitrokey {
+namespace misc {
+
+    /** Integer printed as lowercase hex, zero padded to the width. */
+    struct HexValue {
+        uint64_t value;
+        int width;
+    };
+
+    inline HexValue hex(uint64_t value, int width = 0) { return {value, width}; }
+
+    /** Byte printed as 8 binary digits, most significant first. */
+    struct BitsValue {
+        uint8_t value;
+    };
+
+    inline BitsValue bits(uint8_t value) { return {value}; }
+
+    /** Memory printed as misc::hexdump does, without building a string first. */
+    struct HexdumpView {
+        const uint8_t *data;
+        size_t size;
+        bool print_header;
+        bool print_ascii;
+        bool print_empty;
+    };
+
+    inline HexdumpView hexdump_view(const uint8_t *p, size_t size, bool print_header = true,
+                                    bool print_ascii = true, bool print_empty = true) {
+      return {p, size, print_header, print_ascii, print_empty};
+    }
+
+    /**
+     * Longest hexdump line: offset of up to 16 hex digits and tab, 16 bytes,
+     * ASCII column and newline.
+     */
+    const size_t HEXDUMP_LINE_MAX = 16 + 1 + 16 * 3 + 2 + 16 + 1;
+
+    /**
+     * Writes the hexdump line of the bytes starting at offset into out,
+     * which has to hold HEXDUMP_LINE_MAX characters.
+     * @return number of characters written
+     */
+    size_t format_hexdump_line(char *out, const HexdumpView &view, size_t offset);
+
+    /**
+     * Fixed capacity text buffer living on the stack, replacing std::stringstream
+     * in the packet dissectors. Numbers are encoded with lookup tables, nothing
+     * is allocated until str() is called. Output exceeding the capacity is cut
+     * and marked with "...".
+     * Characters and unsigned char pointers are printed as text, as by std::ostream.
+     */
+    class FormatBuffer {
+    public:
+        static const size_t CAPACITY = 4096;
+
+        FormatBuffer() : m_size(0), m_truncated(false) {}
+        FormatBuffer(const FormatBuffer &) = delete;
+        FormatBuffer &operator=(const FormatBuffer &) = delete;
+
+        FormatBuffer &append(const char *s, size_t size);
+
+        FormatBuffer &operator<<(const char *s);
+        FormatBuffer &operator<<(const unsigned char *s) { return *this << reinterpret_cast<const char *>(s); }
+        FormatBuffer &operator<<(const std::string &s) { return append(s.data(), s.size()); }
+        FormatBuffer &operator<<(char c) { return append(&c, 1); }
+        FormatBuffer &operator<<(unsigned char c) { return *this << static_cast<char>(c); }
+        FormatBuffer &operator<<(signed char c) { return *this << static_cast<char>(c); }
+        FormatBuffer &operator<<(bool b) { return *this << (b ? '1' : '0'); }
+        FormatBuffer &operator<<(HexValue v);
+        FormatBuffer &operator<<(BitsValue v);
+        FormatBuffer &operator<<(const HexdumpView &v);
+
+        template <typename T>
+        typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value, FormatBuffer &>::type
+        operator<<(T value) {
+          return append_decimal(static_cast<int64_t>(value));
+        }
+
+        template <typename T>
+        typename std::enable_if<std::is_integral<T>::value && std::is_unsigned<T>::value, FormatBuffer &>::type
+        operator<<(T value) {
+          return append_decimal(static_cast<uint64_t>(value));
+        }
+
+        /** Scoped enumerations are printed as their numeric value. */
+        template <typename T>
+        typename std::enable_if<std::is_enum<T>::value, FormatBuffer &>::type
+        operator<<(T value) {
+          return *this << static_cast<typename std::underlying_type<T>::type>(value);
+        }
+
+        const char *data() const { return m_data; }
+        size_t size() const { return m_size; }
+        bool truncated() const { return m_truncated; }
+        std::string str() const;
+
+    private:
+        FormatBuffer &append_decimal(uint64_t value);
+        FormatBuffer &append_decimal(int64_t value);
+
+        char m_data[CAPACITY];
+        size_t m_size;
+        bool m_truncated;
+    };
+
+    std::ostream &operator<<(std::ostream &out, HexValue v);
+    std::ostream &operator<<(std::ostream &out, BitsValue v);
+    std::ostream &operator<<(std::ostream &out, const HexdumpView &v);
+
+}
+}
+
+#endif //LIBNITROKEY_FORMAT_BUFFER_H
@@ -0,0 +1,161 @@
+/*
+ * Copyright (c) 2015-2018 Nitrokey UG
+ *
+ * This file is part of libnitrokey.
+ *
+ * libnitrokey is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libnitrokey is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libnitrokey. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0
+ */
+
+#ifndef LIBNITROKEY_LATENCY_STATS_H
+#define LIBNITROKEY_LATENCY_STATS_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+namespace nitrokey {
+namespace device {
+
+    struct HistogramSnapshot {
+        struct Bucket {
+            /** highest value counted in the bucket, in microseconds */
+            uint64_t upper_bound_us;
+            uint64_t count;
+        };
+
+        uint64_t count = 0;
+        uint64_t sum_us = 0;
+        uint64_t min_us = 0;
+        uint64_t max_us = 0;
+        /** non-empty buckets, in increasing order */
+        std::vector<Bucket> buckets;
+
+        /**
+         * Returns the upper bound of the bucket holding the given percentile,
+         * within the histogram precision (1/8 of the value).
+         * @param percentile in the range [0, 100]
+         */
+        uint64_t percentile(double percentile) const;
+    };
+
+    /**
+     * Latency histogram with log-linear buckets: each power of two range is
+     * split linearly into 8 buckets, which keeps the relative error under
+     * 12.5% over the whole range (1 us to 19 hours). Recording is lock-free.
+     */
+    class LatencyHistogram {
+    public:
+        static const int SUB_BUCKET_BITS = 3;
+        static const int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+        static const int MAX_EXPONENT = 35;
+        static const int BUCKET_COUNT = (MAX_EXPONENT - SUB_BUCKET_BITS + 2) * SUB_BUCKETS;
+
+        LatencyHistogram();
+        void record(uint64_t value_us);
+        HistogramSnapshot snapshot() const;
+        void reset();
+
+        static int bucket_index(uint64_t value_us);
+        static uint64_t bucket_upper_bound(int index);
+
+    private:
+        std::atomic<uint64_t> m_buckets[BUCKET_COUNT];
+        std::atomic<uint64_t> m_sum;
+        std::atomic<uint64_t> m_min;
+        std::atomic<uint64_t> m_max;
+    };
+
+    struct CommandLatencySnapshot {
+        uint8_t command_id = 0;
+        /** number of transactions */
+        uint64_t count = 0;
+        /** number of responses read from the device */
+        uint64_t polls = 0;
+        /** number of busy responses */
+        uint64_t busy = 0;
+        /** time from sending the command until the transaction finished */
+        HistogramSnapshot total;
+        /** time from sending the command until the first not busy response */
+        HistogramSnapshot first_response;
+    };
+
+    /**
+     * Transaction latency statistics of a single device, kept per command ID.
+     */
+    class LatencyStats {
+    public:
+        struct CommandStats {
+            std::atomic<uint64_t> count;
+            std::atomic<uint64_t> polls;
+            std::atomic<uint64_t> busy;
+            LatencyHistogram total;
+            LatencyHistogram first_response;
+
+            CommandStats();
+        };
+
+        LatencyStats();
+        ~LatencyStats();
+        LatencyStats(const LatencyStats &) = delete;
+        LatencyStats &operator=(const LatencyStats &) = delete;
+
+        CommandStats &for_command(uint8_t command_id);
+        /**
+         * Returns statistics of the commands run at least once since creation or reset.
+         * Does not block the recording.
+         */
+        std::vector<CommandLatencySnapshot> snapshot() const;
+        void reset();
+
+    private:
+        // allocated on first use of the command
+        std::atomic<CommandStats *> m_commands[256];
+    };
+
+    /**
+     * Measures a single transaction and records it on destruction,
+     * including transactions ending with an exception.
+     */
+    class TransactionTimer {
+    public:
+        TransactionTimer(LatencyStats &stats, uint8_t command_id);
+        ~TransactionTimer();
+        TransactionTimer(const TransactionTimer &) = delete;
+        TransactionTimer &operator=(const TransactionTimer &) = delete;
+
+        enum class PollResult {
+            READY,
+            BUSY,
+            /** response could not be read */
+            FAILED
+        };
+
+        /**
+         * Records a single attempt to read the response from the device.
+         */
+        void poll(PollResult result);
+
+    private:
+        LatencyStats::CommandStats &m_stats;
+        std::chrono::steady_clock::time_point m_start;
+        bool m_responded;
+    };
+
+}
+}
+
+#endif //LIBNITROKEY_LATENCY_STATS_H
@@ -22,8 +22,13 @@
 #ifndef LOG_H
 #define LOG_H
 
+#include <atomic>
+#include <cstdint>
+#include <ctime>
 #include <string>
 #include <functional>
+#include <memory>
+#include <mutex>
 
 namespace nitrokey {
   namespace log {
@@ -46,16 +51,23 @@ namespace nitrokey {
     class LogHandler {
     public:
       virtual void print(const std::string &, Loglevel lvl) = 0;
+      /**
+       * Prints a message logged at the given time. Called by the asynchronous
+       * logging, which prints the messages later, from its own thread.
+       */
+      virtual void print_at(const std::string &str, Loglevel lvl, std::time_t) { print(str, lvl); }
       virtual ~LogHandler() = default;
     protected:
       std::string loglevel_to_str(Loglevel);
       std::string format_message_to_string(const std::string &str, const Loglevel &lvl);
+      std::string format_message_to_string(const std::string &str, const Loglevel &lvl, std::time_t time);
 
     };
 
     class StdlogHandler : public LogHandler {
     public:
       virtual void print(const std::string &, Loglevel lvl) override;
+      virtual void print_at(const std::string &, Loglevel lvl, std::time_t time) override;
     };
 
     class FunctionalLogHandler : public LogHandler {
@@ -64,6 +76,7 @@ namespace nitrokey {
     public:
       FunctionalLogHandler(log_function_type _log_function);
       virtual void print(const std::string &, Loglevel lvl) override;
+      virtual void print_at(const std::string &, Loglevel lvl, std::time_t time) override;
 
     };
 
@@ -78,29 +91,83 @@ namespace nitrokey {
 
     extern StdlogHandler stdlog_handler;
 
+    enum class LogOverflowPolicy {
+      /** drop the message, counting it in Log::dropped_messages() */
+      DROP,
+      /** wait until the output thread makes space */
+      BLOCK
+    };
+
+    class AsyncLogQueue;
+
     class Log {
     public:
-      Log() : mp_loghandler(&stdlog_handler), m_loglevel(Loglevel::WARNING) {}
+      static const size_t DEFAULT_ASYNC_CAPACITY = 4096;
+
+      Log() : mp_loghandler(&stdlog_handler), m_loglevel(Loglevel::WARNING), mp_async(nullptr),
+              m_async_enabled(false), m_async_producers(0), m_overflow_policy(LogOverflowPolicy::DROP) {}
 
       static Log &instance() {
-        if (mp_instance == nullptr) mp_instance = new Log;
-        return *mp_instance;
+        // initialization is thread-safe; never destroyed, so logging works until exit
+        static Log *instance = new Log;
+        return *instance;
       }
 
       void operator()(const std::string &, Loglevel);
+      /**
+       * Returns true if messages of the level are printed. Check before
+       * building expensive messages.
+       */
+      bool is_enabled(Loglevel lvl) const {
+        return mp_loghandler.load() != nullptr && static_cast<int>(lvl) <= static_cast<int>(m_loglevel.load());
+      }
       void set_loglevel(Loglevel lvl) { m_loglevel = lvl; }
+      /**
+       * While asynchronous logging is enabled, the background thread may still
+       * print with the previous handler after this returns, so do not destroy
+       * it before calling disable_async() or flush().
+       */
       void set_handler(LogHandler *handler) { mp_loghandler = handler; }
 
+      /**
+       * Moves the formatting and printing of the messages to a background
+       * thread. Logging only copies the message into a bounded queue.
+       * The handler is then called from the background thread.
+       * @param capacity number of queued messages, rounded up to a power of two;
+       *  used when enabled for the first time only
+       * @param policy what to do with messages logged when the queue is full
+       */
+      void enable_async(size_t capacity = DEFAULT_ASYNC_CAPACITY,
+                        LogOverflowPolicy policy = LogOverflowPolicy::DROP);
+      /**
+       * Prints the queued messages and returns to printing from the logging thread.
+       * Waits for the threads queueing a message at the moment, so none is left
+       * in the stopped queue.
+       */
+      void disable_async();
+      /**
+       * Waits until the messages logged so far are printed.
+       */
+      void flush();
+      /**
+       * Number of messages dropped, because the queue was full.
+       */
+      uint64_t dropped_messages() const;
+
     private:
-      LogHandler *mp_loghandler;
-      Loglevel m_loglevel;
-      static std::string prefix;
+      std::atomic<LogHandler *> mp_loghandler;
+      std::atomic<Loglevel> m_loglevel;
+      // created on first use and never destroyed, as logging threads can still hold it
+      std::atomic<AsyncLogQueue *> mp_async;
+      std::atomic_bool m_async_enabled;
+      /** number of threads checked m_async_enabled and pushing to the queue */
+      std::atomic<unsigned> m_async_producers;
+      std::atomic<LogOverflowPolicy> m_overflow_policy;
+      std::mutex m_async_mutex;
+      /** replaced as a whole, so logging threads only load the pointer; empty when null */
+      static std::shared_ptr<const std::string> prefix;
     public:
       static void setPrefix(std::string prefix = std::string());
-
-    private:
-
-      static Log *mp_instance;
     };
   }
 }
@@ -0,0 +1,44 @@
+/*
+ * Copyright (c) 2015-2018 Nitrokey UG
+ *
+ * This file is part of libnitrokey.
+ *
+ * libnitrokey is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libnitrokey is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libnitrokey. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0
+ */
+
+#ifndef LIBNITROKEY_METRICS_H
+#define LIBNITROKEY_METRICS_H
+
+#include <string>
+
+namespace nitrokey {
+namespace metrics {
+
+    /**
+     * Renders the counters and latency histograms of all device objects in
+     * the OpenMetrics text format, labelled with the device path, model and
+     * serial number. Only devices with an open handle are included.
+     *
+     * Reads the statistics kept in memory: does not communicate with the
+     * devices and does not wait for the device locks, so it is safe to call
+     * from a scraping thread while commands are running.
+     */
+    std::string openmetrics_text();
+
+}
+}
+
+#endif //LIBNITROKEY_METRICS_H
@@ -28,6 +28,8 @@
 #include <string.h>
 #include "log.h"
 #include "LibraryException.h"
+#include "format_buffer.h"
+#include "secure_arena.h"
 #include <sstream>
 #include <stdexcept>
 #include <iomanip>
@@ -113,8 +115,32 @@ typename T::CommandPayload get_payload(){
 
     std::string hexdump(const uint8_t *p, size_t size, bool print_header=true, bool print_ascii=true,
         bool print_empty=true);
+    /**
+     * Overwrites memory holding secrets with zeros. Unlike bzero, the write
+     * is not removed by the compiler even if the memory is not read afterwards.
+     */
+    void secure_zero(void *p, size_t size);
     uint32_t stm_crc32(const uint8_t *data, size_t size);
     std::vector<uint8_t> hex_string_to_byte(const char* hexString);
+    /**
+     * As hex_string_to_byte, for secrets: the result is kept in SecureArena memory.
+     */
+    secure_vector<uint8_t> hex_string_to_secure_byte(const char* hexString);
+    /**
+     * Decodes hex string into the given buffer. Both lower and upper case digits are accepted.
+     * Throws InvalidHexString on invalid character or odd length,
+     * and TargetBufferSmallerThanSource when the result does not fit the buffer.
+     * @return number of bytes written
+     */
+    size_t hex_decode(const char *src, size_t src_size, uint8_t *dest, size_t dest_size);
+    /**
+     * Decodes RFC 4648 base32 string (as used in otpauth:// URIs) into the given buffer.
+     * Case is ignored, as are spaces, dashes and trailing padding.
+     * Throws InvalidBase32String on invalid character,
+     * and TargetBufferSmallerThanSource when the result does not fit the buffer.
+     * @return number of bytes written
+     */
+    size_t base32_decode(const char *src, size_t src_size, uint8_t *dest, size_t dest_size);
 }
 }
 
@@ -0,0 +1,143 @@
+/*
+ * Copyright (c) 2015-2018 Nitrokey UG
+ *
+ * This file is part of libnitrokey.
+ *
+ * libnitrokey is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libnitrokey is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libnitrokey. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0
+ */
+
+#ifndef LIBNITROKEY_PROVISIONING_H
+#define LIBNITROKEY_PROVISIONING_H
+
+#include <cstdint>
+#include <functional>
+#include <istream>
+#include <string>
+#include <vector>
+
+namespace nitrokey {
+    class NitrokeyManager;
+
+namespace provisioning {
+
+    enum class OTPType {
+        HOTP,
+        TOTP,
+    };
+
+    /**
+     * Maximal OTP secret size in bytes (320 bits), as supported by the newer firmwares.
+     */
+    const size_t OTP_SECRET_MAX_SIZE = 40;
+
+    /**
+     * Single OTP slot to write. The decoded secret is kept in a fixed buffer,
+     * which is wiped on destruction and on clear().
+     */
+    struct OTPEntry {
+        OTPType type = OTPType::TOTP;
+        uint8_t slot_number = 0;
+        std::string name;
+        uint8_t secret[OTP_SECRET_MAX_SIZE];
+        size_t secret_size = 0;
+        /** HOTP only */
+        uint64_t counter = 0;
+        /** TOTP only, in seconds */
+        uint16_t period = 30;
+        bool use_8_digits = false;
+        /** line of the source the entry was read from */
+        size_t line = 0;
+
+        OTPEntry();
+        OTPEntry(const OTPEntry &other);
+        OTPEntry &operator=(const OTPEntry &other);
+        ~OTPEntry();
+        void clear();
+    };
+
+    /**
+     * Reads OTP entries from a text stream, one entry per line, without
+     * loading the whole source to memory. Supported line formats:
+     *  - otpauth:// URI, e.g. otpauth://totp/alice?secret=JBSWY3DPEHPK3PXP&period=30&digits=6
+     *    Slots are assigned in order of appearance for each OTP type, unless
+     *    given with a non-standard "slot" parameter. The label is used as the
+     *    slot name and cut to the slot name length.
+     *  - CSV: type,slot,name,secret[,counter_or_period[,digits]]
+     *    where type is hotp or totp, and secret is base32 encoded, or hex
+     *    encoded when prefixed with "hex:".
+     * Empty lines, lines starting with '#' and a "type,..." CSV header are skipped.
+     */
+    class OTPSourceReader {
+    public:
+        explicit OTPSourceReader(std::istream &input);
+        ~OTPSourceReader();
+
+        /**
+         * Reads the next entry.
+         * Throws InvalidOTPSourceEntry, InvalidBase32String or InvalidHexString on
+         * malformed line. Reading can be continued with the next line afterwards.
+         * @return false at the end of the input
+         */
+        bool next(OTPEntry &entry);
+        size_t line() const { return m_line_number; }
+
+    private:
+        void parse_uri(OTPEntry &entry);
+        void parse_csv(OTPEntry &entry);
+
+        std::istream &m_input;
+        std::string m_line;
+        size_t m_line_number;
+        uint8_t m_next_slot[2];
+    };
+
+    struct ProvisioningProgress {
+        /** number of entries processed so far, including the current one */
+        size_t processed;
+        size_t line;
+        /** null when the line could not be parsed */
+        const OTPEntry *entry;
+        bool success;
+        /** error description, empty on success */
+        std::string error;
+    };
+
+    using ProgressCallback = std::function<void(const ProvisioningProgress &)>;
+
+    struct ProvisioningReport {
+        size_t written = 0;
+        size_t failed = 0;
+        /** source line and error description of each failed entry */
+        std::vector<std::pair<size_t, std::string>> errors;
+    };
+
+    /**
+     * Writes OTP entries read from the input to the connected device.
+     * The admin PIN is sent once for the whole batch, and the device capabilities
+     * (secret length) are checked once before the first write.
+     * @param admin_pin admin PIN
+     * @param temporary_password temporary password used for all the writes
+     * @param progress optional callback, called after each entry
+     * @param stop_on_error rethrow the first error instead of reporting it and continuing
+     */
+    ProvisioningReport provision_OTP(NitrokeyManager &manager, std::istream &input, const char *admin_pin,
+                                     const char *temporary_password, ProgressCallback progress = nullptr,
+                                     bool stop_on_error = false);
+
+}
+}
+
+#endif //LIBNITROKEY_PROVISIONING_H
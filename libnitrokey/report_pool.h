@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2015-2018 Nitrokey UG
+ *
+ * This file is part of libnitrokey.
+ *
+ * libnitrokey is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libnitrokey is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libnitrokey. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0
+ */
+
+#ifndef LIBNITROKEY_REPORT_POOL_H
+#define LIBNITROKEY_REPORT_POOL_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace nitrokey {
+namespace device {
+
+    /**
+     * Response report buffers of a single device, reused between transactions
+     * so the responses are decoded in place instead of being copied. Each
+     * buffer is aligned to a cache line. Buffers are wiped with
+     * misc::secure_zero when released, as they may hold secrets.
+     * The memory comes from misc::SecureArena, also when all the pooled
+     * buffers are taken and more are allocated.
+     */
+    class ReportPool {
+    public:
+        /** size of a HID report, see HID_REPORT_SIZE */
+        static const size_t REPORT_SIZE = 65;
+        static const int POOL_SIZE = 8;
+
+        ReportPool();
+        ~ReportPool();
+        ReportPool(const ReportPool &) = delete;
+        ReportPool &operator=(const ReportPool &) = delete;
+
+        /**
+         * Returns a zeroed buffer of REPORT_SIZE bytes. Thread-safe.
+         */
+        uint8_t *acquire();
+        /**
+         * Wipes the buffer and returns it to the pool. Thread-safe.
+         */
+        void release(uint8_t *report);
+
+        /** number of buffers allocated outside of the pool, as it was empty */
+        uint64_t get_overflow_allocations() const { return m_overflow_allocations.load(std::memory_order_relaxed); }
+
+    private:
+        static const size_t SLOT_SIZE = 128;
+        static const size_t CACHE_LINE = 64;
+        static const size_t STORAGE_SIZE = POOL_SIZE * SLOT_SIZE + CACHE_LINE;
+
+        uint8_t *slot(int index) const { return m_slots + index * SLOT_SIZE; }
+
+        uint8_t *m_storage;
+        /** first slot, aligned within m_storage */
+        uint8_t *m_slots;
+        /** bit set for each free slot */
+        std::atomic<uint32_t> m_free;
+        std::atomic<uint64_t> m_overflow_allocations;
+    };
+
+}
+}
+
+#endif //LIBNITROKEY_REPORT_POOL_H
@@ -0,0 +1,127 @@
+/*
+ * Copyright (c) 2015-2018 Nitrokey UG
+ *
+ * This file is part of libnitrokey.
+ *
+ * libnitrokey is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libnitrokey is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libnitrokey. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0
+ */
+
+#ifndef LIBNITROKEY_SECURE_ARENA_H
+#define LIBNITROKEY_SECURE_ARENA_H
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace nitrokey {
+namespace misc {
+
+    struct SecureArenaStats {
+        /** memory mapped for the arena, in bytes */
+        size_t reserved = 0;
+        /** part of the reserved memory locked in RAM */
+        size_t locked = 0;
+        /** blocks currently allocated */
+        size_t allocated_blocks = 0;
+        /** mappings which could not be locked, see RLIMIT_MEMLOCK */
+        uint64_t lock_failures = 0;
+    };
+
+    /**
+     * Allocator for the buffers holding secrets: PINs, OTP secrets, passwords
+     * and device responses. Memory comes from pages locked in RAM, so it is
+     * never swapped out, and excluded from core dumps where supported.
+     * Blocks are served from free lists of power of two size classes, in
+     * constant time, and wiped with secure_zero when freed. Pages are kept
+     * for reuse. Blocks bigger than MAX_BLOCK_SIZE get their own mapping.
+     * Without mmap, or when locking fails, plain memory is used.
+     */
+    class SecureArena {
+    public:
+        static const size_t MIN_BLOCK_SIZE = 32;
+        static const size_t MAX_BLOCK_SIZE = 2048;
+
+        /** process-wide instance, never destroyed */
+        static SecureArena &instance();
+
+        /**
+         * Returns a zeroed block of at least the given size, suitably aligned
+         * for any fundamental type.
+         * @throws std::bad_alloc
+         */
+        void *allocate(size_t size);
+        /**
+         * Wipes and frees the block. The size must be the one given to allocate().
+         */
+        void deallocate(void *p, size_t size);
+
+        SecureArenaStats get_stats();
+
+    private:
+        static const int CLASS_COUNT = 7;
+        /** mapping granularity where the system does not report its page size */
+        static const size_t FALLBACK_PAGE_BYTES = 4096;
+
+        struct FreeBlock {
+            FreeBlock *next;
+        };
+
+        SecureArena();
+        static size_t system_page_bytes();
+        static int size_class(size_t size);
+        /** maps, locks and zeroes the memory, call with m_mutex locked */
+        void *map_pages(size_t size);
+        void unmap_pages(void *p, size_t size);
+
+        /** the system page size, the granularity of the mappings */
+        const size_t m_page_bytes;
+        std::mutex m_mutex;
+        FreeBlock *m_free[CLASS_COUNT];
+        SecureArenaStats m_stats;
+    };
+
+    /**
+     * Standard allocator over SecureArena, for containers holding secrets.
+     */
+    template <typename T>
+    struct SecureAllocator {
+        using value_type = T;
+
+        SecureAllocator() = default;
+        template <typename U>
+        SecureAllocator(const SecureAllocator<U> &) {}
+
+        T *allocate(size_t n) {
+          return static_cast<T *>(SecureArena::instance().allocate(n * sizeof(T)));
+        }
+        void deallocate(T *p, size_t n) {
+          SecureArena::instance().deallocate(p, n * sizeof(T));
+        }
+    };
+
+    template <typename T, typename U>
+    bool operator==(const SecureAllocator<T> &, const SecureAllocator<U> &) { return true; }
+    template <typename T, typename U>
+    bool operator!=(const SecureAllocator<T> &, const SecureAllocator<U> &) { return false; }
+
+    template <typename T>
+    using secure_vector = std::vector<T, SecureAllocator<T>>;
+
+}
+}
+
+#endif //LIBNITROKEY_SECURE_ARENA_H
@@ -0,0 +1,133 @@
+/*
+ * Copyright (c) 2015-2018 Nitrokey UG
+ *
+ * This file is part of libnitrokey.
+ *
+ * libnitrokey is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libnitrokey is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libnitrokey. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0
+ */
+
+#ifndef LIBNITROKEY_SLOT_SYNC_H
+#define LIBNITROKEY_SLOT_SYNC_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace nitrokey {
+    class NitrokeyManager;
+
+namespace sync {
+
+    enum class SlotKind {
+        HOTP,
+        TOTP,
+        PWS,
+    };
+
+    /**
+     * Desired state of a single HOTP or TOTP slot.
+     * OTP secrets cannot be read back from the device, so a slot whose
+     * metadata matches is left untouched unless secret_changed is set.
+     */
+    struct OTPSlotTarget {
+        uint8_t slot_number = 0;
+        /** false to have the slot erased */
+        bool programmed = true;
+        std::string name;
+        /** hex encoded secret, used only when the slot has to be written */
+        std::string secret;
+        /** HOTP: minimal counter value, TOTP: time window in seconds, at most 65535 */
+        uint64_t counter_or_interval = 0;
+        bool use_8_digits = false;
+        bool use_enter = false;
+        bool use_tokenID = false;
+        std::string token_ID;
+        /** force rewriting the slot, e.g. after the secret was rotated */
+        bool secret_changed = false;
+    };
+
+    /**
+     * Desired state of a single Password Safe slot.
+     */
+    struct PWSSlotTarget {
+        uint8_t slot_number = 0;
+        /** false to have the slot erased */
+        bool programmed = true;
+        std::string name;
+        std::string login;
+        std::string password;
+    };
+
+    /**
+     * Desired state of the device. Only the listed slots are managed,
+     * all other slots are neither read nor modified.
+     */
+    struct SyncTarget {
+        std::vector<OTPSlotTarget> hotp;
+        std::vector<OTPSlotTarget> totp;
+        std::vector<PWSSlotTarget> pws;
+    };
+
+    enum class ActionType {
+        WRITE,
+        ERASE,
+    };
+
+    struct SyncAction {
+        SlotKind kind;
+        uint8_t slot_number;
+        ActionType type;
+        /** human readable cause of the action, e.g. "name differs" */
+        std::string reason;
+    };
+
+    /**
+     * Minimal list of writes and erases bringing the device to the target state.
+     */
+    struct SyncPlan {
+        std::vector<SyncAction> actions;
+        /** number of slots already matching the target */
+        size_t unchanged = 0;
+
+        bool empty() const { return actions.empty(); }
+        bool has_otp_actions() const;
+        /** Dry-run report, one line per managed slot change */
+        std::string dissect() const;
+    };
+
+    /**
+     * Reads current metadata of the managed slots and compares it with the target.
+     * Only reads are issued to the device. Password Safe has to be unlocked
+     * if the target contains any PWS slots.
+     * @throws InvalidSlotException for a duplicated or out of range slot number,
+     *  or a TOTP time window out of range
+     */
+    SyncPlan plan(NitrokeyManager &manager, const SyncTarget &target);
+
+    /**
+     * Executes a plan created with plan() for the same target.
+     * The admin PIN is only sent to the device when the plan contains OTP
+     * writes or erases, so applying an empty plan is free.
+     * @param admin_pin admin PIN used to authenticate OTP changes
+     * @param temporary_password temporary password to use for the OTP changes
+     */
+    void apply(NitrokeyManager &manager, const SyncTarget &target, const SyncPlan &plan,
+               const char *admin_pin, const char *temporary_password);
+
+}
+}
+
+#endif //LIBNITROKEY_SLOT_SYNC_H
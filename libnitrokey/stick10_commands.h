@@ -22,7 +22,6 @@
 #ifndef STICK10_COMMANDS_H
 #define STICK10_COMMANDS_H
 
-#include <bitset>
 #include <iomanip>
 #include <string>
 #include <sstream>
@@ -49,8 +48,8 @@ class GetSlotName : public Command<CommandID::READ_SLOT_NAME> {
 
     bool isValid() const { return slot_number<0x10+3; }
       std::string dissect() const {
-          std::stringstream ss;
-          ss << "slot_number:\t" << static_cast<int>(slot_number) << std::endl;
+          ::nitrokey::misc::FormatBuffer ss;
+          ss << "slot_number:\t" << static_cast<int>(slot_number) << '\n';
           return ss.str();
       }
   } __packed;
@@ -60,7 +59,7 @@ class GetSlotName : public Command<CommandID::READ_SLOT_NAME> {
 
     bool isValid() const { return true; }
       std::string dissect() const {
-        std::stringstream ss;
+        ::nitrokey::misc::FormatBuffer ss;
         print_to_ss_volatile(slot_name);
         return ss.str();
       }
@@ -77,8 +76,8 @@ class EraseSlot : Command<CommandID::ERASE_SLOT> {
 
     bool isValid() const { return !(slot_number & 0xF0); }
       std::string dissect() const {
-          std::stringstream ss;
-          ss << "slot_number:\t" << static_cast<int>(slot_number) << std::endl;
+          ::nitrokey::misc::FormatBuffer ss;
+          ss << "slot_number:\t" << static_cast<int>(slot_number) << '\n';
           return ss.str();
       }
   } __packed;
@@ -95,9 +94,9 @@ class SetTime : Command<CommandID::SET_TIME> {
 
     bool isValid() const { return reset && reset != 1; }
       std::string dissect() const {
-          std::stringstream ss;
-          ss << "reset:\t" << static_cast<int>(reset) << std::endl;
-          ss << "time:\t" << (time) << std::endl;
+          ::nitrokey::misc::FormatBuffer ss;
+          ss << "reset:\t" << static_cast<int>(reset) << '\n';
+          ss << "time:\t" << (time) << '\n';
           return ss.str();
       }
   } __packed;
@@ -137,21 +136,21 @@ class WriteToHOTPSlot : Command<CommandID::WRITE_TO_SLOT> {
 
     bool isValid() const { return !(slot_number & 0xF0); }
     std::string dissect() const {
-        std::stringstream ss;
-        ss << "slot_number:\t" << static_cast<int>(slot_number) << std::endl;
+        ::nitrokey::misc::FormatBuffer ss;
+        ss << "slot_number:\t" << static_cast<int>(slot_number) << '\n';
         print_to_ss_volatile(slot_name);
         print_to_ss_volatile(slot_secret);
-        ss << "slot_config:\t" << std::bitset<8>(static_cast<int>(_slot_config)) << std::endl;
-        ss << "\tuse_8_digits(0):\t" << use_8_digits << std::endl;
-        ss << "\tuse_enter(1):\t" << use_enter << std::endl;
-        ss << "\tuse_tokenID(2):\t" << use_tokenID << std::endl;
+        ss << "slot_config:\t" << ::nitrokey::misc::bits(_slot_config) << '\n';
+        ss << "\tuse_8_digits(0):\t" << use_8_digits << '\n';
+        ss << "\tuse_enter(1):\t" << use_enter << '\n';
+        ss << "\tuse_tokenID(2):\t" << use_tokenID << '\n';
 
         ss << "slot_token_id:\t";
         for (auto i : slot_token_id)
-            ss << std::hex << std::setw(2) << std::setfill('0')<< static_cast<int>(i) << " " ;
-        ss << std::endl;
+            ss << ::nitrokey::misc::hex(i, 2) << " ";
+        ss << '\n';
         ss << "slot_counter:\t[" << static_cast<int>(slot_counter) << "]\t"
-         << ::nitrokey::misc::hexdump(reinterpret_cast<const uint8_t *>(&slot_counter), sizeof slot_counter, false);
+         << ::nitrokey::misc::hexdump_view(reinterpret_cast<const uint8_t *>(&slot_counter), sizeof slot_counter, false);
 
       return ss.str();
     }
@@ -188,16 +187,16 @@ class WriteToTOTPSlot : Command<CommandID::WRITE_TO_SLOT> {
 
     bool isValid() const { return !(slot_number & 0xF0); } //TODO check
       std::string dissect() const {
-          std::stringstream ss;
-          ss << "slot_number:\t" << static_cast<int>(slot_number) << std::endl;
+          ::nitrokey::misc::FormatBuffer ss;
+          ss << "slot_number:\t" << static_cast<int>(slot_number) << '\n';
           print_to_ss_volatile(slot_name);
           print_to_ss_volatile(slot_secret);
-          ss << "slot_config:\t" << std::bitset<8>(static_cast<int>(_slot_config)) << std::endl;
+          ss << "slot_config:\t" << ::nitrokey::misc::bits(_slot_config) << '\n';
           ss << "slot_token_id:\t";
           for (auto i : slot_token_id)
-              ss << std::hex << std::setw(2) << std::setfill('0')<< static_cast<int>(i) << " " ;
-          ss << std::endl;
-          ss << "slot_interval:\t" << static_cast<int>(slot_interval) << std::endl;
+              ss << ::nitrokey::misc::hex(i, 2) << " ";
+          ss << '\n';
+          ss << "slot_interval:\t" << static_cast<int>(slot_interval) << '\n';
           return ss.str();
       }
   } __packed;
@@ -216,11 +215,11 @@ class GetTOTP : Command<CommandID::GET_CODE> {
 
     bool isValid() const { return !(slot_number & 0xF0); }
     std::string dissect() const {
-      std::stringstream ss;
-      ss << "slot_number:\t" << static_cast<int>(slot_number) << std::endl;
-      ss << "challenge:\t" << (challenge) << std::endl;
-      ss << "last_totp_time:\t" << (last_totp_time) << std::endl;
-      ss << "last_interval:\t" << static_cast<int>(last_interval) << std::endl;
+      ::nitrokey::misc::FormatBuffer ss;
+      ss << "slot_number:\t" << static_cast<int>(slot_number) << '\n';
+      ss << "challenge:\t" << (challenge) << '\n';
+      ss << "last_totp_time:\t" << (last_totp_time) << '\n';
+      ss << "last_interval:\t" << static_cast<int>(last_interval) << '\n';
       return ss.str();
     }
   } __packed;
@@ -243,12 +242,12 @@ class GetTOTP : Command<CommandID::GET_CODE> {
 
     bool isValid() const { return true; }
     std::string dissect() const {
-      std::stringstream ss;
-      ss << "code:\t" << (code) << std::endl;
-        ss << "slot_config:\t" << std::bitset<8>(static_cast<int>(_slot_config)) << std::endl;
-        ss << "\tuse_8_digits(0):\t" << use_8_digits << std::endl;
-        ss << "\tuse_enter(1):\t" << use_enter << std::endl;
-        ss << "\tuse_tokenID(2):\t" << use_tokenID << std::endl;
+      ::nitrokey::misc::FormatBuffer ss;
+      ss << "code:\t" << (code) << '\n';
+        ss << "slot_config:\t" << ::nitrokey::misc::bits(_slot_config) << '\n';
+        ss << "\tuse_8_digits(0):\t" << use_8_digits << '\n';
+        ss << "\tuse_enter(1):\t" << use_enter << '\n';
+        ss << "\tuse_tokenID(2):\t" << use_tokenID << '\n';
       return ss.str();
     }
   } __packed;
@@ -264,8 +263,8 @@ class GetHOTP : Command<CommandID::GET_CODE> {
 
     bool isValid() const { return (slot_number & 0xF0); }
     std::string dissect() const {
-      std::stringstream ss;
-      ss << "slot_number:\t" << static_cast<int>(slot_number) << std::endl;
+      ::nitrokey::misc::FormatBuffer ss;
+      ss << "slot_number:\t" << static_cast<int>(slot_number) << '\n';
       return ss.str();
     }
   } __packed;
@@ -288,12 +287,12 @@ class GetHOTP : Command<CommandID::GET_CODE> {
 
     bool isValid() const { return true; }
     std::string dissect() const {
-      std::stringstream ss;
-      ss << "code:\t" << (code) << std::endl;
-        ss << "slot_config:\t" << std::bitset<8>(static_cast<int>(_slot_config)) << std::endl;
-        ss << "\tuse_8_digits(0):\t" << use_8_digits << std::endl;
-        ss << "\tuse_enter(1):\t" << use_enter << std::endl;
-        ss << "\tuse_tokenID(2):\t" << use_tokenID << std::endl;
+      ::nitrokey::misc::FormatBuffer ss;
+      ss << "code:\t" << (code) << '\n';
+        ss << "slot_config:\t" << ::nitrokey::misc::bits(_slot_config) << '\n';
+        ss << "\tuse_8_digits(0):\t" << use_8_digits << '\n';
+        ss << "\tuse_enter(1):\t" << use_enter << '\n';
+        ss << "\tuse_tokenID(2):\t" << use_tokenID << '\n';
       return ss.str();
     }
   } __packed;
@@ -315,8 +314,8 @@ class ReadSlot : Command<CommandID::READ_SLOT> {
     bool isValid() const { return !(slot_number & 0xF0); }
 
     std::string dissect() const {
-      std::stringstream ss;
-      ss << "slot_number:\t" << static_cast<int>(slot_number) << std::endl;
+      ::nitrokey::misc::FormatBuffer ss;
+      ss << "slot_number:\t" << static_cast<int>(slot_number) << '\n';
       return ss.str();
     }
   } __packed;
@@ -348,19 +347,19 @@ class ReadSlot : Command<CommandID::READ_SLOT> {
     bool isValid() const { return true; }
 
     std::string dissect() const {
-      std::stringstream ss;
+      ::nitrokey::misc::FormatBuffer ss;
       print_to_ss_volatile(slot_name);
-      ss << "slot_config:\t" << std::bitset<8>(static_cast<int>(_slot_config)) << std::endl;
-      ss << "\tuse_8_digits(0):\t" << use_8_digits << std::endl;
-      ss << "\tuse_enter(1):\t" << use_enter << std::endl;
-      ss << "\tuse_tokenID(2):\t" << use_tokenID << std::endl;
+      ss << "slot_config:\t" << ::nitrokey::misc::bits(_slot_config) << '\n';
+      ss << "\tuse_8_digits(0):\t" << use_8_digits << '\n';
+      ss << "\tuse_enter(1):\t" << use_enter << '\n';
+      ss << "\tuse_tokenID(2):\t" << use_tokenID << '\n';
 
       ss << "slot_token_id:\t";
       for (auto i : slot_token_id)
-        ss << std::hex << std::setw(2) << std::setfill('0')<< static_cast<int>(i) << " " ;
-      ss << std::endl;
+        ss << ::nitrokey::misc::hex(i, 2) << " ";
+      ss << '\n';
       ss << "slot_counter:\t[" << static_cast<int>(slot_counter) << "]\t"
-         << ::nitrokey::misc::hexdump(reinterpret_cast<const uint8_t *>(&slot_counter), sizeof slot_counter, false);
+         << ::nitrokey::misc::hexdump_view(reinterpret_cast<const uint8_t *>(&slot_counter), sizeof slot_counter, false);
       return ss.str();
     }
   } __packed;
@@ -403,23 +402,23 @@ class GetStatus : Command<CommandID::GET_STATUS> {
     }
 
     std::string dissect() const {
-      std::stringstream ss;
+      ::nitrokey::misc::FormatBuffer ss;
       ss  << "firmware_version:\t"
           << "[" << firmware_version << "]" << "\t"
-          << ::nitrokey::misc::hexdump(
+          << ::nitrokey::misc::hexdump_view(
           reinterpret_cast<const uint8_t *>(&firmware_version), sizeof firmware_version, false);
-      ss << "card_serial_u32:\t" << std::hex << card_serial_u32 << std::endl;
+      ss << "card_serial_u32:\t" << ::nitrokey::misc::hex(card_serial_u32) << '\n';
       ss << "card_serial:\t"
-         << ::nitrokey::misc::hexdump(reinterpret_cast<const uint8_t *>(card_serial),
+         << ::nitrokey::misc::hexdump_view(reinterpret_cast<const uint8_t *>(card_serial),
                                       sizeof card_serial, false);
       ss << "general_config:\t"
-         << ::nitrokey::misc::hexdump(reinterpret_cast<const uint8_t *>(general_config),
+         << ::nitrokey::misc::hexdump_view(reinterpret_cast<const uint8_t *>(general_config),
                                       sizeof general_config, false);
-        ss << "numlock:\t" << static_cast<int>(numlock) << std::endl;
-        ss << "capslock:\t" << static_cast<int>(capslock) << std::endl;
-        ss << "scrolllock:\t" << static_cast<int>(scrolllock) << std::endl;
-        ss << "enable_user_password:\t" << static_cast<bool>(enable_user_password) << std::endl;
-        ss << "delete_user_password:\t" << static_cast<bool>(delete_user_password) << std::endl;
+        ss << "numlock:\t" << static_cast<int>(numlock) << '\n';
+        ss << "capslock:\t" << static_cast<int>(capslock) << '\n';
+        ss << "scrolllock:\t" << static_cast<int>(scrolllock) << '\n';
+        ss << "enable_user_password:\t" << static_cast<bool>(enable_user_password) << '\n';
+        ss << "delete_user_password:\t" << static_cast<bool>(delete_user_password) << '\n';
 
         return ss.str();
     }
@@ -436,8 +435,8 @@ class GetPasswordRetryCount : Command<CommandID::GET_PASSWORD_RETRY_COUNT> {
 
     bool isValid() const { return true; }
     std::string dissect() const {
-      std::stringstream ss;
-      ss << " password_retry_count\t" << static_cast<int>(password_retry_count) << std::endl;
+      ::nitrokey::misc::FormatBuffer ss;
+      ss << " password_retry_count\t" << static_cast<int>(password_retry_count) << '\n';
       return ss.str();
     }
   } __packed;
@@ -454,8 +453,8 @@ class GetUserPasswordRetryCount
 
     bool isValid() const { return true; }
     std::string dissect() const {
-      std::stringstream ss;
-      ss << " password_retry_count\t" << static_cast<int>(password_retry_count) << std::endl;
+      ::nitrokey::misc::FormatBuffer ss;
+      ss << " password_retry_count\t" << static_cast<int>(password_retry_count) << '\n';
       return ss.str();
     }
   } __packed;
@@ -467,9 +466,9 @@ class GetUserPasswordRetryCount
     template <typename T, typename Q, int N>
     void write_array(T &ss, Q (&arr)[N]){
         for (int i=0; i<N; i++){
-            ss << std::hex << std::setfill('0') << std::setw(2) << static_cast<int>(arr[i]) << " ";
+            ss << ::nitrokey::misc::hex(arr[i], 2) << " ";
         }
-        ss << std::endl;
+        ss << '\n';
     }
 
 
@@ -480,7 +479,7 @@ class GetPasswordSafeSlotStatus : Command<CommandID::GET_PW_SAFE_SLOT_STATUS> {
 
     bool isValid() const { return true; }
       std::string dissect() const {
-          std::stringstream ss;
+          ::nitrokey::misc::FormatBuffer ss;
           ss << "password_safe_status\t";
           write_array(ss, password_safe_status);
           return ss.str();
@@ -498,8 +497,8 @@ class GetPasswordSafeSlotName : Command<CommandID::GET_PW_SAFE_SLOT_NAME> {
 
     bool isValid() const { return !(slot_number & 0xF0); }
     std::string dissect() const {
-      std::stringstream ss;
-      ss << "slot_number\t" << static_cast<int>(slot_number) << std::endl;
+      ::nitrokey::misc::FormatBuffer ss;
+      ss << "slot_number\t" << static_cast<int>(slot_number) << '\n';
       return ss.str();
     }
   } __packed;
@@ -509,7 +508,7 @@ class GetPasswordSafeSlotName : Command<CommandID::GET_PW_SAFE_SLOT_NAME> {
 
     bool isValid() const { return true; }
     std::string dissect() const {
-      std::stringstream ss;
+      ::nitrokey::misc::FormatBuffer ss;
       print_to_ss_volatile(slot_name);
       return ss.str();
     }
@@ -527,8 +526,8 @@ class GetPasswordSafeSlotPassword
 
     bool isValid() const { return !(slot_number & 0xF0); }
     std::string dissect() const {
-      std::stringstream ss;
-      ss << "   slot_number\t" << static_cast<int>(slot_number) << std::endl;
+      ::nitrokey::misc::FormatBuffer ss;
+      ss << "   slot_number\t" << static_cast<int>(slot_number) << '\n';
       return ss.str();
     }
   } __packed;
@@ -538,7 +537,7 @@ class GetPasswordSafeSlotPassword
 
     bool isValid() const { return true; }
     std::string dissect() const {
-      std::stringstream ss;
+      ::nitrokey::misc::FormatBuffer ss;
       print_to_ss_volatile(slot_password);
       return ss.str();
     }
@@ -556,8 +555,8 @@ class GetPasswordSafeSlotLogin
 
     bool isValid() const { return !(slot_number & 0xF0); }
     std::string dissect() const {
-      std::stringstream ss;
-      ss << "   slot_number\t" << static_cast<int>(slot_number) << std::endl;
+      ::nitrokey::misc::FormatBuffer ss;
+      ss << "   slot_number\t" << static_cast<int>(slot_number) << '\n';
       return ss.str();
     }
   } __packed;
@@ -567,7 +566,7 @@ class GetPasswordSafeSlotLogin
 
     bool isValid() const { return true; }
     std::string dissect() const {
-      std::stringstream ss;
+      ::nitrokey::misc::FormatBuffer ss;
       print_to_ss_volatile(slot_login);
       return ss.str();
     }
@@ -586,8 +585,8 @@ class SetPasswordSafeSlotData : Command<CommandID::SET_PW_SAFE_SLOT_DATA_1> {
 
     bool isValid() const { return !(slot_number & 0xF0); }
       std::string dissect() const {
-          std::stringstream ss;
-          ss << " slot_number\t" << static_cast<int>(slot_number) << std::endl;
+          ::nitrokey::misc::FormatBuffer ss;
+          ss << " slot_number\t" << static_cast<int>(slot_number) << '\n';
           print_to_ss_volatile(slot_name);
           print_to_ss_volatile(slot_password);
           return ss.str();
@@ -606,8 +605,8 @@ class SetPasswordSafeSlotData2 : Command<CommandID::SET_PW_SAFE_SLOT_DATA_2> {
 
     bool isValid() const { return !(slot_number & 0xF0); }
       std::string dissect() const {
-        std::stringstream ss;
-        ss << " slot_number\t" << static_cast<int>(slot_number) << std::endl;
+        ::nitrokey::misc::FormatBuffer ss;
+        ss << " slot_number\t" << static_cast<int>(slot_number) << '\n';
         print_to_ss_volatile(slot_login_name);
         return ss.str();
       }
@@ -624,8 +623,8 @@ class ErasePasswordSafeSlot : Command<CommandID::PW_SAFE_ERASE_SLOT> {
 
     bool isValid() const { return !(slot_number & 0xF0); }
       std::string dissect() const {
-          std::stringstream ss;
-          ss << " slot_number\t" << static_cast<int>(slot_number) << std::endl;
+          ::nitrokey::misc::FormatBuffer ss;
+          ss << " slot_number\t" << static_cast<int>(slot_number) << '\n';
           return ss.str();
       }
 
@@ -642,7 +641,7 @@ class EnablePasswordSafe : Command<CommandID::PW_SAFE_ENABLE> {
 
     bool isValid() const { return true; }
     std::string dissect() const {
-      std::stringstream ss;
+      ::nitrokey::misc::FormatBuffer ss;
       print_to_ss_volatile(user_password);
       return ss.str();
     }
@@ -695,12 +694,12 @@ class WriteGeneralConfig : Command<CommandID::WRITE_CONFIG> {
     bool isValid() const { return numlock < 2 && capslock < 2 && scrolllock < 2 && enable_user_password < 2; }
 
     std::string dissect() const {
-          std::stringstream ss;
-          ss << "numlock:\t" << static_cast<int>(numlock) << std::endl;
-          ss << "capslock:\t" << static_cast<int>(capslock) << std::endl;
-          ss << "scrolllock:\t" << static_cast<int>(scrolllock) << std::endl;
-          ss << "enable_user_password:\t" << static_cast<bool>(enable_user_password) << std::endl;
-          ss << "delete_user_password:\t" << static_cast<bool>(delete_user_password) << std::endl;
+          ::nitrokey::misc::FormatBuffer ss;
+          ss << "numlock:\t" << static_cast<int>(numlock) << '\n';
+          ss << "capslock:\t" << static_cast<int>(capslock) << '\n';
+          ss << "scrolllock:\t" << static_cast<int>(scrolllock) << '\n';
+          ss << "enable_user_password:\t" << static_cast<bool>(enable_user_password) << '\n';
+          ss << "delete_user_password:\t" << static_cast<bool>(delete_user_password) << '\n';
           return ss.str();
       }
   } __packed;
@@ -718,9 +717,9 @@ class FirstAuthenticate : Command<CommandID::FIRST_AUTHENTICATE> {
     bool isValid() const { return true; }
 
     std::string dissect() const {
-      std::stringstream ss;
+      ::nitrokey::misc::FormatBuffer ss;
       print_to_ss_volatile(card_password);
-      hexdump_to_ss(temporary_password);
+      hexdump_to_ss_volatile(temporary_password);
       return ss.str();
     }
   } __packed;
@@ -737,9 +736,9 @@ class UserAuthenticate : Command<CommandID::USER_AUTHENTICATE> {
 
     bool isValid() const { return true; }
       std::string dissect() const {
-        std::stringstream ss;
+        ::nitrokey::misc::FormatBuffer ss;
         print_to_ss_volatile(card_password);
-        hexdump_to_ss(temporary_password);
+        hexdump_to_ss_volatile(temporary_password);
         return ss.str();
       }
   } __packed;
@@ -755,9 +754,9 @@ class Authorize : Command<CommandID::AUTHORIZE> {
     uint8_t temporary_password[25];
 
       std::string dissect() const {
-      std::stringstream ss;
-      ss << " crc_to_authorize:\t" << std::hex << std::setw(2) << std::setfill('0') << crc_to_authorize<< std::endl;
-      hexdump_to_ss(temporary_password);
+      ::nitrokey::misc::FormatBuffer ss;
+      ss << " crc_to_authorize:\t" << ::nitrokey::misc::hex(crc_to_authorize, 2) << '\n';
+      hexdump_to_ss_volatile(temporary_password);
       return ss.str();
     }
   } __packed;
@@ -772,9 +771,9 @@ class UserAuthorize : Command<CommandID::USER_AUTHORIZE> {
     uint32_t crc_to_authorize;
     uint8_t temporary_password[25];
     std::string dissect() const {
-      std::stringstream ss;
-      ss << " crc_to_authorize:\t" <<  crc_to_authorize<< std::endl;
-      hexdump_to_ss(temporary_password);
+      ::nitrokey::misc::FormatBuffer ss;
+      ss << " crc_to_authorize:\t" <<  crc_to_authorize<< '\n';
+      hexdump_to_ss_volatile(temporary_password);
       return ss.str();
     }
   } __packed;
@@ -789,7 +788,7 @@ class UnlockUserPassword : Command<CommandID::UNLOCK_USER_PASSWORD> {
     uint8_t admin_password[25];
     uint8_t user_new_password[25];
       std::string dissect() const {
-        std::stringstream ss;
+        ::nitrokey::misc::FormatBuffer ss;
         print_to_ss_volatile(admin_password);
         print_to_ss_volatile(user_new_password);
         return ss.str();
@@ -806,7 +805,7 @@ class ChangeUserPin : Command<CommandID::CHANGE_USER_PIN> {
     uint8_t old_pin[25];
     uint8_t new_pin[25];
       std::string dissect() const {
-        std::stringstream ss;
+        ::nitrokey::misc::FormatBuffer ss;
         print_to_ss_volatile(old_pin);
         print_to_ss_volatile(new_pin);
         return ss.str();
@@ -822,7 +821,7 @@ class IsAESSupported : Command<CommandID::DETECT_SC_AES> {
   struct CommandPayload {
     uint8_t user_password[20];
       std::string dissect() const {
-        std::stringstream ss;
+        ::nitrokey::misc::FormatBuffer ss;
         print_to_ss_volatile(user_password);
         return ss.str();
       }
@@ -839,7 +838,7 @@ class ChangeAdminPin : Command<CommandID::CHANGE_ADMIN_PIN> {
     uint8_t old_pin[25];
     uint8_t new_pin[25];
       std::string dissect() const {
-        std::stringstream ss;
+        ::nitrokey::misc::FormatBuffer ss;
         print_to_ss_volatile(old_pin);
         print_to_ss_volatile(new_pin);
         return ss.str();
@@ -861,7 +860,7 @@ class FactoryReset : Command<CommandID::FACTORY_RESET> {
   struct CommandPayload {
     uint8_t admin_password[20];
       std::string dissect() const {
-        std::stringstream ss;
+        ::nitrokey::misc::FormatBuffer ss;
         print_to_ss_volatile(admin_password);
         return ss.str();
       }
@@ -876,7 +875,7 @@ class BuildAESKey : Command<CommandID::NEW_AES_KEY> {
   struct CommandPayload {
     uint8_t admin_password[20];
       std::string dissect() const {
-        std::stringstream ss;
+        ::nitrokey::misc::FormatBuffer ss;
         print_to_ss_volatile(admin_password);
         return ss.str();
       }
@@ -895,7 +894,7 @@ class GetRandom : Command<CommandID::GET_RANDOM> {
 
         bool isValid() const { return size_requested < DATA_SIZE_MAX; }
         std::string dissect() const {
-            std::stringstream ss;
+            ::nitrokey::misc::FormatBuffer ss;
             print_to_ss_int(size_requested);
             return ss.str();
         }
@@ -908,10 +907,10 @@ class GetRandom : Command<CommandID::GET_RANDOM> {
 
         bool isValid() const { return true; }
         std::string dissect() const {
-            std::stringstream ss;
+            ::nitrokey::misc::FormatBuffer ss;
             print_to_ss_int(op_success);
             print_to_ss_int(size_effective);
-            hexdump_to_ss(data);
+            hexdump_to_ss_volatile(data);
             return ss.str();
         }
     } __packed;
@@ -927,7 +926,7 @@ public:
   struct CommandPayload {
     uint8_t firmware_password[20];
     std::string dissect() const {
-      std::stringstream ss;
+      ::nitrokey::misc::FormatBuffer ss;
       print_to_ss_volatile(firmware_password);
       return ss.str();
       }
@@ -944,7 +943,7 @@ public:
     uint8_t firmware_password_current[20];
     uint8_t firmware_password_new[20];
     std::string dissect() const {
-      std::stringstream ss;
+      ::nitrokey::misc::FormatBuffer ss;
       print_to_ss_volatile(firmware_password_current);
       print_to_ss_volatile(firmware_password_new);
       return ss.str();
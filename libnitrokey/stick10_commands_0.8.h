@@ -23,7 +23,6 @@
 #ifndef LIBNITROKEY_STICK10_COMMANDS_0_8_H
 #define LIBNITROKEY_STICK10_COMMANDS_0_8_H
 
-#include <bitset>
 #include <iomanip>
 #include <string>
 #include <sstream>
@@ -76,9 +75,9 @@ namespace nitrokey {
 
                     bool isValid() const { return !(slot_number & 0xF0); }
                     std::string dissect() const {
-                      std::stringstream ss;
-                      ss << "slot_number:\t" << static_cast<int>(slot_number) << std::endl;
-                      hexdump_to_ss(temporary_admin_password);
+                      ::nitrokey::misc::FormatBuffer ss;
+                      ss << "slot_number:\t" << static_cast<int>(slot_number) << '\n';
+                      hexdump_to_ss_volatile(temporary_admin_password);
                       return ss.str();
                     }
                 } __packed;
@@ -106,15 +105,16 @@ namespace nitrokey {
                     }
 
                     std::string dissect() const {
-                      std::stringstream ss;
-                      hexdump_to_ss(temporary_admin_password);
-                      ss << "type:\t" << type << std::endl;
-                      ss << "id:\t" << static_cast<int>(id) << std::endl;
+                      ::nitrokey::misc::FormatBuffer ss;
+                      hexdump_to_ss_volatile(temporary_admin_password);
+                      ss << "type:\t" << type << '\n';
+                      ss << "id:\t" << static_cast<int>(id) << '\n';
+                      mark_volatile(data);
 #ifdef LOG_VOLATILE_DATA
-                      ss << "data:" << std::endl
-                         << ::nitrokey::misc::hexdump(reinterpret_cast<const uint8_t *>(&data), sizeof data);
+                      ss << "data:" << '\n'
+                         << ::nitrokey::misc::hexdump_view(reinterpret_cast<const uint8_t *>(&data), sizeof data);
 #else
-                      ss << " Volatile data not logged" << std::endl;
+                      ss << " Volatile data not logged" << '\n';
 #endif
                       return ss.str();
                     }
@@ -128,12 +128,13 @@ namespace nitrokey {
 
                     bool isValid() const { return true; }
                     std::string dissect() const {
-                      std::stringstream ss;
+                      ::nitrokey::misc::FormatBuffer ss;
+                      mark_volatile(data);
 #ifdef LOG_VOLATILE_DATA
-                      ss << "data:" << std::endl
-                         << ::nitrokey::misc::hexdump(reinterpret_cast<const uint8_t *> (&data), sizeof data);
+                      ss << "data:" << '\n'
+                         << ::nitrokey::misc::hexdump_view(reinterpret_cast<const uint8_t *> (&data), sizeof data);
 #else
-                      ss << " Volatile data not logged" << std::endl;
+                      ss << " Volatile data not logged" << '\n';
 #endif
                       return ss.str();
                     }
@@ -175,20 +176,20 @@ namespace nitrokey {
                     bool isValid() const { return true; }
 
                     std::string dissect() const {
-                      std::stringstream ss;
-                      hexdump_to_ss(temporary_admin_password);
-                      ss << "slot_config:\t" << std::bitset<8>(static_cast<int>(_slot_config)) << std::endl;
-                      ss << "\tuse_8_digits(0):\t" << use_8_digits << std::endl;
-                      ss << "\tuse_enter(1):\t" << use_enter << std::endl;
-                      ss << "\tuse_tokenID(2):\t" << use_tokenID << std::endl;
-                      ss << "slot_number:\t" << static_cast<int>(slot_number) << std::endl;
+                      ::nitrokey::misc::FormatBuffer ss;
+                      hexdump_to_ss_volatile(temporary_admin_password);
+                      ss << "slot_config:\t" << ::nitrokey::misc::bits(_slot_config) << '\n';
+                      ss << "\tuse_8_digits(0):\t" << use_8_digits << '\n';
+                      ss << "\tuse_enter(1):\t" << use_enter << '\n';
+                      ss << "\tuse_tokenID(2):\t" << use_tokenID << '\n';
+                      ss << "slot_number:\t" << static_cast<int>(slot_number) << '\n';
                       ss << "slot_counter_or_interval:\t[" << static_cast<int>(slot_counter_or_interval) << "]\t"
-                         << ::nitrokey::misc::hexdump(reinterpret_cast<const uint8_t *>(&slot_counter_or_interval), sizeof slot_counter_or_interval, false);
+                         << ::nitrokey::misc::hexdump_view(reinterpret_cast<const uint8_t *>(&slot_counter_or_interval), sizeof slot_counter_or_interval, false);
 
                       ss << "slot_token_id:\t";
                       for (auto i : slot_token_id)
-                        ss << std::hex << std::setw(2) << std::setfill('0') << static_cast<int>(i) << " ";
-                      ss << std::endl;
+                        ss << ::nitrokey::misc::hex(i, 2) << " ";
+                      ss << '\n';
 
                       return ss.str();
                     }
@@ -211,9 +212,9 @@ namespace nitrokey {
 
                     bool isValid() const { return (slot_number & 0xF0); }
                     std::string dissect() const {
-                      std::stringstream ss;
-                      hexdump_to_ss(temporary_user_password);
-                      ss << "slot_number:\t" << static_cast<int>(slot_number) << std::endl;
+                      ::nitrokey::misc::FormatBuffer ss;
+                      hexdump_to_ss_volatile(temporary_user_password);
+                      ss << "slot_number:\t" << static_cast<int>(slot_number) << '\n';
                       return ss.str();
                     }
                 } __packed;
@@ -236,12 +237,12 @@ namespace nitrokey {
 
                     bool isValid() const { return true; }
                     std::string dissect() const {
-                      std::stringstream ss;
-                      ss << "code:\t" << (code) << std::endl;
-                      ss << "slot_config:\t" << std::bitset<8>(static_cast<int>(_slot_config)) << std::endl;
-                      ss << "\tuse_8_digits(0):\t" << use_8_digits << std::endl;
-                      ss << "\tuse_enter(1):\t" << use_enter << std::endl;
-                      ss << "\tuse_tokenID(2):\t" << use_tokenID << std::endl;
+                      ::nitrokey::misc::FormatBuffer ss;
+                      ss << "code:\t" << (code) << '\n';
+                      ss << "slot_config:\t" << ::nitrokey::misc::bits(_slot_config) << '\n';
+                      ss << "\tuse_8_digits(0):\t" << use_8_digits << '\n';
+                      ss << "\tuse_enter(1):\t" << use_enter << '\n';
+                      ss << "\tuse_tokenID(2):\t" << use_tokenID << '\n';
                       return ss.str();
                     }
                 } __packed;
@@ -263,12 +264,12 @@ namespace nitrokey {
 
                     bool isValid() const { return !(slot_number & 0xF0); }
                     std::string dissect() const {
-                      std::stringstream ss;
-                      hexdump_to_ss(temporary_user_password);
-                      ss << "slot_number:\t" << static_cast<int>(slot_number) << std::endl;
-                      ss << "challenge:\t" << (challenge) << std::endl;
-                      ss << "last_totp_time:\t" << (last_totp_time) << std::endl;
-                      ss << "last_interval:\t" << static_cast<int>(last_interval) << std::endl;
+                      ::nitrokey::misc::FormatBuffer ss;
+                      hexdump_to_ss_volatile(temporary_user_password);
+                      ss << "slot_number:\t" << static_cast<int>(slot_number) << '\n';
+                      ss << "challenge:\t" << (challenge) << '\n';
+                      ss << "last_totp_time:\t" << (last_totp_time) << '\n';
+                      ss << "last_interval:\t" << static_cast<int>(last_interval) << '\n';
                       return ss.str();
                     }
                 } __packed;
@@ -291,12 +292,12 @@ namespace nitrokey {
 
                     bool isValid() const { return true; }
                     std::string dissect() const {
-                      std::stringstream ss;
-                      ss << "code:\t" << (code) << std::endl;
-                      ss << "slot_config:\t" << std::bitset<8>(static_cast<int>(_slot_config)) << std::endl;
-                      ss << "\tuse_8_digits(0):\t" << use_8_digits << std::endl;
-                      ss << "\tuse_enter(1):\t" << use_enter << std::endl;
-                      ss << "\tuse_tokenID(2):\t" << use_tokenID << std::endl;
+                      ::nitrokey::misc::FormatBuffer ss;
+                      ss << "code:\t" << (code) << '\n';
+                      ss << "slot_config:\t" << ::nitrokey::misc::bits(_slot_config) << '\n';
+                      ss << "\tuse_8_digits(0):\t" << use_8_digits << '\n';
+                      ss << "\tuse_enter(1):\t" << use_enter << '\n';
+                      ss << "\tuse_tokenID(2):\t" << use_tokenID << '\n';
                       return ss.str();
                     }
                 } __packed;
@@ -327,12 +328,13 @@ namespace nitrokey {
                                                 && scrolllock < special_HOTP_slots && enable_user_password < 2; }
 
                   std::string dissect() const {
-                      std::stringstream ss;
-                      ss << "numlock:\t" << static_cast<int>(numlock) << std::endl;
-                      ss << "capslock:\t" << static_cast<int>(capslock) << std::endl;
-                      ss << "scrolllock:\t" << static_cast<int>(scrolllock) << std::endl;
-                      ss << "enable_user_password:\t" << static_cast<bool>(enable_user_password) << std::endl;
-                      ss << "delete_user_password:\t" << static_cast<bool>(delete_user_password) << std::endl;
+                      ::nitrokey::misc::FormatBuffer ss;
+                      ss << "numlock:\t" << static_cast<int>(numlock) << '\n';
+                      ss << "capslock:\t" << static_cast<int>(capslock) << '\n';
+                      ss << "scrolllock:\t" << static_cast<int>(scrolllock) << '\n';
+                      ss << "enable_user_password:\t" << static_cast<bool>(enable_user_password) << '\n';
+                      ss << "delete_user_password:\t" << static_cast<bool>(delete_user_password) << '\n';
+                      mark_volatile(temporary_admin_password);
                       return ss.str();
                     }
                 } __packed;
@@ -75,7 +75,7 @@ namespace nitrokey {
                     uint8_t __gap2;
                     uint8_t new_update_password[20];
                     std::string dissect() const {
-                      std::stringstream ss;
+                      ::nitrokey::misc::FormatBuffer ss;
                       print_to_ss_volatile( current_update_password );
                       print_to_ss_volatile( new_update_password );
                       return ss.str();
@@ -105,7 +105,7 @@ namespace nitrokey {
                     uint8_t admin_pin[20];
 
                     std::string dissect() const {
-                      std::stringstream ss;
+                      ::nitrokey::misc::FormatBuffer ss;
                       print_to_ss( static_cast<int>(volume_flag) );
                       print_to_ss( kind );
                       print_to_ss_volatile(admin_pin);
@@ -139,9 +139,9 @@ namespace nitrokey {
                   uint8_t SendSize_u8;
 
                   std::string dissect() const {
-                    std::stringstream ss;
-                    ss << "_padding:" << std::endl
-                       << ::nitrokey::misc::hexdump(reinterpret_cast<const uint8_t *>(_padding),
+                    ::nitrokey::misc::FormatBuffer ss;
+                    ss << "_padding:" << '\n'
+                       << ::nitrokey::misc::hexdump_view(reinterpret_cast<const uint8_t *>(_padding),
                                                     sizeof _padding);
                     print_to_ss(static_cast<int>(SendCounter_u8));
                     print_to_ss(static_cast<int>(SendDataType_u8));
@@ -208,7 +208,7 @@ namespace nitrokey {
                     bool isValid() const { return true; }
 
                     std::string dissect() const {
-                      std::stringstream ss;
+                      ::nitrokey::misc::FormatBuffer ss;
 
                       print_to_ss(transmission_data.dissect());
                       print_to_ss( MagicNumber_StickConfig_u16 );
@@ -244,7 +244,7 @@ namespace nitrokey {
                 struct CommandPayload {
                     uint64_t localtime;  // POSIX seconds from epoch start, supports until year 2106
                     std::string dissect() const {
-                      std::stringstream ss;
+                      ::nitrokey::misc::FormatBuffer ss;
                       print_to_ss( localtime );
                       return ss.str();
                     }
@@ -295,7 +295,7 @@ namespace nitrokey {
                     uint8_t ReadLevelMin;
                     uint8_t ReadLevelMax;
                     std::string dissect() const {
-                      std::stringstream ss;
+                      ::nitrokey::misc::FormatBuffer ss;
                       print_to_ss(static_cast<int>(WriteLevelMin));
                       print_to_ss(static_cast<int>(WriteLevelMax));
                       print_to_ss(static_cast<int>(ReadLevelMin));
@@ -318,7 +318,7 @@ namespace nitrokey {
                     uint8_t EndBlockPercent_u8;
                     uint8_t HiddenVolumePassword_au8[MAX_HIDDEN_VOLUME_PASSWORD_SIZE];
                     std::string dissect() const {
-                      std::stringstream ss;
+                      ::nitrokey::misc::FormatBuffer ss;
                       print_to_ss(static_cast<int>(SlotNr_u8));
                       print_to_ss(static_cast<int>(StartBlockPercent_u8));
                       print_to_ss(static_cast<int>(EndBlockPercent_u8));
@@ -358,7 +358,7 @@ namespace nitrokey {
                     bool isValid() const { return true; }
 
                     std::string dissect() const {
-                      std::stringstream ss;
+                      ::nitrokey::misc::FormatBuffer ss;
 
                       print_to_ss(transmission_data.dissect());
                       print_to_ss(static_cast<int>(FirmwareVersion_au8[0]));
@@ -0,0 +1,113 @@
+/*
+ * Copyright (c) 2015-2018 Nitrokey UG
+ *
+ * This file is part of libnitrokey.
+ *
+ * libnitrokey is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libnitrokey is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libnitrokey. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0
+ */
+
+#ifndef LIBNITROKEY_TIMELINE_H
+#define LIBNITROKEY_TIMELINE_H
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "trace.h"
+
+namespace nitrokey {
+namespace trace {
+
+    /**
+     * Records the trace events into a timeline in the Chrome Trace Event
+     * format, which can be opened in chrome://tracing or Perfetto.
+     *
+     * Each device gets its own process in the timeline, with two tracks:
+     * - commands: a span per transaction, with nested send, poll, wait
+     *   (sleep after sending), busy backoff and reconnect slices,
+     * - lock waits: time spent waiting for the transaction and device handle locks.
+     *
+     * Recording adds its own trace listener (see add_listener), so the one
+     * set with set_listener keeps being called.
+     */
+    class TimelineRecorder {
+    public:
+        static const size_t DEFAULT_MAX_EVENTS = 1000000;
+
+        /**
+         * @param max_events events above the limit are dropped
+         */
+        explicit TimelineRecorder(size_t max_events = DEFAULT_MAX_EVENTS);
+        ~TimelineRecorder();
+        TimelineRecorder(const TimelineRecorder &) = delete;
+        TimelineRecorder &operator=(const TimelineRecorder &) = delete;
+
+        /**
+         * Starts a new recording, dropping the previously recorded events.
+         */
+        void start();
+        /**
+         * Stops recording and removes its trace listener. Recorded events are kept.
+         */
+        void stop();
+        bool is_recording() const;
+        size_t recorded_events() const;
+        size_t dropped_events() const;
+
+        void write_json(std::ostream &out) const;
+        std::string to_json() const;
+
+    private:
+        struct Record {
+            Event event;
+            uint8_t command_id;
+            int64_t value;
+            std::chrono::steady_clock::time_point time;
+            /** index of the device in State::devices */
+            uint32_t device;
+            /** index of the calling thread in State::threads */
+            uint32_t thread;
+        };
+
+        struct State {
+            std::mutex mutex;
+            size_t max_events;
+            bool recording = false;
+            std::chrono::steady_clock::time_point start;
+            std::vector<Record> records;
+            size_t dropped = 0;
+            /** by Device::get_instance_id(), 0 for events without a device */
+            std::unordered_map<uint64_t, uint32_t> device_index;
+            std::vector<std::string> devices;
+            std::unordered_map<size_t, uint32_t> thread_index;
+            /** trace listener while recording, 0 otherwise */
+            ListenerId listener = 0;
+
+            void record(const TraceEvent &e);
+        };
+
+        // shared with the listener, which can be still running after stop()
+        std::shared_ptr<State> m_state;
+    };
+
+}
+}
+
+#endif //LIBNITROKEY_TIMELINE_H
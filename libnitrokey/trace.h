@@ -0,0 +1,158 @@
+/*
+ * Copyright (c) 2015-2018 Nitrokey UG
+ *
+ * This file is part of libnitrokey.
+ *
+ * libnitrokey is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libnitrokey is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libnitrokey. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0
+ */
+
+#ifndef LIBNITROKEY_TRACE_H
+#define LIBNITROKEY_TRACE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+
+namespace nitrokey {
+namespace device {
+    class Device;
+}
+
+namespace trace {
+
+    /**
+     * Phases of a device transaction. Values are stable, as they are
+     * passed through the C API.
+     */
+    enum class Event : uint8_t {
+        /** device lock acquired, value: 0 */
+        transaction_start = 0,
+        /** command sent, value: result of Device::send */
+        send_done = 1,
+        /** response read, value: device status, or -1 when reading failed */
+        poll = 2,
+        /** device busy, waiting before the next poll, value: delay in ms */
+        busy_backoff = 3,
+        /** transfer failed in Device::send or Device::recv, value: errno */
+        transfer_error = 4,
+        /** device handle reopened, value: time taken in us */
+        reconnect = 5,
+        /** response accepted and about to be checked and decoded, value: command status */
+        decode = 6,
+        /** transaction finished, value: command status, or -1 on communication failure */
+        transaction_finish = 7,
+        /** sending the command, value: 0 */
+        send_start = 8,
+        /** reading the response, value: 0 */
+        recv_start = 9,
+        /** transaction lock acquired, value: time waited for it in us */
+        transaction_lock_wait = 10,
+        /** device handle lock acquired in Device::send or Device::recv, value: time waited for it in us */
+        handle_lock_wait = 11,
+    };
+
+    const char *event_to_string(Event event);
+
+    struct TraceEvent {
+        Event event;
+        /** device the event happened on, valid during the callback only */
+        const device::Device *device;
+        /** command ID, 0 for the events coming from Device */
+        uint8_t command_id;
+        int64_t value;
+        std::chrono::steady_clock::time_point time;
+    };
+
+    /**
+     * Trace callback. Called synchronously, from the thread running the
+     * transaction, with the device lock held - it should return quickly.
+     */
+    using TraceListener = std::function<void(const TraceEvent &event)>;
+
+    /**
+     * Sets the main trace callback, the one of NK_set_trace_function; an empty
+     * one removes it. Callbacks added with add_listener are kept.
+     * Tracing is enabled while any callback is registered.
+     * Calls already in progress may still reach the previous callback.
+     */
+    void set_listener(TraceListener listener);
+
+    using ListenerId = uint64_t;
+
+    /**
+     * Adds a trace callback, called after the main one, e.g. by the timeline
+     * recorder, which should not replace the callback set by the application.
+     * @return ID to remove the callback with, never 0
+     */
+    ListenerId add_listener(TraceListener listener);
+    /**
+     * Removes a callback added with add_listener. Calls already in progress
+     * may still reach it.
+     */
+    void remove_listener(ListenerId id);
+
+    namespace detail {
+        extern std::atomic_bool enabled;
+        void emit(Event event, const device::Device *device, uint8_t command_id, int64_t value);
+    }
+
+    inline bool is_enabled() {
+      return detail::enabled.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Measures the time spent waiting for a lock, only while tracing is enabled.
+     * Construct right before locking.
+     */
+    class LockWaitTimer {
+    public:
+        LockWaitTimer() {
+          if (is_enabled()) m_start = std::chrono::steady_clock::now();
+        }
+        bool active() const { return m_start != std::chrono::steady_clock::time_point(); }
+        int64_t elapsed_us() const {
+          return std::chrono::duration_cast<std::chrono::microseconds>(
+              std::chrono::steady_clock::now() - m_start).count();
+        }
+
+    private:
+        std::chrono::steady_clock::time_point m_start;
+    };
+
+    /**
+     * Emits transaction_start, and transaction_finish when leaving the transaction scope,
+     * also when it ends with an exception.
+     */
+    class TransactionTrace {
+    public:
+        TransactionTrace(const device::Device *device, uint8_t command_id);
+        ~TransactionTrace();
+        TransactionTrace(const TransactionTrace &) = delete;
+        TransactionTrace &operator=(const TransactionTrace &) = delete;
+
+        void set_result(int64_t result) { m_result = result; }
+
+    private:
+        const device::Device *m_device;
+        uint8_t m_command_id;
+        int64_t m_result;
+    };
+
+}
+}
+
+#endif //LIBNITROKEY_TRACE_H
@@ -22,17 +22,175 @@
 #include "log.h"
 #include <iostream>
 #include <ctime>
+#include <condition_variable>
 #include <iomanip>
+#include <memory>
+#include <thread>
 
 #include <sstream>
 
 namespace nitrokey {
   namespace log {
 
-    Log *Log::mp_instance = nullptr;
     StdlogHandler stdlog_handler;
 
-    std::string Log::prefix = "";
+    std::shared_ptr<const std::string> Log::prefix;
+    const size_t Log::DEFAULT_ASYNC_CAPACITY;
+
+    /**
+     * Bounded multi-producer, single-consumer queue of log messages, printed
+     * by its own thread. Producers claim a cell with a single atomic operation,
+     * and publish it with its sequence number; they never take a lock.
+     * Cells keep their message buffers, so once warmed up copying a message
+     * does not allocate.
+     */
+    class AsyncLogQueue {
+    public:
+        using Sink = std::function<void(const std::string &, Loglevel, std::time_t)>;
+
+        explicit AsyncLogQueue(size_t capacity) {
+          m_capacity = 1;
+          while (m_capacity < capacity) m_capacity <<= 1;
+          m_cells.reset(new Cell[m_capacity]);
+          for (size_t i = 0; i < m_capacity; i++) m_cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+
+        /**
+         * @return false when the message was dropped
+         */
+        bool push(const std::string &message, Loglevel lvl, std::time_t time, bool block) {
+          auto pos = m_enqueue_pos.load(std::memory_order_relaxed);
+          Cell *cell;
+          for (;;) {
+            cell = &m_cells[pos & (m_capacity - 1)];
+            const auto seq = cell->sequence.load(std::memory_order_acquire);
+            const auto diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+            if (diff == 0) {
+              if (m_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            } else if (diff < 0) {
+              // full
+              if (!block || !m_running) {
+                m_dropped.fetch_add(1, std::memory_order_relaxed);
+                return false;
+              }
+              wake_consumer();
+              std::this_thread::yield();
+              pos = m_enqueue_pos.load(std::memory_order_relaxed);
+            } else {
+              pos = m_enqueue_pos.load(std::memory_order_relaxed);
+            }
+          }
+          cell->level = lvl;
+          cell->time = time;
+          cell->message.assign(message);
+          // sequentially consistent, like the check in consumer_loop, so either
+          // the consumer sees the message before sleeping, or the producer sees it waiting
+          cell->sequence.store(pos + 1, std::memory_order_seq_cst);
+          if (m_consumer_waiting.load(std::memory_order_seq_cst)) wake_consumer();
+          return true;
+        }
+
+        void start(Sink sink) {
+          if (m_running) return;
+          m_sink = std::move(sink);
+          m_running = true;
+          m_consumer = std::thread(&AsyncLogQueue::consumer_loop, this);
+        }
+
+        /**
+         * Stops the thread, after it printed the queued messages.
+         */
+        void stop() {
+          if (!m_running) return;
+          m_running = false;
+          wake_consumer();
+          m_consumer.join();
+        }
+
+        void flush() {
+          const auto target = m_enqueue_pos.load();
+          std::unique_lock<std::mutex> lock(m_mutex);
+          m_flushed.wait(lock, [&]() { return !m_running || m_printed.load() >= target; });
+        }
+
+        uint64_t dropped() const { return m_dropped.load(); }
+
+    private:
+        struct Cell {
+            std::atomic<size_t> sequence;
+            Loglevel level;
+            std::time_t time;
+            std::string message;
+        };
+
+        /** Prints the published messages. Consumer thread only. */
+        size_t print_queued() {
+          size_t printed = 0;
+          for (;;) {
+            auto &cell = m_cells[m_dequeue_pos & (m_capacity - 1)];
+            if (cell.sequence.load(std::memory_order_acquire) != m_dequeue_pos + 1) break;
+            m_sink(cell.message, cell.level, cell.time);
+            cell.sequence.store(m_dequeue_pos + m_capacity, std::memory_order_release);
+            m_dequeue_pos++;
+            printed++;
+          }
+
+          const auto dropped = m_dropped.load(std::memory_order_relaxed);
+          if (dropped != m_reported_dropped) {
+            m_sink(std::to_string(dropped - m_reported_dropped) + " log messages dropped, queue full",
+                   Loglevel::WARNING, std::time(nullptr));
+            m_reported_dropped = dropped;
+          }
+
+          if (printed != 0) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_printed += printed;
+            m_flushed.notify_all();
+          }
+          return printed;
+        }
+
+        void consumer_loop() {
+          for (;;) {
+            if (print_queued() != 0) continue;
+            if (!m_running) {
+              print_queued();
+              break;
+            }
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_consumer_waiting.store(true, std::memory_order_seq_cst);
+            const auto &next = m_cells[m_dequeue_pos & (m_capacity - 1)];
+            if (m_running && next.sequence.load(std::memory_order_seq_cst) != m_dequeue_pos + 1) {
+              // timeout only as a safety net, producers wake the thread up
+              m_wakeup.wait_for(lock, std::chrono::milliseconds(100));
+            }
+            m_consumer_waiting.store(false, std::memory_order_relaxed);
+          }
+          std::lock_guard<std::mutex> lock(m_mutex);
+          m_flushed.notify_all();
+        }
+
+        void wake_consumer() {
+          { std::lock_guard<std::mutex> lock(m_mutex); }
+          m_wakeup.notify_one();
+        }
+
+        std::unique_ptr<Cell[]> m_cells;
+        size_t m_capacity;
+        std::atomic<size_t> m_enqueue_pos{0};
+        size_t m_dequeue_pos = 0;
+        std::atomic<uint64_t> m_dropped{0};
+        uint64_t m_reported_dropped = 0;
+        std::atomic<size_t> m_printed{0};
+
+        Sink m_sink;
+        std::atomic_bool m_running{false};
+        std::atomic_bool m_consumer_waiting{false};
+        std::thread m_consumer;
+        std::mutex m_mutex;
+        std::condition_variable m_wakeup;
+        std::condition_variable m_flushed;
+    };
 
 
     std::string LogHandler::loglevel_to_str(Loglevel lvl) {
@@ -54,17 +212,61 @@ namespace nitrokey {
     }
 
     void Log::operator()(const std::string &logstr, Loglevel lvl) {
-      if (mp_loghandler != nullptr){
+      const auto handler = mp_loghandler.load();
+      if (handler != nullptr){
         // FIXME crashes on exit because static object under mp_loghandler is not valid anymore, see NitrokeyManager::set_log_function
-        if (static_cast<int>(lvl) <= static_cast<int>(m_loglevel)) mp_loghandler->print(prefix+logstr, lvl);
+        if (static_cast<int>(lvl) <= static_cast<int>(m_loglevel.load())) {
+          const auto p = std::atomic_load(&prefix);
+          auto s = p != nullptr ? *p + logstr : logstr;
+          // counted before checking the flag, so disable_async either sees
+          // this producer and waits for it, or the producer sees the flag cleared
+          m_async_producers.fetch_add(1);
+          if (m_async_enabled) {
+            mp_async.load()->push(s, lvl, std::time(nullptr), m_overflow_policy == LogOverflowPolicy::BLOCK);
+            m_async_producers.fetch_sub(1);
+            return;
+          }
+          m_async_producers.fetch_sub(1);
+          handler->print(s, lvl);
+        }
       }
     }
 
+    void Log::enable_async(size_t capacity, LogOverflowPolicy policy) {
+      std::lock_guard<std::mutex> lock(m_async_mutex);
+      m_overflow_policy = policy;
+      if (mp_async == nullptr) mp_async = new AsyncLogQueue(capacity);
+      mp_async.load()->start([this](const std::string &s, Loglevel lvl, std::time_t time) {
+        const auto handler = mp_loghandler.load();
+        if (handler != nullptr) handler->print_at(s, lvl, time);
+      });
+      m_async_enabled = true;
+    }
+
+    void Log::disable_async() {
+      std::lock_guard<std::mutex> lock(m_async_mutex);
+      if (!m_async_enabled) return;
+      m_async_enabled = false;
+      // the consumer is still running, so producers blocked on a full queue finish
+      while (m_async_producers.load() != 0) std::this_thread::yield();
+      mp_async.load()->stop();
+    }
+
+    void Log::flush() {
+      const auto queue = mp_async.load();
+      if (queue != nullptr) queue->flush();
+    }
+
+    uint64_t Log::dropped_messages() const {
+      const auto queue = mp_async.load();
+      return queue != nullptr ? queue->dropped() : 0;
+    }
+
     void Log::setPrefix(const std::string prefix) {
       if (!prefix.empty()){
-        Log::prefix = "["+prefix+"]";
+        std::atomic_store(&Log::prefix, std::make_shared<const std::string>("["+prefix+"]"));
       } else {
-        Log::prefix = "";
+        std::atomic_store(&Log::prefix, std::shared_ptr<const std::string>());
       }
     }
 
@@ -73,23 +275,41 @@ namespace nitrokey {
       std::clog << s;
     }
 
+    void StdlogHandler::print_at(const std::string &str, Loglevel lvl, std::time_t time) {
+      std::string s = format_message_to_string(str, lvl, time);
+      std::clog << s;
+    }
+
     void FunctionalLogHandler::print(const std::string &str, Loglevel lvl) {
       std::string s = format_message_to_string(str, lvl);
       log_function(s);
     }
 
+    void FunctionalLogHandler::print_at(const std::string &str, Loglevel lvl, std::time_t time) {
+      std::string s = format_message_to_string(str, lvl, time);
+      log_function(s);
+    }
+
     void RawFunctionalLogHandler::print(const std::string &str, Loglevel lvl) {
       log_function(str, lvl);
     }
 
     std::string LogHandler::format_message_to_string(const std::string &str, const Loglevel &lvl) {
-      static bool last_short = false;
+      return format_message_to_string(str, lvl, time(nullptr));
+    }
+
+    std::string LogHandler::format_message_to_string(const std::string &str, const Loglevel &lvl, std::time_t t) {
+      static thread_local bool last_short = false;
       if (str.length() == 1){
         last_short = true;
         return str;
       }
-      time_t t = time(nullptr);
-      tm tm = *localtime(&t);
+      tm tm;
+#ifdef _WIN32
+      localtime_s(&tm, &t);
+#else
+      localtime_r(&t, &tm);
+#endif
 
       std::stringstream s;
       s
@@ -0,0 +1,216 @@
+/*
+ * Copyright (c) 2015-2018 Nitrokey UG
+ *
+ * This file is part of libnitrokey.
+ *
+ * libnitrokey is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libnitrokey is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libnitrokey. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0
+ */
+
+#include <iomanip>
+#include <sstream>
+#include <vector>
+#include "libnitrokey/metrics.h"
+#include "libnitrokey/command_id.h"
+#include "libnitrokey/device.h"
+
+namespace nitrokey {
+namespace metrics {
+
+    using device::Device;
+    using device::CommandLatencySnapshot;
+    using device::HistogramSnapshot;
+
+    namespace {
+        using Counter = Device::ErrorCounters::cnt Device::ErrorCounters::*;
+
+        struct CounterInfo {
+            const char *name;
+            Counter counter;
+            const char *help;
+        };
+
+        const CounterInfo counters[] = {
+            {"comm_runs", &Device::ErrorCounters::total_comm_runs, "Transactions started."},
+            {"communication_successful", &Device::ErrorCounters::communication_successful, "Transactions which received a valid response."},
+            {"command_successful", &Device::ErrorCounters::command_successful_recv, "Transactions which the device reported as successful."},
+            {"command_failed", &Device::ErrorCounters::command_result_not_equal_0_recv, "Transactions which the device reported as failed."},
+            {"successful_storage_commands", &Device::ErrorCounters::successful_storage_commands, "Successful Storage specific transactions."},
+            {"sends_executed", &Device::ErrorCounters::sends_executed, "Commands sent."},
+            {"recv_executed", &Device::ErrorCounters::recv_executed, "Responses read."},
+            {"retries", &Device::ErrorCounters::total_retries, "Responses read again, as the previous one was not ready."},
+            {"busy", &Device::ErrorCounters::busy, "Responses with the device busy."},
+            {"busy_progressbar", &Device::ErrorCounters::busy_progressbar, "Responses reporting a long operation in progress."},
+            {"crc_other_than_awaited", &Device::ErrorCounters::CRC_other_than_awaited, "Responses to another command than the sent one."},
+            {"wrong_crc", &Device::ErrorCounters::wrong_CRC, "Responses with an invalid CRC."},
+            {"sending_errors", &Device::ErrorCounters::sending_error, "Transactions failed while sending."},
+            {"receiving_errors", &Device::ErrorCounters::receiving_error, "Transactions failed while receiving."},
+            {"low_level_reconnects", &Device::ErrorCounters::low_level_reconnect, "Device handle reopenings."},
+            {"transient_errors", &Device::ErrorCounters::transient_errors, "Transfer errors retried with the same handle."},
+            {"dead_handle_errors", &Device::ErrorCounters::dead_handle_errors, "Transfer errors leaving the handle unusable."},
+            {"reconnects_rate_limited", &Device::ErrorCounters::reconnects_rate_limited, "Reopenings skipped, as the last one was too recent."},
+            {"reconnect_failures", &Device::ErrorCounters::reconnect_failures, "Reopenings which failed."},
+        };
+
+        /** exported bucket bounds, in seconds, with their canonical text */
+        const struct {
+            double value;
+            const char *text;
+        } histogram_bounds[] = {
+            {0.0005, "0.0005"}, {0.001, "0.001"}, {0.002, "0.002"}, {0.005, "0.005"}, {0.01, "0.01"},
+            {0.02, "0.02"}, {0.05, "0.05"}, {0.1, "0.1"}, {0.2, "0.2"}, {0.5, "0.5"}, {1, "1.0"},
+            {2, "2.0"}, {5, "5.0"}, {10, "10.0"}, {30, "30.0"},
+        };
+
+        struct DeviceSample {
+            std::string labels;
+            int64_t counters[sizeof(metrics::counters) / sizeof(metrics::counters[0])];
+            int64_t reconnect_time_total_us;
+            int64_t reconnect_time_max_us;
+            int health;
+            std::vector<CommandLatencySnapshot> latency;
+        };
+
+        std::string escape_label(const std::string &value) {
+          std::string res;
+          for (const char c : value) {
+            switch (c) {
+              case '\\': res += "\\\\"; break;
+              case '"': res += "\\\""; break;
+              case '\n': res += "\\n"; break;
+              default: res += c;
+            }
+          }
+          return res;
+        }
+
+        std::string device_labels(const Device &d) {
+          std::ostringstream model;
+          model << d.get_device_model();
+          return "path=\"" + escape_label(d.get_path()) + "\",model=\"" + escape_label(model.str())
+                 + "\",serial=\"" + escape_label(d.get_serial_number()) + "\"";
+        }
+
+        std::vector<DeviceSample> collect() {
+          std::vector<DeviceSample> samples;
+          Device::for_each_instance([&samples](const Device &d) {
+            if (!d.has_handle()) return;
+            DeviceSample s;
+            s.labels = device_labels(d);
+            for (size_t i = 0; i < sizeof(counters) / sizeof(counters[0]); i++) {
+              s.counters[i] = (d.m_counters.*counters[i].counter).load();
+            }
+            s.reconnect_time_total_us = d.m_counters.reconnect_time_total_us;
+            s.reconnect_time_max_us = d.m_counters.reconnect_time_max_us;
+            s.health = static_cast<int>(d.get_connection_health());
+            s.latency = d.m_latency.snapshot();
+            samples.push_back(std::move(s));
+          });
+          return samples;
+        }
+
+        void family(std::ostream &out, const std::string &name, const char *type, const char *unit, const char *help) {
+          out << "# TYPE " << name << " " << type << "\n";
+          if (unit != nullptr) out << "# UNIT " << name << " " << unit << "\n";
+          out << "# HELP " << name << " " << help << "\n";
+        }
+
+        double seconds(uint64_t us) {
+          return us / 1e6;
+        }
+
+        void histogram(std::ostream &out, const std::string &name, const std::string &labels,
+                       const HistogramSnapshot &h) {
+          // a recorded bucket is counted once its whole range is under the bound,
+          // so the counts are within the histogram precision (12.5%)
+          size_t bucket = 0;
+          uint64_t cumulative = 0;
+          for (const auto &bound : histogram_bounds) {
+            while (bucket < h.buckets.size() && seconds(h.buckets[bucket].upper_bound_us) <= bound.value) {
+              cumulative += h.buckets[bucket++].count;
+            }
+            out << name << "_bucket{" << labels << ",le=\"" << bound.text << "\"} " << cumulative << "\n";
+          }
+          out << name << "_bucket{" << labels << ",le=\"+Inf\"} " << h.count << "\n";
+          out << name << "_count{" << labels << "} " << h.count << "\n";
+          out << name << "_sum{" << labels << "} " << seconds(h.sum_us) << "\n";
+        }
+
+        std::string command_labels(const DeviceSample &s, const CommandLatencySnapshot &c) {
+          return s.labels + ",command=\""
+                 + proto::commandid_to_string(static_cast<proto::CommandID>(c.command_id)) + "\"";
+        }
+    }
+
+    std::string openmetrics_text() {
+      const auto samples = collect();
+      std::ostringstream out;
+      out << std::setprecision(9);
+
+      for (size_t i = 0; i < sizeof(counters) / sizeof(counters[0]); i++) {
+        const auto name = std::string("nitrokey_") + counters[i].name;
+        family(out, name, "counter", nullptr, counters[i].help);
+        for (const auto &s : samples) {
+          out << name << "_total{" << s.labels << "} " << s.counters[i] << "\n";
+        }
+      }
+
+      family(out, "nitrokey_reconnect_seconds", "counter", "seconds", "Time spent reopening the device handle.");
+      for (const auto &s : samples) {
+        out << "nitrokey_reconnect_seconds_total{" << s.labels << "} " << seconds(s.reconnect_time_total_us) << "\n";
+      }
+      family(out, "nitrokey_reconnect_max_seconds", "gauge", "seconds", "Longest reopening of the device handle.");
+      for (const auto &s : samples) {
+        out << "nitrokey_reconnect_max_seconds{" << s.labels << "} " << seconds(s.reconnect_time_max_us) << "\n";
+      }
+      family(out, "nitrokey_connection_health", "gauge", nullptr,
+             "Connection health: 0 healthy, 1 degraded, 2 reconnecting, 3 disconnected.");
+      for (const auto &s : samples) {
+        out << "nitrokey_connection_health{" << s.labels << "} " << s.health << "\n";
+      }
+
+      family(out, "nitrokey_command_polls", "counter", nullptr, "Responses read, per command.");
+      for (const auto &s : samples) {
+        for (const auto &c : s.latency) {
+          out << "nitrokey_command_polls_total{" << command_labels(s, c) << "} " << c.polls << "\n";
+        }
+      }
+      family(out, "nitrokey_command_busy", "counter", nullptr, "Responses with the device busy, per command.");
+      for (const auto &s : samples) {
+        for (const auto &c : s.latency) {
+          out << "nitrokey_command_busy_total{" << command_labels(s, c) << "} " << c.busy << "\n";
+        }
+      }
+      family(out, "nitrokey_command_duration_seconds", "histogram", "seconds",
+             "Time from sending the command until the transaction finished.");
+      for (const auto &s : samples) {
+        for (const auto &c : s.latency) {
+          histogram(out, "nitrokey_command_duration_seconds", command_labels(s, c), c.total);
+        }
+      }
+      family(out, "nitrokey_command_first_response_seconds", "histogram", "seconds",
+             "Time from sending the command until the first response with the device not busy.");
+      for (const auto &s : samples) {
+        for (const auto &c : s.latency) {
+          histogram(out, "nitrokey_command_first_response_seconds", command_labels(s, c), c.first_response);
+        }
+      }
+
+      out << "# EOF\n";
+      return out.str();
+    }
+
+}
+}
@@ -19,6 +19,10 @@
  * SPDX-License-Identifier: LGPL-3.0
  */
 
+#ifdef __APPLE__
+// memset_s
+#define __STDC_WANT_LIB_EXT1__ 1
+#endif
 #include <sstream>
 #include <string>
 #include "misc.h"
@@ -33,69 +37,117 @@ namespace misc {
 
 
 
-::std::vector<uint8_t> hex_string_to_byte(const char* hexString){
+namespace {
+  const uint8_t INVALID_DIGIT = 0xFF;
+
+  /**
+   * Character to digit value lookup table, INVALID_DIGIT for characters out of the alphabet.
+   */
+  struct DigitTable {
+    uint8_t value[256];
+
+    constexpr DigitTable(const char *alphabet, bool ignore_case) : value() {
+      for (auto &v : value) v = INVALID_DIGIT;
+      for (uint8_t i = 0; alphabet[i] != 0; i++) {
+        const auto c = static_cast<uint8_t>(alphabet[i]);
+        value[c] = i;
+        if (ignore_case && c >= 'A' && c <= 'Z') value[c - 'A' + 'a'] = i;
+        if (ignore_case && c >= 'a' && c <= 'z') value[c - 'a' + 'A'] = i;
+      }
+    }
+  };
+
+  constexpr DigitTable hex_digits("0123456789abcdef", true);
+  constexpr DigitTable base32_digits("ABCDEFGHIJKLMNOPQRSTUVWXYZ234567", true);
+}
+
+size_t hex_decode(const char *src, size_t src_size, uint8_t *dest, size_t dest_size) {
+  if (src_size % 2 != 0) {
+    throw InvalidHexString(0);
+  }
+  if (src_size / 2 > dest_size) {
+    throw TargetBufferSmallerThanSource(src_size / 2, dest_size);
+  }
+  const auto s = reinterpret_cast<const uint8_t *>(src);
+  for (size_t i = 0; i < src_size; i += 2) {
+    const uint8_t hi = hex_digits.value[s[i]];
+    const uint8_t lo = hex_digits.value[s[i + 1]];
+    if ((hi | lo) & 0xF0) {
+      throw InvalidHexString(hi == INVALID_DIGIT ? s[i] : s[i + 1]);
+    }
+    dest[i / 2] = static_cast<uint8_t>(hi << 4 | lo);
+  }
+  return src_size / 2;
+}
+
+size_t base32_decode(const char *src, size_t src_size, uint8_t *dest, size_t dest_size) {
+  const auto s = reinterpret_cast<const uint8_t *>(src);
+  while (src_size > 0 && s[src_size - 1] == '=') src_size--;
+
+  uint32_t buffer = 0;
+  int bits = 0;
+  size_t written = 0;
+  for (size_t i = 0; i < src_size; i++) {
+    const uint8_t c = s[i];
+    if (c == ' ' || c == '-') continue;
+    const uint8_t v = base32_digits.value[c];
+    if (v == INVALID_DIGIT) {
+      throw InvalidBase32String(c);
+    }
+    buffer = (buffer << 5) | v;
+    bits += 5;
+    if (bits >= 8) {
+      bits -= 8;
+      if (written >= dest_size) {
+        throw TargetBufferSmallerThanSource(written + 1, dest_size);
+      }
+      dest[written++] = static_cast<uint8_t>(buffer >> bits);
+    }
+  }
+  return written;
+}
+
+template <typename Vector>
+static Vector hex_string_to_byte_vector(const char* hexString){
     const size_t big_string_size = 257; //arbitrary 'big' number
     const size_t s_size = strnlen(hexString, big_string_size);
-    const size_t d_size = s_size/2;
     if (s_size%2!=0 || s_size>=big_string_size){
         throw InvalidHexString(0);
     }
-    auto data = ::std::vector<uint8_t>();
-    data.reserve(d_size);
-
-    char buf[3];
-    buf[2] = '\0';
-    for(size_t i=0; i<s_size; i++){
-
-        char c = hexString[i];
-        bool char_from_range = (('0' <= c && c <='9') || ('A' <= c && c <= 'F') || ('a' <= c && c<= 'f'));
-        if (!char_from_range){
-            throw InvalidHexString(c);
-        }
-        buf[i%2] = c;
-        if (i%2==1){
-            data.push_back( strtoul(buf, NULL, 16) & 0xFF );
-        }
-    }
+    auto data = Vector(s_size/2);
+    hex_decode(hexString, s_size, data.data(), data.size());
     return data;
-};
+}
 
-#include <cctype>
-::std::string hexdump(const uint8_t *p, size_t size, bool print_header,
-        bool print_ascii, bool print_empty) {
-  ::std::stringstream out;
-  char formatbuf[128];
-  const uint8_t *pstart = p;
-
-  for (const uint8_t *pend = p + size; p < pend;) {
-      if (print_header){
-          snprintf(formatbuf, 128, "%04x\t", static_cast<int> (p - pstart));
-          out << formatbuf;
-      }
+::std::vector<uint8_t> hex_string_to_byte(const char* hexString){
+    return hex_string_to_byte_vector<::std::vector<uint8_t>>(hexString);
+}
 
-    const uint8_t* pp = p;
-    for (const uint8_t *le = p + 16; p < le; p++) {
-      if (p < pend){
-        snprintf(formatbuf, 128, "%02x ", uint8_t(*p));
-        out << formatbuf;
-      } else {
-          if(print_empty)
-            out << "-- ";
-      }
+secure_vector<uint8_t> hex_string_to_secure_byte(const char* hexString){
+    return hex_string_to_byte_vector<secure_vector<uint8_t>>(hexString);
+}
 
-    }
-      if(print_ascii){
-        out << "  ";
-        for (const uint8_t *le = pp + 16; pp < le && pp < pend; pp++) {
-          if (std::isgraph(*pp))
-            out << uint8_t(*pp);
-          else
-            out << '.';
-        }
-      }
-    out << ::std::endl;
+::std::string hexdump(const uint8_t *p, size_t size, bool print_header,
+        bool print_ascii, bool print_empty) {
+  const auto view = hexdump_view(p, size, print_header, print_ascii, print_empty);
+  ::std::string out;
+  out.reserve((size + 15) / 16 * HEXDUMP_LINE_MAX);
+  char line[HEXDUMP_LINE_MAX];
+  for (size_t offset = 0; offset < size; offset += 16) {
+    out.append(line, format_hexdump_line(line, view, offset));
   }
-  return out.str();
+  return out;
+}
+
+void secure_zero(void *p, size_t size) {
+#if defined(HAVE_EXPLICIT_BZERO)
+  explicit_bzero(p, size);
+#elif defined(__APPLE__)
+  memset_s(p, size, 0, size);
+#else
+  volatile uint8_t *vp = static_cast<volatile uint8_t *>(p);
+  while (size--) *vp++ = 0;
+#endif
 }
 
 static uint32_t _crc32(uint32_t crc, uint32_t data) {
@@ -0,0 +1,345 @@
+/*
+ * Copyright (c) 2015-2018 Nitrokey UG
+ *
+ * This file is part of libnitrokey.
+ *
+ * libnitrokey is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libnitrokey is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libnitrokey. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0
+ */
+
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include "libnitrokey/provisioning.h"
+#include "libnitrokey/NitrokeyManager.h"
+#include "libnitrokey/LibraryException.h"
+#include "libnitrokey/CommandFailedException.h"
+#include "libnitrokey/misc.h"
+
+namespace nitrokey {
+namespace provisioning {
+
+    namespace {
+        const uint8_t OTP_SLOT_NAME_LENGTH = 15;
+
+        /**
+         * Half-open range of characters within the currently parsed line.
+         * Ranges are used instead of substrings, so no copies of the secrets are made.
+         */
+        struct Range {
+            size_t begin;
+            size_t end;
+            size_t size() const { return end - begin; }
+            bool empty() const { return begin == end; }
+        };
+
+        Range trim(const std::string &s, Range r) {
+          while (r.begin < r.end && isspace(static_cast<unsigned char>(s[r.begin]))) r.begin++;
+          while (r.end > r.begin && isspace(static_cast<unsigned char>(s[r.end - 1]))) r.end--;
+          return r;
+        }
+
+        bool starts_with_nocase(const std::string &s, Range r, const char *value) {
+          const auto len = strlen(value);
+          if (r.size() < len) return false;
+          for (size_t i = 0; i < len; i++) {
+            if (tolower(static_cast<unsigned char>(s[r.begin + i])) != tolower(static_cast<unsigned char>(value[i])))
+              return false;
+          }
+          return true;
+        }
+
+        bool equals_nocase(const std::string &s, Range r, const char *value) {
+          return r.size() == strlen(value) && starts_with_nocase(s, r, value);
+        }
+
+        std::vector<Range> split(const std::string &s, Range r, char separator) {
+          std::vector<Range> fields;
+          size_t begin = r.begin;
+          for (size_t i = r.begin; i <= r.end; i++) {
+            if (i == r.end || s[i] == separator) {
+              fields.push_back({begin, i});
+              begin = i + 1;
+            }
+          }
+          return fields;
+        }
+
+        uint64_t parse_number(const std::string &s, Range r, uint64_t max, size_t line, const char *reason) {
+          r = trim(s, r);
+          if (r.empty() || r.size() > 20) throw InvalidOTPSourceEntry(line, reason);
+          uint64_t v = 0;
+          for (size_t i = r.begin; i < r.end; i++) {
+            const char c = s[i];
+            if (c < '0' || c > '9') throw InvalidOTPSourceEntry(line, reason);
+            const uint64_t digit = static_cast<uint64_t>(c - '0');
+            if (v > (max - digit) / 10) throw InvalidOTPSourceEntry(line, reason);
+            v = v * 10 + digit;
+          }
+          return v;
+        }
+
+        int hex_value(char c) {
+          if (c >= '0' && c <= '9') return c - '0';
+          if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+          if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+          return -1;
+        }
+
+        std::string percent_decode(const std::string &s, Range r) {
+          std::string result;
+          result.reserve(r.size());
+          for (size_t i = r.begin; i < r.end; i++) {
+            if (s[i] == '%' && i + 2 < r.end && hex_value(s[i + 1]) >= 0 && hex_value(s[i + 2]) >= 0) {
+              result.push_back(static_cast<char>(hex_value(s[i + 1]) << 4 | hex_value(s[i + 2])));
+              i += 2;
+            } else if (s[i] == '+') {
+              result.push_back(' ');
+            } else {
+              result.push_back(s[i]);
+            }
+          }
+          return result;
+        }
+
+        void decode_secret(const std::string &s, Range r, OTPEntry &entry) {
+          r = trim(s, r);
+          if (starts_with_nocase(s, r, "hex:")) {
+            r.begin += 4;
+            entry.secret_size = misc::hex_decode(s.data() + r.begin, r.size(), entry.secret, sizeof entry.secret);
+          } else {
+            entry.secret_size = misc::base32_decode(s.data() + r.begin, r.size(), entry.secret, sizeof entry.secret);
+          }
+          if (entry.secret_size == 0) throw InvalidOTPSourceEntry(entry.line, "empty secret");
+        }
+
+        bool parse_digits(const std::string &s, Range r, size_t line) {
+          const auto digits = parse_number(s, r, 8, line, "digits has to be 6 or 8");
+          if (digits != 6 && digits != 8) throw InvalidOTPSourceEntry(line, "digits has to be 6 or 8");
+          return digits == 8;
+        }
+    }
+
+    OTPEntry::OTPEntry() {
+      bzero(secret, sizeof secret);
+    }
+
+    OTPEntry::OTPEntry(const OTPEntry &other) {
+      *this = other;
+    }
+
+    OTPEntry &OTPEntry::operator=(const OTPEntry &other) {
+      if (this != &other) {
+        type = other.type;
+        slot_number = other.slot_number;
+        name = other.name;
+        memcpy(secret, other.secret, sizeof secret);
+        secret_size = other.secret_size;
+        counter = other.counter;
+        period = other.period;
+        use_8_digits = other.use_8_digits;
+        line = other.line;
+      }
+      return *this;
+    }
+
+    OTPEntry::~OTPEntry() {
+      clear();
+    }
+
+    void OTPEntry::clear() {
+      misc::secure_zero(secret, sizeof secret);
+      secret_size = 0;
+      type = OTPType::TOTP;
+      slot_number = 0;
+      name.clear();
+      counter = 0;
+      period = 30;
+      use_8_digits = false;
+      line = 0;
+    }
+
+    OTPSourceReader::OTPSourceReader(std::istream &input) : m_input(input), m_line_number(0), m_next_slot{0, 0} {}
+
+    OTPSourceReader::~OTPSourceReader() {
+      if (!m_line.empty()) misc::secure_zero(&m_line[0], m_line.size());
+    }
+
+    bool OTPSourceReader::next(OTPEntry &entry) {
+      while (std::getline(m_input, m_line)) {
+        m_line_number++;
+        const auto r = trim(m_line, {0, m_line.size()});
+        bool skip = r.empty() || m_line[r.begin] == '#';
+        if (!skip && !starts_with_nocase(m_line, r, "otpauth://")) {
+          const auto first = trim(m_line, split(m_line, r, ',').front());
+          skip = equals_nocase(m_line, first, "type");
+        }
+        if (skip) continue;
+
+        entry.clear();
+        entry.line = m_line_number;
+        try {
+          if (starts_with_nocase(m_line, r, "otpauth://")) {
+            parse_uri(entry);
+          } else {
+            parse_csv(entry);
+          }
+        } catch (...) {
+          misc::secure_zero(&m_line[0], m_line.size());
+          entry.clear();
+          throw;
+        }
+        misc::secure_zero(&m_line[0], m_line.size());
+        return true;
+      }
+      return false;
+    }
+
+    void OTPSourceReader::parse_uri(OTPEntry &entry) {
+      const auto line = m_line_number;
+      auto r = trim(m_line, {0, m_line.size()});
+      r.begin += strlen("otpauth://");
+
+      const auto type_end = m_line.find('/', r.begin);
+      if (type_end == std::string::npos || type_end > r.end) throw InvalidOTPSourceEntry(line, "missing OTP type");
+      const Range type{r.begin, type_end};
+      if (equals_nocase(m_line, type, "hotp")) entry.type = OTPType::HOTP;
+      else if (equals_nocase(m_line, type, "totp")) entry.type = OTPType::TOTP;
+      else throw InvalidOTPSourceEntry(line, "unsupported OTP type");
+
+      auto query_begin = m_line.find('?', type_end);
+      if (query_begin == std::string::npos || query_begin > r.end) query_begin = r.end;
+      entry.name = percent_decode(m_line, {type_end + 1, query_begin});
+      if (entry.name.size() > OTP_SLOT_NAME_LENGTH) entry.name.resize(OTP_SLOT_NAME_LENGTH);
+
+      bool has_secret = false;
+      bool has_slot = false;
+      if (query_begin < r.end) {
+        for (const auto &param : split(m_line, {query_begin + 1, r.end}, '&')) {
+          const auto eq = m_line.find('=', param.begin);
+          if (eq == std::string::npos || eq >= param.end) continue;
+          const Range key{param.begin, eq};
+          const Range value{eq + 1, param.end};
+          if (equals_nocase(m_line, key, "secret")) {
+            decode_secret(m_line, value, entry);
+            has_secret = true;
+          } else if (equals_nocase(m_line, key, "digits")) {
+            entry.use_8_digits = parse_digits(m_line, value, line);
+          } else if (equals_nocase(m_line, key, "counter")) {
+            entry.counter = parse_number(m_line, value, UINT64_MAX, line, "invalid counter");
+          } else if (equals_nocase(m_line, key, "period")) {
+            entry.period = static_cast<uint16_t>(parse_number(m_line, value, UINT16_MAX, line, "invalid period"));
+          } else if (equals_nocase(m_line, key, "algorithm")) {
+            if (!equals_nocase(m_line, value, "sha1")) throw InvalidOTPSourceEntry(line, "only SHA1 algorithm is supported");
+          } else if (equals_nocase(m_line, key, "slot")) {
+            entry.slot_number = static_cast<uint8_t>(parse_number(m_line, value, UINT8_MAX, line, "invalid slot number"));
+            has_slot = true;
+          }
+        }
+      }
+      if (!has_secret) throw InvalidOTPSourceEntry(line, "missing secret");
+
+      auto &next_slot = m_next_slot[entry.type == OTPType::HOTP ? 0 : 1];
+      if (!has_slot) entry.slot_number = next_slot;
+      next_slot = static_cast<uint8_t>(entry.slot_number + 1);
+    }
+
+    void OTPSourceReader::parse_csv(OTPEntry &entry) {
+      const auto line = m_line_number;
+      const auto fields = split(m_line, {0, m_line.size()}, ',');
+      if (fields.size() < 4 || fields.size() > 6) throw InvalidOTPSourceEntry(line, "invalid number of fields");
+
+      const auto type = trim(m_line, fields[0]);
+      if (equals_nocase(m_line, type, "hotp")) entry.type = OTPType::HOTP;
+      else if (equals_nocase(m_line, type, "totp")) entry.type = OTPType::TOTP;
+      else throw InvalidOTPSourceEntry(line, "unsupported OTP type");
+
+      entry.slot_number = static_cast<uint8_t>(parse_number(m_line, fields[1], UINT8_MAX, line, "invalid slot number"));
+      const auto name = trim(m_line, fields[2]);
+      entry.name.assign(m_line, name.begin, name.size());
+      decode_secret(m_line, fields[3], entry);
+
+      if (fields.size() > 4 && !trim(m_line, fields[4]).empty()) {
+        if (entry.type == OTPType::HOTP) {
+          entry.counter = parse_number(m_line, fields[4], UINT64_MAX, line, "invalid counter");
+        } else {
+          entry.period = static_cast<uint16_t>(parse_number(m_line, fields[4], UINT16_MAX, line, "invalid period"));
+        }
+      }
+      if (fields.size() > 5) {
+        entry.use_8_digits = parse_digits(m_line, fields[5], line);
+      }
+    }
+
+    ProvisioningReport provision_OTP(NitrokeyManager &manager, std::istream &input, const char *admin_pin,
+                                     const char *temporary_password, ProgressCallback progress,
+                                     bool stop_on_error) {
+      const size_t max_secret_size = manager.is_320_OTP_secret_supported() ? OTP_SECRET_MAX_SIZE : 20;
+
+      OTPSourceReader reader(input);
+      ProvisioningReport report;
+      OTPEntry entry;
+      bool authenticated = false;
+      size_t processed = 0;
+
+      while (true) {
+        bool parsed = false;
+        std::string error;
+        try {
+          if (!reader.next(entry)) break;
+          parsed = true;
+          if (entry.secret_size > max_secret_size) {
+            throw TargetBufferSmallerThanSource(entry.secret_size, max_secret_size);
+          }
+          if (!authenticated) {
+            manager.first_authenticate(admin_pin, temporary_password);
+            authenticated = true;
+          }
+          if (entry.type == OTPType::HOTP) {
+            manager.write_HOTP_slot(entry.slot_number, entry.name.c_str(), entry.secret, entry.secret_size,
+                                    entry.counter, entry.use_8_digits, false, false, "", temporary_password);
+          } else {
+            manager.write_TOTP_slot(entry.slot_number, entry.name.c_str(), entry.secret, entry.secret_size,
+                                    entry.period, entry.use_8_digits, false, false, "", temporary_password);
+          }
+        } catch (InvalidOTPSourceEntry &e) {
+          if (stop_on_error) throw;
+          error = e.reason;
+        } catch (LibraryException &e) {
+          if (stop_on_error) throw;
+          error = "library error " + std::to_string(e.exception_id());
+        } catch (CommandFailedException &e) {
+          // without authentication none of the following writes could succeed
+          if (stop_on_error || !authenticated) throw;
+          error = "command failed with status " + std::to_string(e.last_command_status);
+        }
+
+        processed++;
+        const auto line = parsed ? entry.line : reader.line();
+        if (error.empty()) {
+          report.written++;
+        } else {
+          report.failed++;
+          report.errors.emplace_back(line, error);
+        }
+        if (progress) {
+          progress({processed, line, parsed ? &entry : nullptr, error.empty(), error});
+        }
+      }
+      return report;
+    }
+
+}
+}
@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2015-2018 Nitrokey UG
+ *
+ * This file is part of libnitrokey.
+ *
+ * libnitrokey is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libnitrokey is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libnitrokey. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0
+ */
+
+#include <cstring>
+#include "libnitrokey/report_pool.h"
+#include "libnitrokey/misc.h"
+#include "libnitrokey/secure_arena.h"
+
+namespace nitrokey {
+namespace device {
+
+    const size_t ReportPool::REPORT_SIZE;
+    const int ReportPool::POOL_SIZE;
+    const size_t ReportPool::SLOT_SIZE;
+    const size_t ReportPool::CACHE_LINE;
+    const size_t ReportPool::STORAGE_SIZE;
+
+    static_assert(ReportPool::REPORT_SIZE <= 128 && ReportPool::POOL_SIZE <= 32, "pool layout");
+
+    ReportPool::ReportPool()
+        : m_storage(static_cast<uint8_t *>(misc::SecureArena::instance().allocate(STORAGE_SIZE))),
+          m_free((1u << POOL_SIZE) - 1), m_overflow_allocations(0) {
+      const auto address = reinterpret_cast<uintptr_t>(m_storage);
+      m_slots = m_storage + (CACHE_LINE - address % CACHE_LINE) % CACHE_LINE;
+    }
+
+    ReportPool::~ReportPool() {
+      misc::SecureArena::instance().deallocate(m_storage, STORAGE_SIZE);
+    }
+
+    uint8_t *ReportPool::acquire() {
+      auto free = m_free.load(std::memory_order_acquire);
+      while (free != 0) {
+        const auto lowest = free & (~free + 1);
+        if (m_free.compare_exchange_weak(free, free & ~lowest, std::memory_order_acquire)) {
+          int index = 0;
+          while ((lowest >> index) != 1) index++;
+          return slot(index);
+        }
+      }
+      m_overflow_allocations.fetch_add(1, std::memory_order_relaxed);
+      return static_cast<uint8_t *>(misc::SecureArena::instance().allocate(REPORT_SIZE));
+    }
+
+    void ReportPool::release(uint8_t *report) {
+      if (report == nullptr) return;
+      if (report < m_slots || report >= slot(POOL_SIZE)) {
+        misc::SecureArena::instance().deallocate(report, REPORT_SIZE);
+        return;
+      }
+      misc::secure_zero(report, REPORT_SIZE);
+      const auto index = static_cast<int>((report - m_slots) / SLOT_SIZE);
+      m_free.fetch_or(1u << index, std::memory_order_release);
+    }
+
+}
+}
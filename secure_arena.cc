@@ -0,0 +1,152 @@
+/*
+ * Copyright (c) 2015-2018 Nitrokey UG
+ *
+ * This file is part of libnitrokey.
+ *
+ * libnitrokey is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libnitrokey is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libnitrokey. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0
+ */
+
+#include <new>
+#include "libnitrokey/secure_arena.h"
+#include "libnitrokey/misc.h"
+#include "libnitrokey/log.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <unistd.h>
+#define HAVE_MMAN 1
+#endif
+
+namespace nitrokey {
+namespace misc {
+
+    using namespace nitrokey::log;
+
+    const size_t SecureArena::MIN_BLOCK_SIZE;
+    const size_t SecureArena::MAX_BLOCK_SIZE;
+    const int SecureArena::CLASS_COUNT;
+    const size_t SecureArena::FALLBACK_PAGE_BYTES;
+
+    SecureArena &SecureArena::instance() {
+      // not destroyed, as blocks may be freed by other static destructors
+      static auto arena = new SecureArena();
+      return *arena;
+    }
+
+    SecureArena::SecureArena() : m_page_bytes(system_page_bytes()) {
+      for (auto &f : m_free) f = nullptr;
+    }
+
+    size_t SecureArena::system_page_bytes() {
+#ifdef HAVE_MMAN
+      // 16K or 64K on some arm64 and ppc64 systems
+      const auto page = sysconf(_SC_PAGESIZE);
+      if (page >= static_cast<long>(MAX_BLOCK_SIZE)) return static_cast<size_t>(page);
+#endif
+      return FALLBACK_PAGE_BYTES;
+    }
+
+    int SecureArena::size_class(size_t size) {
+      static_assert(MIN_BLOCK_SIZE << (CLASS_COUNT - 1) == MAX_BLOCK_SIZE, "size classes");
+      int c = 0;
+      while ((MIN_BLOCK_SIZE << c) < size) c++;
+      return c;
+    }
+
+    void *SecureArena::map_pages(size_t size) {
+#ifdef HAVE_MMAN
+      void *p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (p == MAP_FAILED) throw std::bad_alloc();
+      m_stats.reserved += size;
+      if (mlock(p, size) == 0) {
+        m_stats.locked += size;
+      } else {
+        if (m_stats.lock_failures++ == 0)
+          LOG("Could not lock the memory for secrets, it may be swapped out", Loglevel::WARNING);
+      }
+#ifdef MADV_DONTDUMP
+      madvise(p, size, MADV_DONTDUMP);
+#endif
+      return p;
+#else
+      m_stats.reserved += size;
+      return new uint8_t[size]();
+#endif
+    }
+
+    void SecureArena::unmap_pages(void *p, size_t size) {
+      m_stats.reserved -= size;
+#ifdef HAVE_MMAN
+      if (munlock(p, size) == 0) m_stats.locked -= size;
+      munmap(p, size);
+#else
+      delete[] static_cast<uint8_t *>(p);
+#endif
+    }
+
+    void *SecureArena::allocate(size_t size) {
+      if (size == 0) size = 1;
+      std::lock_guard<std::mutex> lock(m_mutex);
+      if (size > MAX_BLOCK_SIZE) {
+        const auto mapped = (size + m_page_bytes - 1) / m_page_bytes * m_page_bytes;
+        auto p = map_pages(mapped);
+        m_stats.allocated_blocks++;
+        return p;
+      }
+
+      const auto c = size_class(size);
+      if (m_free[c] == nullptr) {
+        const auto block_size = MIN_BLOCK_SIZE << c;
+        auto page = static_cast<uint8_t *>(map_pages(m_page_bytes));
+        for (size_t offset = m_page_bytes; offset >= block_size; offset -= block_size) {
+          auto block = reinterpret_cast<FreeBlock *>(page + offset - block_size);
+          block->next = m_free[c];
+          m_free[c] = block;
+        }
+      }
+      auto block = m_free[c];
+      m_free[c] = block->next;
+      block->next = nullptr;
+      m_stats.allocated_blocks++;
+      return block;
+    }
+
+    void SecureArena::deallocate(void *p, size_t size) {
+      if (p == nullptr) return;
+      if (size == 0) size = 1;
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_stats.allocated_blocks--;
+      if (size > MAX_BLOCK_SIZE) {
+        const auto mapped = (size + m_page_bytes - 1) / m_page_bytes * m_page_bytes;
+        secure_zero(p, mapped);
+        unmap_pages(p, mapped);
+        return;
+      }
+
+      const auto c = size_class(size);
+      secure_zero(p, MIN_BLOCK_SIZE << c);
+      auto block = static_cast<FreeBlock *>(p);
+      block->next = m_free[c];
+      m_free[c] = block;
+    }
+
+    SecureArenaStats SecureArena::get_stats() {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      return m_stats;
+    }
+
+}
+}
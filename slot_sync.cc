@@ -0,0 +1,257 @@
+/*
+ * Copyright (c) 2015-2018 Nitrokey UG
+ *
+ * This file is part of libnitrokey.
+ *
+ * libnitrokey is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libnitrokey is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libnitrokey. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0
+ */
+
+#include <cstring>
+#include <sstream>
+#include "libnitrokey/slot_sync.h"
+#include "libnitrokey/NitrokeyManager.h"
+#include "libnitrokey/LibraryException.h"
+#include "libnitrokey/CommandFailedException.h"
+
+namespace nitrokey {
+namespace sync {
+
+    namespace {
+        const uint8_t HOTP_SLOT_COUNT = 3;
+        const uint8_t TOTP_SLOT_COUNT = 15;
+
+        const char *kind_to_string(SlotKind kind) {
+          switch (kind) {
+            case SlotKind::HOTP: return "HOTP";
+            case SlotKind::TOTP: return "TOTP";
+            case SlotKind::PWS: return "PWS";
+          }
+          return "";
+        }
+
+        template <typename T>
+        void check_slots(const std::vector<T> &slots, uint8_t slot_count) {
+          uint32_t seen = 0;
+          for (const auto &s : slots) {
+            if (s.slot_number >= slot_count || (seen & (1u << s.slot_number)) != 0)
+              throw InvalidSlotException(s.slot_number);
+            seen |= 1u << s.slot_number;
+          }
+        }
+
+        /** the time window is written as 16 bits */
+        void check_intervals(const std::vector<OTPSlotTarget> &slots) {
+          for (const auto &s : slots) {
+            if (s.programmed && s.counter_or_interval > UINT16_MAX) throw InvalidSlotException(s.slot_number);
+          }
+        }
+
+        template <typename T>
+        const T &find_target(const std::vector<T> &slots, uint8_t slot_number) {
+          for (const auto &s : slots) {
+            if (s.slot_number == slot_number) return s;
+          }
+          throw InvalidSlotException(slot_number);
+        }
+
+        bool field_equals(const uint8_t *field, size_t field_size, const std::string &value) {
+          const auto len = strnlen(reinterpret_cast<const char *>(field), field_size);
+          return len == value.size() && memcmp(field, value.data(), len) == 0;
+        }
+
+        /**
+         * Compares OTP slot metadata with the target, returns the reason
+         * for rewriting the slot or nullptr if it is up to date.
+         */
+        const char *otp_difference(SlotKind kind, const stick10::ReadSlot::ResponsePayload &current,
+                                   const OTPSlotTarget &target) {
+          if (target.secret_changed) return "secret changed";
+          if (!field_equals(current.slot_name, sizeof current.slot_name, target.name)) return "name differs";
+          if (current.use_8_digits != target.use_8_digits
+              || current.use_enter != target.use_enter
+              || current.use_tokenID != target.use_tokenID)
+            return "configuration differs";
+          if (!field_equals(current.slot_token_id, sizeof current.slot_token_id, target.token_ID))
+            return "token ID differs";
+          if (kind == SlotKind::HOTP) {
+            // do not move the counter back - codes already used would become valid again
+            if (current.slot_counter < target.counter_or_interval) return "counter behind target";
+          } else {
+            // for TOTP slots the counter field holds the time window
+            if (current.slot_counter != target.counter_or_interval) return "time window differs";
+          }
+          return nullptr;
+        }
+
+        void plan_otp(NitrokeyManager &manager, SlotKind kind, const std::vector<OTPSlotTarget> &targets,
+                      SyncPlan &plan) {
+          for (const auto &target : targets) {
+            bool programmed = true;
+            stick10::ReadSlot::ResponsePayload current;
+            try {
+              current = kind == SlotKind::HOTP ? manager.get_HOTP_slot_data(target.slot_number)
+                                               : manager.get_TOTP_slot_data(target.slot_number);
+            } catch (CommandFailedException &e) {
+              if (!e.reason_slot_not_programmed()) throw;
+              programmed = false;
+            }
+
+            const char *reason = nullptr;
+            auto type = ActionType::WRITE;
+            if (!target.programmed) {
+              if (programmed) {
+                type = ActionType::ERASE;
+                reason = "slot programmed";
+              }
+            } else if (!programmed) {
+              reason = "slot not programmed";
+            } else {
+              reason = otp_difference(kind, current, target);
+            }
+
+            if (reason == nullptr) {
+              plan.unchanged++;
+              continue;
+            }
+            plan.actions.push_back({kind, target.slot_number, type, reason});
+          }
+        }
+
+        void plan_pws(NitrokeyManager &manager, const std::vector<PWSSlotTarget> &targets, SyncPlan &plan) {
+          if (targets.empty()) return;
+
+          const auto status = manager.get_password_safe_slot_status();
+          uint16_t compare_mask = 0;
+          for (const auto &target : targets) {
+            if (target.programmed && status[target.slot_number] != 0)
+              compare_mask |= 1u << target.slot_number;
+          }
+          // fetch only slots which are programmed on both sides
+          const auto entries = compare_mask != 0 ? manager.read_password_safe(compare_mask) : PasswordSafeEntries();
+
+          for (const auto &target : targets) {
+            const bool programmed = status[target.slot_number] != 0;
+            const char *reason = nullptr;
+            auto type = ActionType::WRITE;
+            if (!target.programmed) {
+              if (programmed) {
+                type = ActionType::ERASE;
+                reason = "slot programmed";
+              }
+            } else if (!programmed) {
+              reason = "slot not programmed";
+            } else {
+              for (const auto &e : entries) {
+                if (e.slot_number != target.slot_number) continue;
+                if (target.name != e.name) reason = "name differs";
+                else if (target.login != e.login) reason = "login differs";
+                else if (target.password != e.password) reason = "password differs";
+                break;
+              }
+            }
+
+            if (reason == nullptr) {
+              plan.unchanged++;
+              continue;
+            }
+            plan.actions.push_back({SlotKind::PWS, target.slot_number, type, reason});
+          }
+        }
+    }
+
+    bool SyncPlan::has_otp_actions() const {
+      for (const auto &a : actions) {
+        if (a.kind != SlotKind::PWS) return true;
+      }
+      return false;
+    }
+
+    std::string SyncPlan::dissect() const {
+      std::stringstream ss;
+      for (const auto &a : actions) {
+        ss << (a.type == ActionType::WRITE ? "write " : "erase ")
+           << kind_to_string(a.kind) << " slot " << static_cast<int>(a.slot_number)
+           << ":\t" << a.reason << std::endl;
+      }
+      ss << "unchanged slots:\t" << unchanged << std::endl;
+      return ss.str();
+    }
+
+    SyncPlan plan(NitrokeyManager &manager, const SyncTarget &target) {
+      check_slots(target.hotp, HOTP_SLOT_COUNT);
+      check_slots(target.totp, TOTP_SLOT_COUNT);
+      check_slots(target.pws, PWS_SLOT_COUNT);
+      check_intervals(target.totp);
+
+      SyncPlan plan;
+      plan_otp(manager, SlotKind::HOTP, target.hotp, plan);
+      plan_otp(manager, SlotKind::TOTP, target.totp, plan);
+      plan_pws(manager, target.pws, plan);
+      return plan;
+    }
+
+    void apply(NitrokeyManager &manager, const SyncTarget &target, const SyncPlan &plan,
+               const char *admin_pin, const char *temporary_password) {
+      check_intervals(target.totp);
+      if (plan.has_otp_actions()) {
+        manager.first_authenticate(admin_pin, temporary_password);
+      }
+
+      PasswordSafeEntries pws_writes;
+      for (const auto &a : plan.actions) {
+        switch (a.kind) {
+          case SlotKind::HOTP:
+          case SlotKind::TOTP: {
+            const auto &t = find_target(a.kind == SlotKind::HOTP ? target.hotp : target.totp, a.slot_number);
+            const bool hotp = a.kind == SlotKind::HOTP;
+            if (a.type == ActionType::ERASE) {
+              if (hotp) manager.erase_hotp_slot(a.slot_number, temporary_password);
+              else manager.erase_totp_slot(a.slot_number, temporary_password);
+              break;
+            }
+            if (t.secret.empty()) throw InvalidHexString(0);
+            if (hotp) {
+              manager.write_HOTP_slot(a.slot_number, t.name.c_str(), t.secret.c_str(), t.counter_or_interval,
+                                      t.use_8_digits, t.use_enter, t.use_tokenID, t.token_ID.c_str(),
+                                      temporary_password);
+            } else {
+              // checked by check_intervals
+              manager.write_TOTP_slot(a.slot_number, t.name.c_str(), t.secret.c_str(),
+                                      static_cast<uint16_t>(t.counter_or_interval),
+                                      t.use_8_digits, t.use_enter, t.use_tokenID, t.token_ID.c_str(),
+                                      temporary_password);
+            }
+            break;
+          }
+          case SlotKind::PWS: {
+            const auto &t = find_target(target.pws, a.slot_number);
+            if (a.type == ActionType::ERASE) {
+              manager.erase_password_safe_slot(a.slot_number);
+            } else {
+              pws_writes.add(t.slot_number, t.name.c_str(), t.login.c_str(), t.password.c_str());
+            }
+            break;
+          }
+        }
+      }
+
+      if (!pws_writes.empty()) {
+        manager.write_password_safe(pws_writes);
+      }
+    }
+
+}
+}
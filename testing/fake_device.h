@@ -0,0 +1,194 @@
+/*
+ * Copyright (c) 2015-2018 Nitrokey UG
+ *
+ * This file is part of libnitrokey.
+ *
+ * libnitrokey is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libnitrokey is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libnitrokey. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0
+ */
+
+#ifndef LIBNITROKEY_FAKE_DEVICE_H
+#define LIBNITROKEY_FAKE_DEVICE_H
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <device.h>
+#include <device_proto.h>
+
+/**
+ * In-process Nitrokey Pro answering each command with a successful response,
+ * for the offline tests, benchmarks and load tests. Timing delays are zero,
+ * so only the library overhead is measured, unless the device processing
+ * time is emulated with set_response_delay() and set_busy_polls().
+ * Only the HID transport is replaced, so the transfers go through
+ * Device::send and Device::recv, and their failures can be emulated with
+ * fail_transfers(). Created connected, use it with
+ * NitrokeyManager::connect_with_device(). Reopen with connect() after
+ * disconnecting.
+ */
+class FakeDevice : public nitrokey::device::Device {
+public:
+  using Response = nitrokey::proto::DeviceResponse<nitrokey::proto::CommandID::GET_STATUS,
+                                                   nitrokey::proto::EmptyPayload>;
+
+  FakeDevice()
+      : Device(nitrokey::device::NITROKEY_VID, nitrokey::device::NITROKEY_PRO_PID,
+               nitrokey::device::DeviceModel::PRO, std::chrono::milliseconds(0), 5,
+               std::chrono::milliseconds(0)) {
+    memset(m_payloads, 0, sizeof m_payloads);
+    memset(&m_response, 0, sizeof m_response);
+    memset(&m_previous, 0, sizeof m_previous);
+    // new enough for the authorization commands
+    set_payload(nitrokey::proto::CommandID::GET_STATUS, std::vector<uint8_t>{12, 0});
+    connect();
+  }
+
+  /** closes the handle while the overrides are still active, ~Device would call hid_close() */
+  ~FakeDevice() override {
+    disconnect();
+  }
+
+  /**
+   * Sets the response payload returned for the command, zeros by default.
+   */
+  void set_payload(nitrokey::proto::CommandID command_id, const std::vector<uint8_t> &payload) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto &p = m_payloads[static_cast<uint8_t>(command_id)];
+    memset(p, 0, sizeof p);
+    memcpy(p, payload.data(), std::min(payload.size(), sizeof p));
+  }
+
+  /**
+   * Emulates the device processing time: the first poll after each command
+   * waits this long before answering.
+   */
+  void set_response_delay(std::chrono::microseconds delay) { m_response_delay = delay; }
+  /**
+   * Answers this many polls after each command with the busy status.
+   */
+  void set_busy_polls(int polls) { m_busy_polls = polls; }
+  /**
+   * Answers this many polls after each command with the response to the
+   * previous command, like a device not done processing yet.
+   */
+  void set_stale_polls(int polls) { m_stale_polls = polls; }
+
+  /**
+   * Fails the next transfers, sends and receives alike, with the errno value.
+   */
+  void fail_transfers(int count, int error) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_failures_left = count;
+    m_failure_errno = error;
+  }
+  /**
+   * Makes reopening the handle fail, like for an unplugged device.
+   */
+  void set_open_fails(bool fails) { m_open_fails = fails; }
+
+  std::atomic<uint64_t> opened{0};
+
+protected:
+  hid_device *_open_handle() override {
+    if (m_open_fails) return nullptr;
+    opened++;
+    // never dereferenced, only compared with nullptr
+    return reinterpret_cast<hid_device *>(this);
+  }
+
+  void _close_handle(hid_device *) override {}
+
+  int _write_report(const void *packet) override {
+    if (take_failure()) return -1;
+    const auto query = static_cast<const uint8_t *>(packet);
+    uint32_t crc;
+    // outgoing CRC follows the 1 byte report ID, 1 byte command ID and payload
+    memcpy(&crc, query + HID_REPORT_SIZE - sizeof crc, sizeof crc);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_previous = m_response;
+    m_response.initialize();
+    m_response.device_status = 0;
+    m_response.command_id = query[1];
+    m_response.last_command_crc = crc;
+    m_response.last_command_status = 0;
+    memcpy(m_response._padding, m_payloads[query[1]], sizeof m_response._padding);
+    m_response.update_CRC();
+    m_busy_left = m_busy_polls;
+    m_stale_left = m_stale_polls;
+    m_first_poll = true;
+    sent++;
+    return HID_REPORT_SIZE;
+  }
+
+  int _read_report(void *packet) override {
+    if (take_failure()) return -1;
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (m_first_poll && m_response_delay.load().count() > 0) {
+      lock.unlock();
+      std::this_thread::sleep_for(m_response_delay.load());
+      lock.lock();
+    }
+    m_first_poll = false;
+    if (m_stale_left > 0) {
+      m_stale_left--;
+      memcpy(packet, &m_previous, sizeof m_previous);
+    } else if (m_busy_left > 0) {
+      m_busy_left--;
+      auto busy = m_response;
+      busy.device_status = static_cast<uint8_t>(nitrokey::proto::stick10::device_status::busy);
+      busy.update_CRC();
+      memcpy(packet, &busy, sizeof busy);
+    } else {
+      memcpy(packet, &m_response, sizeof m_response);
+    }
+    received++;
+    return HID_REPORT_SIZE;
+  }
+
+public:
+  std::atomic<uint64_t> sent{0};
+  std::atomic<uint64_t> received{0};
+
+private:
+  bool take_failure() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_failures_left == 0) return false;
+    m_failures_left--;
+    errno = m_failure_errno;
+    return true;
+  }
+
+  std::mutex m_mutex;
+  Response m_response;
+  Response m_previous;
+  uint8_t m_payloads[256][sizeof(Response::_padding)];
+  std::atomic<std::chrono::microseconds> m_response_delay{std::chrono::microseconds(0)};
+  std::atomic_int m_busy_polls{0};
+  std::atomic_int m_stale_polls{0};
+  std::atomic_bool m_open_fails{false};
+  int m_failures_left = 0;
+  int m_failure_errno = 0;
+  int m_busy_left = 0;
+  int m_stale_left = 0;
+  bool m_first_poll = false;
+};
+
+#endif //LIBNITROKEY_FAKE_DEVICE_H
@@ -0,0 +1,306 @@
+/*
+ * Copyright (c) 2015-2018 Nitrokey UG
+ *
+ * This file is part of libnitrokey.
+ *
+ * libnitrokey is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libnitrokey is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libnitrokey. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0
+ */
+
+#include <iomanip>
+#include <sstream>
+#include <thread>
+#include "libnitrokey/timeline.h"
+#include "libnitrokey/command_id.h"
+#include "libnitrokey/device.h"
+
+namespace nitrokey {
+namespace trace {
+
+    using std::chrono::steady_clock;
+
+    const size_t TimelineRecorder::DEFAULT_MAX_EVENTS;
+
+    namespace {
+        const int COMMANDS_TRACK = 1;
+        const int LOCKS_TRACK = 2;
+
+        std::string json_escape(const std::string &s) {
+          std::string res;
+          for (const char c : s) {
+            switch (c) {
+              case '"': res += "\\\""; break;
+              case '\\': res += "\\\\"; break;
+              default:
+                if (static_cast<unsigned char>(c) < 0x20) {
+                  std::ostringstream hex;
+                  hex << "\\u" << std::hex << std::setw(4) << std::setfill('0') << static_cast<int>(c);
+                  res += hex.str();
+                } else {
+                  res += c;
+                }
+            }
+          }
+          return res;
+        }
+
+        std::string command_name(uint8_t command_id) {
+          return proto::commandid_to_string(static_cast<proto::CommandID>(command_id));
+        }
+
+        /**
+         * Writes the trace events as they are converted, separating them with commas.
+         */
+        class EventWriter {
+        public:
+            EventWriter(std::ostream &out, steady_clock::time_point start) : m_out(out), m_start(start) {}
+
+            void metadata(uint32_t pid, int tid, const char *name, const std::string &value) {
+              begin();
+              m_out << "{\"ph\":\"M\",\"pid\":" << pid;
+              if (tid != 0) m_out << ",\"tid\":" << tid;
+              m_out << ",\"name\":\"" << name << "\",\"args\":{\"name\":\"" << json_escape(value) << "\"}}";
+            }
+
+            void slice(uint32_t pid, int tid, const std::string &name, steady_clock::time_point from,
+                       steady_clock::time_point to, const std::string &args) {
+              begin();
+              m_out << "{\"ph\":\"X\",\"pid\":" << pid << ",\"tid\":" << tid
+                    << ",\"name\":\"" << json_escape(name) << "\",\"ts\":" << micros(from)
+                    << ",\"dur\":" << micros(to) - micros(from) << ",\"args\":{" << args << "}}";
+            }
+
+            void instant(uint32_t pid, int tid, const std::string &name, steady_clock::time_point at,
+                         const std::string &args) {
+              begin();
+              m_out << "{\"ph\":\"i\",\"s\":\"t\",\"pid\":" << pid << ",\"tid\":" << tid
+                    << ",\"name\":\"" << json_escape(name) << "\",\"ts\":" << micros(at)
+                    << ",\"args\":{" << args << "}}";
+            }
+
+        private:
+            void begin() {
+              if (!m_first) m_out << ",\n";
+              m_first = false;
+            }
+
+            double micros(steady_clock::time_point t) const {
+              return std::chrono::duration_cast<std::chrono::nanoseconds>(t - m_start).count() / 1000.0;
+            }
+
+            std::ostream &m_out;
+            steady_clock::time_point m_start;
+            bool m_first = true;
+        };
+
+        /**
+         * Builds the slices of a single device from its events, in order.
+         */
+        class DeviceTimeline {
+        public:
+            DeviceTimeline(EventWriter &writer, uint32_t pid) : m_writer(writer), m_pid(pid) {}
+
+            void add(const Event event, uint8_t command_id, int64_t value, steady_clock::time_point time,
+                     uint32_t thread) {
+              const auto thread_arg = "\"thread\":" + std::to_string(thread);
+              switch (event) {
+                case Event::transaction_lock_wait:
+                case Event::handle_lock_wait: {
+                  const auto name = event == Event::transaction_lock_wait ? "transaction lock" : "handle lock";
+                  const auto args = (command_id != 0 ? "\"command\":\"" + command_name(command_id) + "\"," : std::string())
+                                    + thread_arg;
+                  m_writer.slice(m_pid, LOCKS_TRACK, name, time - std::chrono::microseconds(value), time, args);
+                  break;
+                }
+                case Event::transaction_start:
+                  m_in_transaction = true;
+                  m_transaction_start = time;
+                  m_polls = m_busy = 0;
+                  m_gap.clear();
+                  break;
+                case Event::send_start:
+                case Event::recv_start:
+                  close_gap(time);
+                  m_phase_start = time;
+                  break;
+                case Event::send_done:
+                  m_writer.slice(m_pid, COMMANDS_TRACK, "send", m_phase_start, time,
+                                 "\"status\":" + std::to_string(value));
+                  open_gap("wait", time);
+                  break;
+                case Event::poll:
+                  m_polls++;
+                  if (value == static_cast<int64_t>(proto::stick10::device_status::busy)) m_busy++;
+                  m_writer.slice(m_pid, COMMANDS_TRACK, "poll", m_phase_start, time,
+                                 "\"device_status\":" + std::to_string(value));
+                  open_gap("retry wait", time);
+                  break;
+                case Event::busy_backoff:
+                  open_gap("busy backoff", m_gap_start);
+                  break;
+                case Event::reconnect:
+                  m_writer.slice(m_pid, COMMANDS_TRACK, "reconnect", time - std::chrono::microseconds(value), time,
+                                 thread_arg);
+                  break;
+                case Event::transfer_error:
+                  m_writer.instant(m_pid, COMMANDS_TRACK, "transfer error", time,
+                                   "\"errno\":" + std::to_string(value));
+                  break;
+                case Event::decode:
+                  m_gap.clear();
+                  break;
+                case Event::transaction_finish:
+                  m_gap.clear();
+                  if (!m_in_transaction) break;
+                  m_in_transaction = false;
+                  m_writer.slice(m_pid, COMMANDS_TRACK, command_name(command_id), m_transaction_start, time,
+                                 "\"result\":" + std::to_string(value)
+                                 + ",\"polls\":" + std::to_string(m_polls)
+                                 + ",\"busy\":" + std::to_string(m_busy)
+                                 + "," + thread_arg);
+                  break;
+              }
+            }
+
+        private:
+            void open_gap(const char *name, steady_clock::time_point from) {
+              m_gap = name;
+              m_gap_start = from;
+            }
+
+            void close_gap(steady_clock::time_point to) {
+              if (!m_gap.empty()) m_writer.slice(m_pid, COMMANDS_TRACK, m_gap, m_gap_start, to, "");
+              m_gap.clear();
+            }
+
+            EventWriter &m_writer;
+            uint32_t m_pid;
+            bool m_in_transaction = false;
+            steady_clock::time_point m_transaction_start;
+            steady_clock::time_point m_phase_start;
+            /** time between the phases, closed when the next one starts */
+            std::string m_gap;
+            steady_clock::time_point m_gap_start;
+            int m_polls = 0;
+            int m_busy = 0;
+        };
+    }
+
+    TimelineRecorder::TimelineRecorder(size_t max_events) : m_state(std::make_shared<State>()) {
+      m_state->max_events = max_events;
+    }
+
+    TimelineRecorder::~TimelineRecorder() {
+      if (is_recording()) stop();
+    }
+
+    void TimelineRecorder::State::record(const TraceEvent &e) {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (!recording) return;
+      if (records.size() >= max_events) {
+        dropped++;
+        return;
+      }
+
+      const uint64_t device_id = e.device != nullptr ? e.device->get_instance_id() : 0;
+      auto d = device_index.find(device_id);
+      if (d == device_index.end()) {
+        std::ostringstream name;
+        if (e.device != nullptr) {
+          const auto path = e.device->get_path();
+          name << e.device->get_device_model();
+          if (!path.empty()) name << " " << path;
+        } else {
+          name << "unknown device";
+        }
+        devices.push_back(name.str());
+        d = device_index.emplace(device_id, static_cast<uint32_t>(devices.size() - 1)).first;
+      }
+      const auto thread_id = std::hash<std::thread::id>()(std::this_thread::get_id());
+      const auto t = thread_index.emplace(thread_id, static_cast<uint32_t>(thread_index.size())).first;
+
+      records.push_back({e.event, e.command_id, e.value, e.time, d->second, t->second});
+    }
+
+    void TimelineRecorder::start() {
+      std::lock_guard<std::mutex> lock(m_state->mutex);
+      m_state->records.clear();
+      m_state->dropped = 0;
+      m_state->device_index.clear();
+      m_state->devices.clear();
+      m_state->thread_index.clear();
+      m_state->start = steady_clock::now();
+      m_state->recording = true;
+      // locked in this order only: emit does not hold the registrations lock
+      if (m_state->listener != 0) return;
+      auto state = m_state;
+      m_state->listener = add_listener([state](const TraceEvent &e) { state->record(e); });
+    }
+
+    void TimelineRecorder::stop() {
+      std::lock_guard<std::mutex> lock(m_state->mutex);
+      remove_listener(m_state->listener);
+      m_state->listener = 0;
+      m_state->recording = false;
+      m_state->device_index.clear();
+    }
+
+    bool TimelineRecorder::is_recording() const {
+      std::lock_guard<std::mutex> lock(m_state->mutex);
+      return m_state->recording;
+    }
+
+    size_t TimelineRecorder::recorded_events() const {
+      std::lock_guard<std::mutex> lock(m_state->mutex);
+      return m_state->records.size();
+    }
+
+    size_t TimelineRecorder::dropped_events() const {
+      std::lock_guard<std::mutex> lock(m_state->mutex);
+      return m_state->dropped;
+    }
+
+    void TimelineRecorder::write_json(std::ostream &out) const {
+      std::lock_guard<std::mutex> lock(m_state->mutex);
+      const auto flags = out.flags();
+      out << std::fixed << std::setprecision(3);
+      out << "{\"displayTimeUnit\":\"ms\",\"otherData\":{\"dropped_events\":" << m_state->dropped
+          << "},\"traceEvents\":[\n";
+
+      EventWriter writer(out, m_state->start);
+      std::vector<DeviceTimeline> timelines;
+      for (uint32_t i = 0; i < m_state->devices.size(); i++) {
+        const auto pid = i + 1;
+        writer.metadata(pid, 0, "process_name", m_state->devices[i]);
+        writer.metadata(pid, COMMANDS_TRACK, "thread_name", "commands");
+        writer.metadata(pid, LOCKS_TRACK, "thread_name", "lock waits");
+        timelines.emplace_back(writer, pid);
+      }
+      for (const auto &r : m_state->records) {
+        timelines[r.device].add(r.event, r.command_id, r.value, r.time, r.thread);
+      }
+
+      out << "\n]}\n";
+      out.flags(flags);
+    }
+
+    std::string TimelineRecorder::to_json() const {
+      std::ostringstream out;
+      write_json(out);
+      return out.str();
+    }
+
+}
+}
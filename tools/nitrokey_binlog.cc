@@ -0,0 +1,223 @@
+/*
+ * Copyright (c) 2015-2018 Nitrokey UG
+ *
+ * This file is part of libnitrokey.
+ *
+ * libnitrokey is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libnitrokey is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libnitrokey. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0
+ */
+
+/*
+ * Decodes the binary log written with NK_open_binary_log into the same
+ * packet dissections as the text log.
+ * Usage: nitrokey_binlog <log file>
+ */
+
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include "binary_log.h"
+#include "device.h"
+#include "stick10_commands.h"
+#include "stick20_commands.h"
+
+using namespace nitrokey::proto;
+using nitrokey::log::BinaryLogEvent;
+using nitrokey::log::BinaryLogHeader;
+using nitrokey::log::BinaryLogRecord;
+
+namespace {
+
+  template <typename Transaction>
+  std::string dissect_query(const uint8_t *report) {
+    typename Transaction::OutgoingPacket packet;
+    memcpy(&packet, report, sizeof packet);
+    return static_cast<std::string>(packet);
+  }
+
+  template <typename Transaction>
+  std::string dissect_response(const uint8_t *report) {
+    typename Transaction::ResponsePacket packet;
+    memcpy(&packet, report, sizeof packet);
+    return static_cast<std::string>(packet);
+  }
+
+  struct Dissector {
+    CommandID command_id;
+    std::string (*query)(const uint8_t *);
+    std::string (*response)(const uint8_t *);
+  };
+
+  template <CommandID cmd_id, typename CommandPayload, typename ResponsePayload>
+  Dissector dissector_for(Transaction<cmd_id, CommandPayload, ResponsePayload> *) {
+    using T = Transaction<cmd_id, CommandPayload, ResponsePayload>;
+    return {cmd_id, &dissect_query<T>, &dissect_response<T>};
+  }
+
+#define COMMAND(cls) dissector_for(static_cast<cls::CommandTransaction *>(nullptr))
+
+  // commands sharing an ID (HOTP and TOTP variants) are decoded with the first listed
+  const Dissector dissectors[] = {
+      COMMAND(stick10::GetSlotName),
+      COMMAND(stick10::EraseSlot),
+      COMMAND(stick10::SetTime),
+      COMMAND(stick10::WriteToHOTPSlot),
+      COMMAND(stick10::GetHOTP),
+      COMMAND(stick10::ReadSlot),
+      COMMAND(stick10::GetStatus),
+      COMMAND(stick10::GetPasswordRetryCount),
+      COMMAND(stick10::GetUserPasswordRetryCount),
+      COMMAND(stick10::GetPasswordSafeSlotStatus),
+      COMMAND(stick10::GetPasswordSafeSlotName),
+      COMMAND(stick10::GetPasswordSafeSlotPassword),
+      COMMAND(stick10::GetPasswordSafeSlotLogin),
+      COMMAND(stick10::SetPasswordSafeSlotData),
+      COMMAND(stick10::SetPasswordSafeSlotData2),
+      COMMAND(stick10::ErasePasswordSafeSlot),
+      COMMAND(stick10::EnablePasswordSafe),
+      COMMAND(stick10::PasswordSafeInitKey),
+      COMMAND(stick10::WriteGeneralConfig),
+      COMMAND(stick10::FirstAuthenticate),
+      COMMAND(stick10::UserAuthenticate),
+      COMMAND(stick10::Authorize),
+      COMMAND(stick10::UserAuthorize),
+      COMMAND(stick10::UnlockUserPassword),
+      COMMAND(stick10::ChangeUserPin),
+      COMMAND(stick10::IsAESSupported),
+      COMMAND(stick10::ChangeAdminPin),
+      COMMAND(stick10::LockDevice),
+      COMMAND(stick10::FactoryReset),
+      COMMAND(stick10::BuildAESKey),
+      COMMAND(stick10::GetRandom),
+      COMMAND(stick10::FirmwareUpdate),
+      COMMAND(stick10::FirmwarePasswordChange),
+      COMMAND(stick20::ChangeAdminUserPin20Current),
+      COMMAND(stick20::ChangeAdminUserPin20New),
+      COMMAND(stick20::EnableEncryptedPartition),
+      COMMAND(stick20::EnableHiddenEncryptedPartition),
+      COMMAND(stick20::SetUnencryptedVolumeReadOnlyAdmin),
+      COMMAND(stick20::SetUnencryptedVolumeReadWriteAdmin),
+      COMMAND(stick20::SetEncryptedVolumeReadOnly),
+      COMMAND(stick20::SetEncryptedVolumeReadWrite),
+      COMMAND(stick20::DisableEncryptedPartition),
+      COMMAND(stick20::DisableHiddenEncryptedPartition),
+      COMMAND(stick20::EnableFirmwareUpdate),
+      COMMAND(stick20::ChangeUpdatePassword),
+      COMMAND(stick20::ExportFirmware),
+      COMMAND(stick20::CreateNewKeys),
+      COMMAND(stick20::FillSDCardWithRandomChars),
+      COMMAND(stick20::SendStartup),
+      COMMAND(stick20::SendSetReadonlyToUncryptedVolume),
+      COMMAND(stick20::SendSetReadwriteToUncryptedVolume),
+      COMMAND(stick20::SendClearNewSdCardFound),
+      COMMAND(stick20::GetDeviceStatus),
+      COMMAND(stick20::Wink),
+      COMMAND(stick20::CheckSmartcardUsage),
+      COMMAND(stick20::GetSDCardOccupancy),
+      COMMAND(stick20::SetupHiddenVolume),
+      COMMAND(stick20::ProductionTest),
+  };
+
+#undef COMMAND
+
+  const Dissector *find_dissector(uint8_t command_id) {
+    for (const auto &d : dissectors) {
+      if (static_cast<uint8_t>(d.command_id) == command_id) return &d;
+    }
+    return nullptr;
+  }
+
+  std::string format_time(uint64_t timestamp_us) {
+    const auto seconds = static_cast<time_t>(timestamp_us / 1000000);
+    tm tm;
+#ifdef _WIN32
+    localtime_s(&tm, &seconds);
+#else
+    localtime_r(&seconds, &tm);
+#endif
+    std::stringstream s;
+    s << std::put_time(&tm, "%F %T") << "." << std::setw(6) << std::setfill('0') << timestamp_us % 1000000;
+    return s.str();
+  }
+
+  const char *event_name(uint8_t event) {
+    switch (static_cast<BinaryLogEvent>(event)) {
+      case BinaryLogEvent::DEVICE: return "Device";
+      case BinaryLogEvent::QUERY: return "Outgoing HID packet";
+      case BinaryLogEvent::RESPONSE: return "Incoming HID packet";
+      case BinaryLogEvent::RETRIED_RESPONSE: return "Invalid incoming HID packet";
+    }
+    return "Unknown event";
+  }
+
+  void print_record(const BinaryLogRecord &r) {
+    std::cout << "[" << format_time(r.timestamp_us) << "][device " << r.device_id << "] ";
+    if (r.event == static_cast<uint8_t>(BinaryLogEvent::DEVICE)) {
+      std::string path(reinterpret_cast<const char *>(r.report), strnlen(reinterpret_cast<const char *>(r.report), sizeof r.report));
+      std::cout << event_name(r.event) << ": " << static_cast<nitrokey::device::DeviceModel>(r.device_status)
+                << " " << path << std::endl;
+      return;
+    }
+
+    std::cout << event_name(r.event) << ": "
+              << commandid_to_string(static_cast<CommandID>(r.command_id))
+              << ", retries (sending, receiving): " << r.sending_retries << ", " << r.receiving_retries;
+    if (r.flags & BinaryLogRecord::FLAG_MASKED) std::cout << ", secrets masked";
+    std::cout << std::endl;
+    if (!(r.flags & BinaryLogRecord::FLAG_REPORT)) return;
+
+    const auto d = find_dissector(r.command_id);
+    if (d == nullptr) {
+      std::cout << "No dissector for the command, raw packet:" << std::endl
+                << nitrokey::misc::hexdump(r.report, sizeof r.report);
+      return;
+    }
+    const bool query = r.event == static_cast<uint8_t>(BinaryLogEvent::QUERY);
+    std::cout << (query ? d->query(r.report) : d->response(r.report));
+  }
+}
+
+int main(int argc, char *argv[]) {
+  if (argc != 2) {
+    std::cerr << "Usage: " << argv[0] << " <binary log file>" << std::endl;
+    return 2;
+  }
+  std::ifstream in(argv[1], std::ios::binary);
+  if (!in) {
+    std::cerr << "Could not open " << argv[1] << std::endl;
+    return 1;
+  }
+
+  BinaryLogHeader header;
+  if (!in.read(reinterpret_cast<char *>(&header), sizeof header)
+      || memcmp(header.magic, nitrokey::log::BINARY_LOG_MAGIC, sizeof header.magic) != 0) {
+    std::cerr << "Not a libnitrokey binary log" << std::endl;
+    return 1;
+  }
+  if (header.version != nitrokey::log::BINARY_LOG_VERSION || header.record_size != sizeof(BinaryLogRecord)) {
+    std::cerr << "Unsupported binary log version " << header.version << std::endl;
+    return 1;
+  }
+
+  BinaryLogRecord record;
+  while (in.read(reinterpret_cast<char *>(&record), sizeof record)) {
+    print_record(record);
+  }
+  return 0;
+}
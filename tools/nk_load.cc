@@ -0,0 +1,331 @@
+/*
+ * Copyright (c) 2015-2018 Nitrokey UG
+ *
+ * This file is part of libnitrokey.
+ *
+ * libnitrokey is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libnitrokey is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libnitrokey. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0
+ */
+
+/*
+ * Load generator replaying a mix of operations through NitrokeyManager,
+ * against real devices or emulated ones.
+ * Run with --help for the usage.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "NitrokeyManager.h"
+#include "latency_stats.h"
+#include "LibraryException.h"
+#include "fake_device.h"
+
+using namespace nitrokey;
+using namespace nitrokey::device;
+using std::chrono::steady_clock;
+
+namespace {
+
+  enum class Op { STATUS, TOTP, HOTP, PWS, SLOT_NAME, COUNT };
+  const int OP_COUNT = static_cast<int>(Op::COUNT);
+  const char *const OP_NAMES[OP_COUNT] = {"status", "totp", "hotp", "pws", "slot_name"};
+
+  struct Options {
+    int weights[OP_COUNT] = {100, 0, 0, 0, 0};
+    /** operations per second over all threads, 0 for closed loop */
+    double rate = 0;
+    int threads = 0;
+    double duration_s = 10;
+    /** device paths, empty for all connected */
+    std::vector<std::string> paths;
+    int fake_devices = 0;
+    int fake_delay_us = 0;
+    int fake_busy_polls = 0;
+  };
+
+  struct OpStats {
+    std::atomic<uint64_t> ok{0};
+    std::atomic<uint64_t> command_errors{0};
+    std::atomic<uint64_t> communication_errors{0};
+    LatencyHistogram latency;
+  };
+
+  struct Target {
+    std::shared_ptr<Device> device;
+    std::unique_ptr<NitrokeyManager> manager;
+    /** counters at the start, to report the difference */
+    std::vector<int64_t> counters_at_start;
+  };
+
+  struct CounterField {
+    const char *name;
+    int64_t (*get)(const Device::ErrorCounters &c);
+  };
+
+#define COUNTER(field) {#field, [](const Device::ErrorCounters &c) -> int64_t { return c.field; }}
+  const CounterField COUNTERS[] = {
+      COUNTER(total_comm_runs),
+      COUNTER(total_retries),
+      COUNTER(busy),
+      COUNTER(sending_error),
+      COUNTER(receiving_error),
+      COUNTER(transient_errors),
+      COUNTER(low_level_reconnect),
+      COUNTER(reconnect_failures),
+      COUNTER(reconnect_time_total_us),
+  };
+#undef COUNTER
+
+  std::vector<int64_t> read_counters(const Device &d) {
+    std::vector<int64_t> res;
+    for (const auto &c : COUNTERS) res.push_back(c.get(d.m_counters));
+    return res;
+  }
+
+  void usage(const char *name) {
+    std::cerr << "Usage: " << name << " [options]\n"
+        "  --mix <op>=<weight>,...  operation mix, ops: status, totp, hotp, pws, slot_name\n"
+        "                           (default: status=100)\n"
+        "  --rate <ops/s>           open loop at the given total rate, latency counted from the\n"
+        "                           scheduled start (default: closed loop)\n"
+        "  --threads <n>            worker threads, spread over the devices (default: one per device)\n"
+        "  --duration <s>           run time in seconds (default: 10)\n"
+        "  --devices <path>,...     devices to use (default: all connected)\n"
+        "  --fake <n>               use n emulated devices instead\n"
+        "  --fake-delay <us>        emulated device processing time per command (default: 0)\n"
+        "  --fake-busy <n>          busy responses before each answer of the emulated devices (default: 0)\n";
+  }
+
+  std::vector<std::string> split(const std::string &s, char separator) {
+    std::vector<std::string> res;
+    std::stringstream ss(s);
+    std::string item;
+    while (std::getline(ss, item, separator)) {
+      if (!item.empty()) res.push_back(item);
+    }
+    return res;
+  }
+
+  bool parse_mix(const std::string &mix, Options &o) {
+    std::fill(std::begin(o.weights), std::end(o.weights), 0);
+    for (const auto &item : split(mix, ',')) {
+      const auto eq = item.find('=');
+      if (eq == std::string::npos) return false;
+      const auto name = item.substr(0, eq);
+      const auto op = std::find_if(std::begin(OP_NAMES), std::end(OP_NAMES),
+                                   [&name](const char *n) { return name == n; });
+      if (op == std::end(OP_NAMES)) return false;
+      o.weights[op - std::begin(OP_NAMES)] = std::atoi(item.c_str() + eq + 1);
+    }
+    return std::any_of(std::begin(o.weights), std::end(o.weights), [](int w) { return w > 0; });
+  }
+
+  bool parse_options(int argc, char *argv[], Options &o) {
+    for (int i = 1; i < argc; i++) {
+      const std::string arg = argv[i];
+      if (i + 1 >= argc) return false;
+      const std::string value = argv[++i];
+      if (arg == "--mix") {
+        if (!parse_mix(value, o)) return false;
+      }
+      else if (arg == "--rate") o.rate = std::atof(value.c_str());
+      else if (arg == "--threads") o.threads = std::atoi(value.c_str());
+      else if (arg == "--duration") o.duration_s = std::atof(value.c_str());
+      else if (arg == "--devices") o.paths = split(value, ',');
+      else if (arg == "--fake") o.fake_devices = std::atoi(value.c_str());
+      else if (arg == "--fake-delay") o.fake_delay_us = std::atoi(value.c_str());
+      else if (arg == "--fake-busy") o.fake_busy_polls = std::atoi(value.c_str());
+      else return false;
+    }
+    return o.duration_s > 0 && o.rate >= 0 && o.threads >= 0;
+  }
+
+  /**
+   * Opens the devices, each with its own manager, so they run in parallel.
+   */
+  std::vector<Target> open_targets(const Options &o) {
+    std::vector<Target> res;
+    if (o.fake_devices > 0) {
+      for (int i = 0; i < o.fake_devices; i++) {
+        auto fake = std::make_shared<FakeDevice>();
+        fake->set_path("fake" + std::to_string(i));
+        fake->set_response_delay(std::chrono::microseconds(o.fake_delay_us));
+        fake->set_busy_polls(o.fake_busy_polls);
+        res.push_back({fake, nullptr, {}});
+      }
+    } else {
+      for (const auto &info : Device::enumerate()) {
+        if (!o.paths.empty() && std::find(o.paths.begin(), o.paths.end(), info.m_path) == o.paths.end()) continue;
+        auto d = Device::create(info.m_deviceModel);
+        if (!d) continue;
+        d->set_path(info.m_path);
+        d->set_serial_number(info.m_serialNumber);
+        if (!d->connect()) {
+          std::cerr << "Could not connect to " << info.m_path << std::endl;
+          continue;
+        }
+        res.push_back({d, nullptr, {}});
+      }
+    }
+    for (auto &t : res) {
+      t.manager.reset(new NitrokeyManager());
+      t.manager->connect_with_device(t.device);
+      t.counters_at_start = read_counters(*t.device);
+    }
+    return res;
+  }
+
+  void run_op(NitrokeyManager &m, Op op) {
+    switch (op) {
+      case Op::STATUS:
+        m.get_status();
+        break;
+      case Op::TOTP:
+        m.get_TOTP_code(0, "");
+        break;
+      case Op::HOTP:
+        m.get_HOTP_code(0, "");
+        break;
+      case Op::PWS:
+        m.get_password_safe_slot_status();
+        break;
+      case Op::SLOT_NAME:
+        free(m.get_totp_slot_name(0));
+        break;
+      case Op::COUNT:
+        break;
+    }
+  }
+
+  void worker(Target &target, const Options &o, unsigned seed, OpStats *stats,
+              steady_clock::time_point start, steady_clock::time_point end) {
+    std::mt19937 random(seed);
+    std::discrete_distribution<int> choose_op(std::begin(o.weights), std::end(o.weights));
+    const auto interval = o.rate > 0
+        ? std::chrono::duration_cast<steady_clock::duration>(std::chrono::duration<double>(o.threads / o.rate))
+        : steady_clock::duration::zero();
+    // spread the threads over the first interval
+    auto scheduled = start + interval * seed / std::max(o.threads, 1);
+
+    while (true) {
+      if (o.rate > 0) {
+        if (scheduled >= end) break;
+        std::this_thread::sleep_until(scheduled);
+      } else {
+        scheduled = steady_clock::now();
+        if (scheduled >= end) break;
+      }
+
+      const auto op = static_cast<Op>(choose_op(random));
+      auto &s = stats[static_cast<int>(op)];
+      try {
+        run_op(*target.manager, op);
+        s.ok++;
+      }
+      catch (const CommandFailedException &) {
+        s.command_errors++;
+      }
+      catch (const LibraryException &) {
+        s.command_errors++;
+      }
+      catch (const DeviceCommunicationException &) {
+        s.communication_errors++;
+      }
+      // in open loop the time waiting for a late start counts as latency
+      const auto latency = std::chrono::duration_cast<std::chrono::microseconds>(steady_clock::now() - scheduled);
+      s.latency.record(static_cast<uint64_t>(latency.count()));
+      scheduled += interval;
+    }
+  }
+
+  void report(const Options &o, const std::vector<Target> &targets, const OpStats *stats, double elapsed_s) {
+    uint64_t total = 0;
+    for (int i = 0; i < OP_COUNT; i++) total += stats[i].ok + stats[i].command_errors + stats[i].communication_errors;
+
+    std::cout << std::fixed << std::setprecision(1)
+              << targets.size() << " device(s), " << o.threads << " thread(s), "
+              << (o.rate > 0 ? "open loop at " + std::to_string(static_cast<int>(o.rate)) + " ops/s" : std::string("closed loop"))
+              << ", " << elapsed_s << " s: " << total / elapsed_s << " ops/s" << std::endl << std::endl;
+
+    std::cout << std::left << std::setw(12) << "operation" << std::right
+              << std::setw(10) << "ok" << std::setw(10) << "cmd err" << std::setw(10) << "comm err"
+              << std::setw(10) << "p50 us" << std::setw(10) << "p90 us" << std::setw(10) << "p99 us"
+              << std::setw(10) << "p99.9 us" << std::setw(10) << "max us" << std::endl;
+    for (int i = 0; i < OP_COUNT; i++) {
+      const auto h = stats[i].latency.snapshot();
+      if (h.count == 0) continue;
+      std::cout << std::left << std::setw(12) << OP_NAMES[i] << std::right
+                << std::setw(10) << stats[i].ok << std::setw(10) << stats[i].command_errors
+                << std::setw(10) << stats[i].communication_errors
+                << std::setw(10) << h.percentile(50) << std::setw(10) << h.percentile(90)
+                << std::setw(10) << h.percentile(99) << std::setw(10) << h.percentile(99.9)
+                << std::setw(10) << h.max_us << std::endl;
+    }
+
+    std::cout << std::endl << std::left << std::setw(24) << "device counters";
+    for (const auto &c : COUNTERS) std::cout << " " << c.name;
+    std::cout << std::endl;
+    for (const auto &t : targets) {
+      const auto now = read_counters(*t.device);
+      std::cout << std::left << std::setw(24) << t.device->get_path() << std::right;
+      for (size_t i = 0; i < now.size(); i++) {
+        std::cout << " " << std::setw(static_cast<int>(strlen(COUNTERS[i].name))) << now[i] - t.counters_at_start[i];
+      }
+      std::cout << std::endl;
+    }
+  }
+}
+
+int main(int argc, char *argv[]) {
+  Options o;
+  if (!parse_options(argc, argv, o)) {
+    usage(argv[0]);
+    return 2;
+  }
+  log::Log::instance().set_loglevel(log::Loglevel::ERROR);
+
+  auto targets = open_targets(o);
+  if (targets.empty()) {
+    std::cerr << "No devices to run against, connect one or use --fake" << std::endl;
+    return 1;
+  }
+  if (o.threads == 0) o.threads = static_cast<int>(targets.size());
+
+  OpStats stats[OP_COUNT];
+  const auto start = steady_clock::now();
+  const auto end = start + std::chrono::duration_cast<steady_clock::duration>(std::chrono::duration<double>(o.duration_s));
+  std::vector<std::thread> workers;
+  for (int t = 0; t < o.threads; t++) {
+    workers.emplace_back(worker, std::ref(targets[t % targets.size()]), std::cref(o),
+                         static_cast<unsigned>(t), stats, start, end);
+  }
+  for (auto &w : workers) w.join();
+  const auto elapsed = std::chrono::duration<double>(steady_clock::now() - start).count();
+
+  report(o, targets, stats, elapsed);
+  for (auto &t : targets) t.manager->disconnect();
+  return 0;
+}
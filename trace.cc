@@ -0,0 +1,117 @@
+/*
+ * Copyright (c) 2015-2018 Nitrokey UG
+ *
+ * This file is part of libnitrokey.
+ *
+ * libnitrokey is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libnitrokey is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libnitrokey. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0
+ */
+
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "trace_probes.h"
+
+namespace nitrokey {
+namespace trace {
+
+    namespace {
+        struct Registration {
+            ListenerId id;
+            TraceListener listener;
+        };
+        using Registrations = std::vector<Registration>;
+
+        // replaced as a whole, so a running emit keeps its callbacks alive
+        std::shared_ptr<const Registrations> registrations;
+        // serializes the replacements
+        std::mutex registrations_mutex;
+        // 0 is the listener of set_listener
+        ListenerId next_listener_id = 1;
+
+        /** replaces the listener with the id, removes it when empty; call with registrations_mutex locked */
+        void replace_listener(ListenerId id, TraceListener listener) {
+          const auto current = std::atomic_load(&registrations);
+          auto r = std::make_shared<Registrations>();
+          if (current != nullptr) {
+            for (const auto &reg : *current) {
+              if (reg.id != id) r->push_back(reg);
+            }
+          }
+          if (listener) r->push_back({id, std::move(listener)});
+          const bool enabled = !r->empty();
+          std::atomic_store(&registrations, std::shared_ptr<const Registrations>(enabled ? std::move(r) : nullptr));
+          detail::enabled = enabled;
+        }
+    }
+
+    namespace detail {
+        std::atomic_bool enabled{false};
+
+        void emit(Event event, const device::Device *device, uint8_t command_id, int64_t value) {
+          const auto current = std::atomic_load(&registrations);
+          if (current == nullptr) return;
+          const TraceEvent e = {event, device, command_id, value, std::chrono::steady_clock::now()};
+          for (const auto &reg : *current) reg.listener(e);
+        }
+    }
+
+    void set_listener(TraceListener listener) {
+      std::lock_guard<std::mutex> lock(registrations_mutex);
+      replace_listener(0, std::move(listener));
+    }
+
+    ListenerId add_listener(TraceListener listener) {
+      std::lock_guard<std::mutex> lock(registrations_mutex);
+      const auto id = next_listener_id++;
+      replace_listener(id, std::move(listener));
+      return id;
+    }
+
+    void remove_listener(ListenerId id) {
+      if (id == 0) return;
+      std::lock_guard<std::mutex> lock(registrations_mutex);
+      replace_listener(id, nullptr);
+    }
+
+    TransactionTrace::TransactionTrace(const device::Device *device, uint8_t command_id)
+        : m_device(device), m_command_id(command_id), m_result(-1) {
+      NK_TRACE(transaction_start, m_device, m_command_id, 0);
+    }
+
+    TransactionTrace::~TransactionTrace() {
+      NK_TRACE(transaction_finish, m_device, m_command_id, m_result);
+    }
+
+    const char *event_to_string(Event event) {
+      switch (event) {
+        case Event::transaction_start: return "transaction_start";
+        case Event::send_done: return "send_done";
+        case Event::poll: return "poll";
+        case Event::busy_backoff: return "busy_backoff";
+        case Event::transfer_error: return "transfer_error";
+        case Event::reconnect: return "reconnect";
+        case Event::decode: return "decode";
+        case Event::transaction_finish: return "transaction_finish";
+        case Event::send_start: return "send_start";
+        case Event::recv_start: return "recv_start";
+        case Event::transaction_lock_wait: return "transaction_lock_wait";
+        case Event::handle_lock_wait: return "handle_lock_wait";
+      }
+      return "unknown";
+    }
+
+}
+}
@@ -0,0 +1,53 @@
+/*
+ * Copyright (c) 2015-2018 Nitrokey UG
+ *
+ * This file is part of libnitrokey.
+ *
+ * libnitrokey is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libnitrokey is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libnitrokey. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0
+ */
+
+
+#ifndef LIBNITROKEY_TRACE_PROBES_H
+#define LIBNITROKEY_TRACE_PROBES_H
+
+/*
+ * Trace points of the library. Not installed: the USDT probes depend on
+ * HAVE_SYS_SDT_H, set when building the library only, so they are expanded
+ * in its translation units only, never in inline code of the public headers.
+ */
+
+#include "libnitrokey/trace.h"
+
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+#define NK_TRACE_PROBE(name, device, command_id, value) \
+  DTRACE_PROBE3(libnitrokey, name, (device), (command_id), (value))
+#else
+#define NK_TRACE_PROBE(name, device, command_id, value) do {} while (0)
+#endif
+
+/**
+ * Emits a trace point: USDT probe libnitrokey:name where supported, and a call
+ * to the registered listener, if any. Without a listener and an attached
+ * tracer this costs a single flag check.
+ */
+#define NK_TRACE(name, device, command_id, value) do { \
+  NK_TRACE_PROBE(name, device, command_id, value); \
+  if (::nitrokey::trace::is_enabled()) \
+    ::nitrokey::trace::detail::emit(::nitrokey::trace::Event::name, (device), (command_id), (value)); \
+} while (0)
+
+#endif //LIBNITROKEY_TRACE_PROBES_H
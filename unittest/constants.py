@@ -78,6 +78,8 @@ class LibraryErrors(Enum):
     INVALID_SLOT = 201
     INVALID_HEX_STRING = 202
     TARGET_BUFFER_SIZE_SMALLER_THAN_SOURCE = 203
+    INVALID_BASE32_STRING = 204
+    INVALID_OTP_SOURCE_ENTRY = 205
 
     def __eq__(self, other):
         other_name = 'Unknown'
@@ -30,6 +30,7 @@ const char * RFC_SECRET = "12345678901234567890";
 #include <NitrokeyManager.h>
 #include <stick20_commands.h>
 #include "../NK_C_API.h"
+#include <fleet.h>
 
 using namespace nitrokey;
 
@@ -213,6 +214,22 @@ TEST_CASE("Use API ID", "[BASIC]") {
     std::cout << "finished" << std::endl;
 }
 
+TEST_CASE("Refresh API ID keeps active device", "[BASIC]") {
+    auto nm = NitrokeyManager::instance();
+    nm->set_loglevel(2);
+
+    auto v = nm->list_devices_by_cpuID();
+    REQUIRE(v.size() > 0);
+    REQUIRE(nm->connect_with_ID(v[0]));
+
+    for (int j = 0; j < 10; j++) {
+        auto refreshed = nm->list_devices_by_cpuID();
+        REQUIRE(refreshed == v);
+        REQUIRE(nm->get_current_device_id() == v[0]);
+        REQUIRE(nm->is_connected());
+    }
+}
+
 TEST_CASE("Use API ID refresh", "[BASIC]") {
     auto nm = NitrokeyManager::instance();
     nm->set_loglevel(2);
@@ -241,3 +258,37 @@ TEST_CASE("Use API ID refresh", "[BASIC]") {
     }
     std::cout << "finished" << std::endl;
 }
+
+TEST_CASE("Run operation on all devices in parallel", "[BASIC]") {
+    fleet::FleetOptions options;
+    options.deadline = std::chrono::seconds(10);
+    auto results = fleet::run<std::string>([](NitrokeyManager &nm) {
+        return nm.get_serial_number();
+    }, options);
+    REQUIRE(results.size() > 0);
+    for (const auto &r : results) {
+        std::cout << r.device.m_path << " " << r.value << " " << r.error
+          << " " << r.duration.count() << "us" << std::endl;
+        REQUIRE(r.success);
+        REQUIRE_FALSE(r.value.empty());
+    }
+}
+
+TEST_CASE("Switch between devices using pooled connections", "[BASIC]") {
+    auto nm = NitrokeyManager::instance();
+    auto v = Device::enumerate();
+    REQUIRE(v.size() > 0);
+    nm->get_connection_pool().clear();
+    nm->get_connection_pool().reset_stats();
+
+    const int rounds = 10;
+    for (int j = 0; j < rounds; j++) {
+        for (const auto &i : v) {
+            REQUIRE(nm->connect_with_path(i.m_path));
+            REQUIRE_NOTHROW(nm->get_serial_number());
+        }
+    }
+    const auto stats = nm->get_connection_pool().get_stats();
+    REQUIRE(stats.misses == v.size());
+    REQUIRE(stats.hits == v.size() * (rounds - 1));
+}
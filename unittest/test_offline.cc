@@ -25,6 +25,24 @@
 #include <string>
 #include <regex>
 #include "../NK_C_API.h"
+#include "../trace_probes.h"
+#include <slot_sync.h>
+#include <provisioning.h>
+#include <fleet.h>
+#include <enumeration_cache.h>
+#include <connection_pool.h>
+#include <latency_stats.h>
+#include <trace.h>
+#include <timeline.h>
+#include <metrics.h>
+#include <binary_log.h>
+#include <command_registry.h>
+#include <report_pool.h>
+#include <stick10_commands.h>
+#include <fstream>
+#include "fake_device.h"
+#include <thread>
+#include <sstream>
 
 using namespace nitrokey::proto;
 using namespace nitrokey::device;
@@ -44,6 +62,8 @@ TEST_CASE("Return false on no device connected", "[fast]") {
   auto stick_pro = make_shared<Stick10>();
   REQUIRE_NOTHROW(connected = stick_pro->connect());
   REQUIRE_FALSE(connected);
+  REQUIRE(stick_pro->get_connection_health() == ConnectionHealth::DISCONNECTED);
+  REQUIRE_FALSE(stick_pro->is_open());
 
 
   auto i = NitrokeyManager::instance();
@@ -52,6 +72,7 @@ TEST_CASE("Return false on no device connected", "[fast]") {
   REQUIRE_FALSE(i->is_connected());
   REQUIRE_FALSE(i->disconnect());
   REQUIRE_FALSE(i->could_current_device_be_enumerated());
+  REQUIRE(i->list_devices_by_cpuID().empty());
 
 
   int C_connected = 1;
@@ -113,6 +134,73 @@ TEST_CASE("Test C++ side behaviour in offline", "[fast]") {
 }
 
 
+TEST_CASE("Test bulk password safe access in offline", "[fast]") {
+  PasswordSafeEntries entries;
+  REQUIRE(entries.empty());
+  REQUIRE_NOTHROW(entries.add(1, "name", "login", "password"));
+  REQUIRE_NOTHROW(entries.add(0, "", nullptr, "12345678901234567890"));
+  REQUIRE(entries.size() == 2);
+  REQUIRE(entries[0].slot_number == 1);
+  REQUIRE(string(entries[0].login) == "login");
+  REQUIRE(string(entries[1].login).empty());
+
+  REQUIRE_THROWS_AS(entries.add(1, "name", "login", "password"), InvalidSlotException);
+  REQUIRE_THROWS_AS(entries.add(PWS_SLOT_COUNT, "name", "login", "password"), InvalidSlotException);
+  REQUIRE_THROWS_AS(entries.add(2, "123456789012", "login", "password"), TooLongStringException);
+  REQUIRE_THROWS_AS(entries.add(2, "name", "login", "123456789012345678901"), TooLongStringException);
+  REQUIRE(entries.size() == 2);
+
+  auto copy = entries;
+  entries.clear();
+  REQUIRE(entries.empty());
+  REQUIRE(copy.size() == 2);
+  REQUIRE(string(copy[0].password) == "password");
+
+  auto i = NitrokeyManager::instance();
+  REQUIRE_THROWS_AS(i->read_password_safe(), DeviceNotConnected);
+  REQUIRE_THROWS_AS(i->write_password_safe(copy), DeviceNotConnected);
+
+  NK_password_safe pws;
+  REQUIRE(NK_read_password_safe(0xFFFF, nullptr) == -1);
+  REQUIRE(NK_write_password_safe(nullptr) == -1);
+  REQUIRE(NK_read_password_safe(0xFFFF, &pws) != 0);
+}
+
+TEST_CASE("Test slot sync planning in offline", "[fast]") {
+  auto i = NitrokeyManager::instance();
+
+  sync::SyncTarget target;
+  sync::SyncPlan plan;
+  REQUIRE_NOTHROW(plan = sync::plan(*i, target));
+  REQUIRE(plan.empty());
+  REQUIRE_FALSE(plan.has_otp_actions());
+  REQUIRE_NOTHROW(sync::apply(*i, target, plan, "12345678", "123123123"));
+
+  sync::OTPSlotTarget hotp;
+  hotp.slot_number = 3;
+  target.hotp.push_back(hotp);
+  REQUIRE_THROWS_AS(sync::plan(*i, target), InvalidSlotException);
+
+  target.hotp[0].slot_number = 0;
+  target.hotp.push_back(target.hotp[0]);
+  REQUIRE_THROWS_AS(sync::plan(*i, target), InvalidSlotException);
+
+  target.hotp.pop_back();
+  REQUIRE_THROWS_AS(sync::plan(*i, target), DeviceNotConnected);
+
+  sync::OTPSlotTarget totp;
+  totp.counter_or_interval = 0x10000 + 30;
+  target.totp.push_back(totp);
+  REQUIRE_THROWS_AS(sync::plan(*i, target), InvalidSlotException);
+  target.totp[0].counter_or_interval = 30;
+  REQUIRE_THROWS_AS(sync::plan(*i, target), DeviceNotConnected);
+
+  plan.actions.push_back({sync::SlotKind::HOTP, 0, sync::ActionType::WRITE, "slot not programmed"});
+  REQUIRE(plan.has_otp_actions());
+  REQUIRE(plan.dissect().find("write HOTP slot 0") != string::npos);
+}
+
+
 TEST_CASE("Test helper function - hex_string_to_byte", "[fast]") {
   using namespace nitrokey::misc;
   std::vector<uint8_t> v;
@@ -125,6 +213,921 @@ TEST_CASE("Test helper function - hex_string_to_byte", "[fast]") {
   }
 }
 
+TEST_CASE("Test helper functions - hex and base32 decoding", "[fast]") {
+  using namespace nitrokey::misc;
+  uint8_t buf[10];
+  REQUIRE(hex_decode("00aAfF", 6, buf, sizeof buf) == 3);
+  REQUIRE(buf[0] == 0x00);
+  REQUIRE(buf[1] == 0xAA);
+  REQUIRE(buf[2] == 0xFF);
+  REQUIRE_THROWS_AS(hex_decode("0g", 2, buf, sizeof buf), InvalidHexString);
+  REQUIRE_THROWS_AS(hex_decode("001", 3, buf, sizeof buf), InvalidHexString);
+  REQUIRE_THROWS_AS(hex_decode("00", 2, buf, 0), TargetBufferSmallerThanSource);
+  REQUIRE_THROWS_AS(hex_string_to_byte("0x"), InvalidHexString);
+
+  // RFC 4648 test vectors
+  const char *vectors[][2] = {
+      {"", ""}, {"f", "MY======"}, {"fo", "MZXQ===="}, {"foo", "MZXW6==="},
+      {"foob", "MZXW6YQ="}, {"fooba", "MZXW6YTB"}, {"foobar", "MZXW6YTBOI======"},
+  };
+  for (auto &v : vectors) {
+    INFO("Vector: " << v[1]);
+    const auto size = base32_decode(v[1], strlen(v[1]), buf, sizeof buf);
+    REQUIRE(string(reinterpret_cast<char *>(buf), size) == v[0]);
+  }
+  REQUIRE(base32_decode("mzxw 6ytb-oi", 12, buf, sizeof buf) == 6);
+  REQUIRE(string(reinterpret_cast<char *>(buf), 6) == "foobar");
+  REQUIRE_THROWS_AS(base32_decode("MZ1W", 4, buf, sizeof buf), InvalidBase32String);
+  REQUIRE_THROWS_AS(base32_decode("MZXW6YTBOI", 10, buf, 5), TargetBufferSmallerThanSource);
+}
+
+TEST_CASE("Test exception messages", "[fast]") {
+  TargetBufferSmallerThanSource e(300, 10);
+  const char *message = e.what();
+  REQUIRE(string(message) == "Target buffer size is smaller than source: [source size, buffer size] 300 10");
+  // stored in the exception, the same buffer on every call
+  REQUIRE(e.what() == message);
+  auto copy = e;
+  REQUIRE(string(copy.what()) == message);
+}
+
+TEST_CASE("Test OTP source reader", "[fast]") {
+  using namespace nitrokey::provisioning;
+  std::istringstream input(
+      "# comment\n"
+      "type,slot,name,secret,counter_or_period,digits\n"
+      "otpauth://totp/Example%3Aalice%40example.com?secret=JBSWY3DPEHPK3PXP&period=60&digits=8\n"
+      "otpauth://hotp/second?secret=MZXW6YTBOI&counter=5&slot=2\n"
+      "\n"
+      "totp, 7, csv name, hex:3132333435363738393031323334353637383930, 30, 6\n"
+      "otpauth://totp/third?secret=JBSWY3DPEHPK3PXP\n"
+      "otpauth://totp/broken?period=30\n"
+      "totp,1,bad,MZ1W\n"
+      "hotp,0,last,MZXW6YTBOI\n");
+  OTPSourceReader reader(input);
+  OTPEntry e;
+
+  REQUIRE(reader.next(e));
+  REQUIRE(e.type == OTPType::TOTP);
+  REQUIRE(e.slot_number == 0);
+  REQUIRE(e.name == "Example:alice@e");
+  REQUIRE(e.secret_size == 10);
+  REQUIRE(e.period == 60);
+  REQUIRE(e.use_8_digits);
+  REQUIRE(e.line == 3);
+
+  REQUIRE(reader.next(e));
+  REQUIRE(e.type == OTPType::HOTP);
+  REQUIRE(e.slot_number == 2);
+  REQUIRE(e.counter == 5);
+  REQUIRE(string(reinterpret_cast<char *>(e.secret), e.secret_size) == "foobar");
+
+  REQUIRE(reader.next(e));
+  REQUIRE(e.slot_number == 7);
+  REQUIRE(e.name == "csv name");
+  REQUIRE(e.secret_size == 20);
+  REQUIRE(e.secret[0] == '1');
+  REQUIRE_FALSE(e.use_8_digits);
+
+  REQUIRE(reader.next(e));
+  REQUIRE(e.slot_number == 1);
+
+  REQUIRE_THROWS_AS(reader.next(e), InvalidOTPSourceEntry);
+  REQUIRE(reader.line() == 8);
+  REQUIRE_THROWS_AS(reader.next(e), InvalidBase32String);
+
+  REQUIRE(reader.next(e));
+  REQUIRE(e.name == "last");
+  REQUIRE_FALSE(reader.next(e));
+
+  auto i = NitrokeyManager::instance();
+  std::istringstream empty;
+  REQUIRE_THROWS_AS(provision_OTP(*i, empty, "12345678", "123123123"), DeviceNotConnected);
+}
+
+TEST_CASE("Test fleet executor in offline", "[fast]") {
+  using namespace nitrokey::fleet;
+
+  DeviceInfo info{DeviceModel::PRO, "path", "0001"};
+  DeviceFilter filter;
+  REQUIRE(filter.matches(info));
+  filter.models = {DeviceModel::STORAGE};
+  REQUIRE_FALSE(filter.matches(info));
+  filter.models.push_back(DeviceModel::PRO);
+  REQUIRE(filter.matches(info));
+  filter.serial_numbers = {"0002"};
+  REQUIRE_FALSE(filter.matches(info));
+
+  bool called = false;
+  auto results = run<int>([&called](NitrokeyManager &) { called = true; return 1; });
+  REQUIRE(results.empty());
+  REQUIRE_FALSE(called);
+  REQUIRE_FALSE(cancellation_requested());
+
+  auto i = NitrokeyManager::instance();
+  REQUIRE_FALSE(i->connect_with_device(nullptr));
+}
+
+TEST_CASE("Test fleet deadline does not wait for the operations", "[fast]") {
+  using namespace nitrokey::fleet;
+
+  // owned by the straggler too, which outlives run_tasks()
+  struct Gate {
+      std::atomic<bool> released{false};
+      std::atomic<bool> done{false};
+  };
+  const auto gate = std::make_shared<Gate>();
+  // unblocks the operation in case run_tasks() waits for it
+  std::thread releaser([gate] {
+    const auto until = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (!gate->released && std::chrono::steady_clock::now() < until)
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    gate->released = true;
+  });
+
+  std::vector<DeviceInfo> devices{{DeviceModel::PRO, "fast", "0001"}, {DeviceModel::PRO, "slow", "0002"}};
+  FleetOptions options;
+  options.deadline = std::chrono::milliseconds(100);
+  auto outcomes = detail::run_tasks(devices, [gate](size_t index, NitrokeyManager &) {
+    if (index == 1) {
+      while (!gate->released) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      gate->done = true;
+    }
+  }, options, [](const DeviceInfo &) { return std::make_shared<FakeDevice>(); });
+
+  // returned at the deadline, the slow operation is still blocked
+  REQUIRE_FALSE(gate->released);
+  REQUIRE(outcomes.size() == 2);
+  REQUIRE(outcomes[0].success);
+  REQUIRE_FALSE(outcomes[1].success);
+  REQUIRE(outcomes[1].timed_out);
+
+  gate->released = true;
+  releaser.join();
+  while (!gate->done) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+}
+
+TEST_CASE("Test enumeration cache", "[fast]") {
+  std::vector<DeviceInfo> connected;
+  int scans = 0;
+  EnumerationCache cache([&]() { scans++; return connected; }, std::chrono::milliseconds(50), false);
+  REQUIRE_FALSE(cache.is_hotplug_monitored());
+
+  REQUIRE(cache.devices().empty());
+  REQUIRE(cache.generation() == 1);
+  REQUIRE(scans == 1);
+
+  // served from memory within the time-to-live
+  connected.push_back({DeviceModel::PRO, "path1", "0001"});
+  REQUIRE(cache.devices().empty());
+  REQUIRE_FALSE(cache.contains(DeviceModel::PRO));
+  REQUIRE(scans == 1);
+
+  // a miss on lookup by path rescans once
+  REQUIRE(cache.find("path1").has_value());
+  REQUIRE(scans == 2);
+  REQUIRE(cache.generation() == 2);
+  REQUIRE_FALSE(cache.find("path2").has_value());
+  REQUIRE(scans == 3);
+  REQUIRE(cache.generation() == 2);
+
+  cache.invalidate();
+  REQUIRE(cache.devices().size() == 1);
+  REQUIRE(scans == 4);
+  REQUIRE(cache.generation() == 2);
+
+  connected.clear();
+  std::this_thread::sleep_for(std::chrono::milliseconds(60));
+  REQUIRE(cache.devices().empty());
+  REQUIRE(scans == 5);
+  REQUIRE(cache.generation() == 3);
+
+  // with hotplug events the longer time-to-live still applies, as the socket
+  // may be bound while no events are delivered
+  int monitored_scans = 0;
+  EnumerationCache monitored([&]() { monitored_scans++; return connected; }, std::chrono::seconds(60), true,
+                             std::chrono::milliseconds(50));
+  REQUIRE(monitored.devices().empty());
+  REQUIRE(monitored_scans == 1);
+  std::this_thread::sleep_for(std::chrono::milliseconds(60));
+  REQUIRE(monitored.devices().empty());
+  REQUIRE(monitored_scans == (monitored.is_hotplug_monitored() ? 2 : 1));
+}
+
+TEST_CASE("Test connection pool in offline", "[fast]") {
+  ConnectionPool pool(2);
+  REQUIRE(pool.checkout("/nonexistent/path") == nullptr);
+  auto stats = pool.get_stats();
+  REQUIRE(stats.hits == 0);
+  REQUIRE(stats.misses == 1);
+  REQUIRE(stats.size == 0);
+  REQUIRE(stats.max_size == 2);
+
+  pool.set_max_size(0);
+  pool.reset_stats();
+  REQUIRE(pool.get_stats().misses == 0);
+  REQUIRE(pool.get_stats().max_size == 0);
+
+  REQUIRE(NK_connect_with_path("/nonexistent/path") == 0);
+  REQUIRE(NK_get_connection_pool_stats(nullptr) == -1);
+  NK_connection_pool_stats c_stats;
+  REQUIRE(NK_get_connection_pool_stats(&c_stats) == 0);
+  REQUIRE(c_stats.misses >= 1);
+  REQUIRE(c_stats.size == 0);
+}
+
+TEST_CASE("Test latency histograms", "[fast]") {
+  for (uint64_t v : {0ull, 1ull, 7ull, 8ull, 9ull, 15ull, 16ull, 17ull, 100ull, 1000ull, 123456ull, 1ull << 35}) {
+    const auto i = LatencyHistogram::bucket_index(v);
+    REQUIRE(LatencyHistogram::bucket_upper_bound(i) >= v);
+    REQUIRE((i == 0 || LatencyHistogram::bucket_upper_bound(i - 1) < v));
+  }
+  REQUIRE(LatencyHistogram::bucket_index(UINT64_MAX) == LatencyHistogram::BUCKET_COUNT - 1);
+
+  LatencyHistogram h;
+  for (uint64_t v = 1; v <= 1000; v++) h.record(v);
+  auto s = h.snapshot();
+  REQUIRE(s.count == 1000);
+  REQUIRE(s.sum_us == 500500);
+  REQUIRE(s.min_us == 1);
+  REQUIRE(s.max_us == 1000);
+  REQUIRE(s.percentile(50) >= 500);
+  REQUIRE(s.percentile(50) <= 500 * 9 / 8);
+  REQUIRE(s.percentile(100) == 1000);
+  h.reset();
+  REQUIRE(h.snapshot().count == 0);
+
+  LatencyStats stats;
+  {
+    TransactionTimer timer(stats, 0x2E);
+    timer.poll(TransactionTimer::PollResult::BUSY);
+    timer.poll(TransactionTimer::PollResult::FAILED);
+    timer.poll(TransactionTimer::PollResult::READY);
+    timer.poll(TransactionTimer::PollResult::READY);
+  }
+  auto commands = stats.snapshot();
+  REQUIRE(commands.size() == 1);
+  REQUIRE(commands[0].command_id == 0x2E);
+  REQUIRE(commands[0].count == 1);
+  REQUIRE(commands[0].polls == 4);
+  REQUIRE(commands[0].busy == 1);
+  REQUIRE(commands[0].first_response.count == 1);
+  stats.reset();
+  REQUIRE(stats.snapshot().empty());
+
+  REQUIRE(NK_get_command_latency(nullptr, 0) == -1);
+  NK_command_latency c_latency[4];
+  REQUIRE(NK_get_command_latency(c_latency, 4) == 0);
+}
+
+TEST_CASE("Test transaction tracing hooks", "[fast]") {
+  using nitrokey::trace::Event;
+  std::vector<std::pair<Event, int64_t>> events;
+  nitrokey::trace::set_listener([&events](const nitrokey::trace::TraceEvent &e) {
+    events.emplace_back(e.event, e.value);
+  });
+  REQUIRE(nitrokey::trace::is_enabled());
+  try {
+    nitrokey::trace::TransactionTrace t(nullptr, 0x2E);
+    NK_TRACE(busy_backoff, nullptr, 0x2E, 20);
+    throw std::runtime_error("failed");
+  } catch (const std::runtime_error &) {}
+  {
+    nitrokey::trace::TransactionTrace t(nullptr, 0x2E);
+    t.set_result(0);
+  }
+  nitrokey::trace::set_listener(nullptr);
+  REQUIRE_FALSE(nitrokey::trace::is_enabled());
+  NK_TRACE(poll, nullptr, 0x2E, 0);
+
+  REQUIRE(events.size() == 5);
+  REQUIRE(events[0].first == Event::transaction_start);
+  REQUIRE(events[1] == std::make_pair(Event::busy_backoff, int64_t(20)));
+  REQUIRE(events[2] == std::make_pair(Event::transaction_finish, int64_t(-1)));
+  REQUIRE(events[4] == std::make_pair(Event::transaction_finish, int64_t(0)));
+  REQUIRE(std::string(nitrokey::trace::event_to_string(Event::decode)) == "decode");
+}
+
+TEST_CASE("Test timeline recorder", "[fast]") {
+  const uint8_t cmd = static_cast<uint8_t>(nitrokey::proto::CommandID::GET_STATUS);
+  nitrokey::trace::TimelineRecorder recorder(12);
+  recorder.start();
+  NK_TRACE(transaction_lock_wait, nullptr, cmd, 150);
+  {
+    nitrokey::trace::TransactionTrace t(nullptr, cmd);
+    NK_TRACE(send_start, nullptr, cmd, 0);
+    NK_TRACE(send_done, nullptr, cmd, 64);
+    NK_TRACE(recv_start, nullptr, cmd, 0);
+    NK_TRACE(poll, nullptr, cmd, 1);
+    NK_TRACE(busy_backoff, nullptr, cmd, 200);
+    NK_TRACE(recv_start, nullptr, cmd, 0);
+    NK_TRACE(poll, nullptr, cmd, 0);
+    NK_TRACE(decode, nullptr, cmd, 0);
+    t.set_result(0);
+  }
+  NK_TRACE(transfer_error, nullptr, 0, 5);
+  NK_TRACE(transfer_error, nullptr, 0, 5);
+  recorder.stop();
+  REQUIRE_FALSE(nitrokey::trace::is_enabled());
+  REQUIRE(recorder.recorded_events() == 12);
+  REQUIRE(recorder.dropped_events() == 1);
+
+  const auto json = recorder.to_json();
+  for (const auto name : {"\"process_name\"", "\"lock waits\"", "\"transaction lock\"", "\"send\"",
+                          "\"wait\"", "\"poll\"", "\"busy backoff\"", "\"GET_STATUS\"", "\"polls\":2",
+                          "\"busy\":1", "\"transfer error\""}) {
+    CAPTURE(name);
+    REQUIRE(json.find(name) != std::string::npos);
+  }
+  REQUIRE(json.find("retry wait") == std::string::npos);
+}
+
+TEST_CASE("Test timeline recorder keeps the trace listener", "[fast]") {
+  int user_events = 0;
+  nitrokey::trace::set_listener([&user_events](const nitrokey::trace::TraceEvent &) { user_events++; });
+  nitrokey::trace::TimelineRecorder recorder(100);
+  recorder.start();
+  recorder.start();
+  {
+    // devices replacing each other, possibly at the same address, get their own processes
+    auto first = std::make_shared<FakeDevice>();
+    NK_TRACE(poll, first.get(), 0, 0);
+    first.reset();
+    auto second = std::make_shared<FakeDevice>();
+    REQUIRE(second->get_instance_id() > 1);
+    NK_TRACE(poll, second.get(), 0, 0);
+  }
+  recorder.stop();
+  REQUIRE(recorder.recorded_events() == 2);
+  REQUIRE(user_events == 2);
+  const auto json = recorder.to_json();
+  REQUIRE(json.find("\"pid\":2") != std::string::npos);
+
+  REQUIRE(nitrokey::trace::is_enabled());
+  NK_TRACE(poll, nullptr, 0, 0);
+  REQUIRE(user_events == 3);
+  nitrokey::trace::set_listener(nullptr);
+  REQUIRE_FALSE(nitrokey::trace::is_enabled());
+}
+
+TEST_CASE("Test OpenMetrics exposition in offline", "[fast]") {
+  const auto text = nitrokey::metrics::openmetrics_text();
+  REQUIRE(text.find("# TYPE nitrokey_wrong_crc counter\n") != std::string::npos);
+  REQUIRE(text.find("# TYPE nitrokey_command_duration_seconds histogram\n") != std::string::npos);
+  // no device is open
+  REQUIRE(text.find("nitrokey_wrong_crc_total{") == std::string::npos);
+  REQUIRE(text.substr(text.size() - 6) == "# EOF\n");
+
+  auto c_text = NK_get_metrics_text();
+  REQUIRE(c_text != nullptr);
+  REQUIRE(std::string(c_text) == text);
+  free(c_text);
+}
+
+TEST_CASE("Test OpenMetrics exposition of an open device", "[fast]") {
+  auto fake = std::make_shared<FakeDevice>();
+  fake->set_path("fake\"path");
+  fake->set_serial_number("1234");
+  stick10::GetStatus::CommandTransaction::run(fake);
+
+  const auto text = nitrokey::metrics::openmetrics_text();
+  const std::string labels = "path=\"fake\\\"path\",model=\"Pro\",serial=\"1234\"";
+  REQUIRE(text.find("nitrokey_wrong_crc_total{" + labels + "} 0\n") != std::string::npos);
+  REQUIRE(text.find("nitrokey_connection_health{" + labels + "} 0\n") != std::string::npos);
+  REQUIRE(text.find("nitrokey_reconnect_seconds_total{" + labels + "} 0\n") != std::string::npos);
+  REQUIRE(text.find("nitrokey_command_polls_total{" + labels + ",command=\"GET_STATUS\"} 1\n")
+          != std::string::npos);
+  REQUIRE(text.find("nitrokey_command_duration_seconds_count{" + labels + ",command=\"GET_STATUS\"} 1\n")
+          != std::string::npos);
+
+  // the labels are copied, so they may be changed while scraping
+  std::atomic_bool done{false};
+  std::thread writer([&fake, &done] {
+    for (int i = 0; !done; i++) fake->set_serial_number(std::to_string(i));
+  });
+  for (int i = 0; i < 100; i++) nitrokey::metrics::openmetrics_text();
+  done = true;
+  writer.join();
+}
+
+TEST_CASE("Test asynchronous logging", "[fast]") {
+  using namespace nitrokey::log;
+  std::mutex m;
+  std::vector<std::string> printed;
+  std::atomic_bool release{false};
+  RawFunctionalLogHandler handler([&](const std::string &s, Loglevel) {
+    while (!release) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    std::lock_guard<std::mutex> lock(m);
+    printed.push_back(s);
+  });
+  auto &log = Log::instance();
+  log.set_handler(&handler);
+  log.set_loglevel(Loglevel::DEBUG_L2);
+  log.enable_async(4, LogOverflowPolicy::DROP);
+
+  // the handler holds the first message, filling the queue
+  for (int i = 0; i < 20; i++) LOG("message " + std::to_string(i), Loglevel::DEBUG);
+  release = true;
+  log.flush();
+  const auto dropped = log.dropped_messages();
+  REQUIRE(dropped > 0);
+  {
+    std::lock_guard<std::mutex> lock(m);
+    REQUIRE(printed.front() == "message 0");
+    REQUIRE(printed.size() >= 20 - dropped);
+    printed.clear();
+  }
+
+  log.enable_async(4, LogOverflowPolicy::BLOCK);
+  std::vector<std::thread> producers;
+  for (int t = 0; t < 4; t++) {
+    producers.emplace_back([t]() {
+      for (int i = 0; i < 50; i++) LOG(std::to_string(t) + ":" + std::to_string(i), Loglevel::DEBUG);
+    });
+  }
+  for (auto &p : producers) p.join();
+  log.disable_async();
+  REQUIRE(log.dropped_messages() == dropped);
+  REQUIRE(printed.size() == 200);
+
+  // disabled while logging: no message is left in the stopped queue
+  printed.clear();
+  log.enable_async(4, LogOverflowPolicy::BLOCK);
+  producers.clear();
+  for (int t = 0; t < 4; t++) {
+    producers.emplace_back([t]() {
+      for (int i = 0; i < 200; i++) LOG(std::to_string(t) + ":" + std::to_string(i), Loglevel::DEBUG);
+    });
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  log.disable_async();
+  for (auto &p : producers) p.join();
+  REQUIRE(log.dropped_messages() == dropped);
+  REQUIRE(printed.size() == 800);
+
+  // the prefix is replaced while other threads are logging
+  printed.clear();
+  std::thread prefixer([] {
+    for (int i = 0; i < 100; i++) Log::setPrefix(std::to_string(i));
+  });
+  for (int i = 0; i < 100; i++) LOG("prefixed", Loglevel::DEBUG);
+  prefixer.join();
+  Log::setPrefix("path");
+  LOG("prefixed", Loglevel::DEBUG);
+  Log::setPrefix();
+  LOG("plain", Loglevel::DEBUG);
+  REQUIRE(printed.size() == 102);
+  REQUIRE(printed[100] == "[path]prefixed");
+  REQUIRE(printed[101] == "plain");
+
+  log.set_handler(&stdlog_handler);
+  log.set_loglevel(Loglevel::WARNING);
+}
+
+TEST_CASE("Test binary log masks secrets", "[fast]") {
+  using namespace nitrokey::log;
+  const std::string path = "test_binary_log.bin";
+  auto &binary_log = BinaryLog::instance();
+  REQUIRE(binary_log.open(path));
+  REQUIRE(binary_log.is_open());
+
+  stick10::FirstAuthenticate::CommandTransaction::OutgoingPacket packet;
+  packet.initialize();
+  memset(packet.payload.card_password, 'a', sizeof packet.payload.card_password);
+  memset(packet.payload.temporary_password, 'b', sizeof packet.payload.temporary_password);
+  binary_log.write_packet(nullptr, BinaryLogEvent::QUERY, packet, 0, 0, 3, 0);
+  binary_log.close();
+  REQUIRE_FALSE(binary_log.is_open());
+
+  std::ifstream in(path, std::ios::binary);
+  BinaryLogHeader header;
+  REQUIRE(in.read(reinterpret_cast<char *>(&header), sizeof header));
+  REQUIRE(memcmp(header.magic, BINARY_LOG_MAGIC, sizeof header.magic) == 0);
+  REQUIRE(header.version == BINARY_LOG_VERSION);
+  REQUIRE(header.record_size == 96);
+
+  BinaryLogRecord device, query;
+  REQUIRE(in.read(reinterpret_cast<char *>(&device), sizeof device));
+  REQUIRE(device.event == static_cast<uint8_t>(BinaryLogEvent::DEVICE));
+  REQUIRE(in.read(reinterpret_cast<char *>(&query), sizeof query));
+  REQUIRE(query.event == static_cast<uint8_t>(BinaryLogEvent::QUERY));
+  REQUIRE(query.device_id == device.device_id);
+  REQUIRE(query.command_id == static_cast<uint8_t>(CommandID::FIRST_AUTHENTICATE));
+  REQUIRE(query.sending_retries == 3);
+  REQUIRE(query.flags == (BinaryLogRecord::FLAG_REPORT | BinaryLogRecord::FLAG_MASKED));
+
+  decltype(packet) logged;
+  memcpy(&logged, query.report, sizeof logged);
+  for (auto c : logged.payload.card_password) REQUIRE(c == 0);
+  for (auto c : logged.payload.temporary_password) REQUIRE(c == 0);
+  in.close();
+  remove(path.c_str());
+}
+
+namespace {
+  /**
+   * Writes the packet into a new binary log, and returns its record.
+   */
+  template <typename Packet>
+  nitrokey::log::BinaryLogRecord log_packet(const Packet &packet) {
+    using namespace nitrokey::log;
+    const std::string path = "test_binary_log_mask.bin";
+    auto &binary_log = BinaryLog::instance();
+    REQUIRE(binary_log.open(path));
+    binary_log.write_packet(nullptr, BinaryLogEvent::QUERY, packet, 0, 0, 0, 0);
+    binary_log.close();
+
+    std::ifstream in(path, std::ios::binary);
+    BinaryLogHeader header;
+    BinaryLogRecord device, record;
+    REQUIRE(in.read(reinterpret_cast<char *>(&header), sizeof header));
+    REQUIRE(in.read(reinterpret_cast<char *>(&device), sizeof device));
+    REQUIRE(in.read(reinterpret_cast<char *>(&record), sizeof record));
+    in.close();
+    remove(path.c_str());
+    return record;
+  }
+
+  struct OpaquePayload {
+    uint8_t contents[20];
+    bool isValid() const { return true; }
+    std::string dissect() const { return "Opaque payload"; }
+  } __packed;
+}
+
+#define REQUIRE_SECRET_MASKED(packet_type, field) do { \
+    INFO(#packet_type " " #field); \
+    packet_type packet; \
+    packet.initialize(); \
+    memset(&packet.payload.field, 0xA5, sizeof packet.payload.field); \
+    const auto record = log_packet(packet); \
+    REQUIRE((record.flags & nitrokey::log::BinaryLogRecord::FLAG_MASKED) != 0); \
+    REQUIRE(std::count(record.report, record.report + sizeof record.report, 0xA5) == 0); \
+  } while (0)
+
+TEST_CASE("Test binary log masks every secret field", "[fast]") {
+  REQUIRE_SECRET_MASKED(stick10::WriteToHOTPSlot::CommandTransaction::OutgoingPacket, slot_name);
+  REQUIRE_SECRET_MASKED(stick10::WriteToHOTPSlot::CommandTransaction::OutgoingPacket, slot_secret);
+  REQUIRE_SECRET_MASKED(stick10::WriteToTOTPSlot::CommandTransaction::OutgoingPacket, slot_name);
+  REQUIRE_SECRET_MASKED(stick10::WriteToTOTPSlot::CommandTransaction::OutgoingPacket, slot_secret);
+  REQUIRE_SECRET_MASKED(stick10::SetPasswordSafeSlotData::CommandTransaction::OutgoingPacket, slot_name);
+  REQUIRE_SECRET_MASKED(stick10::SetPasswordSafeSlotData::CommandTransaction::OutgoingPacket, slot_password);
+  REQUIRE_SECRET_MASKED(stick10::SetPasswordSafeSlotData2::CommandTransaction::OutgoingPacket, slot_login_name);
+  REQUIRE_SECRET_MASKED(stick10::GetPasswordSafeSlotName::CommandTransaction::ResponsePacket, slot_name);
+  REQUIRE_SECRET_MASKED(stick10::GetPasswordSafeSlotPassword::CommandTransaction::ResponsePacket, slot_password);
+  REQUIRE_SECRET_MASKED(stick10::GetPasswordSafeSlotLogin::CommandTransaction::ResponsePacket, slot_login);
+  REQUIRE_SECRET_MASKED(stick10::EnablePasswordSafe::CommandTransaction::OutgoingPacket, user_password);
+  REQUIRE_SECRET_MASKED(stick10::FirstAuthenticate::CommandTransaction::OutgoingPacket, card_password);
+  REQUIRE_SECRET_MASKED(stick10::FirstAuthenticate::CommandTransaction::OutgoingPacket, temporary_password);
+  REQUIRE_SECRET_MASKED(stick10::UserAuthenticate::CommandTransaction::OutgoingPacket, card_password);
+  REQUIRE_SECRET_MASKED(stick10::UserAuthenticate::CommandTransaction::OutgoingPacket, temporary_password);
+  REQUIRE_SECRET_MASKED(stick10::Authorize::CommandTransaction::OutgoingPacket, temporary_password);
+  REQUIRE_SECRET_MASKED(stick10::UserAuthorize::CommandTransaction::OutgoingPacket, temporary_password);
+  REQUIRE_SECRET_MASKED(stick10::UnlockUserPassword::CommandTransaction::OutgoingPacket, admin_password);
+  REQUIRE_SECRET_MASKED(stick10::UnlockUserPassword::CommandTransaction::OutgoingPacket, user_new_password);
+  REQUIRE_SECRET_MASKED(stick10::ChangeUserPin::CommandTransaction::OutgoingPacket, old_pin);
+  REQUIRE_SECRET_MASKED(stick10::ChangeUserPin::CommandTransaction::OutgoingPacket, new_pin);
+  REQUIRE_SECRET_MASKED(stick10::ChangeAdminPin::CommandTransaction::OutgoingPacket, old_pin);
+  REQUIRE_SECRET_MASKED(stick10::ChangeAdminPin::CommandTransaction::OutgoingPacket, new_pin);
+  REQUIRE_SECRET_MASKED(stick10::IsAESSupported::CommandTransaction::OutgoingPacket, user_password);
+  REQUIRE_SECRET_MASKED(stick10::FactoryReset::CommandTransaction::OutgoingPacket, admin_password);
+  REQUIRE_SECRET_MASKED(stick10::BuildAESKey::CommandTransaction::OutgoingPacket, admin_password);
+  REQUIRE_SECRET_MASKED(stick10::GetRandom::CommandTransaction::ResponsePacket, data);
+  REQUIRE_SECRET_MASKED(stick10::FirmwareUpdate::CommandTransaction::OutgoingPacket, firmware_password);
+  REQUIRE_SECRET_MASKED(stick10::FirmwarePasswordChange::CommandTransaction::OutgoingPacket, firmware_password_current);
+  REQUIRE_SECRET_MASKED(stick10::FirmwarePasswordChange::CommandTransaction::OutgoingPacket, firmware_password_new);
+
+  REQUIRE_SECRET_MASKED(stick10_08::EraseSlot::CommandTransaction::OutgoingPacket, temporary_admin_password);
+  REQUIRE_SECRET_MASKED(stick10_08::SendOTPData::CommandTransaction::OutgoingPacket, temporary_admin_password);
+  REQUIRE_SECRET_MASKED(stick10_08::SendOTPData::CommandTransaction::OutgoingPacket, data);
+  REQUIRE_SECRET_MASKED(stick10_08::SendOTPData::CommandTransaction::ResponsePacket, data);
+  REQUIRE_SECRET_MASKED(stick10_08::WriteToOTPSlot::CommandTransaction::OutgoingPacket, temporary_admin_password);
+  REQUIRE_SECRET_MASKED(stick10_08::GetHOTP::CommandTransaction::OutgoingPacket, temporary_user_password);
+  REQUIRE_SECRET_MASKED(stick10_08::GetTOTP::CommandTransaction::OutgoingPacket, temporary_user_password);
+  REQUIRE_SECRET_MASKED(stick10_08::WriteGeneralConfig::CommandTransaction::OutgoingPacket, temporary_admin_password);
+
+  REQUIRE_SECRET_MASKED(stick20::EnableEncryptedPartition::CommandTransaction::OutgoingPacket, password);
+  REQUIRE_SECRET_MASKED(stick20::CreateNewKeys::CommandTransaction::OutgoingPacket, password);
+  REQUIRE_SECRET_MASKED(stick20::ChangeUpdatePassword::CommandTransaction::OutgoingPacket, current_update_password);
+  REQUIRE_SECRET_MASKED(stick20::ChangeUpdatePassword::CommandTransaction::OutgoingPacket, new_update_password);
+  REQUIRE_SECRET_MASKED(stick20::FillSDCardWithRandomChars::CommandTransaction::OutgoingPacket, admin_pin);
+  REQUIRE_SECRET_MASKED(stick20::SetupHiddenVolume::CommandTransaction::OutgoingPacket, HiddenVolumePassword_au8);
+
+  // masked whole when the dissection shows no fields
+  typedef HIDReport<CommandID::GET_STATUS, OpaquePayload> OpaquePacket;
+  REQUIRE_SECRET_MASKED(OpaquePacket, contents);
+}
+
+TEST_CASE("Test transactions against the fake device", "[fast]") {
+  auto fake = std::make_shared<FakeDevice>();
+  auto i = NitrokeyManager::instance();
+  REQUIRE(i->connect_with_device(fake));
+  REQUIRE(i->get_minor_firmware_version() == 12);
+  REQUIRE(i->get_HOTP_code(0, "") == "000000");
+  REQUIRE(fake->sent == 3);
+  REQUIRE(fake->received == 3);
+  REQUIRE(fake->m_counters.communication_successful == 3);
+
+  struct NK_status status;
+  REQUIRE(NK_get_status(&status) == 0);
+  REQUIRE(status.firmware_version_minor == 12);
+  i->disconnect();
+  REQUIRE(NK_get_status(&status) != 0);
+}
+
+TEST_CASE("Test manager call not split by a concurrent connect", "[fast]") {
+  auto first = std::make_shared<FakeDevice>();
+  auto second = std::make_shared<FakeDevice>();
+  auto i = NitrokeyManager::instance();
+  REQUIRE(i->connect_with_device(first));
+
+  // the device is switched while the firmware version is being read
+  first->set_response_delay(std::chrono::milliseconds(100));
+  std::thread reader([&i] { i->get_HOTP_code(0, ""); });
+  while (first->sent == 0) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  REQUIRE(i->connect_with_device(second));
+  reader.join();
+
+  // the HOTP code was read from the device the call started with
+  REQUIRE(first->sent == 2);
+  REQUIRE(second->sent == 0);
+  i->disconnect();
+}
+
+TEST_CASE("Test command latency read during a transaction", "[fast]") {
+  auto fake = std::make_shared<FakeDevice>();
+  auto i = NitrokeyManager::instance();
+  REQUIRE(i->connect_with_device(fake));
+  REQUIRE(i->get_minor_firmware_version() == 12);
+
+  // the bulk write holds the manager lock for the whole transfer
+  PasswordSafeEntries entries;
+  entries.add(1, "name", "login", "password");
+  fake->set_response_delay(std::chrono::milliseconds(300));
+  fake->sent = 0;
+  std::atomic_bool written{false};
+  std::thread writer([&i, &entries, &written] {
+    i->write_password_safe(entries);
+    written = true;
+  });
+  while (fake->sent == 0) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  const auto latency = i->get_command_latency();
+  i->reset_command_latency();
+  // read while the transfer, several commands of 300 ms each, is still running
+  REQUIRE_FALSE(written);
+  REQUIRE(latency.size() == 1);
+  REQUIRE(latency[0].command_id == static_cast<uint8_t>(CommandID::GET_STATUS));
+  writer.join();
+
+  i->disconnect();
+  REQUIRE(i->get_command_latency().empty());
+}
+
+TEST_CASE("Test connection health transitions", "[fast]") {
+  auto fake = std::make_shared<FakeDevice>();
+  REQUIRE(fake->get_connection_health() == ConnectionHealth::HEALTHY);
+  REQUIRE(fake->opened == 1);
+  std::vector<ConnectionHealth> on_reconnect;
+  nitrokey::trace::set_listener([&on_reconnect](const nitrokey::trace::TraceEvent &e) {
+    if (e.event == nitrokey::trace::Event::reconnect) on_reconnect.push_back(e.device->get_connection_health());
+  });
+  uint8_t report[HID_REPORT_SIZE] = {};
+
+  // transient errors are retried with the same handle
+  fake->fail_transfers(2, EIO);
+  REQUIRE(fake->send(report) == HID_REPORT_SIZE);
+  REQUIRE(fake->m_counters.transient_errors == 2);
+  REQUIRE(fake->m_counters.low_level_reconnect == 0);
+  REQUIRE(fake->get_connection_health() == ConnectionHealth::HEALTHY);
+
+  // still failing: the handle is reopened, and the report sent over the new one
+  fake->fail_transfers(3, EIO);
+  REQUIRE(fake->send(report) == HID_REPORT_SIZE);
+  REQUIRE(fake->m_counters.low_level_reconnect == 1);
+  REQUIRE(fake->opened == 2);
+  REQUIRE(on_reconnect == std::vector<ConnectionHealth>{ConnectionHealth::RECONNECTING});
+  REQUIRE(fake->get_connection_health() == ConnectionHealth::HEALTHY);
+
+  // reopening again right away is not allowed
+  fake->fail_transfers(3, EIO);
+  REQUIRE(fake->send(report) < 0);
+  REQUIRE(fake->m_counters.reconnects_rate_limited == 1);
+  REQUIRE(fake->get_connection_health() == ConnectionHealth::DEGRADED);
+
+  // a dead handle, which can't be reopened yet, fails right away
+  fake->fail_transfers(1, ENODEV);
+  REQUIRE_THROWS_AS(fake->send(report), DeviceNotConnected);
+  REQUIRE(fake->m_counters.dead_handle_errors == 1);
+  REQUIRE(fake->m_counters.reconnects_rate_limited == 2);
+  fake->fail_transfers(0, 0);
+
+  // a dead handle, which can't be reopened
+  std::this_thread::sleep_for(std::chrono::milliseconds(300));
+  fake->set_open_fails(true);
+  fake->fail_transfers(1, ENODEV);
+  REQUIRE_THROWS_AS(fake->recv(report), DeviceNotConnected);
+  REQUIRE(fake->m_counters.reconnect_failures == 1);
+  REQUIRE(fake->get_connection_health() == ConnectionHealth::DISCONNECTED);
+  REQUIRE_FALSE(fake->is_open());
+
+  fake->set_open_fails(false);
+  REQUIRE(fake->connect());
+  REQUIRE(fake->get_connection_health() == ConnectionHealth::HEALTHY);
+  REQUIRE(fake->recv(report) == HID_REPORT_SIZE);
+  nitrokey::trace::set_listener(nullptr);
+}
+
+TEST_CASE("Test transaction engine", "[fast]") {
+  using stick10::GetStatus;
+  REQUIRE_THROWS_AS(GetStatus::CommandTransaction::run(nullptr), DeviceNotConnected);
+
+  auto fake = std::make_shared<FakeDevice>();
+  fake->set_busy_polls(3);
+  auto resp = GetStatus::CommandTransaction::run(fake);
+  REQUIRE(resp.data().firmware_version_st.minor == 12);
+  REQUIRE(resp.packet().command_id == static_cast<uint8_t>(CommandID::GET_STATUS));
+  REQUIRE(resp.packet().last_command_crc == GetStatus::CommandTransaction::getCRC({}));
+  REQUIRE(fake->m_counters.busy == 3);
+  REQUIRE(fake->received == 4);
+}
+
+TEST_CASE("Test chunked transfer", "[fast]") {
+  using std::chrono::steady_clock;
+  REQUIRE_THROWS_AS(ChunkedTransfer(nullptr), DeviceNotConnected);
+
+  auto fake = std::make_shared<FakeDevice>();
+  // long enough that waiting it for both commands could not pass unnoticed
+  fake->set_receiving_delay(std::chrono::milliseconds(1000));
+  auto i = NitrokeyManager::instance();
+  REQUIRE(i->connect_with_device(fake));
+  fake->sent = fake->received = 0;
+
+  // polled right away, without waiting the send-receive delay per command:
+  // a single poll answers each command
+  auto start = steady_clock::now();
+  i->write_password_safe_slot(1, "name", "login", "password");
+  REQUIRE(fake->sent == 2);
+  REQUIRE(fake->received == 2);
+  REQUIRE(steady_clock::now() - start < std::chrono::milliseconds(1000));
+
+  // an early poll answered with the previous response is followed by a
+  // second one, after the full delay
+  fake->set_receiving_delay(std::chrono::milliseconds(100));
+  fake->set_stale_polls(1);
+  fake->sent = fake->received = 0;
+  start = steady_clock::now();
+  i->write_password_safe_slot(1, "name", "login", "password");
+  REQUIRE(fake->sent == 2);
+  REQUIRE(fake->received == 4);
+  // a lower bound only, sleeping never ends early
+  REQUIRE(steady_clock::now() - start >= std::chrono::milliseconds(2 * 95));
+  fake->set_stale_polls(0);
+
+  {
+    ChunkedTransfer transfer(fake);
+    // other transactions wait until the transfer is done
+    REQUIRE_FALSE(fake->m_send_receive_mtx.try_lock());
+    auto resp = stick10::GetStatus::CommandTransaction::run(transfer, {});
+    REQUIRE(resp.data().firmware_version_st.minor == 12);
+    REQUIRE(transfer.chunks() == 1);
+  }
+  REQUIRE(fake->m_send_receive_mtx.try_lock());
+  fake->m_send_receive_mtx.unlock();
+  i->disconnect();
+}
+
+TEST_CASE("Test secure arena", "[fast]") {
+  using namespace nitrokey::misc;
+  auto &arena = SecureArena::instance();
+  const auto before = arena.get_stats();
+
+  auto p = static_cast<uint8_t *>(arena.allocate(40));
+  REQUIRE(reinterpret_cast<uintptr_t>(p) % 16 == 0);
+  for (int i = 0; i < 40; i++) REQUIRE(p[i] == 0);
+  memset(p, 0xAA, 40);
+  arena.deallocate(p, 40);
+  // freed blocks are reused first, wiped
+  auto q = static_cast<uint8_t *>(arena.allocate(64));
+  REQUIRE(q == p);
+  for (int i = sizeof(void *); i < 64; i++) REQUIRE(q[i] == 0);
+  arena.deallocate(q, 64);
+
+  const auto before_big = arena.get_stats();
+  auto big = static_cast<uint8_t *>(arena.allocate(10000));
+  big[9999] = 1;
+  REQUIRE(arena.get_stats().allocated_blocks == before.allocated_blocks + 1);
+  // mapped in whole system pages
+  const auto reserved = arena.get_stats().reserved - before_big.reserved;
+  REQUIRE(reserved >= 10000);
+  REQUIRE(reserved % 4096 == 0);
+  arena.deallocate(big, 10000);
+  REQUIRE(arena.get_stats().allocated_blocks == before.allocated_blocks);
+
+  auto secret = hex_string_to_secure_byte("00ff10");
+  REQUIRE(secret.size() == 3);
+  REQUIRE(secret[1] == 0xff);
+  REQUIRE_THROWS_AS(hex_string_to_secure_byte("0"), InvalidHexString);
+
+  PasswordSafeEntries entries;
+  entries.add(1, "name", "login", "password");
+  auto copy = entries;
+  REQUIRE(string(copy[0].password) == "password");
+}
+
+TEST_CASE("Test response report pool", "[fast]") {
+  ReportPool pool;
+  auto first = pool.acquire();
+  REQUIRE(reinterpret_cast<uintptr_t>(first) % 64 == 0);
+  memset(first, 0xAA, ReportPool::REPORT_SIZE);
+  pool.release(first);
+  auto again = pool.acquire();
+  REQUIRE(again == first);
+  for (size_t i = 0; i < ReportPool::REPORT_SIZE; i++) REQUIRE(again[i] == 0);
+
+  vector<uint8_t *> taken = {again};
+  for (int i = 1; i <= ReportPool::POOL_SIZE; i++) taken.push_back(pool.acquire());
+  REQUIRE(pool.get_overflow_allocations() == 1);
+  for (auto r : taken) pool.release(r);
+
+  auto fake = std::make_shared<FakeDevice>();
+  uint8_t *report;
+  {
+    auto resp = stick10::GetStatus::CommandTransaction::run(fake);
+    report = resp.report();
+    REQUIRE(resp.data().firmware_version_st.minor == 12);
+    auto moved = std::move(resp);
+    REQUIRE(resp.report() == nullptr);
+    REQUIRE(moved.data().firmware_version_st.minor == 12);
+  }
+  REQUIRE(report[0] == 0);
+  REQUIRE(report[HID_REPORT_SIZE - 1] == 0);
+  REQUIRE(fake->m_report_pool.get_overflow_allocations() == 0);
+}
+
+TEST_CASE("Test packet dissection formatting", "[fast]") {
+  using namespace nitrokey::misc;
+  const uint8_t data[] = {0x00, 0x41, 0x7f, 0xff, 0x10, 0x20, 0x30, 0x40,
+                          0x50, 0x60, 0x70, 0x80, 0x90, 0xa0, 0xb0, 0xc0, 0x61};
+  REQUIRE(hexdump(data, sizeof data) ==
+          "0000\t00 41 7f ff 10 20 30 40 50 60 70 80 90 a0 b0 c0   .A....0@P`p.....\n"
+          "0010\t61 -- -- -- -- -- -- -- -- -- -- -- -- -- -- --   a\n");
+  REQUIRE(hexdump(data, 2, false, false, false) == "00 41 \n");
+  // offsets past 0xffff are printed with all their digits
+  const std::vector<uint8_t> large(0x10001, 0x61);
+  char line[HEXDUMP_LINE_MAX];
+  const auto n = format_hexdump_line(line, hexdump_view(large.data(), large.size()), 0x10000);
+  REQUIRE(std::string(line, n) == "10000\t61 -- -- -- -- -- -- -- -- -- -- -- -- -- -- --   a\n");
+  REQUIRE(hexdump(large.data(), large.size()).substr(0x1000 * 72) == std::string(line, n));
+
+  FormatBuffer b;
+  b << "v:" << 42 << ' ' << -7 << ' ' << static_cast<uint8_t>('x') << ' ' << true << ' '
+    << hex(0xab, 4) << ' ' << hex(0) << ' ' << bits(0x81) << ' ' << uint64_t(18446744073709551615ull);
+  REQUIRE(b.str() == "v:42 -7 x 1 00ab 0 10000001 18446744073709551615");
+
+  FormatBuffer full;
+  for (size_t i = 0; i < FormatBuffer::CAPACITY; i++) full << 'a';
+  REQUIRE(full.truncated());
+  REQUIRE(full.str().size() < FormatBuffer::CAPACITY);
+  REQUIRE(full.str().substr(full.str().size() - 3) == "...");
+
+  stick10::GetStatus::CommandTransaction::ResponsePacket resp;
+  resp.initialize();
+  resp.command_id = static_cast<uint8_t>(CommandID::GET_STATUS);
+  resp.payload.firmware_version_st.minor = 12;
+  resp.payload.card_serial_u32 = 0x1234abcd;
+  resp.update_CRC();
+  const auto text = static_cast<std::string>(resp);
+  REQUIRE(text.find("Command ID:\tGET_STATUS hex: 0") != string::npos);
+  REQUIRE(text.find("firmware_version:\t[12]\t0c 00 -- ") != string::npos);
+  REQUIRE(text.find("card_serial_u32:\t1234abcd\n") != string::npos);
+}
+
+TEST_CASE("Test command registry", "[fast]") {
+  static_assert(command_info(CommandID::GET_STATUS).read_only, "GET_STATUS can be cached");
+  static_assert(command_info(CommandID::WINK).family == CommandFamily::STORAGE, "WINK is Storage only");
+  static_assert(!is_command_supported(CommandID::WINK, false, 12), "Pro has no WINK");
+
+  int known = 0;
+  for (int i = 0; i < 256; i++) {
+    const auto &c = command_info(static_cast<uint8_t>(i));
+    REQUIRE(static_cast<int>(c.id) == i);
+    if (!c.known) continue;
+    known++;
+    REQUIRE(string(commandid_to_string(c.id)) == c.name);
+  }
+  REQUIRE(known == 73);
+  REQUIRE(string(commandid_to_string(static_cast<CommandID>(0x1C))) == "UNKNOWN");
+  REQUIRE(command_info(0x3F).storage_status);
+  REQUIRE_FALSE(command_info(CommandID::SD_CARD_HIGH_WATERMARK).storage_status);
+
+  REQUIRE(is_command_supported(CommandID::AUTHORIZE, false, 7));
+  REQUIRE_FALSE(is_command_supported(CommandID::AUTHORIZE, false, 8));
+  REQUIRE(is_command_supported(CommandID::AUTHORIZE, true, 53));
+  REQUIRE_FALSE(is_command_supported(CommandID::SEND_OTP_DATA, true, 53));
+  REQUIRE(is_command_supported(CommandID::SEND_OTP_DATA, true, 54));
+  REQUIRE(is_command_supported(CommandID::WINK, true, 52));
+}
+
 #include "test_command_ids_header.h"
 TEST_CASE("Test device commands ids", "[fast]") {
 // Make sure CommandID values are in sync with firmware's header
@@ -212,3 +1215,12 @@ TEST_CASE("Connect should not return true after the second attempt", "[fast]") {
   result = NK_logout();
   REQUIRE(result == 0);
 }
+
+TEST_CASE("Shutdown releases the library and allows to connect again", "[fast]") {
+  REQUIRE(NK_login_auto() == 0);
+  REQUIRE(NK_shutdown() == 0);
+  REQUIRE(NK_shutdown() == 0);
+  REQUIRE(NK_login_auto() == 0);
+  REQUIRE(NK_logout() == 0);
+  REQUIRE(Device::release_hid_context());
+}
@@ -141,6 +141,47 @@ def test_password_safe_slot_status(C):
     assert is_slot_programmed[1] == 1
 
 
+@pytest.mark.PWS
+def test_password_safe_bulk_read_write(C):
+    assert C.NK_enable_password_safe(DefaultPasswords.USER) == DeviceErrorCode.STATUS_OK
+    PWS_slot_count = 16
+    for i in range(0, PWS_slot_count):
+        assert C.NK_erase_password_safe_slot(i) == DeviceErrorCode.STATUS_OK
+
+    entries = ffi.new('struct NK_password_safe *')
+    written = [1, 4, 15]
+    for n, i in enumerate(written):
+        iss = str(i)
+        entries.slots[n].slot_number = i
+        entries.slots[n].name = helper_PWS_get_slotname(iss)
+        entries.slots[n].login = helper_PWS_get_loginname(iss)
+        entries.slots[n].password = helper_PWS_get_pass(iss)
+    entries.count = len(written)
+    assert C.NK_write_password_safe(entries) == DeviceErrorCode.STATUS_OK
+
+    for i in written:
+        iss = str(i)
+        assert gs(C.NK_get_password_safe_slot_name(i)) == helper_PWS_get_slotname(iss)
+        assert gs(C.NK_get_password_safe_slot_login(i)) == helper_PWS_get_loginname(iss)
+        assert gs(C.NK_get_password_safe_slot_password(i)) == helper_PWS_get_pass(iss)
+
+    read = ffi.new('struct NK_password_safe *')
+    assert C.NK_read_password_safe(0xFFFF, read) == DeviceErrorCode.STATUS_OK
+    assert read.count == len(written)
+    for n, i in enumerate(written):
+        iss = str(i)
+        assert read.slots[n].slot_number == i
+        assert ffi.string(read.slots[n].name) == helper_PWS_get_slotname(iss)
+        assert ffi.string(read.slots[n].login) == helper_PWS_get_loginname(iss)
+        assert ffi.string(read.slots[n].password) == helper_PWS_get_pass(iss)
+
+    assert C.NK_read_password_safe(1 << 4, read) == DeviceErrorCode.STATUS_OK
+    assert read.count == 1
+    assert read.slots[0].slot_number == 4
+
+    assert C.NK_lock_device() == DeviceErrorCode.STATUS_OK
+    assert C.NK_read_password_safe(0xFFFF, read) == DeviceErrorCode.STATUS_NOT_AUTHORIZED
+
 @pytest.mark.aes
 def test_issue_device_locks_on_second_key_generation_in_sequence(C):
 #    if is_pro_rtm_07(C) or is_pro_rtm_08(C):
@@ -734,6 +775,23 @@ def test_get_status(C):
     assert status_st.firmware_version_minor != 0
 
 
+@pytest.mark.status
+def test_get_command_latency(C):
+    C.NK_reset_command_latency()
+    status_st = ffi.new('struct NK_status *')
+    for _ in range(3):
+        assert C.NK_get_status(status_st) == 0
+    latency = ffi.new('struct NK_command_latency[256]')
+    count = C.NK_get_command_latency(latency, 256)
+    assert count >= 1
+    entries = [latency[i] for i in range(count) if latency[i].count > 0]
+    assert sum(e.count for e in entries) >= 3
+    for e in entries:
+        assert e.polls >= e.count
+        assert 0 < e.total_p50_us <= e.total_p99_us <= e.total_max_us
+        print(e.command_id, e.count, e.total_p50_us, e.first_response_p50_us)
+
+
 @pytest.mark.status
 def test_get_serial_number(C):
     sn = C.NK_device_serial_number()
@@ -0,0 +1,269 @@
+/*
+ * Copyright (c) 2015-2018 Nitrokey UG
+ *
+ * This file is part of libnitrokey.
+ *
+ * libnitrokey is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * libnitrokey is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libnitrokey. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0
+ */
+
+/*
+ * Contention stress test: N threads share NitrokeyManager::instance() and the
+ * C API, running mixed connect, disconnect, status and OTP workloads against
+ * fake devices. Reports throughput, tail latency and lock wait time.
+ * Build with ADD_TSAN to check the run for data races, any report fails it.
+ *
+ * Tunable with environment variables:
+ *  NK_STRESS_THREADS - number of worker threads (default: 8)
+ *  NK_STRESS_SECONDS - duration of each scenario (default: 1)
+ */
+
+#include "catch2/catch.hpp"
+#include <NitrokeyManager.h>
+#include <latency_stats.h>
+#include <trace.h>
+#include "../NK_C_API.h"
+#include "fake_device.h"
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <thread>
+
+using namespace nitrokey;
+using namespace nitrokey::device;
+using std::chrono::steady_clock;
+
+namespace {
+
+  int env_int(const char *name, int fallback) {
+    const auto value = std::getenv(name);
+    if (value == nullptr) return fallback;
+    const auto parsed = std::atoi(value);
+    return parsed > 0 ? parsed : fallback;
+  }
+
+  enum class Op {
+    STATUS,
+    HOTP,
+    C_API_STATUS,
+    C_API_HOTP,
+    CONNECT,
+    DISCONNECT,
+    LIST_BY_ID,
+    COUNT
+  };
+
+  const char *op_name(Op op) {
+    switch (op) {
+      case Op::STATUS: return "get_status";
+      case Op::HOTP: return "get_HOTP_code";
+      case Op::C_API_STATUS: return "NK_get_status";
+      case Op::C_API_HOTP: return "NK_get_hotp_code";
+      case Op::CONNECT: return "connect_with_device";
+      case Op::DISCONNECT: return "disconnect";
+      case Op::LIST_BY_ID: return "list_devices_by_cpuID";
+      case Op::COUNT: break;
+    }
+    return "";
+  }
+
+  const int OP_COUNT = static_cast<int>(Op::COUNT);
+
+  struct OpStats {
+    std::atomic<uint64_t> ok{0};
+    /** expected failures, e.g. no device connected at the moment */
+    std::atomic<uint64_t> failed{0};
+    LatencyHistogram latency;
+  };
+
+  struct Scenario {
+    const char *name;
+    /** relative weights of the operations, indexed by Op */
+    int weights[OP_COUNT];
+  };
+
+  class StressRun {
+  public:
+    explicit StressRun(const Scenario &scenario) : m_scenario(scenario) {
+      for (int i = 0; i < 3; i++) m_devices.push_back(std::make_shared<FakeDevice>());
+    }
+
+    /**
+     * Runs the scenario and prints its report.
+     * @return number of unexpected exceptions
+     */
+    uint64_t run(int threads, std::chrono::milliseconds duration) {
+      auto manager = NitrokeyManager::instance();
+      manager->connect_with_device(m_devices[0]);
+      trace::set_listener([this](const trace::TraceEvent &e) {
+        if (e.event == trace::Event::transaction_lock_wait) m_transaction_lock_wait.record(e.value);
+        if (e.event == trace::Event::handle_lock_wait) m_handle_lock_wait.record(e.value);
+      });
+
+      const auto start = steady_clock::now();
+      const auto deadline = start + duration;
+      std::atomic_int running{threads};
+      std::vector<std::thread> workers;
+      for (int t = 0; t < threads; t++) {
+        workers.emplace_back([this, t, deadline, &running]() {
+          worker(static_cast<unsigned>(t), deadline);
+          running--;
+        });
+      }
+      // a deadlock would hang the test runner instead of failing it
+      while (running > 0) {
+        if (steady_clock::now() > deadline + std::chrono::seconds(30)) {
+          std::cerr << "Stress workers did not finish, possible deadlock" << std::endl;
+          std::abort();
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      }
+      for (auto &w : workers) w.join();
+      const auto elapsed = std::chrono::duration<double>(steady_clock::now() - start).count();
+
+      trace::set_listener(nullptr);
+      manager->disconnect();
+      report(threads, elapsed);
+      return m_unexpected;
+    }
+
+  private:
+    void worker(unsigned seed, steady_clock::time_point deadline) {
+      std::mt19937 random(seed);
+      std::discrete_distribution<int> choose_op(std::begin(m_scenario.weights), std::end(m_scenario.weights));
+      std::uniform_int_distribution<size_t> choose_device(0, m_devices.size() - 1);
+      auto manager = NitrokeyManager::instance();
+
+      while (steady_clock::now() < deadline) {
+        const auto op = static_cast<Op>(choose_op(random));
+        auto &stats = m_ops[static_cast<int>(op)];
+        const auto op_start = steady_clock::now();
+        bool ok = true;
+        try {
+          switch (op) {
+            case Op::STATUS:
+              manager->get_status();
+              break;
+            case Op::HOTP:
+              manager->get_HOTP_code(0, "");
+              break;
+            case Op::C_API_STATUS: {
+              struct NK_status status;
+              ok = NK_get_status(&status) == 0;
+              break;
+            }
+            case Op::C_API_HOTP: {
+              // the last command status is process-wide, check the result instead
+              auto code = NK_get_hotp_code(0);
+              ok = strlen(code) != 0;
+              free(code);
+              break;
+            }
+            case Op::CONNECT: {
+              // reopened, as disconnecting the manager closes the device
+              auto &d = m_devices[choose_device(random)];
+              if (!d->is_open()) d->connect();
+              ok = manager->connect_with_device(d);
+              break;
+            }
+            case Op::DISCONNECT:
+              manager->disconnect();
+              break;
+            case Op::LIST_BY_ID:
+              manager->list_devices_by_cpuID();
+              ok = manager->connect_with_ID("no such device");
+              break;
+            case Op::COUNT:
+              break;
+          }
+        }
+        catch (const DeviceCommunicationException &) {
+          ok = false;
+        }
+        catch (...) {
+          m_unexpected++;
+          ok = false;
+        }
+        const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(steady_clock::now() - op_start);
+        stats.latency.record(static_cast<uint64_t>(elapsed.count()));
+        (ok ? stats.ok : stats.failed)++;
+      }
+    }
+
+    static void print_histogram(const std::string &name, const HistogramSnapshot &h, const std::string &extra) {
+      std::cout << "  " << std::left << std::setw(24) << name << std::right
+                << std::setw(10) << h.count
+                << std::setw(10) << h.percentile(50)
+                << std::setw(10) << h.percentile(99)
+                << std::setw(10) << h.percentile(99.9)
+                << std::setw(10) << h.max_us
+                << "  " << extra << std::endl;
+    }
+
+    void report(int threads, double elapsed_s) const {
+      uint64_t total = 0;
+      for (const auto &s : m_ops) total += s.ok + s.failed;
+
+      std::cout << "Stress scenario '" << m_scenario.name << "': " << threads << " threads, "
+                << std::fixed << std::setprecision(2) << elapsed_s << " s, "
+                << std::setprecision(0) << total / elapsed_s << " ops/s" << std::endl;
+      std::cout << "  " << std::left << std::setw(24) << "latency [us]" << std::right
+                << std::setw(10) << "count" << std::setw(10) << "p50" << std::setw(10) << "p99"
+                << std::setw(10) << "p99.9" << std::setw(10) << "max" << std::endl;
+      for (int i = 0; i < OP_COUNT; i++) {
+        const auto snapshot = m_ops[i].latency.snapshot();
+        if (snapshot.count == 0) continue;
+        print_histogram(op_name(static_cast<Op>(i)), snapshot,
+                        "failed: " + std::to_string(m_ops[i].failed.load()));
+      }
+      std::cout << "  lock wait [us]" << std::endl;
+      const auto transaction_wait = m_transaction_lock_wait.snapshot();
+      print_histogram("transaction lock", transaction_wait,
+                      "total: " + std::to_string(transaction_wait.sum_us));
+      const auto handle_wait = m_handle_lock_wait.snapshot();
+      print_histogram("device handle lock", handle_wait, "total: " + std::to_string(handle_wait.sum_us));
+      std::cout << std::defaultfloat;
+    }
+
+    const Scenario &m_scenario;
+    std::vector<std::shared_ptr<FakeDevice>> m_devices;
+    OpStats m_ops[OP_COUNT];
+    LatencyHistogram m_transaction_lock_wait;
+    LatencyHistogram m_handle_lock_wait;
+    std::atomic<uint64_t> m_unexpected{0};
+  };
+
+  uint64_t run_scenario(const Scenario &scenario) {
+    const auto threads = env_int("NK_STRESS_THREADS", 8);
+    const auto duration = std::chrono::milliseconds(env_int("NK_STRESS_SECONDS", 1) * 1000);
+    StressRun run(scenario);
+    return run.run(threads, duration);
+  }
+}
+
+//                                                status hotp c_status c_hotp connect disconnect list
+TEST_CASE("Stress transactions on a shared device", "[stress]") {
+  const Scenario scenario = {"transactions", {40, 30, 20, 10, 0, 0, 0}};
+  REQUIRE(run_scenario(scenario) == 0);
+}
+
+TEST_CASE("Stress transactions with connection changes", "[stress]") {
+  const Scenario scenario = {"mixed", {30, 20, 15, 10, 15, 8, 2}};
+  REQUIRE(run_scenario(scenario) == 0);
+}